@@ -71,6 +71,30 @@
 // Usando esta função significa que temos que usar mais pinos dio no dispositivo RFM95/sx1276 e também conecte enable dio1 para detectar este estado.
 #define _CAD 1
 
+// Ordem adaptativa de SF no CAD. Em vez de tentar sempre SF7, SF8, ... SF12, o scanner tenta
+// primeiro os SF com mais tráfego (ponderado pelo tempo do CAD em cada SF), aprendidos dos
+// uplinks recebidos com um decaimento, e pode ser ligado/desligado na página web para comparar
+// com a ordem fixa.
+// 0 = Ordem fixa SF7..SF12;
+// 1 = Ordem adaptativa.
+#define _CAD_ADAPT 1
+#define _CAD_DECAY 4 // Decaimento do peso de cada SF por uplink recebido: 1/2^_CAD_DECAY.
+
+// Agendador de varredura de canais (HOP). Com o HOP ligado, o rádio percorre uma tabela de
+// _SCAN_SLOTS posições, cada uma com um canal de freqs[], o conjunto de SF tentados pelo CAD e o
+// tempo de permanência (mSec). A tabela é gravada na configuração e alterada em /api/scan.
+// A troca de posição é feita pela radioService() no fim da permanência, mas nunca no meio de uma
+// varredura do CAD, de um RX ou de um TX; nesses casos ela espera o fim do quadro.
+// Com _SCAN_ADAPT, a permanência de cada posição acompanha a atividade do canal: vai de metade
+// (sem atividade) ao dobro (atividade em toda visita) da permanência configurada, limitada por
+// _SCAN_DWELL_MIN e _SCAN_DWELL_MAX.
+#define _SCAN_SLOTS 8
+#define _SCAN_DWELL 100 // Permanência padrão de cada posição (mSec).
+#define _SCAN_DWELL_MIN 20 // mSec.
+#define _SCAN_DWELL_MAX 400 // mSec.
+#define _SCAN_LATE 2000 // Atraso da troca (uSec) a partir do qual a permanência conta como perdida.
+#define _SCAN_ADAPT 1
+
 // Definições para o servidor web admin.
 // A_SERVER determina se a página da web administrativa está ou não incluída no esboço.
 // Normalmente, deixe-o entrar!
@@ -98,6 +122,13 @@
 // 3: Para a placa WIFI_LoRa_32 com base em ESP32 da Heltec;
 // 4: Outro, defina seu próprio no loraModem.h.
 #define _PIN_OUT 3
+
+// Número de módulos SX127x no mesmo barramento SPI (somente ESP32). O rádio 0 usa os pinos acima
+// (pins em loraModem.h) e é o único que transmite. Os outros só recebem, cada um no seu canal de
+// freqs[], e são definidos em radioPins[] (loraModem.h). Todos entregam os quadros ao mesmo anel de
+// uplinks, e o gateway encaminha tudo como um único gateway. Com o HOP, só o rádio 0 percorre a
+// tabela do agendador de varredura; os outros continuam nos seus canais e com todos os SF.
+#define _RADIOS 1
 //#define _PIN_OUT 4 --> Implementado configuração para Placa com base ESP32 e NiceRF (SX1276) da AFEletrônica).
 
 // Reunir estatísticas sobre o status do sensor e do Wifi.
@@ -109,6 +140,31 @@
 // Número máximo de registros estatísticos reunidos. 20 é um bom máximo (memória intensiva).
 #define MAX_STAT 20
 
+// Tamanho da tabela de estatísticas por nó (DevAddr), potência de 2; cada entrada ocupa 36 bytes.
+// Com a tabela cheia, um nó novo ocupa o lugar do nó visto há mais tempo entre os examinados.
+#define _NODES 256
+
+// Perfil de desempenho: mede chamadas, tempo total e tempo máximo (uSec) de cada etapa
+// (stateMachine, receivePkt, buildRxpk, sendPacket, readUdp) e mostra na página web.
+// 0 = Desativado;
+// 1 = Ativado (duas chamadas micros() por etapa).
+#define PROFILE 1
+
+// Métricas no formato texto do Prometheus em /metrics: os contadores do gateway e histogramas
+// de latência (CAD até RXDONE, RXDONE até o envio UDP, loop(), sendUdp(), erro do horário do TX)
+// e de transações SPI por pacote.
+// 0 = Desativado;
+// 1 = Ativado.
+#define _METRICS 1
+
+// Registro (trace) binário de eventos do rádio e do UDP num anel de tamanho fixo, visto em /trace.
+// Com o trace ativado, as mensagens Serial da stateMachine(), receivePkt(), txLoraModem() e readUdp()
+// não são impressas, pois o Serial (e principalmente o Serial.flush()) altera o tempo do rádio.
+// 0 = Desativado (mensagens no Serial conforme DUSB e debug);
+// 1 = Ativado.
+#define _TRACE 1
+#define _TRACE_SIZE 256 // Eventos no anel, potência de 2 (12 bytes cada).
+
 // Gateways de canal único se eles se comportarem estritamente devem usar apenas um canal de frequência e um fator de espalhamento.
 // No entanto, o backend TTN responde ao intervalo de tempo RX2 dos fatores de espalhamento SF9-SF12.
 // Além disso, o servidor responderá com SF12 no intervalo de tempo RX2.
@@ -140,8 +196,24 @@
 // Defina seu endereço LoRa e a chave abaixo neste arquivo.
 // Consulte as especificações. para 4.3.2.
 #define GATEWAYNODE 0
+
+// Verificação do MIC dos uplinks dos dispositivos ABP definidos em micDevices[] (loraCrypto.h).
+// O resultado é contado e mostrado na página web; os quadros são encaminhados de qualquer forma.
 #define _CHECK_MIC 0
 
+// Criptografia (nó do gateway e _CHECK_MIC).
+// _CRYPTO_HW 0 = AES em software com tabela T;
+// _CRYPTO_HW 1 = AES do mbedtls, que no ESP32 usa o acelerador de hardware. Para blocos isolados
+// (como no MIC) o custo de ligar o acelerador a cada bloco pode tornar o hardware mais lento;
+// compare os ciclos por MIC mostrados na página web.
+// _CRYPTO_TEST 1 = Autoteste com os vetores do FIPS-197 e do RFC 4493 no setup().
+#ifdef ESP32BUILD
+#define _CRYPTO_HW 0
+#else
+#define _CRYPTO_HW 0 // O ESP8266 não tem acelerador AES.
+#endif
+#define _CRYPTO_TEST 1
+
 // Esta seção define se usamos o gateway como um repetidor.
 // Para ele, usamos outra saída como o canal (padrão == 0) em que estamos recebendo as mensagens.
 #define REPEATER 0
@@ -163,7 +235,30 @@
 
 // Nome do arquivo de configuração no sistema de arquivos SPIFFs.
 // Neste arquivo nós armazenamos a configuração e outras informações relevantes que devem sobreviver a uma reinicialização do gateway.
-#define CONFIGFILE "/gwayConfig.txt"
+// A configuração é gravada em dois arquivos binários, CONFIGFILE ".0" e ".1", com CRC (veja loraFiles.h).
+// CONFIGTEXT é o formato texto antigo, importado uma vez se não houver configuração binária.
+#define CONFIGFILE "/gwayConfig"
+#define CONFIGTEXT "/gwayConfig.txt"
+#define COUNTERFILE "/gwayCounters.log" // Contadores fcnt, boots e wifis, só acrescentados.
+#define _CNT_LOG_MAX 256 // Registros (16 bytes) antes de compactar o COUNTERFILE na configuração.
+
+// Journal de uplinks (store-and-forward). Quando a WLAN cai ou o envio UDP falha, o datagrama
+// PUSH_DATA já montado é guardado neste arquivo, e é reenviado quando a conexão volta, no máximo
+// um a cada _JOURNAL_RATE milissegundos. O journal é um anel de _JOURNAL_SLOTS registros de tamanho
+// fixo; com o anel cheio, o registro mais antigo é descartado.
+#define _JOURNAL 1 // 0 = Desativado; 1 = Ativado.
+#define JOURNALFILE "/gwayJournal.bin"
+#define _JOURNAL_SLOTS 64 // Deve ser uma potência de 2. 64 registros ocupam cerca de 58 KB.
+#define _JOURNAL_RATE 250 // Intervalo mínimo (mSec) entre dois reenvios.
+
+// Acompanhamento dos PUSH_ACK e PULL_ACK de cada servidor. Um token sem resposta em _ACK_TIMEOUT
+// milissegundos é contado como perdido. Com _PUSH_RETRY 1, todo PUSH_DATA de rxpk (JSON ou binário)
+// sem resposta é reenviado uma vez ao servidor que não o confirmou, e o token só é perdido se o
+// reenvio também ficar sem resposta. As cópias ficam em _PUSH_COPIES buffers de _RXPK_BUDGET bytes;
+// um PUSH_DATA confirmado libera a sua logo, então elas só se acumulam com datagramas perdidos.
+#define _ACK_TIMEOUT 2000
+#define _PUSH_RETRY 1
+#define _PUSH_COPIES 4
 
 // Definir as configurações do servidor (IMPORTANTE).
 #define _LOCUDPPORT 1700 // Porta UDP do gateway! Muitas vezes 1700 ou 1701 é usado para comms upstream.
@@ -172,6 +267,75 @@
 #define _MSG_INTERVAL 15
 #define _PULL_INTERVAL 55 // PULL_DATA mensagens para o servidor para receber downstream em milissegundos.
 #define _STAT_INTERVAL 120 // Envie uma mensagem 'stat' para o servidor.
+
+// Agrupamento (batch) de uplinks: vários rxpk em um único datagrama PUSH_DATA.
+// O lote é enviado quando o próximo quadro não cabe mais em _RXPK_BUDGET bytes ou quando o
+// primeiro quadro do lote esperou _RXPK_LATENCY milissegundos, o que acontecer primeiro.
+// _RXPK_LATENCY 0 desativa o agrupamento: um datagrama por quadro, como antes.
+#define _RXPK_BUDGET 900 // Tamanho máximo do datagrama em bytes, deve ser <= TX_BUFF_SIZE.
+#define _RXPK_LATENCY 50 // Atraso máximo (mSec) adicionado ao primeiro quadro do lote.
+
+// Filtro de uplinks, aplicado na stateMachine() logo após receivePkt(). Um quadro recusado não
+// entra no anel de uplinks e não é encaminhado a nenhum servidor.
+// _UP_FILTER 1 = Filtro de prefixos de DevAddr (upFilters[] em loraModem.h), para não encaminhar
+// o tráfego de outras redes (NetID) que o nosso servidor nunca vai rotear. Desligado por padrão,
+// pois o gateway pode encaminhar a um servidor privado; ajuste upFilters[] antes de ligar.
+// _DEDUP_WINDOW: quadros Unconfirmed Data Up com o mesmo DevAddr e FCnt recebidos dentro desta
+// janela (mSec) são descartados como repetições. 0 desativa. Confirmed Data Up nunca é descartado,
+// pois a repetição é como o nó pede de novo o ACK.
+#define _UP_FILTER 0
+#define _DEDUP_WINDOW 5000
+
+// Fila de downlinks. Um txpk cujo tmst está a menos de _TX_MIN_AHEAD uSec no futuro é recusado
+// com TOO_LATE, e a mais de _TX_MAX_AHEAD uSec com TOO_EARLY. O loop() entrega o primeiro
+// downlink da fila ao rádio _TX_LEAD uSec antes do seu tmst.
+#define _TX_MIN_AHEAD 20000 // 20 mSec.
+#define _TX_MAX_AHEAD 10000000 // 10 segundos, suficiente para o JOIN_ACCEPT em RX2 (6 seg).
+#define _TX_LEAD 20000 // 20 mSec.
+
+// O TX é disparado por um temporizador (esp_timer) com o FIFO já carregado. O temporizador dispara
+// _TX_SPIN uSec antes do instante exato e o restante é esperado ativamente, para reduzir o jitter.
+#define _TX_SPIN 100
+
+// Calibração automática do TX. No TXDONE, o tempo entre a escrita de OPMODE_TX e a interrupção,
+// menos o tempo no ar calculado, é o atraso do rádio para começar a transmitir. A média desse
+// atraso (txTime.lag) é descontada do instante do TX, além do ajuste manual txDelay.
+// Medidas com erro maior que _TX_CAL_MAX uSec são descartadas. O atraso só é aplicado depois de
+// _TX_CAL_N medidas e é a mediana das últimas _TX_CAL_N, então uma interrupção TXDONE atrasada
+// não desloca os TX seguintes.
+#define _TX_CAL 1
+#define _TX_CAL_MAX 2000
+#define _TX_CAL_N 8
+
+// Tarefa do rádio (somente ESP32). O rádio é atendido por uma tarefa FreeRTOS própria, acordada
+// pela interrupção do DIO, num núcleo diferente do loop() e da rede (que rodam no núcleo 1 e cuidam
+// do servidor web, da WLAN e do UDP, veja _NET_TASK). As duas partes se comunicam pelo anel de uplinks (upRing) e pela
+// fila de downlinks (downQ), então um cliente web lento ou uma reconexão da WLAN não atrasam o rádio.
+// 0 = O rádio é atendido pelo loop(), como antes;
+// 1 = Tarefa do rádio.
+#ifdef ESP32BUILD
+#define _RADIO_TASK 1
+#else
+#define _RADIO_TASK 0 // O ESP8266 tem um único núcleo e não usa FreeRTOS.
+#endif
+#define _RADIO_CORE 0 // Núcleo da tarefa do rádio.
+#define _RADIO_PRIO 5 // Prioridade da tarefa do rádio (o loop() tem prioridade 1).
+#define _RADIO_TICK 1 // Intervalo máximo (mSec) sem acordar, para a fila de downlinks e o hop.
+
+// Tarefa da rede (somente ESP32, requer _RADIO_TASK). A parte de rede do loop() (WLAN, anel de
+// uplinks, lotes de rxpk, journal, acks, PULL_DATA e stat, readUdp() e NTP) roda na netService(),
+// chamada por uma tarefa FreeRTOS própria. O loop() fica só com o servidor web e o OTA, então
+// uma página lenta não atrasa o encaminhamento dos uplinks nem a leitura dos downlinks.
+// 0 = A rede é atendida pelo loop(), como antes;
+// 1 = Tarefa da rede.
+#if _RADIO_TASK >= 1
+#define _NET_TASK 1
+#else
+#define _NET_TASK 0
+#endif
+#define _NET_CORE 1 // Núcleo da tarefa da rede (o mesmo do loop() e da WLAN).
+#define _NET_PRIO 2 // Prioridade da tarefa da rede: acima do loop() e abaixo do rádio.
+#define _NET_TICK 10 // Intervalo máximo (mSec) sem acordar, para os prazos dos lotes, dos acks e o UDP.
 #define _NTP_INTERVAL 3600 // Quantas vezes queremos tempo sincronização NTP.
 #define _WWW_INTERVAL 20 // Número de segundos antes de atualizar a página WWW.
 
@@ -187,6 +351,15 @@
 //#define _THINGPORT 1700 // dash.westenberg.org:8057
 //#define _THINGSERVER "seuServidor.com" // URL do servidor do manipulador LoRa-udp.js.
 
+// Lista de servidores upstream. _TTNSERVER e _THINGSERVER são só os valores iniciais: a lista fica
+// na configuração do gateway (gwayConfig.up[]) e pode ser alterada em /api/servers. Cada servidor
+// tem os seus intervalos de PULL_DATA e stat, e cada datagrama de rxpk é montado uma vez e enviado
+// a todos. O endereço de cada servidor é guardado e resolvido de novo a cada _DNS_REFRESH segundos
+// pelo loop(), um servidor por vez, fora do caminho de envio.
+#define _UP_SERVERS 4 // Máximo de servidores, no máximo 8.
+#define _DNS_REFRESH 3600 // Segundos entre resoluções do nome de um servidor.
+#define _DNS_RETRY 30 // Segundos até tentar de novo uma resolução que falhou.
+
 // Definições de identidade do gateway.
 #define _DESCRIPTION "ESP LoRa Gateway - AdailSilva" // Descrição do gateway.
 #define _EMAIL "adail101@hotmail.com" // E-mail do proprietário do gateway.
@@ -48,6 +48,8 @@
 //#include "esp_wifi.h"
 #include "WiFi.h"
 #include "SPIFFS.h"
+#include "esp_timer.h" // Temporizador de alta resolução para o instante exato do TX.
+#include "esp_heap_caps.h" // Maior bloco livre do heap, mostrado na página web.
 #else
 #include <ESP8266WiFi.h>
 #include <DNSServer.h> // Servidor DNS local.
@@ -56,7 +58,6 @@
 #include "FS.h"
 #include <WiFiUdp.h>
 #include <pins_arduino.h>
-#include <ArduinoJson.h>
 #include <SimpleTimer.h>
 #include <gBase64.h> // https://github.com/adamvr/arduino-base64 (mudou o nome).
 
@@ -76,8 +77,15 @@ extern "C"
 #include <mutex.h> // Veja o diretório lib.
 #endif
 
+#if _CRYPTO_HW >= 1
+#include "mbedtls/aes.h" // AES com o acelerador do ESP32, veja _loraCrypto.ino.
+#endif
+
 #include "loraModem.h"
 #include "loraFiles.h"
+#include "loraJson.h"
+#include "loraWww.h"
+#include "loraCrypto.h"
 
 #if WIFIMANAGER > 0
 #include <WiFiManager.h> // Biblioteca para configuração do WiFi no ESP através de um access point - ponto de acesso (AP).
@@ -92,10 +100,6 @@ extern "C"
 #include <ESP8266WebServer.h>
 #endif
 
-#if GATEWAYNODE == 1
-#include "AES-128_V10.h"
-#endif
-
 #if OLED == 1
 #include "SSD1306.h"
 SSD1306 display(OLED_ADDR, OLED_SDA, OLED_SCL); // i2c ADDR & SDA, SCL na Placa Wemos D1.
@@ -151,12 +155,10 @@ char description[64] = _DESCRIPTION; // Usado para descrição de forma livre.
 // Definições dos servidores:
 IPAddress localhost;   // IP Local.
 IPAddress ntpServer;   // Endereço IP de NTP_TIMESERVER.
-IPAddress ttnServer;   // Endereço IP do servidor de rede (TTN neste caso específico).
-IPAddress thingServer; // Endereço IP do servidor de rede (Thing neste caso específico).
 
 WiFiUDP Udp;
-uint32_t stattime = 0; // Última vez que enviamos uma mensagem stat para o servidor.
-uint32_t pulltime = 0; // Última vez que enviamos um pedido pull_data ao servidor.
+uint32_t stattime = 0; // Última vez que enviamos a mensagem do nó do gateway (GATEWAYNODE).
+uint32_t pulltime = 0; // Última vez que reiniciamos o rádio (a cada _PULL_INTERVAL).
 uint32_t lastTmst = 0;
 #if A_SERVER == 1
 uint32_t wwwtime = 0;
@@ -171,6 +173,104 @@ SimpleTimer timer; // Variável Timer é necessária para envios atrasados.
 #define RX_BUFF_SIZE 1024 // Downstream recebido do MQTT.
 #define STATUS_SIZE 512   // Deve (!) Ser suficiente com base no texto estático .. foi 1024.
 
+// Tamanho máximo de um objeto rxpk com len bytes de payload: os campos fixos ocupam menos de 180
+// caracteres e o campo data ocupa base64_enc_len(len).
+#define RXPK_MAX_LEN(len) (180 + base64_enc_len(len))
+
+// Lote de rxpk que está sendo montado por receivePacket() e enviado por rxpkFlush().
+#define RXPK_FRAMES 8 // Quadros do lote com o tmst guardado para a métrica MET_RX_UDP.
+struct rxpkBatch
+{
+	uint8_t buf[TX_BUFF_SIZE]; // Datagrama PUSH_DATA em construção.
+	int index; // Próxima posição livre em buf.
+	uint8_t count; // Quadros no lote atual.
+	uint32_t start; // millis() do primeiro quadro do lote.
+	uint32_t firstIn; // micros() em que o primeiro quadro entrou no lote.
+	uint32_t sumIn; // Soma dos micros() em que cada quadro entrou no lote.
+
+	uint32_t datagrams; // Estatísticas: datagramas enviados.
+	uint32_t frames; // Quadros enviados em todos os datagramas.
+	uint8_t maxFrames; // Maior número de quadros num datagrama.
+	uint64_t sumWait; // Soma da latência adicionada (uSec) a todos os quadros.
+	uint32_t maxWait; // Maior latência adicionada (uSec) a um quadro.
+	uint32_t rxTmst[RXPK_FRAMES]; // tmst (RXDONE) dos primeiros quadros do lote, para as métricas.
+
+	// O mesmo lote no formato binário (PKT_PUSH_BIN), montado só se algum servidor o usa.
+	// Um registro binário é sempre menor que o rxpk JSON do mesmo quadro, então cabe em _RXPK_BUDGET.
+	uint8_t bin[_RXPK_BUDGET];
+	int binIndex; // Próxima posição livre em bin.
+
+	// Comparação dos dois formatos: bytes e tempo de codificação somados por quadro.
+	uint32_t jsonFrames;
+	uint32_t jsonBytes;
+	uint32_t jsonUs;
+	uint32_t binFrames;
+	uint32_t binBytes;
+	uint32_t binUs;
+} batch;
+
+// Estado dos servidores upstream, na mesma ordem de gwayConfig.up[]. Para cada servidor guardamos
+// o endereço resolvido, os horários do PULL_DATA e do stat, os tokens dos PUSH_DATA e PULL_DATA
+// enviados e ainda não confirmados, e as estatísticas dos envios e dos acks.
+#if _UP_SERVERS > 8
+#error "_UP_SERVERS deve ser no máximo 8 (pushCopy.wait tem um bit por servidor)."
+#endif
+#define ACK_PENDING 8 // Tokens aguardando resposta, por servidor.
+#define RTT_BINS 7
+const uint16_t rttLimit[RTT_BINS - 1] = {25, 50, 100, 200, 500, 1000}; // Limites (mSec); o último bin é >= 1000.
+
+struct ackEntry
+{
+	uint16_t token;
+	uint8_t ident; // PKT_PUSH_DATA ou PKT_PULL_DATA.
+	bool used; // Aguardando o ack.
+	bool retry; // Este envio já é o reenvio de uma cópia de pushCopies[].
+	uint32_t sent; // micros() do envio.
+};
+
+struct upServer
+{
+	IPAddress ip; // Endereço resolvido de gwayConfig.up[].host.
+	int port;
+	bool resolved; // ip é válido.
+	uint32_t resolveTime; // millis() da última tentativa de resolução (0 = nunca).
+	uint32_t pullTime; // millis() do último PULL_DATA.
+	uint32_t statTime; // millis() do último stat.
+	uint32_t sendCount; // Datagramas entregues ao UDP.
+	uint32_t sendFail; // Envios que falharam (sem endereço, sem WLAN ou erro do UDP).
+	uint32_t sendMax; // Maior duração de um envio (uSec).
+	uint64_t sendSum; // Soma das durações dos envios (uSec).
+	struct ackEntry pend[ACK_PENDING];
+	uint8_t next; // Próxima posição de pend[] a usar.
+	uint32_t pushSent; // PUSH_DATA enviados, sem os reenvios.
+	uint32_t pushAcked; // PUSH_ACK recebidos.
+	uint32_t pullSent; // PULL_DATA enviados.
+	uint32_t pullAcked; // PULL_ACK recebidos.
+	uint32_t lost; // Tokens sem resposta em _ACK_TIMEOUT (os PUSH_DATA, nem ao reenvio).
+	uint32_t unknown; // Acks com token desconhecido (atrasados ou duplicados).
+	uint32_t retries; // PUSH_DATA reenviados.
+	uint32_t statSent; // PUSH_DATA enviados desde o último stat (para o ackr).
+	uint32_t statAcked; // PUSH_ACK recebidos desde o último stat.
+	uint32_t rtt[RTT_BINS]; // Histograma do tempo de ida e volta.
+	uint32_t rttLast; // Último RTT (uSec).
+	uint32_t rttMax; // Maior RTT (uSec).
+	uint64_t rttSum; // Soma dos RTT (uSec), a média é rttSum / (pushAcked + pullAcked).
+} upSrv[_UP_SERVERS];
+
+#if _PUSH_RETRY >= 1
+// Cópias dos últimos PUSH_DATA (JSON ou binários), para o reenvio. Uma cópia é achada pelo token e
+// fica ocupada enquanto algum servidor não a confirmou; com todas ocupadas, a mais antiga dá lugar.
+struct pushCopy
+{
+	uint8_t buf[_RXPK_BUDGET];
+	uint16_t len;
+	uint16_t token;
+	uint8_t wait; // Bit por servidor: enviado e ainda sem PUSH_ACK.
+	uint8_t retried; // Bit por servidor: o reenvio já foi feito.
+} pushCopies[_PUSH_COPIES];
+uint8_t pushNext = 0; // Próxima cópia a ocupar, se nenhuma estiver livre.
+#endif
+
 #if GATEWAYNODE == 1
 uint16_t frameCount = 0; // Escrevemos isso no arquivo da SPIFFS.
 #endif
@@ -293,44 +393,6 @@ static void printTime()
 	return;
 }
 
-// ---------------------------------------------------------------------------------------------------------
-// Converte um float em string para impressão:
-//
-// Parâmetros:
-//
-// f é o valor float para converter.
-// p é precisão em dígitos decimais.
-// val é array de caracteres para resultados.
-// ---------------------------------------------------------------------------------------------------------
-void ftoa(float f, char *val, int p)
-{
-	int j = 1;
-	int ival, fval;
-	char b[7] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-
-	for (int i = 0; i < p; i++)
-	{
-		j = j * 10;
-	}
-
-	ival = (int)f; // Faz parte do inteiro.
-	fval = (int)((f - ival) * j); // Faz fração, tem o mesmo sinal que a parte inteira.
-	if (fval < 0)
-		fval = -fval; // Então, se for negativo, faça a fração positiva novamente.
-	// "sprintf" NÃO se encaixa na memória.
-	strcat(val, itoa(ival, b, 10)); // Copia a parte inteira primeiro, base 10, terminada em null.
-	strcat(val, "."); // Copiar ponto decimal.
-
-	itoa(fval, b, 10); // Copiar a parte da fração base 10.
-	for (int i = 0; i < (p - strlen(b)); i++)
-	{
-		strcat(val, "0"); // Primeiro número de 0 da fração?
-	}
-
-	// Fração pode ser qualquer coisa de 0 a 10 ^ p, então pode ter menos dígitos.
-	strcat(val, b);
-}
-
 // =========================================================================================================
 // Funções de TEMPO NTP.
 // =========================================================================================================
@@ -444,6 +506,8 @@ void setupTime()
 int WlanReadWpa()
 {
 
+	upDefaults();
+	scanDefaults();
 	readConfig(CONFIGFILE, &gwayConfig);
 
 	if (gwayConfig.sf != (uint8_t)0)
@@ -453,6 +517,7 @@ int WlanReadWpa()
 	_cad = gwayConfig.cad;
 	_hop = gwayConfig.hop;
 	gwayConfig.boots++; // A cada inicialização do sistema é incrementada a redefinição.
+	writeCounters();
 
 #if GATEWAYNODE == 1
 	if (gwayConfig.fcnt != (uint8_t)0)
@@ -482,6 +547,7 @@ int WlanReadWpa()
 	Serial.println(F(" >"));
 	Serial.println(F("."));
 #endif
+	return (1);
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -498,11 +564,10 @@ int WlanWriteWpa(char *ssid, char *pass)
 	Serial.println();
 
 	// Uso da versão 3.3 do arquivo de configuração.
-	String s((char *)ssid);
-	gwayConfig.ssid = s;
-
-	String p((char *)pass);
-	gwayConfig.pass = p;
+	strncpy(gwayConfig.ssid, ssid, sizeof(gwayConfig.ssid) - 1);
+	gwayConfig.ssid[sizeof(gwayConfig.ssid) - 1] = 0;
+	strncpy(gwayConfig.pass, pass, sizeof(gwayConfig.pass) - 1);
+	gwayConfig.pass[sizeof(gwayConfig.pass) - 1] = 0;
 
 #if GATEWAYNODE == 1
 	gwayConfig.fcnt = frameCount;
@@ -550,7 +615,7 @@ int WlanConnect(int maxTry)
 	{
 
 		// Tentamos todos os SSID em wap array até o sucesso.
-		for (int j = wpa_index; j < (sizeof(wpa) / sizeof(wpa[0])); j++)
+		for (unsigned int j = wpa_index; j < (sizeof(wpa) / sizeof(wpa[0])); j++)
 		{
 
 			// Começamos com pontos de acesso conhecidos na lista.
@@ -566,7 +631,7 @@ int WlanConnect(int maxTry)
 
 			// Conte o número de vezes que chamamos WiFi.begin.
 			gwayConfig.wifis++;
-			writeGwayCfg(CONFIGFILE);
+			writeCounters(); // Só o contador mudou: acrescente ao COUNTERFILE.
 
 			WiFi.begin(ssid, password);
 
@@ -647,7 +712,9 @@ int readUdp(int packetSize)
 	uint8_t protocol;
 	uint16_t token;
 	uint8_t ident;
-	uint8_t buff[32];				 // Buffer geral a ser usado pelo UDP, definido como 64. (Observação! :/ == 32)
+	int txErr; // Resultado de sendPacket(), código de erro do TX_ACK.
+	size_t ackLen; // Comprimento do TX_ACK, size_t como o retorno de Udp.write().
+	uint8_t buff[64];				 // Buffer geral a ser usado pelo UDP (cabeçalho de 12 bytes + JSON do TX_ACK).
 	uint8_t buff_down[RX_BUFF_SIZE]; // Buffer para downstream.
 
 	if (WlanConnect(10) < 0)
@@ -710,6 +777,7 @@ int readUdp(int packetSize)
 		protocol = buff_down[0];
 		token = buff_down[2] * 256 + buff_down[1];
 		ident = buff_down[3];
+		TRACE(TR_UDP_IN, ident, packetSize);
 
 		// Analisamos agora o tipo de mensagem do servidor (se houver).
 		switch (ident)
@@ -719,7 +787,7 @@ int readUdp(int packetSize)
 			// Como esta função é usada somente para downstream, esta opção nunca será selecionado, mas está inclusa apenas como referência.
 		case PKT_PUSH_DATA: // 0x00 UP (Para Cima - Uplink).
 
-#if DUSB >= 1
+#if (DUSB >= 1) && (_TRACE == 0)
 			if (debug >= 1)
 			{
 				Serial.println(F("Gateway enviou dados do sensor para o servidor, UPLink: Sensor --> Gateway --> AppServer."));
@@ -745,8 +813,9 @@ int readUdp(int packetSize)
 		// Esta mensagem é enviada pelo servidor para confirmar o recebimento de uma mensagem.
 		// (sensor) enviada com o código acima.
 		case PKT_PUSH_ACK: // 0x01 DOWN (Para Baixo - Downlink).
+			ackReceived(remoteIpNo, remotePortNo, token, ident);
 
-#if DUSB >= 1
+#if (DUSB >= 1) && (_TRACE == 0)
 			if (debug >= 2)
 			{
 				Serial.println(F("Confirmação do servidor sobre o recebimento de uma mensagem, DOWNLink: AppServer --> Gateway."));
@@ -764,7 +833,7 @@ int readUdp(int packetSize)
 			break;
 
 		case PKT_PULL_DATA: // 0x02 UP (Para Cima - Uplink).
-#if DUSB >= 1
+#if (DUSB >= 1) && (_TRACE == 0)
 			Serial.println(F("Puxar Dados, UPLink: Sensor --> Gateway --> AppServer"));
 #endif
 			break;
@@ -772,7 +841,7 @@ int readUdp(int packetSize)
 			// Esse tipo de mensagem é usado para confirmar a mensagem OTAA para o nó.
 			// XXX Esse formato de mensagem também pode ser usado para outra comunicação downstream.
 		case PKT_PULL_RESP: // 0x03 DOWN (Para Baixo - Downlink).
-#if DUSB >= 1
+#if (DUSB >= 1) && (_TRACE == 0)
 			if (debug >= 0)
 			{
 				Serial.println(F("Confirmação da mensagem de OTAA para o nó, DOWNLink: AppServer --> Gateway --> Nó."));
@@ -781,9 +850,13 @@ int readUdp(int packetSize)
 #endif
 			lastTmst = micros(); // Armazena o último "tmst" deste pacote foi recebido.
 
-			// Enviamos para o nó LoRa, primeiro o "tempo", em seguida, enviamos as mensagens.
-			_state = S_TX;
-			if (sendPacket(data, packetSize - 4) < 0)
+			// Decodifique o txpk e coloque-o na fila de downlinks; o loop() o transmite no tmst.
+			{
+				PROF_BEGIN(PROF_TXPK);
+				txErr = sendPacket(data, packetSize - 4);
+				PROF_END(PROF_TXPK);
+			}
+			if (txErr < 0)
 			{
 				return (-1);
 			}
@@ -803,17 +876,33 @@ int readUdp(int packetSize)
 			buff[10] = MAC_array[4];
 			buff[11] = MAC_array[5];
 			buff[12] = 0;
-#if DUSB >= 1
+
+			// Se o downlink foi recusado, informe o motivo em JSON (protocolo v2) para que o
+			// servidor de rede possa reagendá-lo. Sem erro, o TX_ACK fica só com o cabeçalho.
+			ackLen = 12;
+			switch (txErr)
+			{
+			case TXACK_TOO_LATE:
+				ackLen += sprintf((char *)(buff + 12), "{\"txpk_ack\":{\"error\":\"%s\"}}", "TOO_LATE");
+				break;
+			case TXACK_TOO_EARLY:
+				ackLen += sprintf((char *)(buff + 12), "{\"txpk_ack\":{\"error\":\"%s\"}}", "TOO_EARLY");
+				break;
+			case TXACK_COLLISION_PACKET:
+				ackLen += sprintf((char *)(buff + 12), "{\"txpk_ack\":{\"error\":\"%s\"}}", "COLLISION_PACKET");
+				break;
+			}
+#if (DUSB >= 1) && (_TRACE == 0)
 			Serial.println(F("readUdp:: Buffer de TX (Transmissão) preenchido."));
 #endif
 			// Apenas envie o PKT_PULL_ACK para o soquete UDP que acabou de enviar os dados!
 			Udp.beginPacket(remoteIpNo, remotePortNo);
 
 #ifdef ESP32BUILD
-			if (Udp.write(buff, 12) != 12)
+			if (Udp.write(buff, ackLen) != ackLen)
 			{
 #else
-			if (Udp.write((char *)buff, 12) != 12)
+			if (Udp.write((char *)buff, ackLen) != ackLen)
 			{
 #endif
 #if DUSB >= 1
@@ -823,7 +912,7 @@ int readUdp(int packetSize)
 			}
 			else
 			{
-#if DUSB >= 1
+#if (DUSB >= 1) && (_TRACE == 0)
 				if (debug >= 0)
 				{
 					Serial.print(F("PKT_TX_ACK:: tmst="));
@@ -841,7 +930,7 @@ int readUdp(int packetSize)
 			}
 			yield();
 
-#if DUSB >= 1
+#if (DUSB >= 1) && (_TRACE == 0)
 			if (debug >= 1)
 			{
 				Serial.print(F("PKT_PULL_RESP:: Tamanho: "));
@@ -860,7 +949,8 @@ int readUdp(int packetSize)
 			break;
 
 		case PKT_PULL_ACK: // 0x04 DOWN; o servidor envia um PULL_ACK para confirmar o recibo de PULL_DATA.
-#if DUSB >= 1
+			ackReceived(remoteIpNo, remotePortNo, token, ident);
+#if (DUSB >= 1) && (_TRACE == 0)
 			if (debug >= 2)
 			{
 				Serial.print(F("PKT_PULL_ACK:: Tamanho: "));
@@ -894,7 +984,7 @@ int readUdp(int packetSize)
 #endif
 			break;
 		}
-#if DUSB >= 2
+#if (DUSB >= 2) && (_TRACE == 0)
 		if (debug >= 1)
 		{
 			Serial.print(F("readUdp:: Retornando = "));
@@ -923,9 +1013,11 @@ int readUdp(int packetSize)
 // ---------------------------------------------------------------------------------------------------------
 int sendUdp(IPAddress server, int port, uint8_t *msg, int length)
 {
+	uint32_t start = micros();
 
-	// Verifica se estamos conectados ao WiFi e à internet.
-	if (WlanConnect(3) < 0)
+	// Verifica se estamos conectados ao WiFi. A reconexão é feita pelo loop(), e não aqui, para
+	// que um envio nunca espere pela WLAN.
+	if (WiFi.status() != WL_CONNECTED)
 	{
 #if DUSB >= 1
 		Serial.print(F("sendUdp: ERRO, conectando ao WiFi."));
@@ -933,6 +1025,7 @@ int sendUdp(IPAddress server, int port, uint8_t *msg, int length)
 #endif
 		Udp.flush();
 		yield();
+		METRIC(MET_SENDUDP, micros() - start);
 		return (0);
 	}
 	yield();
@@ -948,21 +1041,23 @@ int sendUdp(IPAddress server, int port, uint8_t *msg, int length)
 		if (debug >= 1)
 			Serial.println(F("sendUdp:: ERRO, Udp.beginPacket."));
 #endif
+		METRIC(MET_SENDUDP, micros() - start);
 		return (0);
 	}
 	yield();
 
 #ifdef ESP32BUILD
-	if (Udp.write(msg, length) != length)
+	if (Udp.write(msg, length) != (size_t)length)
 	{
 #else
-	if (Udp.write((char *)msg, length) != length)
+	if (Udp.write((char *)msg, length) != (size_t)length)
 	{
 #endif
 #if DUSB >= 1
 		Serial.println(F("sendUdp:: ERRO de gravação."));
 #endif
 		Udp.endPacket(); // Fechar UDP.
+		METRIC(MET_SENDUDP, micros() - start);
 		return (0);		 // ERRO de retorno.
 	}
 	yield();
@@ -976,11 +1071,450 @@ int sendUdp(IPAddress server, int port, uint8_t *msg, int length)
 			Serial.flush();
 		}
 #endif
+		METRIC(MET_SENDUDP, micros() - start);
 		return (0);
 	}
+
+	// Guarde o token dos PUSH_DATA e PULL_DATA para casar com o PUSH_ACK ou PULL_ACK.
+	int s = upServerIndex(server, port);
+	if ((s >= 0) && (length >= 12) && ((msg[3] == PKT_PUSH_DATA) || (msg[3] == PKT_PUSH_BIN) || (msg[3] == PKT_PULL_DATA)))
+	{
+		ackSent(s, msg);
+	}
+	TRACE(TR_UDP_OUT, (length >= 4 ? msg[3] : 0xFF), length);
+	METRIC(MET_SENDUDP, micros() - start);
 	return (1);
 } //sendUDP
 
+// ---------------------------------------------------------------------------------------------------------
+// Devolve o índice em upSrv[] do servidor upstream com este endereço e porta, ou -1.
+// ---------------------------------------------------------------------------------------------------------
+int upServerIndex(IPAddress server, int port)
+{
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		if (upSrv[s].resolved && (upSrv[s].port == port) && (upSrv[s].ip == server))
+			return (s);
+	}
+	return (-1);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Preenche gwayConfig.up[] com os servidores iniciais (_TTNSERVER e _THINGSERVER). Chamada antes
+// de readConfig(), que substitui a lista pela configuração gravada, se houver.
+// ---------------------------------------------------------------------------------------------------------
+void upDefaults()
+{
+	memset(gwayConfig.up, 0, sizeof(gwayConfig.up));
+	memset(gwayConfig.upFormat, UP_FMT_JSON, sizeof(gwayConfig.upFormat));
+#ifdef _TTNSERVER
+	strncpy(gwayConfig.up[0].host, _TTNSERVER, sizeof(gwayConfig.up[0].host) - 1);
+	gwayConfig.up[0].port = _TTNPORT;
+	gwayConfig.up[0].pullInterval = _PULL_INTERVAL;
+	gwayConfig.up[0].statInterval = _STAT_INTERVAL;
+#endif
+#ifdef _THINGSERVER
+	strncpy(gwayConfig.up[1].host, _THINGSERVER, sizeof(gwayConfig.up[1].host) - 1);
+	gwayConfig.up[1].port = _THINGPORT;
+	gwayConfig.up[1].pullInterval = _PULL_INTERVAL;
+	gwayConfig.up[1].statInterval = _STAT_INTERVAL;
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Resolve o nome do servidor s e guarda o endereço em upSrv[s]. Um servidor que já tinha endereço
+// continua com o endereço antigo se a nova resolução falhar.
+// Retorna: true se o servidor tem um endereço válido.
+// ---------------------------------------------------------------------------------------------------------
+bool upResolve(int s)
+{
+	struct upServer *u = &upSrv[s];
+	struct upServerCfg *c = &gwayConfig.up[s];
+	IPAddress ip;
+
+	u->resolveTime = millis();
+	if (u->resolveTime == 0)
+		u->resolveTime = 1; // 0 quer dizer "nunca".
+	if (c->host[0] == 0)
+	{
+		u->resolved = false;
+		return (false);
+	}
+	if (!WiFi.hostByName(c->host, ip))
+	{
+#if DUSB >= 1
+		Serial.print(F("upResolve:: ERRO em hostByName "));
+		Serial.println(c->host);
+#endif
+		return (u->resolved);
+	}
+	u->ip = ip;
+	u->port = c->port;
+	u->resolved = true;
+	return (true);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Chamada pelo loop(): resolve de novo no máximo um servidor, o primeiro cuja resolução venceu
+// (_DNS_REFRESH) ou falhou há mais de _DNS_RETRY segundos.
+// ---------------------------------------------------------------------------------------------------------
+void upRefresh()
+{
+	uint32_t now = millis();
+
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		struct upServer *u = &upSrv[s];
+		if (gwayConfig.up[s].host[0] == 0)
+			continue;
+		uint32_t age = (now - u->resolveTime) / 1000;
+		if ((u->resolveTime == 0) || (age >= (u->resolved ? _DNS_REFRESH : _DNS_RETRY)))
+		{
+			upResolve(s);
+			return;
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Esquece o endereço do servidor s, para que seja resolvido no próximo upRefresh() com o nome e a
+// porta atuais de gwayConfig.up[s]. Os PULL_DATA e stat recomeçam logo em seguida.
+// ---------------------------------------------------------------------------------------------------------
+void upReset(int s)
+{
+	struct upServer *u = &upSrv[s];
+	u->resolved = false;
+	u->resolveTime = 0;
+	u->pullTime = millis() - (uint32_t)gwayConfig.up[s].pullInterval * 1000;
+	u->statTime = millis() - (uint32_t)gwayConfig.up[s].statInterval * 1000;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Envia o datagrama msg ao servidor s e mede a duração do envio.
+// Retorna: 1 se foi entregue ao UDP, 0 em erro.
+// ---------------------------------------------------------------------------------------------------------
+int upSend(int s, uint8_t *msg, int length)
+{
+	struct upServer *u = &upSrv[s];
+
+	if (!u->resolved)
+	{
+		u->sendFail++;
+		return (0);
+	}
+	uint32_t start = micros();
+	int ret = sendUdp(u->ip, u->port, msg, length);
+	uint32_t us = micros() - start;
+	u->sendSum += us;
+	if (us > u->sendMax)
+		u->sendMax = us;
+	if (ret)
+		u->sendCount++;
+	else
+		u->sendFail++;
+	return (ret);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Envia o mesmo datagrama msg, montado uma só vez, a todos os servidores configurados com o formato
+// fmt (UP_FMT_JSON, UP_FMT_BIN ou UP_FMT_ALL para todos).
+// Retorna: o número de servidores para os quais o envio deu certo.
+// ---------------------------------------------------------------------------------------------------------
+int upSendAll(uint8_t *msg, int length, uint8_t fmt)
+{
+	int sent = 0;
+
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		if (gwayConfig.up[s].host[0] == 0)
+			continue;
+		if ((fmt != UP_FMT_ALL) && (gwayConfig.upFormat[s] != fmt))
+			continue;
+		sent += upSend(s, msg, length);
+		yield();
+	}
+	return (sent);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Retorna true se algum servidor configurado recebe o rxpk no formato binário.
+// ---------------------------------------------------------------------------------------------------------
+bool upBinary()
+{
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		if ((gwayConfig.up[s].host[0] != 0) && (gwayConfig.upFormat[s] == UP_FMT_BIN))
+			return (true);
+	}
+	return (false);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Chamada pelo loop() com a WLAN conectada: envia o PULL_DATA e o stat de cada servidor no
+// intervalo configurado para ele.
+// ---------------------------------------------------------------------------------------------------------
+void upService()
+{
+	uint32_t now = millis();
+
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		struct upServer *u = &upSrv[s];
+		struct upServerCfg *c = &gwayConfig.up[s];
+		if ((c->host[0] == 0) || !u->resolved)
+			continue;
+
+		// stat PUSH_DATA messagem (*2, par. 4).
+		if ((c->statInterval > 0) && ((now - u->statTime) >= (uint32_t)c->statInterval * 1000))
+		{
+#if DUSB >= 1
+			if (debug >= 2)
+			{
+				Serial.print(F("STAT "));
+				Serial.println(s);
+			}
+#endif
+			sendstat(s);
+			u->statTime = now;
+			yield();
+		}
+
+		// PULL_DATA messagem (*2, par. 4).
+		if ((c->pullInterval > 0) && ((now - u->pullTime) >= (uint32_t)c->pullInterval * 1000))
+		{
+#if DUSB >= 1
+			if (debug >= 1)
+			{
+				Serial.print(F("PULL "));
+				Serial.println(s);
+			}
+#endif
+			pullData(s);
+			u->pullTime = now;
+			yield();
+		}
+	}
+}
+
+#if _PUSH_RETRY >= 1
+// ---------------------------------------------------------------------------------------------------------
+// Devolve a cópia em pushCopies[] do PUSH_DATA com este token, ou NULL.
+// ---------------------------------------------------------------------------------------------------------
+struct pushCopy *pushCopyFind(uint16_t token)
+{
+	for (int i = 0; i < _PUSH_COPIES; i++)
+	{
+		if ((pushCopies[i].len > 0) && (pushCopies[i].token == token))
+			return (&pushCopies[i]);
+	}
+	return (NULL);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Guarda uma cópia do PUSH_DATA msg antes do envio, numa posição livre ou na mais antiga.
+// ---------------------------------------------------------------------------------------------------------
+void pushCopyAdd(uint8_t *msg, int length)
+{
+	if ((length < 12) || (length > _RXPK_BUDGET))
+	{
+		return;
+	}
+	int i = pushNext;
+	for (int n = 0; n < _PUSH_COPIES; n++)
+	{
+		if (pushCopies[(pushNext + n) % _PUSH_COPIES].wait == 0)
+		{
+			i = (pushNext + n) % _PUSH_COPIES;
+			break;
+		}
+	}
+	struct pushCopy *c = &pushCopies[i];
+	memcpy(c->buf, msg, length);
+	c->len = length;
+	c->token = msg[2] * 256 + msg[1];
+	c->wait = 0; // Os bits são ligados por ackSent(), servidor a servidor.
+	c->retried = 0;
+	pushNext = (i + 1) % _PUSH_COPIES;
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------
+// Registra um PUSH_DATA ou PULL_DATA enviado ao servidor s numa posição livre de pend[]. Só com todas
+// esperando um ack a posição u->next é reaproveitada, e o token que ela esperava é contado como perdido.
+// ---------------------------------------------------------------------------------------------------------
+void ackSent(int s, uint8_t *msg)
+{
+	struct upServer *u = &upSrv[s];
+	for (int i = 0; i < ACK_PENDING; i++)
+	{
+		if (!u->pend[u->next].used)
+			break;
+		u->next = (u->next + 1) % ACK_PENDING;
+	}
+	struct ackEntry *e = &u->pend[u->next];
+
+	if (e->used)
+	{
+		u->lost++;
+#if _PUSH_RETRY >= 1
+		struct pushCopy *old = ((e->ident == PKT_PUSH_DATA) ? pushCopyFind(e->token) : NULL);
+		if (old != NULL)
+		{
+			old->wait &= ~(1 << s);
+		}
+#endif
+	}
+	e->token = msg[2] * 256 + msg[1]; // O mesmo cálculo do readUdp().
+	e->ident = ((msg[3] == PKT_PULL_DATA) ? PKT_PULL_DATA : PKT_PUSH_DATA); // PKT_PUSH_BIN também recebe PUSH_ACK.
+	e->used = true;
+	e->retry = false;
+#if _PUSH_RETRY >= 1
+	struct pushCopy *c = pushCopyFind(e->token);
+	if ((c != NULL) && (e->ident == PKT_PUSH_DATA))
+	{
+		e->retry = ((c->retried & (1 << s)) != 0);
+		c->wait |= (1 << s);
+	}
+#endif
+	e->sent = micros();
+	u->next = (u->next + 1) % ACK_PENDING;
+
+	if (e->ident == PKT_PUSH_DATA)
+	{
+		if (!e->retry) // O reenvio é o mesmo PUSH_DATA, contado em retries.
+		{
+			u->pushSent++;
+			u->statSent++;
+		}
+	}
+	else
+	{
+		u->pullSent++;
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Casa um PUSH_ACK ou PULL_ACK recebido com o token pendente e registra o tempo de ida e volta.
+// ---------------------------------------------------------------------------------------------------------
+void ackReceived(IPAddress server, int port, uint16_t token, uint8_t ident)
+{
+	int s = upServerIndex(server, port);
+	if (s < 0)
+	{
+		return;
+	}
+	struct upServer *u = &upSrv[s];
+	uint8_t sentIdent = ((ident == PKT_PUSH_ACK) ? PKT_PUSH_DATA : PKT_PULL_DATA);
+
+	for (int i = 0; i < ACK_PENDING; i++)
+	{
+		struct ackEntry *e = &u->pend[i];
+		if (e->used && (e->token == token) && (e->ident == sentIdent))
+		{
+			uint32_t rtt = micros() - e->sent;
+			e->used = false;
+
+			u->rttLast = rtt;
+			u->rttSum += rtt;
+			if (rtt > u->rttMax)
+			{
+				u->rttMax = rtt;
+			}
+			int b = 0;
+			while ((b < RTT_BINS - 1) && (rtt >= (uint32_t)rttLimit[b] * 1000))
+			{
+				b++;
+			}
+			u->rtt[b]++;
+
+			if (ident == PKT_PUSH_ACK)
+			{
+				u->pushAcked++;
+				u->statAcked++;
+#if _PUSH_RETRY >= 1
+				struct pushCopy *c = pushCopyFind(token);
+				if (c != NULL)
+				{
+					c->wait &= ~(1 << s); // Confirmado, não precisa de reenvio.
+				}
+#endif
+			}
+			else
+			{
+				u->pullAcked++;
+			}
+			return;
+		}
+	}
+	u->unknown++;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Chamada pelo loop(): conta como perdidos os tokens sem resposta em _ACK_TIMEOUT. Com _PUSH_RETRY,
+// um PUSH_DATA sem resposta que ainda tem cópia é reenviado uma vez ao mesmo servidor, e o token só é
+// perdido se o reenvio também não for confirmado em _ACK_TIMEOUT.
+// ---------------------------------------------------------------------------------------------------------
+void ackCheck()
+{
+	uint32_t now = micros();
+
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		struct upServer *u = &upSrv[s];
+		for (int i = 0; i < ACK_PENDING; i++)
+		{
+			struct ackEntry *e = &u->pend[i];
+			// Diferença com sinal: um reenvio registrado nesta volta tem sent depois de now.
+			if (!e->used || ((int32_t)(now - e->sent) < (int32_t)_ACK_TIMEOUT * 1000))
+			{
+				continue;
+			}
+			e->used = false;
+#if _PUSH_RETRY >= 1
+			struct pushCopy *c = ((e->ident == PKT_PUSH_DATA) ? pushCopyFind(e->token) : NULL);
+			if ((c != NULL) && !e->retry && !(c->retried & (1 << s)))
+			{
+				c->retried |= (1 << s);
+				u->retries++;
+#if DUSB >= 1
+				if (debug >= 1)
+				{
+					Serial.print(F("ackCheck:: Reenviando PUSH_DATA, token = "));
+					Serial.println(e->token, HEX);
+				}
+#endif
+				if (upSend(s, c->buf, c->len))
+				{
+					continue; // ackSent() registrou o reenvio com o mesmo token.
+				}
+			}
+			if (c != NULL)
+			{
+				c->wait &= ~(1 << s); // Desistimos deste servidor.
+			}
+#endif
+			u->lost++;
+		}
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Devolve a porcentagem de PUSH_DATA confirmados pelo servidor s desde o último stat, em décimos
+// (1000 == 100.0%), e recomeça a contagem. Sem envios, o ackr é 100%.
+// ---------------------------------------------------------------------------------------------------------
+uint32_t ackRatio(int s)
+{
+	struct upServer *u = &upSrv[s];
+	uint32_t r = 1000;
+	if (u->statSent > 0)
+	{
+		r = (u->statAcked >= u->statSent ? 1000 : (u->statAcked * 1000) / u->statSent);
+	}
+	u->statSent = 0;
+	u->statAcked = 0;
+	return (r);
+}
+
 // ---------------------------------------------------------------------------------------------------------
 // UDPconnect (): conectar-se ao UDP, que é uma coisa local, afinal conexões UDP não existem.
 //
@@ -1027,8 +1561,11 @@ bool UDPconnect()
 // - Token Aleatório (2 bytes).
 // - Identificador PULL_DATA (1 byte) = 0x02
 // - Identificador exclusivo do gateway (8 bytes) = endereço MAC.
+//
+// Parâmetros:
+// - s: índice do servidor em upSrv[].
 // ---------------------------------------------------------------------------------------------------------
-void pullData()
+void pullData(int s)
 {
 
 	uint8_t pullDataReq[12]; // relatório de status como um objeto JSON.
@@ -1057,25 +1594,7 @@ void pullData()
 	pullIndex = 12; // cabeçalho de 12 bytes
 
 	// enviar a atualização.
-	uint8_t *pullPtr;
-	pullPtr = pullDataReq,
-#ifdef _TTNSERVER
-	sendUdp(ttnServer, _TTNPORT, pullDataReq, pullIndex);
-	yield();
-
-#endif
-
-#if DUSB >= 1
-	if (pullPtr != pullDataReq)
-	{
-		Serial.println(F("pullPtr != pullDatReq"));
-		Serial.flush();
-	}
-
-#endif
-#ifdef _THINGSERVER
-	sendUdp(thingServer, _THINGPORT, pullDataReq, pullIndex);
-#endif
+	upSend(s, pullDataReq, pullIndex);
 
 #if DUSB >= 1
 	if (debug >= 2)
@@ -1104,18 +1623,14 @@ void pullData()
 // Envia mensagem de status periódica para o servidor, mesmo quando não recebemos nenhum dado.
 //
 // Parâmetros:
-// - <nenhum>
+// - s: índice do servidor em upSrv[].
 // ---------------------------------------------------------------------------------------------------------
-void sendstat()
+void sendstat(int s)
 {
 
 	uint8_t status_report[STATUS_SIZE]; // relatório de status como um objeto JSON.
-	char stat_timestamp[32]; // XXX estava 24.
 	time_t t;
 
-	char clat[10] = {0};
-	char clon[10] = {0};
-
 	int stat_index = 0;
 	uint8_t token_h = (uint8_t)rand(); // token aleatório.
 	uint8_t token_l = (uint8_t)rand(); // token aleatório.
@@ -1136,27 +1651,72 @@ void sendstat()
 	status_report[10] = MAC_array[4];
 	status_report[11] = MAC_array[5];
 
-	stat_index = 12; // cabeçalho de 12 bytes
-
 	t = now(); // obter registro de data e hora para estatísticas.
 
-	// XXX Usando CET como o fuso horário atual. Mude para o seu fuso horário.
-	sprintf(stat_timestamp, "%04d-%02d-%02d %02d:%02d:%02d CET", year(), month(), day(), hour(), minute(), second());
-	yield();
-
-	ftoa(lat, clat, 5); // Converte lat (latitude) em um array de "char" com 5 casas decimais.
-	ftoa(lon, clon, 5); // Como IDE NÃO PODE imprimir floats. (Faz com a longitude o mesmo que é feito acima com a latitude).
+	// O cabeçalho tem 12 bytes; o ackr é diferente para cada servidor, então a mensagem é montada para cada um.
+	// envia a atualização.
+	stat_index = statJson(status_report, t, ackRatio(s));
+	if (stat_index > 0)
+		upSend(s, status_report, stat_index);
+	return;
+} //sendstat
 
-	// Constroe a mensagem Status no formato JSON, XXX Divide esta...
-	delay(1);
+// ---------------------------------------------------------------------------------------------------------
+// Monta o objeto {"stat":{...}} depois do cabeçalho de 12 bytes de status_report.
+//
+// Parâmetros:
+// t: A hora do relatório.
+// ackr: A porcentagem de PUSH_DATA confirmados, em décimos (veja ackRatio()).
+// Retorna: o comprimento do datagrama, ou -1 se não coube em STATUS_SIZE.
+// ---------------------------------------------------------------------------------------------------------
+int statJson(uint8_t *status_report, time_t t, uint32_t ackr)
+{
+	struct jsonWriter w;
 
-	int j = snprintf((char *)(status_report + stat_index), STATUS_SIZE - stat_index,
-					 "{\"stat\":{\"time\":\"%s\",\"lati\":%s,\"long\":%s,\"alti\":%i,\"rxnb\":%u,\"rxok\":%u,\"rxfw\":%u,\"ackr\":%u.0,\"dwnb\":%u,\"txnb\":%u,\"pfrm\":\"%s\",\"mail\":\"%s\",\"desc\":\"%s\"}}",
-					 stat_timestamp, clat, clon, (int)alt, cp_nb_rx_rcv, cp_nb_rx_ok, cp_up_pkt_fwd, 0, 0, 0, platform, email, description);
+	// Constroe a mensagem Status no formato JSON com o jsonWriter, sem sprintf nem floats.
+	// XXX Usando CET como o fuso horário atual. Mude para o seu fuso horário.
+	jwInit(&w, status_report, STATUS_SIZE, 12);
+	jwLit(&w, "{\"stat\":{\"time\":\"");
+	jwUintPad(&w, year(t), 4);
+	jwLit(&w, "-");
+	jwUintPad(&w, month(t), 2);
+	jwLit(&w, "-");
+	jwUintPad(&w, day(t), 2);
+	jwLit(&w, " ");
+	jwUintPad(&w, hour(t), 2);
+	jwLit(&w, ":");
+	jwUintPad(&w, minute(t), 2);
+	jwLit(&w, ":");
+	jwUintPad(&w, second(t), 2);
+	jwLit(&w, " CET\",\"lati\":");
+	jwFixed(&w, (int32_t)lroundf(lat * 100000), 5); // Latitude com 5 casas decimais.
+	jwLit(&w, ",\"long\":");
+	jwFixed(&w, (int32_t)lroundf(lon * 100000), 5);
+	jwLit(&w, ",\"alti\":");
+	jwInt(&w, (int)alt);
+	jwLit(&w, ",\"rxnb\":");
+	jwUint(&w, cp_nb_rx_rcv);
+	jwLit(&w, ",\"rxok\":");
+	jwUint(&w, cp_nb_rx_ok);
+	jwLit(&w, ",\"rxfw\":");
+	jwUint(&w, cp_up_pkt_fwd);
+	jwLit(&w, ",\"ackr\":");
+	jwFixed(&w, ackr, 1); // Porcentagem de PUSH_DATA confirmados, com uma casa decimal.
+	jwLit(&w, ",\"dwnb\":0,\"txnb\":0,\"pfrm\":");
+	jwStr(&w, platform);
+	jwLit(&w, ",\"mail\":");
+	jwStr(&w, email);
+	jwLit(&w, ",\"desc\":");
+	jwStr(&w, description);
+	jwLit(&w, "}}");
 	yield(); // Dá lugar ao serviço de limpeza interno do ESP32/ESP8266.
 
-	stat_index += j;
-	status_report[stat_index] = 0; // adiciona terminador de string, por segurança.
+	int stat_index = jwEnd(&w); // Termina a string com 0, por segurança; -1 se não coube.
+	if (stat_index < 0)
+	{
+		Serial.println(F("sendstat:: Buffer de ERRO muito grande."));
+		return (-1);
+	}
 
 	if (debug >= 2)
 	{
@@ -1165,24 +1725,8 @@ void sendstat()
 		Serial.print(F(" >>>"));
 		Serial.println((char *)(status_report + 12)); // DEBUG: exibir o stat JSON.
 	}
-
-	if (stat_index > STATUS_SIZE)
-	{
-		Serial.println(F("sendstat:: Buffer de ERRO muito grande."));
-		return;
-	}
-
-	// envia a atualização.
-#ifdef _TTNSERVER
-	sendUdp(ttnServer, _TTNPORT, status_report, stat_index);
-	yield();
-#endif
-
-#ifdef _THINGSERVER
-	sendUdp(thingServer, _THINGPORT, status_report, stat_index);
-#endif
-	return;
-} //sendstat
+	return (stat_index);
+}
 
 // =========================================================================================================
 // CÓDIGO DO PROGRAMA PRINCIPAL (setup() e loop() - CONFIGURAÇÃO E LAÇO)
@@ -1210,6 +1754,9 @@ void setup()
 #endif
 #if MUTEX_INT == 1
 	CreateMutux(&inIntr);
+#endif
+#if _NET_TASK >= 1
+	netMutex = xSemaphoreCreateRecursiveMutex(); // Antes da primeira gravação da configuração.
 #endif
 	if (SPIFFS.begin())
 		Serial.println(F("SPIFFS Carregado com Sucesso."));
@@ -1292,6 +1839,9 @@ void setup()
 #endif
 	WiFi.mode(WIFI_STA);
 	WlanReadWpa(); // Leia as últimas configurações de WiFi de SPIFFS na memória.
+#if _JOURNAL >= 1
+	journalInit(); // Abra o journal de uplinks (depois do CONFIGFILE, que pode formatar o SPIFFS).
+#endif
 
 	WiFi.macAddress(MAC_array);
 	sprintf(MAC_char, "%02x:%02x:%02x:%02x:%02x:%02x", MAC_char[0], MAC_array[1], MAC_char[2], MAC_array[3], MAC_char[4], MAC_array[5]);
@@ -1303,7 +1853,7 @@ void setup()
 	Serial.println(F("."));
 
 	// Começamos conectando-nos a uma rede WiFi, configuramos o hostname.
-	char hostname[12];
+	char hostname[20]; // "LoRa_esp8266-" mais 6 dígitos hexadecimais e o terminador.
 #ifdef ESP32BUILD
 	sprintf(hostname, "%s%02x%02x%02x", "LoRa_esp32-", MAC_array[3], MAC_array[4], MAC_array[5]);
 #else
@@ -1356,6 +1906,15 @@ void setup()
 	// Este pino estava comentado. GPIO0/D3. Usado para salto de frequência, não importante.
 	pinMode(pins.dio2, INPUT); // Pino 32 Para Heltec, Setado em loraModem.h.
 
+#if _RADIOS > 1
+	// O chip select dos rádios extras tem que estar em HIGH antes do primeiro acesso SPI ao rádio 0.
+	for (int n = 0; n < _RADIOS - 1; n++)
+	{
+		pinMode(radioPins[n][0], OUTPUT);
+		digitalWrite(radioPins[n][0], HIGH);
+	}
+#endif
+
 // Inicia os pinos da comunição SPI.
 #ifdef ESP32BUILD
 	// Está setado em loraModem.h.
@@ -1389,20 +1948,19 @@ void setup()
 		die("Configuração:: ERRO em hostByName NTP.");
 	};
 	delay(100);
-#ifdef _TTNSERVER
-	if (!WiFi.hostByName(_TTNSERVER, ttnServer)) // Use DNS para obter o IP do servidor uma vez.
+	// Primeira resolução dos servidores upstream. Um servidor que falhar aqui é tentado de novo
+	// pelo upRefresh() no loop(), sem impedir o gateway de encaminhar para os outros.
+	for (int s = 0; s < _UP_SERVERS; s++)
 	{
-		die("Configuração:: ERRO em hostByName TTN.");
-	};
-	delay(100);
-#endif
-#ifdef _THINGSERVER
-	if (!WiFi.hostByName(_THINGSERVER, thingServer))
-	{
-		die("Configuração:: ERRO em hostByName THING.");
+		if (gwayConfig.up[s].host[0] == 0)
+			continue;
+		if (!upResolve(s))
+		{
+			Serial.print(F("Configuração:: ERRO em hostByName "));
+			Serial.println(gwayConfig.up[s].host);
+		}
+		delay(100);
 	}
-	delay(100);
-#endif
 
 // As atualizações Over the Air (OTAA) são suportadas quando temos uma conexão WiFi.
 // Não há necessidade da configuração de hora do NTP ser precisa para que essa função funcione.
@@ -1428,8 +1986,12 @@ void setup()
 	printTime();
 	Serial.println(F("."));
 
-	writeGwayCfg(CONFIGFILE);
-	Serial.println(F("Configuração do gateway salva."));
+	// Grave só se a rede mudou; os contadores já estão no COUNTERFILE.
+	if (strcmp(WiFi.SSID().c_str(), gwayConfig.ssid) != 0)
+	{
+		writeGwayCfg(CONFIGFILE);
+		Serial.println(F("Configuração do gateway salva."));
+	}
 #endif
 
 #if A_SERVER == 1
@@ -1437,6 +1999,10 @@ void setup()
 	setupWWW();
 #endif
 
+#if (GATEWAYNODE == 1) || (_CHECK_MIC >= 1)
+	cryptoSetup(); // Tabelas do AES, autoteste e chaves dos dispositivos.
+#endif
+
 	delay(100); // Aguarda a configuração.
 
 	// Configura e inicializa a máquina de estado LoRa em _loramModem.ino.
@@ -1453,7 +2019,6 @@ void setup()
 		_state = S_RX;
 		rxLoraModem();
 	}
-	LoraUp.payLength = 0; // Inicia o comprimento como 0.
 
 	// Manipuladores de interrupção de inicialização, que são compartilhados para GPIO15/D8,
 	// Ligamos interrupções com nível lógico alto: HIGH.
@@ -1471,7 +2036,28 @@ void setup()
 		attachInterrupt(pins.dio1, Interrupt_1, RISING); // Separar interrupções.
 	}
 
-	writeConfig(CONFIGFILE, &gwayConfig); // Escrever configuração.
+#if _RADIOS > 1
+	radioSetup(); // Rádios extras, cada um no seu canal.
+#endif
+
+#if _RADIO_TASK >= 1
+	// A partir daqui o rádio pertence à tarefa do rádio; o loop() cuida do servidor web.
+	xTaskCreatePinnedToCore(radioLoop, "radio", 4096, NULL, _RADIO_PRIO, &radioTask, _RADIO_CORE);
+#if DUSB >= 1
+	Serial.print(F("Tarefa do rádio no núcleo "));
+	Serial.println(_RADIO_CORE);
+#endif
+#endif
+
+#if _NET_TASK >= 1
+	// E a rede (WLAN, uplinks, UDP e NTP) pertence à tarefa da rede.
+	xTaskCreatePinnedToCore(netLoop, "net", 8192, NULL, _NET_PRIO, &netTask, _NET_CORE);
+#if DUSB >= 1
+	Serial.print(F("Tarefa da rede no núcleo "));
+	Serial.println(_NET_CORE);
+#endif
+#endif
+
 
 // Display OLED I2C Azul Amarelo 0.96 Polegadas:
 // Ativar display OLED
@@ -1511,44 +2097,27 @@ void setup()
 void loop()
 {
 	uint32_t nowSeconds;
-	int packetSize;
 
 	nowTime = micros();
-	nowSeconds = (uint32_t)millis() / 1000;
 
-	// Verifica o valor do evento, o que significa que uma interrupção chegou.
-	// Neste caso, tratamos da interrupção (por exemplo, mensagem recebida) no userspace em loop().
-	if (_event != 0x00)
+#if _METRICS >= 1
+	// Duração da iteração anterior do loop(), incluindo o que o core faz entre as chamadas.
+	static uint32_t loopStart = 0;
+	if (loopStart != 0)
 	{
-		stateMachine(); // Inicie a máquina de estado.
-		_event = 0; // Valor de reset.
-		return; // Loop de reinicialização.
+		METRIC(MET_LOOP, nowTime - loopStart);
 	}
+	loopStart = nowTime;
+#endif
 
-  // Após um período de silêncio, certifique-se de reiniciar o modem.
-  // XXX Ainda tem que medir o período silencioso no stat [0];
-  // Por enquanto usamos msgTime
-	if ((((nowTime - statr[0].tmst) / 1000000) > _MSG_INTERVAL) &&
-		(msgTime < statr[0].tmst))
+#if _RADIO_TASK == 0
+	// Sem a tarefa do rádio, o loop() atende o rádio primeiro: eventos das interrupções, a fila de
+	// downlinks, os pedidos de reinício e o hop. Depois de um evento, reinicie o loop().
+	if (radioService())
 	{
-#if DUSB >= 1
-		Serial.print("'r' - Após um período de silêncio, certifique-se de reiniciar o modem.");
-#endif
-		initLoraModem();
-		if (_cad)
-		{
-			_state = S_SCAN;
-			cadScanner();
-		}
-		else
-		{
-			_state = S_RX;
-			rxLoraModem();
-		}
-		writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t)0x00);
-		writeRegister(REG_IRQ_FLAGS, 0xFF); // Redefinir todos os sinalizadores de interrupção.
-		msgTime = nowTime;
+		return; // Loop de reinicialização.
 	}
+#endif
 
 #if A_OTA == 1
 	// Executar a atualização OTA (Over the Air) se ativada e solicitada pelo usuário.
@@ -1565,15 +2134,55 @@ void loop()
 	server.handleClient();
 #endif
 
+#if _NET_TASK == 0
+	// Sem a tarefa da rede, o loop() atende a WLAN, os uplinks, o UDP e o NTP.
+	netService();
+#endif
+
+	// Reinicie o rádio no antigo intervalo do PULL_DATA. Só volta a escutar (RADIO_LISTEN): a
+	// cópia-sombra dos registradores evita as escritas iguais e não há o pulso de reset de 20 mSec.
+	// O reset completo (RADIO_INIT) fica para o período de silêncio em radioService().
+	nowSeconds = (uint32_t)millis() / 1000;
+	if ((nowSeconds - pulltime) >= _PULL_INTERVAL)
+	{ // Acorde todos os segundos xx.
+		if ((_state != S_TX) && (_state != S_TXDONE)) // Não interrompa um downlink.
+		{
+			radioRestart(RADIO_LISTEN);
+		}
+		pulltime = nowSeconds;
+	}
+}
+
+// ----------------------------------------------------------------------------
+// Toda a parte de rede: a conexão WLAN, o encaminhamento do anel de uplinks (lotes de rxpk e
+// journal), os acks, PULL_DATA e stat dos servidores, readUdp(), a mensagem do nó e o NTP.
+// Chamada pela tarefa da rede (_NET_TASK), dentro de NET_LOCK(), ou pelo loop().
+// ----------------------------------------------------------------------------
+void netService()
+{
+	uint32_t nowSeconds = (uint32_t)millis() / 1000;
+	int packetSize;
+
 	// Se não estivermos conectados, tente se conectar.
-  // Não vamos ler o Udp neste ciclo de loop então.
+  // Não vamos ler o Udp nesta volta então.
 	if (WlanConnect(1) < 0)
 	{
 #if DUSB >= 1
-		Serial.print(F("loop: ERRO reconectar WLAN"));
+		Serial.print(F("netService: ERRO reconectar WLAN"));
+#endif
+#if _JOURNAL >= 1
+		// Sem WLAN os quadros recebidos vão para o journal, em vez de ficarem no anel até ele encher.
+		while ((_event == 0) && (upRing.tail != upRing.head))
+		{
+			receivePacket();
+		}
+		if ((batch.count > 0) && ((millis() - batch.start) >= _RXPK_LATENCY))
+		{
+			rxpkFlush();
+		}
 #endif
 		yield();
-		return; // Saia do loop se não houver WLAN conectada.
+		return; // Sem WLAN conectada não há mais nada a fazer nesta volta.
 	}
 
 	// Então, se estamos conectados.
@@ -1583,6 +2192,37 @@ void loop()
   // Como não sabemos quando o servidor responderá, testamos em todos os loops.
 	else
 	{
+		// Encaminhe os quadros que a stateMachine() deixou no anel de uplinks. Paramos assim que
+		// chegar um novo evento do rádio, para que ele seja atendido primeiro (sem a tarefa do rádio).
+		while ((_event == 0) && (upRing.tail != upRing.head))
+		{
+			if (receivePacket() <= 0)
+			{
+#if DUSB >= 1
+				Serial.println(F("loop:: Erro no encaminhamento do Pacote."));
+#endif
+			}
+			yield();
+		}
+
+		// Envie o lote de rxpk quando o prazo do primeiro quadro expirou.
+		if ((batch.count > 0) && ((millis() - batch.start) >= _RXPK_LATENCY))
+		{
+			rxpkFlush();
+		}
+
+#if _JOURNAL >= 1
+		// Reenvie os uplinks guardados durante a queda da WLAN, um por vez.
+		journalReplay();
+#endif
+
+		// Conte os acks que não chegaram e, se for o caso, reenvie os PUSH_DATA sem resposta.
+		ackCheck();
+
+		// PULL_DATA e stat de cada servidor upstream, e a resolução de nomes vencida.
+		upService();
+		upRefresh();
+
 		while ((packetSize = Udp.parsePacket()) > 0)
 		{ // Comprimento da mensagem UDP em espera.
 #if DUSB >= 2
@@ -1590,7 +2230,10 @@ void loop()
 #endif
 			// O pacote pode ser PKT_PUSH_ACK (0x01), PKT_PULL_ACK (0x03) ou PKT_PULL_RESP (0x04).
       // Este comando é encontrado no byte 4 (buffer [3]).
-			if (readUdp(packetSize) <= 0)
+			PROF_BEGIN(PROF_READUDP);
+			int udpLen = readUdp(packetSize);
+			PROF_END(PROF_READUDP);
+			if (udpLen <= 0)
 			{
 #if DUSB >= 1
 				if (debug > 0)
@@ -1598,78 +2241,14 @@ void loop()
 #endif
 				break;
 			}
-			// Agora sabemos que recebemos uma mensagem bem-sucedida do host.
-			else
-			{
-				_event = 1; // Pode ser feito em dobro se mais mensagens forem recebidas.
-			}
 			//yield();
 		}
 	}
 	yield();
 
-	// A próxima seção é apenas de emergência. Se possível, nós hop() na máquina de estados.
-	// Se hopping estiver habilitado, e por falta de timer, nós hop().
-	// XXX Experimental, 2,5 ms entre o máximo de hops.
-
-	if ((_hop) && (((long)(nowTime - hopTime)) > 7500))
-	{
-
-		if ((_state == S_SCAN) && (sf == SF12))
-		{
-#if DUSB >= 1
-			if (debug >= 1)
-				Serial.println(F("loop:: hop - Salto de Frequências."));
-#endif
-			hop();
-		}
-
-		// A seção XXX abaixo não funciona sem mais trabalho. É a seção com a maioria
-		// influencia no modo de operação do HOP (o que é um pouco inesperado).
-		// Se continuarmos em outro estado, resetar.
-		else if (((long)(nowTime - hopTime)) > 100000)
-		{
-
-			_state = S_RX;
-			rxLoraModem();
-
-			hop();
-
-			if (_cad)
-			{
-				_state = S_SCAN;
-				cadScanner();
-			}
-		}
-		else if (debug >= 3)
-		{
-			Serial.print(F(" state="));
-			Serial.println(_state);
-		}
-		inHop = false; // Redefinir a proteção de reentrada do HOP.
-		yield();
-	}
-
-	// stat PUSH_DATA messagem (*2, par. 4).
-
+	// As mensagens stat e PULL_DATA de cada servidor são enviadas pelo upService().
 	if ((nowSeconds - stattime) >= _STAT_INTERVAL)
 	{ // Acorde todos os segundos xx
-#if DUSB >= 1
-		if (debug >= 2)
-		{
-			Serial.print(F("STAT <"));
-			Serial.flush();
-		}
-#endif
-		sendstat(); // Mostrar a mensagem de status e enviar para o servidor.
-#if DUSB >= 1
-		if (debug >= 2)
-		{
-			Serial.println(F(">"));
-			if (debug >= 2)
-				Serial.flush();
-		}
-#endif
 
 // Se o gateway se comporta como um nó, fazemos de tempos em tempos envia uma mensagem do nó para o servidor backend.
 // O emessage do nod Gateway não tem nada a ver com o STAT_INTERVAL mensagem mas agendamos na mesma frequência.
@@ -1692,45 +2271,8 @@ void loop()
 	}
 	yield();
 
-	// envia PULL_DATA messagem (*2, par. 4)
-	nowSeconds = (uint32_t)millis() / 1000;
-	if ((nowSeconds - pulltime) >= _PULL_INTERVAL)
-	{ // Acorde todos os segundos xx.
-#if DUSB >= 1
-		if (debug >= 1)
-		{
-			Serial.print(F("PULL <"));
-			if (debug >= 2)
-				Serial.flush();
-		}
-#endif
-		pullData(); // Envie a mensagem PULL_DATA para o servidor.
-		initLoraModem();
-		if (_cad)
-		{
-			_state = S_SCAN;
-			cadScanner();
-		}
-		else
-		{
-			_state = S_RX;
-			rxLoraModem();
-		}
-		writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t)0x00);
-		writeRegister(REG_IRQ_FLAGS, 0xFF); // Redefinir todos os sinalizadores de interrupção.
-#if DUSB >= 1
-		if (debug >= 1)
-		{
-			Serial.println(F(">"));
-			if (debug >= 2)
-				Serial.flush();
-		}
-#endif
-		pulltime = nowSeconds;
-	}
-
 // Se fizermos o nosso próprio manuseio de NTP (aconselhável).
-// Não usamos a interrupção do temporizador, mas usamos o tempo do próprio loop(), que é melhor para o SPI.
+// Não usamos a interrupção do temporizador, mas o tempo da própria netService(), que é melhor para o SPI.
 #if NTP_INTR == 0
 	// Defina a hora de forma manual. Não use setSyncProvider.
 	// Como esta função pode colidir com o SPI e outras interrupções.
@@ -1747,3 +2289,21 @@ void loop()
 	}
 #endif
 }
+
+#if _NET_TASK >= 1
+// ----------------------------------------------------------------------------
+// Tarefa da rede, fixa no núcleo _NET_CORE. Dorme até o upRingPush() anunciar um quadro novo, ou no
+// máximo _NET_TICK mSec, para os prazos dos lotes, dos acks e do UDP. Cada volta segura NET_LOCK(),
+// então uma página que altera os servidores ou grava a configuração espera a volta terminar.
+// ----------------------------------------------------------------------------
+void netLoop(void *)
+{
+	for (;;)
+	{
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(_NET_TICK));
+		NET_LOCK();
+		netService();
+		NET_UNLOCK();
+	}
+}
+#endif
@@ -0,0 +1,451 @@
+// =========================================================================================================
+// =========== LoRaWAN Gateway de Canal único para ESP32/ESP8266 ===========
+// Copyright (c) 2016, 2017 Maarten Westenberg versão para ESP32/ESP8266
+// Versão 5.0.1
+// Data: 15-11-2017
+// Autor: Maarten Westenberg, E-mail: mw12554@hotmail.com
+// Contibuições de Dorijan Morelj e Andreas Spies pelo suporte a OLED.
+//
+// ========== Tradução: AdailSilva, E-mail: adail101@hotmail.com ===========
+//
+// Baseado no trabalho feito por Thomas Telkamp para o gateway Raspberry PI de canal único e muitos outros.
+//
+// Todos os direitos reservados. Este programa e os materiais acompanhantes são disponibilizados
+// sob os termos da licença MIT que acompanha esta distribuição e está disponível em:
+// https://opensource.org/licenses/mit-license.php
+//
+// NENHUMA GARANTIA DE QUALQUER TIPO É FORNECIDA.
+//
+// Os protocolos e especificações usados para este gateway de canal único:
+//
+// 1. Especificação LoRa Versão V1.0 e V1.1 para comunicação Gateway-Node;
+//
+// 2. Protocolo de comunicação Semtech Básico entre o gateway LoRa e a versão 3.0.0 do servidor
+//  https://github.com/Lora-net/packet_forwarder/blob/master/PROTOCOL.TXT.
+//
+// Notas:
+//
+// Este arquivo contém o módulo de criptografia LoRaWAN: AES-128, CMAC (RFC 4493), o MIC e a
+// criptografia do FRMPayload (par. 4.3.3 e 4.4 da especificação), usado pelo nó do gateway
+// (_sensor.ino) e pela verificação do MIC dos uplinks (_CHECK_MIC).
+// As chaves são preparadas uma vez (aesSetKey(), cmacSetKey()) e reutilizadas em todo quadro.
+// =========================================================================================================
+
+#if (GATEWAYNODE == 1) || (_CHECK_MIC >= 1)
+
+#if _CRYPTO_HW == 0
+// ---------------------------------------------------------------------------------------------------------
+// AES-128 em software com tabela T. Uma única tabela de 1 KB (aesTe0) é usada com rotações no lugar
+// das quatro tabelas usuais. A S-box e a tabela são calculadas por aesTables() no cryptoSetup(),
+// em vez de ficarem na flash.
+// ---------------------------------------------------------------------------------------------------------
+static uint8_t aesSbox[256];
+static uint32_t aesTe0[256];
+
+#define ROTL8(x, n) ((uint8_t)(((x) << (n)) | ((x) >> (8 - (n)))))
+#define ROR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void aesTables()
+{
+	uint8_t p = 1;
+	uint8_t q = 1;
+
+	// Percorre o grupo multiplicativo do GF(2^8): p é multiplicado por 3 e q dividido por 3,
+	// então q é sempre o inverso de p. A S-box é a transformação afim do inverso.
+	do
+	{
+		p = p ^ (uint8_t)(p << 1) ^ ((p & 0x80) ? 0x1B : 0);
+		q ^= (uint8_t)(q << 1);
+		q ^= (uint8_t)(q << 2);
+		q ^= (uint8_t)(q << 4);
+		if (q & 0x80)
+			q ^= 0x09;
+		aesSbox[p] = q ^ ROTL8(q, 1) ^ ROTL8(q, 2) ^ ROTL8(q, 3) ^ ROTL8(q, 4) ^ 0x63;
+	} while (p != 1);
+	aesSbox[0] = 0x63;
+
+	// aesTe0[x] = (2.S[x], S[x], S[x], 3.S[x]): SubBytes e MixColumns de uma coluna.
+	for (int i = 0; i < 256; i++)
+	{
+		uint8_t s = aesSbox[i];
+		uint8_t s2 = (uint8_t)(s << 1) ^ ((s & 0x80) ? 0x1B : 0);
+		aesTe0[i] = ((uint32_t)s2 << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | (uint8_t)(s2 ^ s);
+	}
+}
+
+static uint32_t aesLoad(const uint8_t *b)
+{
+	return (((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3]);
+}
+
+static void aesStore(uint8_t *b, uint32_t v)
+{
+	b[0] = (uint8_t)(v >> 24);
+	b[1] = (uint8_t)(v >> 16);
+	b[2] = (uint8_t)(v >> 8);
+	b[3] = (uint8_t)v;
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------
+// Prepara a chave AES-128 key (16 bytes): expansão das chaves de rodada (FIPS-197, par. 5.2).
+// ---------------------------------------------------------------------------------------------------------
+void aesSetKey(struct aesKey *k, const uint8_t *key)
+{
+#if _CRYPTO_HW >= 1
+	mbedtls_aes_init(&k->ctx);
+	mbedtls_aes_setkey_enc(&k->ctx, key, 128);
+#else
+	const uint8_t rcon[10] = {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36};
+	uint32_t *rk = k->rk;
+
+	for (int i = 0; i < 4; i++)
+		rk[i] = aesLoad(key + 4 * i);
+	for (int i = 4; i < 44; i++)
+	{
+		uint32_t t = rk[i - 1];
+		if ((i & 3) == 0)
+		{
+			// RotWord, SubWord e Rcon.
+			t = ((uint32_t)aesSbox[(t >> 16) & 0xFF] << 24) | ((uint32_t)aesSbox[(t >> 8) & 0xFF] << 16) |
+				((uint32_t)aesSbox[t & 0xFF] << 8) | aesSbox[t >> 24];
+			t ^= (uint32_t)rcon[(i / 4) - 1] << 24;
+		}
+		rk[i] = rk[i - 4] ^ t;
+	}
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Criptografa um bloco de 16 bytes no lugar com a chave k.
+// ---------------------------------------------------------------------------------------------------------
+void aesEncrypt(struct aesKey *k, uint8_t *block)
+{
+#if _CRYPTO_HW >= 1
+	mbedtls_aes_crypt_ecb(&k->ctx, MBEDTLS_AES_ENCRYPT, block, block);
+#else
+	const uint32_t *rk = k->rk;
+	uint32_t s0 = aesLoad(block) ^ rk[0];
+	uint32_t s1 = aesLoad(block + 4) ^ rk[1];
+	uint32_t s2 = aesLoad(block + 8) ^ rk[2];
+	uint32_t s3 = aesLoad(block + 12) ^ rk[3];
+	uint32_t t0, t1, t2, t3;
+
+	// Rodadas 1 a 9: SubBytes, ShiftRows e MixColumns pela tabela, e AddRoundKey.
+	for (int r = 1; r < 10; r++)
+	{
+		rk += 4;
+		t0 = aesTe0[s0 >> 24] ^ ROR32(aesTe0[(s1 >> 16) & 0xFF], 8) ^
+			 ROR32(aesTe0[(s2 >> 8) & 0xFF], 16) ^ ROR32(aesTe0[s3 & 0xFF], 24) ^ rk[0];
+		t1 = aesTe0[s1 >> 24] ^ ROR32(aesTe0[(s2 >> 16) & 0xFF], 8) ^
+			 ROR32(aesTe0[(s3 >> 8) & 0xFF], 16) ^ ROR32(aesTe0[s0 & 0xFF], 24) ^ rk[1];
+		t2 = aesTe0[s2 >> 24] ^ ROR32(aesTe0[(s3 >> 16) & 0xFF], 8) ^
+			 ROR32(aesTe0[(s0 >> 8) & 0xFF], 16) ^ ROR32(aesTe0[s1 & 0xFF], 24) ^ rk[2];
+		t3 = aesTe0[s3 >> 24] ^ ROR32(aesTe0[(s0 >> 16) & 0xFF], 8) ^
+			 ROR32(aesTe0[(s1 >> 8) & 0xFF], 16) ^ ROR32(aesTe0[s2 & 0xFF], 24) ^ rk[3];
+		s0 = t0;
+		s1 = t1;
+		s2 = t2;
+		s3 = t3;
+	}
+
+	// Última rodada, sem MixColumns.
+	rk += 4;
+	t0 = ((uint32_t)aesSbox[s0 >> 24] << 24) | ((uint32_t)aesSbox[(s1 >> 16) & 0xFF] << 16) |
+		 ((uint32_t)aesSbox[(s2 >> 8) & 0xFF] << 8) | aesSbox[s3 & 0xFF];
+	t1 = ((uint32_t)aesSbox[s1 >> 24] << 24) | ((uint32_t)aesSbox[(s2 >> 16) & 0xFF] << 16) |
+		 ((uint32_t)aesSbox[(s3 >> 8) & 0xFF] << 8) | aesSbox[s0 & 0xFF];
+	t2 = ((uint32_t)aesSbox[s2 >> 24] << 24) | ((uint32_t)aesSbox[(s3 >> 16) & 0xFF] << 16) |
+		 ((uint32_t)aesSbox[(s0 >> 8) & 0xFF] << 8) | aesSbox[s1 & 0xFF];
+	t3 = ((uint32_t)aesSbox[s3 >> 24] << 24) | ((uint32_t)aesSbox[(s0 >> 16) & 0xFF] << 16) |
+		 ((uint32_t)aesSbox[(s1 >> 8) & 0xFF] << 8) | aesSbox[s2 & 0xFF];
+	aesStore(block, t0 ^ rk[0]);
+	aesStore(block + 4, t1 ^ rk[1]);
+	aesStore(block + 8, t2 ^ rk[2]);
+	aesStore(block + 12, t3 ^ rk[3]);
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Dobra uma subchave CMAC: desloca 1 bit para a esquerda e aplica Rb (0x87) se o bit mais alto era 1.
+// ---------------------------------------------------------------------------------------------------------
+static void cmacDouble(uint8_t *out, const uint8_t *in)
+{
+	uint8_t carry = in[0] & 0x80;
+	for (int i = 0; i < 15; i++)
+		out[i] = (uint8_t)(in[i] << 1) | (in[i + 1] >> 7);
+	out[15] = (uint8_t)(in[15] << 1);
+	if (carry)
+		out[15] ^= 0x87;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Prepara a chave CMAC: a chave AES e as subchaves k1 e k2 (RFC 4493, par. 2.3).
+// ---------------------------------------------------------------------------------------------------------
+void cmacSetKey(struct cmacKey *k, const uint8_t *key)
+{
+	uint8_t l[16];
+
+	aesSetKey(&k->aes, key);
+	memset(l, 0, 16);
+	aesEncrypt(&k->aes, l);
+	cmacDouble(k->k1, l);
+	cmacDouble(k->k2, k->k1);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// CMAC (RFC 4493, par. 2.4) de b0 | msg, sem copiar a mensagem.
+// Parâmetros:
+// - b0: bloco de 16 bytes antes da mensagem (o B0 do MIC), ou NULL.
+// - msg, len: a mensagem.
+// - mac: os 16 bytes do CMAC.
+// ---------------------------------------------------------------------------------------------------------
+void cmacCompute(struct cmacKey *k, const uint8_t *b0, const uint8_t *msg, uint8_t len, uint8_t *mac)
+{
+	uint8_t x[16];
+	uint8_t i;
+
+	memset(x, 0, 16);
+	if (b0 != NULL)
+	{
+		for (i = 0; i < 16; i++)
+			x[i] = b0[i];
+		if (len == 0)
+		{
+			// b0 é o último bloco, completo.
+			for (i = 0; i < 16; i++)
+				x[i] ^= k->k1[i];
+			aesEncrypt(&k->aes, x);
+			memcpy(mac, x, 16);
+			return;
+		}
+		aesEncrypt(&k->aes, x);
+	}
+
+	// Todos os blocos exceto o último.
+	while (len > 16)
+	{
+		for (i = 0; i < 16; i++)
+			x[i] ^= msg[i];
+		aesEncrypt(&k->aes, x);
+		msg += 16;
+		len -= 16;
+	}
+
+	// Último bloco: completo com k1, ou preenchido com 0x80 0x00... e k2.
+	for (i = 0; i < len; i++)
+		x[i] ^= msg[i];
+	if (len == 16)
+	{
+		for (i = 0; i < 16; i++)
+			x[i] ^= k->k1[i];
+	}
+	else
+	{
+		x[len] ^= 0x80;
+		for (i = 0; i < 16; i++)
+			x[i] ^= k->k2[i];
+	}
+	aesEncrypt(&k->aes, x);
+	memcpy(mac, x, 16);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Bloco comum do MIC (B0, id 0x49) e da criptografia (A, id 0x01) do LoRaWAN 1.0.
+// ---------------------------------------------------------------------------------------------------------
+static void loraBlock(uint8_t *b, uint8_t id, uint8_t dir, uint32_t devAddr, uint32_t fcnt, uint8_t last)
+{
+	b[0] = id;
+	b[1] = 0x00;
+	b[2] = 0x00;
+	b[3] = 0x00;
+	b[4] = 0x00;
+	b[5] = dir; // 0 é uplink.
+	b[6] = (uint8_t)devAddr; // DevAddr e FCnt em little-endian.
+	b[7] = (uint8_t)(devAddr >> 8);
+	b[8] = (uint8_t)(devAddr >> 16);
+	b[9] = (uint8_t)(devAddr >> 24);
+	b[10] = (uint8_t)fcnt;
+	b[11] = (uint8_t)(fcnt >> 8);
+	b[12] = (uint8_t)(fcnt >> 16);
+	b[13] = (uint8_t)(fcnt >> 24);
+	b[14] = 0x00;
+	b[15] = last; // len no B0, número do bloco no A.
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// MIC de um quadro LoRaWAN (par. 4.4): cmac[0..3] de aes128_cmac(NwkSKey, B0 | msg).
+// msg é MHDR | FHDR | FPort | FRMPayload, sem o MIC. O MIC é escrito em mic[0..3].
+// ---------------------------------------------------------------------------------------------------------
+void loraMic(struct cmacKey *k, uint8_t dir, uint32_t devAddr, uint32_t fcnt,
+			 const uint8_t *msg, uint8_t len, uint8_t *mic)
+{
+	uint8_t b0[16];
+	uint8_t mac[16];
+
+	loraBlock(b0, 0x49, dir, devAddr, fcnt, len);
+	cmacCompute(k, b0, msg, len, mac);
+	mic[0] = mac[0];
+	mic[1] = mac[1];
+	mic[2] = mac[2];
+	mic[3] = mac[3];
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Criptografa (ou decifra, é a mesma operação) o FRMPayload no lugar (par. 4.3.3).
+// ---------------------------------------------------------------------------------------------------------
+void loraCrypt(struct aesKey *k, uint8_t dir, uint32_t devAddr, uint32_t fcnt, uint8_t *data, uint8_t len)
+{
+	uint8_t a[16];
+
+	for (uint8_t i = 1; len > 0; i++)
+	{
+		loraBlock(a, 0x01, dir, devAddr, fcnt, i);
+		aesEncrypt(k, a);
+		uint8_t n = (len < 16 ? len : 16);
+		for (uint8_t j = 0; j < n; j++)
+			data[j] ^= a[j];
+		data += n;
+		len -= n;
+	}
+}
+
+#if _CHECK_MIC >= 1
+// ---------------------------------------------------------------------------------------------------------
+// Verifica o MIC de um uplink recebido. Só quadros de dados (Unconfirmed/Confirmed Data Up) de um
+// DevAddr em micDevices[] são verificados. O quadro só traz os 16 bits inferiores do FCnt; os
+// superiores vêm do último FCnt aceito, e um FCnt menor que o anterior é tentado como rollover.
+// Parâmetros:
+// - buf, len: PHYPayload completo, com o MIC nos últimos 4 bytes.
+// Retorna: MIC_OK, MIC_FAIL ou MIC_UNKNOWN.
+// ---------------------------------------------------------------------------------------------------------
+uint8_t micCheck(const uint8_t *buf, uint8_t len)
+{
+	uint8_t mtype = buf[0] >> 5;
+	uint8_t mic[4];
+
+	// MHDR(1) | DevAddr(4) | FCtrl(1) | FCnt(2) | MIC(4).
+	if ((len < 12) || ((mtype != 0x02) && (mtype != 0x04)))
+	{
+		micCount.unknown++;
+		return (MIC_UNKNOWN);
+	}
+	uint32_t devAddr = buf[1] | ((uint32_t)buf[2] << 8) | ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 24);
+
+	for (uint8_t d = 0; d < MIC_DEVICES; d++)
+	{
+		if (micDevices[d].devAddr != devAddr)
+			continue;
+
+		struct micState *m = &micState[d];
+		uint32_t fcnt = (m->fcnt & 0xFFFF0000) | buf[6] | ((uint16_t)buf[7] << 8);
+		if ((fcnt < m->fcnt) && ((m->fcnt - fcnt) > 0x8000))
+		{
+			fcnt += 0x10000; // Os 16 bits inferiores deram a volta.
+		}
+
+		loraMic(&m->key, 0, devAddr, fcnt, buf, len - 4, mic);
+		if (memcmp(mic, buf + len - 4, 4) == 0)
+		{
+			m->fcnt = fcnt;
+			m->ok++;
+			micCount.ok++;
+			return (MIC_OK);
+		}
+		m->fail++;
+		micCount.fail++;
+		return (MIC_FAIL);
+	}
+	micCount.unknown++;
+	return (MIC_UNKNOWN);
+}
+#endif
+
+#if _CRYPTO_TEST >= 1
+// ---------------------------------------------------------------------------------------------------------
+// Autoteste com os vetores do FIPS-197 (apêndice C.1) e do RFC 4493 (par. 4), e a medida dos
+// ciclos de CPU de um MIC de um uplink de 32 bytes com a chave já preparada.
+// Retorna: true se todos os vetores conferem.
+// ---------------------------------------------------------------------------------------------------------
+bool cryptoSelfTest()
+{
+	const uint8_t fipsKey[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+								 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F};
+	const uint8_t fipsOut[16] = {0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30,
+								 0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A};
+	const uint8_t key[16] = {0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE, 0xD2, 0xA6,
+							 0xAB, 0xF7, 0x15, 0x88, 0x09, 0xCF, 0x4F, 0x3C};
+	const uint8_t msg[64] = {0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E, 0x11, 0x73, 0x93, 0x17, 0x2A,
+							 0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03, 0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51,
+							 0x30, 0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11, 0xE5, 0xFB, 0xC1, 0x19, 0x1A, 0x0A, 0x52, 0xEF,
+							 0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B, 0x17, 0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10};
+	const uint8_t lens[4] = {0, 16, 40, 64};
+	const uint8_t macs[4][16] = {
+		{0xBB, 0x1D, 0x69, 0x29, 0xE9, 0x59, 0x37, 0x28, 0x7F, 0xA3, 0x7D, 0x12, 0x9B, 0x75, 0x67, 0x46},
+		{0x07, 0x0A, 0x16, 0xB4, 0x6B, 0x4D, 0x41, 0x44, 0xF7, 0x9B, 0xDD, 0x9D, 0xD0, 0x4A, 0x28, 0x7C},
+		{0xDF, 0xA6, 0x67, 0x47, 0xDE, 0x9A, 0xE6, 0x30, 0x30, 0xCA, 0x32, 0x61, 0x14, 0x97, 0xC8, 0x27},
+		{0x51, 0xF0, 0xBE, 0xBF, 0x7E, 0x3B, 0x9D, 0x92, 0xFC, 0x49, 0x74, 0x17, 0x79, 0x36, 0x3C, 0xFE}};
+	struct aesKey a;
+	struct cmacKey c;
+	uint8_t buf[16];
+	bool ok = true;
+
+	aesSetKey(&a, fipsKey);
+	for (uint8_t i = 0; i < 16; i++)
+		buf[i] = (uint8_t)(i * 0x11); // 00 11 22 ... FF
+	aesEncrypt(&a, buf);
+	if (memcmp(buf, fipsOut, 16) != 0)
+		ok = false;
+
+	cmacSetKey(&c, key);
+	for (uint8_t t = 0; t < 4; t++)
+	{
+		cmacCompute(&c, NULL, msg, lens[t], buf);
+		if (memcmp(buf, macs[t], 16) != 0)
+		{
+			ok = false;
+#if DUSB >= 1
+			Serial.print(F("cryptoSelfTest:: ERRO CMAC len="));
+			Serial.println(lens[t]);
+#endif
+		}
+	}
+
+	// Um uplink típico: MHDR | FHDR | FPort | 24 bytes de FRMPayload.
+	uint32_t start = ESP.getCycleCount();
+	loraMic(&c, 0, 0x26011234, 1, msg, 32, buf);
+	cryptoBench.micCycles = ESP.getCycleCount() - start;
+	cryptoBench.tested = true;
+	cryptoBench.passed = ok;
+
+#if DUSB >= 1
+	Serial.print(F("cryptoSelfTest:: "));
+	Serial.print(ok ? F("OK") : F("ERRO"));
+	Serial.print(F(", ciclos por MIC="));
+	Serial.println(cryptoBench.micCycles);
+#endif
+	return (ok);
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------
+// Chamado pelo setup(): calcula as tabelas do AES, executa o autoteste e prepara as chaves
+// dos dispositivos de micDevices[].
+// ---------------------------------------------------------------------------------------------------------
+void cryptoSetup()
+{
+#if _CRYPTO_HW == 0
+	aesTables();
+#endif
+#if _CRYPTO_TEST >= 1
+	cryptoSelfTest();
+#endif
+#if _CHECK_MIC >= 1
+	for (uint8_t d = 0; d < MIC_DEVICES; d++)
+	{
+		cmacSetKey(&micState[d].key, micDevices[d].nwkSKey);
+	}
+#endif
+}
+
+#endif // (GATEWAYNODE == 1) || (_CHECK_MIC >= 1)
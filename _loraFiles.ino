@@ -43,15 +43,16 @@
 //}
 //
 // ---------------------------------------------------------------------------------------------------------
-// Leia o arquivo de configuração do gateway.
+// Leia o arquivo de configuração do gateway no formato texto antigo (CONFIGTEXT).
+// Usado só uma vez, para importar a configuração para o formato binário, veja readConfig().
 // ---------------------------------------------------------------------------------------------------------
 // =========================================================================================================
 
-int readConfig(const char *fn, struct espGwayConfig *c)
+int readConfigText(const char *fn, struct espGwayConfig *c)
 {
 
 	Serial.println("");
-	Serial.println(F("Leitura da Configuração:: Iniciando..."));
+	Serial.println(F("Importação da Configuração (texto):: Iniciando..."));
 	Serial.println("");
 
 	if (!SPIFFS.exists(fn))
@@ -77,14 +78,14 @@ int readConfig(const char *fn, struct espGwayConfig *c)
 		{ // SSID WiFi.
 			Serial.print(F("SSID ---------------------------------------------------------------------> "));
 			Serial.println(val);
-			(*c).ssid = val; // "val" contém "ssid", nós não fazemos check.
+			val.toCharArray((*c).ssid, sizeof((*c).ssid)); // "val" contém "ssid", nós não fazemos check.
 		}
 		// Comentar:
 		if (id == "PASS")
 		{ // Senha WiFi.
 			Serial.print(F("SENHA --------------------------------------------------------------------> "));
 			Serial.println(val);
-			(*c).pass = val;
+			val.toCharArray((*c).pass, sizeof((*c).pass));
 		}
 		if (id == "CH")
 		{ // Canal de Frequência.
@@ -197,7 +198,7 @@ int writeGwayCfg(const char *fn)
 {
 
 	gwayConfig.sf = (uint8_t)sf;
-	gwayConfig.ssid = WiFi.SSID();
+	WiFi.SSID().toCharArray(gwayConfig.ssid, sizeof(gwayConfig.ssid));
 	//gwayConfig.pass = WiFi.PASS();  // XXX Devemos encontrar uma maneira de armazenar a senha também.
 	gwayConfig.ch = ifreq;
 	gwayConfig.debug = debug;
@@ -211,117 +212,499 @@ int writeGwayCfg(const char *fn)
 }
 
 // ------------------------------------------------------------------------------------
-// Escreva o anúncio de configuração encontrado na estrutura espGwayConfig para SPIFFS.
+// Nome do arquivo do registro slot (0 ou 1) da configuração fn: fn ".0" ou fn ".1".
 // ------------------------------------------------------------------------------------
-int writeConfig(const char *fn, struct espGwayConfig *c)
+static void cfgName(char *name, const char *fn, uint8_t slot)
 {
+	strcpy(name, fn);
+	strcat(name, (slot == 0 ? ".0" : ".1"));
+}
 
-	if (!SPIFFS.exists(fn))
+// ------------------------------------------------------------------------------------
+// CRC-32 (IEEE 802.3, polinômio refletido 0xEDB88320). Comece com crc = 0xFFFFFFFF e
+// inverta o resultado final.
+// ------------------------------------------------------------------------------------
+uint32_t crc32Update(uint32_t crc, const uint8_t *p, uint32_t len)
+{
+	while (len--)
 	{
-		Serial.print("AVISO:: writeConfig, arquivo não existe, formatando ");
-		SPIFFS.format();
-		// XXX faça todas as declarações iniciais aqui se o config vars precisar ter um valor.
-		Serial.println(fn);
+		crc ^= *p++;
+		for (uint8_t i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
 	}
-	File f = SPIFFS.open(fn, "w");
+	return (crc);
+}
+
+// ------------------------------------------------------------------------------------
+// Leia um registro de configuração. Retorna true se o cabeçalho, a versão, o tamanho das tabelas
+// (_UP_SERVERS, _SCAN_SLOTS) e o CRC conferem; um registro de outra compilação, com as tabelas em
+// outras posições, é recusado.
+// ------------------------------------------------------------------------------------
+static bool readCfgSlot(const char *name, struct cfgHeader *h, struct espGwayConfig *c)
+{
+	uint32_t crc;
+
+	File f = SPIFFS.open(name, "r");
+	if (!f)
+	{
+		return (false);
+	}
+	bool ok = (f.read((uint8_t *)h, sizeof(*h)) == sizeof(*h)) &&
+			  (h->magic == CFG_MAGIC) && (h->version == CFG_VERSION) && (h->len == sizeof(*c)) &&
+			  (h->upServers == _UP_SERVERS) && (h->scanSlots == _SCAN_SLOTS) &&
+			  (f.read((uint8_t *)c, h->len) == h->len) &&
+			  (f.read((uint8_t *)&crc, sizeof(crc)) == sizeof(crc));
+	f.close();
+	if (!ok)
+	{
+		return (false);
+	}
+	uint32_t calc = crc32Update(0xFFFFFFFF, (uint8_t *)h, sizeof(*h));
+	calc = crc32Update(calc, (uint8_t *)c, h->len) ^ 0xFFFFFFFF;
+	return (calc == crc);
+}
+
+// ------------------------------------------------------------------------------------
+// Leia a configuração do gateway: o registro válido mais novo dos dois arquivos e depois
+// os contadores do COUNTERFILE. Sem configuração binária, o CONFIGTEXT antigo é importado.
+// O SPIFFS só é formatado quando nenhum dos arquivos existe; com registros inválidos (CRC,
+// outra CFG_VERSION) os valores iniciais de c são gravados sem formatar, para não perder o
+// journal de uplinks e o COUNTERFILE.
+// O tempo gasto fica em cfgState.loadUs.
+// ------------------------------------------------------------------------------------
+int readConfig(const char *fn, struct espGwayConfig *c)
+{
+	uint32_t start = micros();
+	struct cfgHeader h;
+	struct espGwayConfig tmp;
+	char name[32];
+	bool found = false; // Algum dos arquivos existe.
+
+	cfgState.slot = -1;
+	for (uint8_t slot = 0; slot < 2; slot++)
+	{
+		cfgName(name, fn, slot);
+		if (!SPIFFS.exists(name))
+		{
+			continue;
+		}
+		found = true;
+		tmp = *c; // c só muda se o registro for válido e o mais novo.
+		if (!readCfgSlot(name, &h, &tmp))
+		{
+			cfgState.errors++;
+			Serial.print(F("AVISO:: readConfig, registro inválido: "));
+			Serial.println(name);
+			continue;
+		}
+		if ((cfgState.slot < 0) || ((int32_t)(h.seq - cfgState.seq) > 0))
+		{
+			*c = tmp;
+			cfgState.slot = slot;
+			cfgState.seq = h.seq;
+		}
+	}
+
+	if (cfgState.slot < 0)
+	{
+		if (SPIFFS.exists(CONFIGTEXT))
+		{
+			// Primeiro boot com o formato binário: importe o arquivo texto e grave o registro.
+			readConfigText(CONFIGTEXT, c);
+			writeConfig(fn, c);
+			SPIFFS.remove(CONFIGTEXT);
+		}
+		else if (found)
+		{
+			// Registros inválidos: grave os valores iniciais, sem apagar os outros arquivos.
+			Serial.println(F("AVISO:: readConfig, nenhum registro válido, gravando a configuração padrão."));
+			writeConfig(fn, c);
+		}
+		else
+		{
+			cfgName(name, fn, 0);
+			Serial.print(F("AVISO:: readConfig, nenhuma configuração, formatando "));
+			Serial.println(name);
+			SPIFFS.format();
+			writeConfig(fn, c);
+			return (-1);
+		}
+	}
+
+	readCounters(c);
+	cfgState.loadUs = micros() - start;
+
+	Serial.print(F("Leitura da Configuração:: registro "));
+	Serial.print(cfgState.seq);
+	Serial.print(F(", contadores "));
+	Serial.print(cfgState.cntRecords);
+	Serial.print(F(", "));
+	Serial.print(cfgState.loadUs);
+	Serial.println(F(" uSec."));
+	return (1);
+}
+
+// ------------------------------------------------------------------------------------
+// Escreva o anúncio de configuração encontrado na estrutura espGwayConfig para SPIFFS.
+// O registro vai para o arquivo que não tem o registro atual, com seq + 1, e só passa a
+// ser o atual depois de gravado por completo.
+// ------------------------------------------------------------------------------------
+static int cfgWrite(const char *fn, struct espGwayConfig *c)
+{
+	uint32_t start = micros();
+	struct cfgHeader h;
+	char name[32];
+	uint8_t slot = (cfgState.slot == 0 ? 1 : 0);
+
+	h.magic = CFG_MAGIC;
+	h.version = CFG_VERSION;
+	h.len = sizeof(*c);
+	h.seq = cfgState.seq + 1;
+	h.upServers = _UP_SERVERS;
+	h.scanSlots = _SCAN_SLOTS;
+	h.res = 0;
+	c->cntSeq = cfgState.cntSeq; // Os contadores deste registro estão atualizados até aqui.
+	uint32_t crc = crc32Update(0xFFFFFFFF, (uint8_t *)&h, sizeof(h));
+	crc = crc32Update(crc, (uint8_t *)c, sizeof(*c)) ^ 0xFFFFFFFF;
+
+	cfgName(name, fn, slot);
+	File f = SPIFFS.open(name, "w");
 	if (!f)
 	{
 		Serial.print("ERRO:: Escrita da Configuração, abrir arquivo = ");
-		Serial.print(fn);
+		Serial.print(name);
 		Serial.println();
+		cfgState.errors++;
+		return (-1);
+	}
+	bool ok = (f.write((uint8_t *)&h, sizeof(h)) == sizeof(h)) &&
+			  (f.write((uint8_t *)c, sizeof(*c)) == sizeof(*c)) &&
+			  (f.write((uint8_t *)&crc, sizeof(crc)) == sizeof(crc));
+	f.close();
+	if (!ok)
+	{
+		Serial.println(F("ERRO:: Escrita da Configuração incompleta."));
+		cfgState.errors++;
 		return (-1);
 	}
 
-	f.print("SSID");
-	f.print('=');
-	f.print((*c).ssid);
-	f.print('\n');
-
-	f.print("PASS");
-	f.print('=');
-	f.print((*c).pass);
-	f.print('\n');
-
-	f.print("CH");
-	f.print('=');
-	f.print((*c).ch);
-	f.print('\n');
-
-	f.print("SF");
-	f.print('=');
-	f.print((*c).sf);
-	f.print('\n');
-
-	f.print("FCNT");
-	f.print('=');
-	f.print((*c).fcnt);
-	f.print('\n');
-
-	f.print("DEBUG");
-	f.print('=');
-	f.print((*c).debug);
-	f.print('\n');
-
-	f.print("CAD");
-	f.print('=');
-	f.print((*c).cad);
-	f.print('\n');
-
-	f.print("HOP");
-	f.print('=');
-	f.print((*c).hop);
-	f.print('\n');
-
-	f.print("NODE");
-	f.print('=');
-	f.print((*c).isNode);
-	f.print('\n');
-
-	f.print("BOOTS");
-	f.print('=');
-	f.print((*c).boots);
-	f.print('\n');
-
-	f.print("RESETS");
-	f.print('=');
-	f.print((*c).resets);
-	f.print('\n');
-
-	f.print("WIFIS");
-	f.print('=');
-	f.print((*c).wifis);
-	f.print('\n');
-
-	f.print("VIEWS");
-	f.print('=');
-	f.print((*c).views);
-	f.print('\n');
-
-	f.print("REFR");
-	f.print('=');
-	f.print((*c).refresh);
-	f.print('\n');
-
-	f.print("REENTS");
-	f.print('=');
-	f.print((*c).reents);
-	f.print('\n');
-
-	f.print("NTPETIM");
-	f.print('=');
-	f.print((*c).ntpErrTime);
-	f.print('\n');
-
-	f.print("NTPERR");
-	f.print('=');
-	f.print((*c).ntpErr);
-	f.print('\n');
-
-	f.print("NTPS");
-	f.print('=');
-	f.print((*c).ntps);
-	f.print('\n');
+	cfgState.slot = slot;
+	cfgState.seq = h.seq;
+	cfgState.writes++;
+	cfgState.writeUs = micros() - start;
+	return (1);
+}
 
+// ------------------------------------------------------------------------------------
+// Grave a configuração com cfgWrite(). Chamada pelo loop() (páginas web) e pela tarefa da
+// rede (_NET_TASK), então a gravação e o cfgState ficam dentro de NET_LOCK().
+// ------------------------------------------------------------------------------------
+int writeConfig(const char *fn, struct espGwayConfig *c)
+{
+	NET_LOCK();
+	int ret = cfgWrite(fn, c);
+	NET_UNLOCK();
+	return (ret);
+}
+
+// ------------------------------------------------------------------------------------
+// Leia o COUNTERFILE e aplique o registro de contadores mais novo, se ele for mais novo
+// que os contadores do registro de configuração (c->cntSeq). Um registro incompleto ou
+// com CRC errado (queda de energia durante o acréscimo) faz o arquivo ser compactado.
+// ------------------------------------------------------------------------------------
+void readCounters(struct espGwayConfig *c)
+{
+	struct cntRecord r;
+	struct cntRecord best;
+	bool found = false;
+	bool damaged = false;
+
+	cfgState.cntSeq = c->cntSeq;
+	cfgState.cntRecords = 0;
+
+	File f = SPIFFS.open(COUNTERFILE, "r");
+	if (!f)
+	{
+		return;
+	}
+	damaged = ((f.size() % sizeof(r)) != 0);
+	while (f.read((uint8_t *)&r, sizeof(r)) == sizeof(r))
+	{
+		cfgState.cntRecords++;
+		if ((crc32Update(0xFFFFFFFF, (uint8_t *)&r, sizeof(r) - 4) ^ 0xFFFFFFFF) != r.crc)
+		{
+			damaged = true;
+			continue;
+		}
+		if (!found || ((int32_t)(r.seq - best.seq) > 0))
+		{
+			best = r;
+			found = true;
+		}
+	}
 	f.close();
+
+	if (found && ((int32_t)(best.seq - c->cntSeq) > 0))
+	{
+		c->fcnt = (uint16_t)best.fcnt;
+		c->boots = best.boots;
+		c->wifis = best.wifis;
+		cfgState.cntSeq = best.seq;
+	}
+	if (damaged)
+	{
+		cfgState.errors++;
+		compactCounters();
+	}
+}
+
+// ------------------------------------------------------------------------------------
+// Grave a configuração (com os contadores atuais) e esvazie o COUNTERFILE.
+// Se a energia cair entre as duas etapas, os registros antigos do arquivo têm seq <= cntSeq
+// e são ignorados na próxima leitura.
+// ------------------------------------------------------------------------------------
+void compactCounters()
+{
+	if (writeConfig(CONFIGFILE, &gwayConfig) < 0)
+	{
+		return;
+	}
+	File f = SPIFFS.open(COUNTERFILE, "w");
+	if (f)
+	{
+		f.close();
+	}
+	cfgState.cntRecords = 0;
+}
+
+// ------------------------------------------------------------------------------------
+// Acrescente os contadores fcnt, boots e wifis de gwayConfig ao COUNTERFILE.
+// ------------------------------------------------------------------------------------
+static int cntWrite()
+{
+	struct cntRecord r;
+
+	cfgState.cntSeq++;
+	if (cfgState.cntRecords >= _CNT_LOG_MAX)
+	{
+		compactCounters();
+		return (1);
+	}
+
+	r.seq = cfgState.cntSeq;
+	r.fcnt = gwayConfig.fcnt;
+	r.boots = gwayConfig.boots;
+	r.wifis = gwayConfig.wifis;
+	r.crc = crc32Update(0xFFFFFFFF, (uint8_t *)&r, sizeof(r) - 4) ^ 0xFFFFFFFF;
+
+	File f = SPIFFS.open(COUNTERFILE, "a");
+	if (!f)
+	{
+		cfgState.errors++;
+		return (-1);
+	}
+	if (f.write((uint8_t *)&r, sizeof(r)) != sizeof(r))
+	{
+		f.close();
+		cfgState.errors++;
+		compactCounters(); // Não deixe um registro incompleto no meio do arquivo.
+		return (-1);
+	}
+	f.close();
+	cfgState.cntRecords++;
+	cfgState.cntAppends++;
 	return (1);
 }
+
+// ------------------------------------------------------------------------------------
+// Grave os contadores com cntWrite(), dentro de NET_LOCK() como writeConfig().
+// Use no lugar de writeGwayCfg() quando só esses contadores mudaram.
+// ------------------------------------------------------------------------------------
+int writeCounters()
+{
+	NET_LOCK();
+	int ret = cntWrite();
+	NET_UNLOCK();
+	return (ret);
+}
+
+#if _JOURNAL >= 1
+// =========================================================================================================
+// JOURNAL DE UPLINKS (STORE-AND-FORWARD).
+// =========================================================================================================
+// ---------------------------------------------------------------------------------------------------------
+// Abra o journal de uplinks, ou crie-o com todos os registros vazios. Os registros pendentes
+// de antes da reinicialização são encontrados pelo número de sequência no cabeçalho.
+// ---------------------------------------------------------------------------------------------------------
+int journalInit()
+{
+	struct journalHdr h;
+	bool found = false;
+	uint32_t lo = 0;
+	uint32_t hi = 0;
+
+	journal.ready = false;
+	journal.head = 0;
+	journal.tail = 0;
+
+	File f = SPIFFS.open(JOURNALFILE, "r");
+	if (!f || (f.size() != _JOURNAL_SLOTS * JOURNAL_SLOT))
+	{
+		if (f)
+			f.close();
+		Serial.print(F("journalInit:: Criando "));
+		Serial.println(JOURNALFILE);
+
+		f = SPIFFS.open(JOURNALFILE, "w");
+		if (!f)
+		{
+			Serial.println(F("ERRO:: journalInit, não foi possível criar o arquivo."));
+			return (-1);
+		}
+		uint8_t zero[64] = {0};
+		for (uint32_t i = 0; i < _JOURNAL_SLOTS * JOURNAL_SLOT; i += sizeof(zero))
+		{
+			f.write(zero, min((uint32_t)sizeof(zero), (uint32_t)(_JOURNAL_SLOTS * JOURNAL_SLOT - i)));
+		}
+		f.close();
+		journal.ready = true;
+		return (0);
+	}
+
+	// Os registros válidos são contíguos: o de menor sequência é o tail, o de maior é head - 1.
+	for (int i = 0; i < _JOURNAL_SLOTS; i++)
+	{
+		f.seek(i * JOURNAL_SLOT, SeekSet);
+		if (f.read((uint8_t *)&h, sizeof(h)) != sizeof(h))
+		{
+			break;
+		}
+		if (h.magic != JOURNAL_MAGIC)
+		{
+			continue;
+		}
+		if (!found || ((int32_t)(h.seq - lo) < 0))
+			lo = h.seq;
+		if (!found || ((int32_t)(h.seq - hi) > 0))
+			hi = h.seq;
+		found = true;
+	}
+	f.close();
+
+	if (found)
+	{
+		journal.tail = lo;
+		journal.head = hi + 1;
+	}
+	journal.ready = true;
+
+	Serial.print(F("journalInit:: Registros pendentes: "));
+	Serial.println(journal.head - journal.tail);
+	return (journal.head - journal.tail);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Guarde um datagrama PUSH_DATA que não pôde ser enviado. Com o journal cheio, o registro mais
+// antigo é sobrescrito (e contado em journal.evicted).
+// ---------------------------------------------------------------------------------------------------------
+int journalAdd(uint8_t *buf, int len)
+{
+	struct journalHdr h;
+
+	if (!journal.ready || (len <= 0) || (len > _RXPK_BUDGET))
+	{
+		journal.errors++;
+		return (-1);
+	}
+	File f = SPIFFS.open(JOURNALFILE, "r+");
+	if (!f)
+	{
+		journal.errors++;
+		return (-1);
+	}
+	if ((journal.head - journal.tail) >= _JOURNAL_SLOTS)
+	{
+		journal.tail++; // O registro mais antigo é sobrescrito abaixo.
+		journal.evicted++;
+	}
+
+	h.magic = JOURNAL_MAGIC;
+	h.seq = journal.head;
+	h.len = len;
+	h.res = 0;
+	f.seek((journal.head % _JOURNAL_SLOTS) * JOURNAL_SLOT, SeekSet);
+	if ((f.write((uint8_t *)&h, sizeof(h)) != sizeof(h)) || (f.write(buf, len) != (size_t)len))
+	{
+		f.close();
+		journal.errors++;
+		return (-1);
+	}
+	f.close();
+
+	journal.head++;
+	journal.queued++;
+#if DUSB >= 1
+	if (debug >= 1)
+	{
+		Serial.print(F("journalAdd:: Datagrama guardado, pendentes: "));
+		Serial.println(journal.head - journal.tail);
+	}
+#endif
+	return (len);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Reenvie o registro mais antigo do journal, no máximo um a cada _JOURNAL_RATE milissegundos.
+// Só é chamada pelo loop() com a WLAN conectada e sem lote de rxpk em construção, pois
+// usa o buffer batch.buf para ler o registro.
+//
+// Retorna: o comprimento do datagrama reenviado, 0 se não havia nada a fazer ou < 0 em erro.
+// ---------------------------------------------------------------------------------------------------------
+int journalReplay()
+{
+	struct journalHdr h;
+
+	if (!journal.ready || (journal.head == journal.tail) || (batch.count > 0))
+	{
+		return (0);
+	}
+	if ((millis() - journal.lastReplay) < _JOURNAL_RATE)
+	{
+		return (0);
+	}
+	journal.lastReplay = millis();
+
+	File f = SPIFFS.open(JOURNALFILE, "r+");
+	if (!f)
+	{
+		journal.errors++;
+		return (-1);
+	}
+	uint32_t pos = (journal.tail % _JOURNAL_SLOTS) * JOURNAL_SLOT;
+	f.seek(pos, SeekSet);
+	if ((f.read((uint8_t *)&h, sizeof(h)) != sizeof(h)) || (h.magic != JOURNAL_MAGIC) ||
+		(h.seq != journal.tail) || (h.len > _RXPK_BUDGET) || (f.read(batch.buf, h.len) != h.len))
+	{
+		f.close();
+		journal.tail++; // Registro ilegível: pule-o.
+		journal.errors++;
+		return (-1);
+	}
+
+	if (upSendAll(batch.buf, h.len, UP_FMT_ALL) == 0)
+	{
+		f.close();
+		return (-1); // Tente de novo no próximo intervalo.
+	}
+
+	// Marque o registro como reenviado.
+	h.magic = 0;
+	f.seek(pos, SeekSet);
+	f.write((uint8_t *)&h, sizeof(h));
+	f.close();
+
+	journal.tail++;
+	journal.replayed++;
+	return (h.len);
+}
+#endif
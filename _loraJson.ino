@@ -0,0 +1,530 @@
+// =========================================================================================================
+// =========== LoRaWAN Gateway de Canal único para ESP32/ESP8266 ===========
+// Copyright (c) 2016, 2017 Maarten Westenberg versão para ESP32/ESP8266
+// Versão 5.0.1
+// Data: 15-11-2017
+// Autor: Maarten Westenberg, E-mail: mw12554@hotmail.com
+// Contibuições de Dorijan Morelj e Andreas Spies pelo suporte a OLED.
+//
+// ========== Tradução: AdailSilva, E-mail: adail101@hotmail.com ===========
+//
+// Baseado no trabalho feito por Thomas Telkamp para o gateway Raspberry PI de canal único e muitos outros.
+//
+// Todos os direitos reservados. Este programa e os materiais acompanhantes são disponibilizados
+// sob os termos da licença MIT que acompanha esta distribuição e está disponível em:
+// https://opensource.org/licenses/mit-license.php
+//
+// NENHUMA GARANTIA DE QUALQUER TIPO É FORNECIDA.
+//
+// Os protocolos e especificações usados para este gateway de canal único:
+//
+// 1. Especificação LoRa Versão V1.0 e V1.1 para comunicação Gateway-Node;
+//
+// 2. Protocolo de comunicação Semtech Básico entre o gateway LoRa e a versão 3.0.0 do servidor
+//  https://github.com/Lora-net/packet_forwarder/blob/master/PROTOCOL.TXT.
+//
+// Notas:
+//
+// Este arquivo contém o gerador de JSON (jsonWriter) usado para montar as mensagens rxpk e stat
+// e o leitor (jsonReader) que decodifica o txpk das mensagens PULL_RESP.
+// =========================================================================================================
+
+// ---------------------------------------------------------------------------------------------------------
+// Inicia o writer sobre buf, começando em index (por exemplo, depois do cabeçalho de 12 bytes).
+// ---------------------------------------------------------------------------------------------------------
+void jwInit(struct jsonWriter *w, uint8_t *buf, int size, int index)
+{
+	w->buf = buf;
+	w->size = size;
+	w->index = index;
+	w->overflow = false;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Copia len bytes de s para a saída. Deixa sempre um byte livre para o terminador.
+// ---------------------------------------------------------------------------------------------------------
+void jwRaw(struct jsonWriter *w, const char *s, int len)
+{
+	if (w->overflow || (w->index + len >= w->size))
+	{
+		w->overflow = true;
+		return;
+	}
+	memcpy(w->buf + w->index, s, len);
+	w->index += len;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Escreve um inteiro sem sinal em decimal, com pelo menos digits dígitos (zeros à esquerda).
+// ---------------------------------------------------------------------------------------------------------
+void jwUintPad(struct jsonWriter *w, uint32_t v, uint8_t digits)
+{
+	char tmp[10]; // 4294967295 tem 10 dígitos.
+	uint8_t n = 0;
+	do
+	{
+		tmp[n++] = '0' + (v % 10);
+		v /= 10;
+	} while ((v > 0) || (n < digits));
+
+	if (w->overflow || (w->index + n >= w->size))
+	{
+		w->overflow = true;
+		return;
+	}
+	while (n > 0)
+	{
+		w->buf[w->index++] = tmp[--n];
+	}
+}
+
+void jwUint(struct jsonWriter *w, uint32_t v)
+{
+	jwUintPad(w, v, 1);
+}
+
+void jwInt(struct jsonWriter *w, int32_t v)
+{
+	if (v < 0)
+	{
+		jwLit(w, "-");
+		jwUint(w, (uint32_t)(-(v + 1)) + 1); // Também funciona para INT32_MIN.
+		return;
+	}
+	jwUint(w, (uint32_t)v);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Escreve um número em ponto fixo: v / 10^dec, com exatamente dec casas decimais.
+// Por exemplo jwFixed(w, 916800000, 6) escreve a frequência em MHz "916.800000"
+// sem usar float.
+// ---------------------------------------------------------------------------------------------------------
+void jwFixed(struct jsonWriter *w, int32_t v, uint8_t dec)
+{
+	uint32_t div = 1;
+	for (uint8_t i = 0; i < dec; i++)
+	{
+		div *= 10;
+	}
+	uint32_t a = (v < 0) ? (uint32_t)(-(v + 1)) + 1 : (uint32_t)v;
+	if (v < 0)
+	{
+		jwLit(w, "-");
+	}
+	jwUint(w, a / div);
+	if (dec > 0)
+	{
+		jwLit(w, ".");
+		jwUintPad(w, a % div, dec);
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Escreve uma string entre aspas. Aspas, barras invertidas e caracteres de controle são escapados.
+// ---------------------------------------------------------------------------------------------------------
+void jwStr(struct jsonWriter *w, const char *s)
+{
+	jwLit(w, "\"");
+	for (; (*s != 0) && !w->overflow; s++)
+	{
+		if ((*s == '"') || (*s == '\\'))
+		{
+			jwLit(w, "\\");
+			jwRaw(w, s, 1);
+		}
+		else if ((uint8_t)*s < 0x20)
+		{
+			jwLit(w, " ");
+		}
+		else
+		{
+			jwRaw(w, s, 1);
+		}
+	}
+	jwLit(w, "\"");
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Codifica len bytes em base64, uma única vez, direto no buffer de saída.
+// ---------------------------------------------------------------------------------------------------------
+void jwBase64(struct jsonWriter *w, uint8_t *data, int len)
+{
+	int encodedLen = base64_enc_len(len); // máximo 340 para 255 bytes.
+	if (w->overflow || (w->index + encodedLen >= w->size))
+	{
+		w->overflow = true; // base64_encode() também escreve o terminador.
+		return;
+	}
+	w->index += base64_encode((char *)(w->buf + w->index), (char *)data, len);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Termina a saída com um '\0' (não incluído no comprimento) e retorna o comprimento,
+// ou -1 se algum campo não coube no buffer.
+// ---------------------------------------------------------------------------------------------------------
+int jwEnd(struct jsonWriter *w)
+{
+	if (w->overflow)
+	{
+		return (-1);
+	}
+	w->buf[w->index] = 0;
+	return (w->index);
+}
+
+// =========================================================================================================
+// Leitor de JSON (jsonReader) para o txpk.
+// Todas as funções jr* devolvem false quando o JSON é inválido ou o fim do buffer é alcançado.
+// =========================================================================================================
+
+// ---------------------------------------------------------------------------------------------------------
+// Pula os espaços e devolve o próximo caractere sem consumi-lo (0 no fim do buffer).
+// ---------------------------------------------------------------------------------------------------------
+char jrPeek(struct jsonReader *r)
+{
+	while ((r->p < r->end) && ((*r->p == ' ') || (*r->p == '\t') || (*r->p == '\r') || (*r->p == '\n')))
+	{
+		r->p++;
+	}
+	return ((r->p < r->end) ? *r->p : 0);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Consome o caractere c (depois dos espaços).
+// ---------------------------------------------------------------------------------------------------------
+bool jrExpect(struct jsonReader *r, char c)
+{
+	if (jrPeek(r) != c)
+	{
+		return (false);
+	}
+	r->p++;
+	return (true);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Lê uma string. s e len apontam para o conteúdo entre as aspas, dentro do buffer original;
+// os escapes não são convertidos (as strings do txpk não os usam).
+// ---------------------------------------------------------------------------------------------------------
+bool jrString(struct jsonReader *r, const char **s, int *len)
+{
+	if (!jrExpect(r, '"'))
+	{
+		return (false);
+	}
+	*s = r->p;
+	while (r->p < r->end)
+	{
+		if (*r->p == '"')
+		{
+			*len = r->p - *s;
+			r->p++;
+			return (true);
+		}
+		if (*r->p == '\\')
+		{
+			r->p++; // Pula o caractere escapado.
+		}
+		r->p++;
+	}
+	return (false);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Lê um número sem sinal em ponto fixo com dec casas decimais: "916.8" com dec=6 dá 916800000.
+// Casas decimais além de dec são ignoradas. Com dec=0 lê um inteiro (a parte fracionária é ignorada).
+// ---------------------------------------------------------------------------------------------------------
+bool jrFixed(struct jsonReader *r, uint8_t dec, uint32_t *v)
+{
+	uint64_t x = 0;
+	uint8_t n = 0;
+	char c = jrPeek(r);
+
+	if ((c < '0') || (c > '9'))
+	{
+		return (false);
+	}
+	while ((r->p < r->end) && (*r->p >= '0') && (*r->p <= '9'))
+	{
+		x = x * 10 + (*r->p++ - '0');
+		if (x > 0xFFFFFFFF)
+		{
+			return (false);
+		}
+	}
+	if ((r->p < r->end) && (*r->p == '.'))
+	{
+		r->p++;
+		while ((r->p < r->end) && (*r->p >= '0') && (*r->p <= '9'))
+		{
+			if (n < dec)
+			{
+				x = x * 10 + (*r->p - '0');
+				n++;
+			}
+			r->p++;
+		}
+	}
+	for (; n < dec; n++)
+	{
+		x *= 10;
+	}
+	if (x > 0xFFFFFFFF)
+	{
+		return (false);
+	}
+	*v = (uint32_t)x;
+	return (true);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Lê true ou false.
+// ---------------------------------------------------------------------------------------------------------
+bool jrBool(struct jsonReader *r, bool *v)
+{
+	char c = jrPeek(r);
+	if ((c == 't') && (r->end - r->p >= 4) && (memcmp(r->p, "true", 4) == 0))
+	{
+		r->p += 4;
+		*v = true;
+		return (true);
+	}
+	if ((c == 'f') && (r->end - r->p >= 5) && (memcmp(r->p, "false", 5) == 0))
+	{
+		r->p += 5;
+		*v = false;
+		return (true);
+	}
+	return (false);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Pula um valor que não nos interessa. Objetos e arrays são pulados contando a profundidade.
+// ---------------------------------------------------------------------------------------------------------
+bool jrSkip(struct jsonReader *r)
+{
+	const char *s;
+	int len;
+	int depth = 0;
+
+	do
+	{
+		char c = jrPeek(r);
+		if (c == '"')
+		{
+			if (!jrString(r, &s, &len))
+			{
+				return (false);
+			}
+		}
+		else if ((c == '{') || (c == '['))
+		{
+			depth++;
+			r->p++;
+		}
+		else if ((c == '}') || (c == ']'))
+		{
+			if (depth == 0)
+			{
+				return (false);
+			}
+			depth--;
+			r->p++;
+		}
+		else if ((c == ',') || (c == ':'))
+		{
+			if (depth == 0)
+			{
+				return (false);
+			}
+			r->p++;
+		}
+		else if (c == 0)
+		{
+			return (false);
+		}
+		else
+		{
+			// Número, true, false ou null.
+			while ((r->p < r->end) && (strchr(",:{}[]\" \t\r\n", *r->p) == NULL))
+			{
+				r->p++;
+			}
+		}
+	} while (depth > 0);
+	return (true);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Compara a chave lida (k, len) com o literal s.
+// ---------------------------------------------------------------------------------------------------------
+#define jrKey(k, len, s) (((len) == sizeof(s) - 1) && (memcmp((k), (s), sizeof(s) - 1) == 0))
+
+// ---------------------------------------------------------------------------------------------------------
+// Lê os campos do objeto txpk em uma passada só. O payload é decodificado de base64 direto em
+// payLoad (MAX_PAYLOAD_LENGTH bytes), que é o buffer entregue depois ao rádio.
+//
+// Retorna: o comprimento do payload decodificado, ou -1 se o JSON é inválido, falta um campo
+// obrigatório (tmst ou imme, freq, datr, data) ou algum valor está fora da faixa.
+// ---------------------------------------------------------------------------------------------------------
+int txpkObject(struct jsonReader *r, struct txpkFields *tx, uint8_t *payLoad)
+{
+	const char *k;
+	const char *s;
+	int klen;
+	int len;
+	int payLength = -1;
+	uint32_t v;
+
+	if (!jrExpect(r, '{'))
+	{
+		return (-1);
+	}
+	if (jrExpect(r, '}'))
+	{
+		return (-1); // Objeto vazio.
+	}
+	do
+	{
+		if (!jrString(r, &k, &klen) || !jrExpect(r, ':'))
+		{
+			return (-1);
+		}
+		if (jrKey(k, klen, "tmst"))
+		{
+			if (!jrFixed(r, 0, &tx->tmst))
+				return (-1);
+			tx->found |= TXPK_TMST;
+		}
+		else if (jrKey(k, klen, "imme"))
+		{
+			if (!jrBool(r, &tx->imme))
+				return (-1);
+			tx->found |= TXPK_IMME;
+		}
+		else if (jrKey(k, klen, "freq"))
+		{
+			if (!jrFixed(r, 6, &tx->freq)) // MHz para Hz.
+				return (-1);
+			tx->found |= TXPK_FREQ;
+		}
+		else if (jrKey(k, klen, "datr"))
+		{
+			// "SF7BW125" .. "SF12BW125".
+			if (!jrString(r, &s, &len) || (len < 3) || (s[0] != 'S') || (s[1] != 'F'))
+				return (-1);
+			tx->sf = 0;
+			for (int i = 2; (i < len) && (s[i] >= '0') && (s[i] <= '9') && (tx->sf < 100); i++)
+			{
+				tx->sf = tx->sf * 10 + (s[i] - '0');
+			}
+			if ((tx->sf < 7) || (tx->sf > 12))
+				return (-1);
+			tx->found |= TXPK_DATR;
+		}
+		else if (jrKey(k, klen, "powe"))
+		{
+			if (!jrFixed(r, 0, &v) || (v > 30))
+				return (-1);
+			tx->powe = v;
+			tx->found |= TXPK_POWE;
+		}
+		else if (jrKey(k, klen, "ipol"))
+		{
+			if (!jrBool(r, &tx->ipol))
+				return (-1);
+			tx->found |= TXPK_IPOL;
+		}
+		else if (jrKey(k, klen, "size"))
+		{
+			if (!jrFixed(r, 0, &v) || (v > MAX_PAYLOAD_LENGTH))
+				return (-1);
+			tx->size = v;
+			tx->found |= TXPK_SIZE;
+		}
+		else if (jrKey(k, klen, "data"))
+		{
+			// Verifique o tamanho antes de decodificar: o payload não pode passar de MAX_PAYLOAD_LENGTH.
+			if (!jrString(r, &s, &len) || (len == 0) || (len > base64_enc_len(MAX_PAYLOAD_LENGTH)))
+				return (-1);
+			payLength = base64_dec_len((char *)s, len);
+			if (payLength > MAX_PAYLOAD_LENGTH)
+				return (-1);
+			// O base64_decode() escreve um '\0' depois do último byte, que com um payload de
+			// MAX_PAYLOAD_LENGTH bytes cairia fora de payLoad. Os grupos de 4 caracteres vão direto
+			// para payLoad, menos o último, que passa por tmp.
+			int head = ((len - 1) / 4) * 4;
+			char tmp[4];
+			payLength = base64_decode((char *)payLoad, (char *)s, head);
+			int n = base64_decode(tmp, (char *)s + head, len - head);
+			memcpy(payLoad + payLength, tmp, n);
+			payLength += n;
+			tx->found |= TXPK_DATA;
+		}
+		else if (!jrSkip(r))
+		{
+			return (-1);
+		}
+	} while (jrExpect(r, ','));
+
+	if (!jrExpect(r, '}'))
+	{
+		return (-1);
+	}
+	if ((!(tx->found & TXPK_TMST) && !tx->imme) || !(tx->found & TXPK_FREQ) ||
+		!(tx->found & TXPK_DATR) || !(tx->found & TXPK_DATA))
+	{
+		return (-1);
+	}
+	return (payLength);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Decodifica a mensagem {"txpk":{...}} de um PULL_RESP, sem alocação e sem copiar o JSON.
+//
+// Parâmetros:
+// buf, len: O JSON (depois do cabeçalho de 4 bytes). Não precisa terminar com '\0'.
+// tx: Os campos decodificados.
+// payLoad: Buffer de MAX_PAYLOAD_LENGTH bytes que recebe o payload decodificado.
+// Retorna: o comprimento do payload, ou -1 em erro.
+// ---------------------------------------------------------------------------------------------------------
+int txpkParse(const uint8_t *buf, int len, struct txpkFields *tx, uint8_t *payLoad)
+{
+	struct jsonReader r;
+	const char *k;
+	int klen;
+	int payLength = -1;
+
+	r.p = (const char *)buf;
+	r.end = (const char *)buf + len;
+	memset(tx, 0, sizeof(struct txpkFields));
+
+	if (!jrExpect(&r, '{'))
+	{
+		return (-1);
+	}
+	do
+	{
+		if (!jrString(&r, &k, &klen) || !jrExpect(&r, ':'))
+		{
+			return (-1);
+		}
+		if (jrKey(k, klen, "txpk") && (payLength < 0))
+		{
+			if ((payLength = txpkObject(&r, tx, payLoad)) < 0)
+			{
+				return (-1);
+			}
+		}
+		else if (!jrSkip(&r))
+		{
+			return (-1);
+		}
+	} while (jrExpect(&r, ','));
+
+	if (!jrExpect(&r, '}'))
+	{
+		return (-1);
+	}
+	return (payLength);
+}
@@ -148,6 +148,7 @@ uint8_t readRegister(uint8_t addr)
 #endif
 
 	SPI.beginTransaction(readSettings);
+	spiTrans++;
 
 	digitalWrite(pins.ss, LOW); // Selecione o receptor.
 	SPI.transfer(addr & 0x7F);
@@ -162,6 +163,57 @@ uint8_t readRegister(uint8_t addr)
 	return ((uint8_t)res);
 }
 
+// ---------------------------------------------------------------------------------------------------------
+// Cache de registradores.
+// Somente registradores de configuração, que o chip não altera sozinho, podem ser guardados
+// no cache. Para esses writeRegister() compara com a cópia-sombra e pula a escrita igual.
+// ---------------------------------------------------------------------------------------------------------
+bool regCacheable(uint8_t addr)
+{
+	switch (addr)
+	{
+	case REG_FRF_MSB:
+	case REG_FRF_MID:
+	case REG_FRF_LSB:
+	case REG_PAC:
+	case REG_PARAMP:
+	case REG_LNA:
+	case REG_IRQ_FLAGS_MASK:
+	case REG_MODEM_CONFIG1:
+	case REG_MODEM_CONFIG2:
+	case REG_SYMB_TIMEOUT_LSB:
+	case REG_PAYLOAD_LENGTH:
+	case REG_MAX_PAYLOAD_LENGTH:
+	case REG_HOP_PERIOD:
+	case REG_MODEM_CONFIG3:
+	case REG_INVERTIQ:
+	case REG_SYNC_WORD:
+	case REG_DIO_MAPPING_1:
+	case REG_DIO_MAPPING_2:
+	case REG_PADAC_SX1276:
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+// Retorna true quando o registrador addr já contém value segundo a cópia-sombra.
+bool regCacheHit(uint8_t addr, uint8_t value)
+{
+	return ((regCacheValid[addr >> 3] & (1 << (addr & 0x07))) && (regCache[addr] == value));
+}
+
+// Invalide um registrador ou, com addr == 0xFF, o cache inteiro (após reset do chip).
+void regCacheInvalidate(uint8_t addr)
+{
+	if (addr == 0xFF)
+	{
+		memset(regCacheValid, 0, sizeof(regCacheValid));
+		return;
+	}
+	regCacheValid[addr >> 3] &= ~(1 << (addr & 0x07));
+}
+
 // ---------------------------------------------------------------------------------------------------------
 // Escreve valor para um registrador com endereço addr.
 // Função escreve um byte de cada vez.
@@ -177,6 +229,13 @@ SPISettings writeSettings(SPISPEED, MSBFIRST, SPI_MODE0);
 
 void writeRegister(uint8_t addr, uint8_t value)
 {
+	addr &= 0x7F;
+	if (regCacheHit(addr, value))
+	{
+		spiWriteSkip++;
+		return;
+	}
+
 	//noInterrupts(); // XXX
 #if MUTEX_SPO == 1
 	if (!GetMutex(&mutexSPI))
@@ -199,6 +258,7 @@ void writeRegister(uint8_t addr, uint8_t value)
 #endif
 
 	SPI.beginTransaction(writeSettings);
+	spiTrans++;
 	digitalWrite(pins.ss, LOW); // Selecione o receptor.
 
 	SPI.transfer((addr | 0x80) & 0xFF);
@@ -209,6 +269,13 @@ void writeRegister(uint8_t addr, uint8_t value)
 
 	SPI.endTransaction();
 
+	// Atualize a cópia-sombra somente depois que o valor foi realmente escrito.
+	if (regCacheable(addr))
+	{
+		regCache[addr] = value;
+		regCacheValid[addr >> 3] |= (1 << (addr & 0x07));
+	}
+
 #if MUTEX_SPO == 1
 	ReleaseMutex(&mutexSPI);
 #endif
@@ -250,6 +317,7 @@ void writeBuffer(uint8_t addr, uint8_t *buf, uint8_t len)
 #endif
 
 	SPI.beginTransaction(writeSettings);
+	spiTrans++;
 	digitalWrite(pins.ss, LOW); // Selecione o receptor.
 
 	SPI.transfer((addr | 0x80) & 0xFF); // Escreva o endereço do buffer.
@@ -267,6 +335,60 @@ void writeBuffer(uint8_t addr, uint8_t *buf, uint8_t len)
 	//interrupts();
 }
 
+// ---------------------------------------------------------------------------------------------------------
+// Lê um buffer de um registrador com endereço addr, numa única transação SPI (burst).
+// Enquanto o CS fica baixo o SX1276 entrega um byte a cada ciclo de 8 clocks. Para o REG_FIFO o
+// ponteiro REG_FIFO_ADDR_PTR é incrementado internamente, então o FIFO inteiro pode ser lido
+// com apenas um endereço, em vez de uma transação completa por byte.
+//
+// Parâmetros:
+//
+// addr: Endereço SPI para ler.
+// buf: Buffer onde os bytes lidos são guardados.
+// len: Número de bytes para ler.
+// Retorna: <void>.
+// ---------------------------------------------------------------------------------------------------------
+
+void readBuffer(uint8_t addr, uint8_t *buf, uint8_t len)
+{
+#if MUTEX_SPI == 1
+	if (!GetMutex(&mutexSPI))
+	{
+#if DUSB >= 1
+		if (debug >= 0)
+		{
+			gwayConfig.reents++;
+			Serial.print(F("Leitura do buffer :: leia reentrada."));
+			printTime();
+			Serial.println();
+			delayMicroseconds(50);
+			initLoraModem();
+			if (debug >= 2)
+				Serial.flush();
+		}
+#endif
+		return;
+	}
+#endif
+
+	SPI.beginTransaction(readSettings);
+	spiTrans++;
+	digitalWrite(pins.ss, LOW); // Selecione o receptor.
+
+	SPI.transfer(addr & 0x7F); // Escreva o endereço do buffer.
+	for (uint8_t i = 0; i < len; i++)
+	{
+		buf[i] = (uint8_t)SPI.transfer(0x00);
+	}
+	digitalWrite(pins.ss, HIGH); // Desmarque o receptor.
+
+	SPI.endTransaction();
+
+#if MUTEX_SPI == 1
+	ReleaseMutex(&mutexSPI);
+#endif
+}
+
 // ---------------------------------------------------------------------------------------------------------
 // setRate está definindo taxa e fator de espalhamento e CRC etc, para transmissão.
 // Modem Config 1 (MC1) == 0x72 para sx1276
@@ -346,6 +468,13 @@ void setFreq(uint32_t freq)
 {
 	// Definir frequência.
 	uint64_t frf = ((uint64_t)freq << 19) / 32000000;
+
+	// O SX1276 só aplica uma nova frequência quando o FrfLsb é escrito. Se MSB ou MID
+	// mudaram, o LSB tem que ser escrito mesmo que o cache diga que ele é igual.
+	if (!regCacheHit(REG_FRF_MSB, (uint8_t)(frf >> 16)) || !regCacheHit(REG_FRF_MID, (uint8_t)(frf >> 8)))
+	{
+		regCacheInvalidate(REG_FRF_LSB);
+	}
 	writeRegister(REG_FRF_MSB, (uint8_t)(frf >> 16));
 	writeRegister(REG_FRF_MID, (uint8_t)(frf >> 8));
 	writeRegister(REG_FRF_LSB, (uint8_t)(frf >> 0));
@@ -405,33 +534,151 @@ void opmode(uint8_t mode)
 }
 
 // ---------------------------------------------------------------------------------------------------------
-// Pule para a próxima frequência conforme definido por NUM_HOPS.
-// Esta função só deve ser usada para operação do receptor. A atual frequência
-// do receptor é determinada pelo índice ifreq da seguinte forma: freqs [ifreq].
+// Preenche gwayConfig.scan[] com a tabela inicial do agendador de varredura: uma posição para cada
+// canal de freqs[] (no AU915, os 8 canais de 125 kHz da sub-banda), todos os SF e _SCAN_DWELL mSec.
+// Chamada antes de readConfig(), que a substitui pela tabela gravada.
 // ---------------------------------------------------------------------------------------------------------
-void hop()
+void scanDefaults()
 {
-	// Se já estamos em uma função hop, não prossiga.
-	if (!inHop)
+	uint8_t nf = sizeof(freqs) / sizeof(int); // Número de elementos na matriz.
+
+	memset(gwayConfig.scan, 0, sizeof(gwayConfig.scan));
+	for (uint8_t i = 0; (i < _SCAN_SLOTS) && (i < nf); i++)
 	{
+		gwayConfig.scan[i].ch = i;
+		gwayConfig.scan[i].sfMask = SCAN_SF_ALL;
+		gwayConfig.scan[i].dwell = _SCAN_DWELL;
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Uma posição da tabela é usada se tem permanência, um canal de freqs[] e ao menos um SF.
+// ---------------------------------------------------------------------------------------------------------
+bool scanValid(uint8_t p)
+{
+	struct scanSlot *s = &scan.slot[p];
+	return ((s->dwell > 0) && (s->ch < sizeof(freqs) / sizeof(int)) && ((s->sfMask & SCAN_SF_ALL) != 0));
+}
 
-		inHop = true;
-		opmode(OPMODE_STANDBY);
-		ifreq = (ifreq + 1) % NUM_HOPS;
-		setFreq(freqs[ifreq]);
-		hopTime = micros(); // registrar o momento do HOP.
-		opmode(OPMODE_CAD);
-		inHop = false;
+// ---------------------------------------------------------------------------------------------------------
+// Copia a tabela gwayConfig.scan[] para scan.slot[] e zera as estatísticas. A próxima
+// radioService() com o HOP ligado começa na primeira posição válida.
+// ---------------------------------------------------------------------------------------------------------
+void scanLoad()
+{
+	memset(&scan, 0, sizeof(scan));
+	for (uint8_t i = 0; i < _SCAN_SLOTS; i++)
+	{
+		scan.slot[i].ch = gwayConfig.scan[i].ch;
+		scan.slot[i].sfMask = gwayConfig.scan[i].sfMask & SCAN_SF_ALL;
+		scan.slot[i].dwell = gwayConfig.scan[i].dwell;
 	}
-#if DUSB >= 2
+	scan.pos = _SCAN_SLOTS - 1;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Registra um CAD detect ou um quadro recebido na posição atual do agendador. Só o rádio 0
+// percorre a tabela; os eventos dos outros rádios (_RADIOS > 1) não contam.
+// ---------------------------------------------------------------------------------------------------------
+void scanHit(bool packet)
+{
+	if (!scan.active || (radioActive != 0))
+		return;
+	if (packet)
+		scan.slot[scan.pos].packets++;
 	else
+		scan.slot[scan.pos].detects++;
+	scan.hits++;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Fim de uma visita à posição p: atualiza a atividade (média exponencial 1/8 das visitas com detect
+// ou quadro) e, com _scanAdapt, a permanência: de dwell/2 sem atividade a 2 * dwell com atividade em
+// toda visita, sendo dwell o valor configurado, limitada por _SCAN_DWELL_MIN e _SCAN_DWELL_MAX.
+// ---------------------------------------------------------------------------------------------------------
+void scanAdapt(uint8_t p)
+{
+	struct scanSlot *s = &scan.slot[p];
+	int32_t a = (scan.hits > 0 ? 256 : 0);
+	s->activity += (a - (int32_t)s->activity) / 8;
+
+	uint32_t base = gwayConfig.scan[p].dwell;
+	uint32_t d = base;
+	if (_scanAdapt)
 	{
-		if (debug >= 3)
+		d = base / 2 + (3 * base * s->activity) / 512;
+		if (d < _SCAN_DWELL_MIN)
+			d = _SCAN_DWELL_MIN;
+		if (d > _SCAN_DWELL_MAX)
+			d = _SCAN_DWELL_MAX;
+	}
+	if (base > 0)
+		s->dwell = d;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// scanNext()
+// Troca o receptor para a próxima posição válida da tabela do agendador de varredura. Substitui o
+// antigo hop(): a permanência em cada canal não depende mais do loop(), e sim do instante de fim
+// (deadline) de cada visita, verificado pela radioService(). O tempo na posição que termina é somado
+// à sua ocupação; uma troca atrasada mais que _SCAN_LATE, sem quadro em curso, conta como perdida.
+// Esta função só deve ser usada para operação do receptor.
+// ---------------------------------------------------------------------------------------------------------
+void scanNext(uint32_t now)
+{
+	if (scan.active)
+	{
+		struct scanSlot *s = &scan.slot[scan.pos];
+		int32_t late = (int32_t)(now - scan.deadline);
+		s->occupancy += now - scan.start;
+		if (!scan.held)
 		{
-			Serial.println(F("Hop:: tentar re-entrada."));
+			if (late > _SCAN_LATE)
+				s->missed++;
+			if ((late > 0) && ((uint32_t)late > scan.lateMax))
+				scan.lateMax = late;
 		}
+		scanAdapt(scan.pos);
+	}
+
+	uint8_t p = scan.pos;
+	for (uint8_t i = 0; i < _SCAN_SLOTS; i++)
+	{
+		p = (p + 1) % _SCAN_SLOTS;
+		if (scanValid(p))
+			break;
+	}
+	if (!scanValid(p))
+	{
+		scan.active = false; // Tabela vazia: o receptor fica no canal atual.
+		return;
+	}
+	if (scan.active && (p <= scan.pos))
+		scan.cycles++;
+
+	struct scanSlot *s = &scan.slot[p];
+	scan.pos = p;
+	scan.active = true;
+	scan.held = false;
+	scan.hits = 0;
+	scan.start = now;
+	scan.deadline = now + (uint32_t)s->dwell * 1000;
+	s->visits++;
+	TRACE(TR_SCAN_SLOT, p, s->ch);
+
+	ifreq = s->ch;
+	freq = freqs[ifreq];
+	if (_cad)
+	{
+		_state = S_SCAN;
+		cadScanner(); // Define a frequência e o primeiro SF da posição.
+		writeRegister(REG_IRQ_FLAGS, 0xFF);
+	}
+	else
+	{
+		_state = S_RX;
+		rxLoraModem();
 	}
-#endif
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -443,6 +690,9 @@ void hop()
 // ---------------------------------------------------------------------------------------------------------
 uint8_t receivePkt(uint8_t *payload)
 {
+	PROF_BEGIN(PROF_RECEIVE);
+	uint32_t rxStart = micros();
+	uint32_t rxSpi = spiTrans;
 	uint8_t irqflags = readRegister(REG_IRQ_FLAGS); // 0x12; bandeiras lidas de volta.
 
 	cp_nb_rx_rcv++; // Receber contador de estatísticas.
@@ -450,11 +700,12 @@ uint8_t receivePkt(uint8_t *payload)
 	// Verifique se há payload IRQ_LORA_CRCERR_MASK = conjunto 0x20.
 	if ((irqflags & IRQ_LORA_CRCERR_MASK) == IRQ_LORA_CRCERR_MASK)
 	{
-#if DUSB >= 2
+#if (DUSB >= 2) && (_TRACE == 0)
 		Serial.println(F("CRC"));
 #endif
 		// Redefinir o sinalizador CRC 0x20.
 		writeRegister(REG_IRQ_FLAGS, (uint8_t)(IRQ_LORA_CRCERR_MASK || IRQ_LORA_RXDONE_MASK)); // 0x12; limpar CRC (== 0x20) bandeira.
+		PROF_END(PROF_RECEIVE);
 		return 0;
 	}
 	else
@@ -463,29 +714,8 @@ uint8_t receivePkt(uint8_t *payload)
 
 		uint8_t currentAddr = readRegister(REG_FIFO_RX_CURRENT_ADDR); // 0x10.
 		uint8_t receivedCount = readRegister(REG_RX_NB_BYTES); // 0x13; Quantos bytes foram lidos.
-#if DUSB >= 2
-		if ((debug >= 0) && (currentAddr > 64))
-		{
-			Serial.print(F("receivePkt:: Rx addr>64"));
-			Serial.println(currentAddr);
-			if (debug >= 2)
-				Serial.flush();
-		}
-#endif
-		writeRegister(REG_FIFO_ADDR_PTR, (uint8_t)currentAddr); // 0x0D
-
-		if (receivedCount > 64)
-		{
-#if DUSB >= 2
-			Serial.print(F("receivePkt:: Contagem recebida = "));
-			Serial.println(receivedCount);
-			if (debug >= 2)
-				Serial.flush();
-#endif
-			receivedCount = 64;
-		}
-#if DUSB >= 2
-		else if (debug >= 2)
+#if (DUSB >= 2) && (_TRACE == 0)
+		if (debug >= 2)
 		{
 			Serial.print(F("ReceivePkt:: addr = "));
 			Serial.print(currentAddr);
@@ -495,12 +725,17 @@ uint8_t receivePkt(uint8_t *payload)
 				Serial.flush();
 		}
 #endif
-		for (int i = 0; i < receivedCount; i++)
-		{
-			payload[i] = readRegister(REG_FIFO); // 0x00
-		}
+		writeRegister(REG_FIFO_ADDR_PTR, (uint8_t)currentAddr); // 0x0D
+
+		// Leia o pacote inteiro em uma única transação SPI. O ponteiro do FIFO dá a volta
+		// em 0xFF, então um quadro de 255 bytes cabe sempre, seja qual for o currentAddr.
+		readBuffer(REG_FIFO, payload, receivedCount); // 0x00
 
 		writeRegister(REG_IRQ_FLAGS, (uint8_t)0xFF); // Redefinir todas as interrupções.
+
+		rxSpiTrans = spiTrans - rxSpi;
+		rxSpiMicros = micros() - rxStart;
+		PROF_END(PROF_RECEIVE);
 		return (receivedCount);
 	}
 
@@ -517,7 +752,7 @@ uint8_t receivePkt(uint8_t *payload)
 bool sendPkt(uint8_t *payLoad, uint8_t payLength)
 {
 #if DUSB >= 2
-	if (payLength >= 128)
+	if (payLength > MAX_PAYLOAD_LENGTH)
 	{
 		if (debug >= 1)
 		{
@@ -538,6 +773,27 @@ bool sendPkt(uint8_t *payLoad, uint8_t payLength)
 	return true;
 }
 
+// ---------------------------------------------------------------------------------------------------------
+// Calcula o tempo no ar (uSec) de um quadro LoRa de len bytes no SF sf, com BW125, CR 4/5,
+// preâmbulo de 8 símbolos, cabeçalho explícito e sem CRC (como nos downlinks).
+// Veja a seção 4.1.1.7 do datasheet do SX1276.
+// ---------------------------------------------------------------------------------------------------------
+uint32_t airTime(uint8_t sf, uint8_t len)
+{
+	uint32_t tsym = (1UL << sf) * 8; // 2^SF / 125 kHz, em uSec.
+	uint8_t de = ((sf == SF11) || (sf == SF12)) ? 1 : 0; // LowDataRateOptimize.
+
+	int32_t num = 8 * (int32_t)len - 4 * sf + 28; // CRC=0, IH=0.
+	int32_t den = 4 * (sf - 2 * de);
+	int32_t nsym = 8;
+	if (num > 0)
+	{
+		nsym += ((num + den - 1) / den) * 5; // ceil() * (CR + 4).
+	}
+	// Preâmbulo de 8 + 4.25 símbolos.
+	return ((tsym * 49) / 4 + nsym * tsym);
+}
+
 // ---------------------------------------------------------------------------------------------------------
 // loraWait()
 // Esta função implementa o protocolo de espera necessário para transmissões downstream.
@@ -560,12 +816,12 @@ void loraWait(uint32_t tmst)
 {
 	uint32_t startTime = micros(); // Início da função loraWait.
 	tmst += txDelay;
-	uint32_t waitTime = tmst - micros();
+	int32_t waitTime = (int32_t)(tmst - micros()); // Negativo se já estamos atrasados.
 
 	while (waitTime > 16000)
 	{
 		delay(15); // ms atraso incluindo rendimento, ligeiramente mais curto.
-		waitTime = tmst - micros();
+		waitTime = (int32_t)(tmst - micros());
 	}
 	if (waitTime > 0)
 		delayMicroseconds(waitTime);
@@ -614,14 +870,16 @@ void loraWait(uint32_t tmst)
 // 12. Escreva REG LoRa Fifo Addr Ptr.
 // 13. Escreva REG LoRa Payload Length.
 // 14. Buffer de gravação (byte por byte).
-// 15. Espere até o momento certo para transmitir chegou.
-// 16. opmode TX.
+// 15. Guarde o valor de REG_OPMODE que inicia o TX.
+//
+// A transmissão não começa aqui: txArm() agenda txTrigger() para o instante do tmst,
+// enquanto o loop() continua livre.
 // ---------------------------------------------------------------------------------------------------------
 
-void txLoraModem(uint8_t *payLoad, uint8_t payLength, uint32_t tmst, uint8_t sfTx,
+void txLoraModem(uint8_t *payLoad, uint8_t payLength, uint8_t sfTx,
 				 uint8_t powe, uint32_t freq, uint8_t crc, uint8_t iiq)
 {
-#if DUSB >= 2
+#if (DUSB >= 2) && (_TRACE == 0)
 	if (debug >= 1)
 	{
 		// Certifique-se de que todo o material serial seja feito antes de continuar.
@@ -640,6 +898,7 @@ void txLoraModem(uint8_t *payLoad, uint8_t payLength, uint32_t tmst, uint8_t sfT
 	}
 #endif
 	_state = S_TX;
+	TRACE(TR_TX_LOAD, 0, payLength);
 
 	// 1. Selecione o modem LoRa no modo de espera.
 	//opmode(OPMODE_LORA);  // Ajusta o registrador 0x01 para 0x80.
@@ -680,15 +939,9 @@ void txLoraModem(uint8_t *payLoad, uint8_t payLength, uint32_t tmst, uint8_t sfT
 	// 11, 12, 13, 14. Escreva o buffer para o FiFo.
 	sendPkt(payLoad, payLength);
 
-	// 15. Aguarde o atraso extra. O timer de delayMicroseconds é preciso até 16383 uSec.
-	loraWait(tmst);
-
 	// Definir o endereço base do buffer de transmissão no FIFO.
 	writeRegister(REG_FIFO_ADDR_PTR, (uint8_t)readRegister(REG_FIFO_TX_BASE_AD)); // Defina 0x0D para 0x0F (contém 0x80);
 
-	// Para TX, temos que definir o valor de PAYLOAD_LENGTH.
-	writeRegister(REG_PAYLOAD_LENGTH, (uint8_t)payLength); // Defina 0x22, max 0x40 == 64Byte long.
-
 	//For TX we have to set the MAX_PAYLOAD_LENGTH
 	writeRegister(REG_MAX_PAYLOAD_LENGTH, (uint8_t)MAX_PAYLOAD_LENGTH); // Defina 0x22, max 0x40 == 64Byte long.
 
@@ -697,11 +950,129 @@ void txLoraModem(uint8_t *payLoad, uint8_t payLength, uint32_t tmst, uint8_t sfT
 	writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t)0x00); // Limpe a máscara.
 	writeRegister(REG_IRQ_FLAGS, (uint8_t)IRQ_LORA_TXDONE_MASK); // Defina 0x12 para 0x08.
 
-	// 16. Inicie a transmissão real do FiFo.
-	opmode(OPMODE_TX); // Defina 0x01 como 0x03 (o valor real se torna 0x83).
+	// 15. O valor que inicia a transmissão real do FiFo (o valor real se torna 0x83). Assim o
+	// txTrigger() precisa de uma única escrita SPI, sem ler o REG_OPMODE antes.
+	txTime.opmode = (uint8_t)((readRegister(REG_OPMODE) & ~OPMODE_MASK) | OPMODE_TX);
 
 } // txLoraModem
 
+// ---------------------------------------------------------------------------------------------------------
+// txTrigger()
+// Inicia a transmissão preparada por txLoraModem(). Chamado pelo temporizador _TX_SPIN uSec
+// antes de txTime.target; o restante é esperado ativamente para o início ser preciso.
+// Roda na tarefa do esp_timer: só faz a escrita de OPMODE_TX (em S_TX a tarefa do rádio não usa
+// o SPI), guarda o instante e acorda a tarefa do rádio, que chama txFired(). O _state e as
+// estatísticas são escritos somente pela tarefa do rádio.
+// ---------------------------------------------------------------------------------------------------------
+void txTrigger(void *)
+{
+	while ((int32_t)(txTime.target - micros()) > 0)
+		;
+	writeRegister(REG_OPMODE, txTime.opmode); // Defina 0x01 como 0x83.
+	txTime.start = micros();
+	txTime.fired = true;
+#if _RADIO_TASK >= 1
+	if (radioTask != NULL)
+	{
+		xTaskNotifyGive(radioTask);
+	}
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Chamado pela radioService() depois do txTrigger(), antes de qualquer evento do rádio (o TXDONE
+// chega só depois do tempo no ar). Registra o jitter (real - agendado) e passa para S_TXDONE,
+// onde o TXDONE reinicia o receptor.
+// ---------------------------------------------------------------------------------------------------------
+void txFired()
+{
+	txTime.fired = false;
+	int32_t jit = (int32_t)(txTime.start - txTime.target);
+	_state = S_TXDONE;
+
+	txTime.last = jit;
+	if ((txTime.count == 0) || (jit < txTime.min))
+		txTime.min = jit;
+	if ((txTime.count == 0) || (jit > txTime.max))
+		txTime.max = jit;
+	txTime.sum += jit;
+	txTime.count++;
+	METRIC(MET_DOWN_ERR, (jit < 0 ? -jit : jit));
+}
+
+#if _TX_CAL >= 1
+// ---------------------------------------------------------------------------------------------------------
+// Chamado no TXDONE. irqTime - txTime.start é o tempo desde a escrita de OPMODE_TX até o fim do
+// quadro; descontado o tempo no ar de LoraDown, sobra o atraso do rádio para começar a transmitir.
+// txTime.lag é a mediana das últimas _TX_CAL_N medidas e é descontada do instante do próximo TX por
+// txArm(). Até haver _TX_CAL_N medidas ele fica em zero: uma primeira interrupção atrasada não vira
+// o atraso de todos os TX, e mais da metade das medidas precisa mudar para mover a mediana.
+// ---------------------------------------------------------------------------------------------------------
+void txCalibrate()
+{
+	int32_t lag = (int32_t)(irqTime - txTime.start) - (int32_t)LoraDown.airtime;
+	if ((lag < -_TX_CAL_MAX) || (lag > _TX_CAL_MAX))
+	{
+		return; // Interrupção muito atrasada ou tempo no ar incorreto.
+	}
+	txTime.calRing[txTime.calCount % _TX_CAL_N] = lag;
+	txTime.calCount++;
+	if (txTime.calCount < _TX_CAL_N)
+	{
+		return;
+	}
+
+	// Mediana: ordenação por inserção de uma cópia do anel.
+	int32_t s[_TX_CAL_N];
+	for (uint8_t i = 0; i < _TX_CAL_N; i++)
+	{
+		uint8_t j = i;
+		for (; (j > 0) && (s[j - 1] > txTime.calRing[i]); j--)
+			s[j] = s[j - 1];
+		s[j] = txTime.calRing[i];
+	}
+	txTime.lag = s[_TX_CAL_N / 2];
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------
+// txArm()
+// Agenda o início do TX preparado por txLoraModem() para tmst + txDelay - txTime.lag e retorna
+// imediatamente, para que o loop() continue atendendo UDP, web e rádio até lá.
+// No ESP32 usamos um esp_timer (executado na tarefa do esp_timer, onde o SPI é permitido).
+// Sem ele, voltamos à espera ativa de loraWait().
+// ---------------------------------------------------------------------------------------------------------
+#ifdef ESP32BUILD
+esp_timer_handle_t txTimer = NULL;
+#endif
+
+void txArm(uint32_t tmst)
+{
+	tmst -= txTime.lag; // Atraso do rádio medido no TXDONE (_TX_CAL), zero sem calibração.
+	txTime.target = tmst + txDelay;
+#ifdef ESP32BUILD
+	if (txTimer == NULL)
+	{
+		esp_timer_create_args_t args;
+		args.callback = &txTrigger;
+		args.arg = NULL;
+		args.dispatch_method = ESP_TIMER_TASK;
+		args.name = "loraTx";
+		esp_timer_create(&args, &txTimer);
+	}
+	int32_t w = (int32_t)(txTime.target - micros()) - _TX_SPIN;
+	if (w < 1)
+	{
+		w = 1; // Já estamos em cima da hora: dispare assim que possível.
+	}
+	esp_timer_start_once(txTimer, (uint64_t)w);
+#else
+	// Aguarde o atraso extra. O timer de delayMicroseconds é preciso até 16383 uSec.
+	loraWait(tmst);
+	txTrigger(NULL);
+#endif
+}
+
 // ---------------------------------------------------------------------------------------------------------
 // Configure o receptor LoRa no transceptor conectado.
 // - Determine o tipo de transceptor correto (sx1272 / RFM92 ou sx1276 / RFM95).
@@ -739,7 +1110,8 @@ void rxLoraModem()
 	writeRegister(REG_INVERTIQ, (uint8_t)0x27); // 0x33, 0x27; para redefinir a partir de TX.
 
 	// O tamanho máximo da carga depende do buffer de 256 bytes.
-  // Na inicialização, o TX começa em 0x80 e o RX em 0x00. RX, portanto, maximizado em 128 bytes.
+  // Na inicialização, o TX começa em 0x80 e o RX em 0x00. Como o rádio é half-duplex o RX pode
+  // passar de 0x80 e usar o FIFO inteiro, até MAX_PAYLOAD_LENGTH (255) bytes.
   // Para o TX, temos que definir o PAYLOAD_LENGTH.
 	//writeRegister(REG_PAYLOAD_LENGTH, (uint8_t) PAYLOAD_LENGTH); // Defina 0x22, 0x40==64Byte long.
 
@@ -834,8 +1206,14 @@ void cadScanner()
 #endif
 	setFreq(freqs[ifreq]);
 
-	// Para cada vez que nós determinamos o scanner, configuramos o SF para o valor inicial.
-	sf = SF7; // Nós fazemos SF mais baixo, isso é mais rápido!
+	// Para cada vez que nós determinamos o scanner, configuramos o SF para o valor inicial:
+	// o primeiro da ordem de varredura (SF7 na ordem fixa, que é o CAD mais rápido) que está
+	// no conjunto de SF da posição atual do agendador de varredura.
+	cadScan.pos = cadStep(0);
+	if (cadScan.pos >= CAD_SFS)
+		cadScan.pos = 0;
+	cadScan.start = micros();
+	sf = (sf_t)cadSf(cadScan.pos);
 
 	// 4. Definir fator de propagação e CRC.
 	setRate(sf, 0x04);
@@ -861,6 +1239,85 @@ void cadScanner()
 	return;
 } // cadScanner
 
+// ---------------------------------------------------------------------------------------------------------
+// SF do passo pos da ordem de varredura do CAD.
+// ---------------------------------------------------------------------------------------------------------
+uint8_t cadSf(uint8_t pos)
+{
+	return (_cadAdapt ? cadScan.order[pos] : SF7 + pos);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Primeiro passo da ordem de varredura, a partir de pos, com um SF no conjunto da posição atual do
+// agendador de varredura (todos os SF sem o HOP, e nos rádios extras, que não percorrem a tabela).
+// Retorna CAD_SFS se não há mais nenhum.
+// ---------------------------------------------------------------------------------------------------------
+uint8_t cadStep(uint8_t pos)
+{
+	uint8_t mask = ((_hop && scan.active && (radioActive == 0)) ? scan.slot[scan.pos].sfMask : SCAN_SF_ALL);
+	while ((pos < CAD_SFS) && !(mask & (1 << (cadSf(pos) - SF7))))
+	{
+		pos++;
+	}
+	return (pos);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// cadLearn()
+// Aprende a ordem de varredura do CAD com o SF de cada uplink recebido. Os pesos decaem
+// 1/2^_CAD_DECAY a cada uplink, para acompanhar mudanças no tráfego.
+// A ordem minimiza o tempo esperado até o detect: os SF são ordenados por peso / duração do CAD,
+// e a duração do CAD dobra a cada SF (um símbolo, 2^SF / BW), então o critério é peso * 2^(12 - SF).
+// ---------------------------------------------------------------------------------------------------------
+void cadLearn(uint8_t sfRx)
+{
+	uint32_t key[CAD_SFS];
+
+	for (int i = 0; i < CAD_SFS; i++)
+	{
+		cadScan.weight[i] -= cadScan.weight[i] >> _CAD_DECAY;
+	}
+	if ((sfRx >= SF7) && (sfRx <= SF12))
+	{
+		cadScan.weight[sfRx - SF7] += (4096 >> _CAD_DECAY);
+	}
+
+	// Ordenação por inserção (6 elementos); no empate fica o SF menor, que é mais rápido.
+	for (int i = 0; i < CAD_SFS; i++)
+	{
+		uint32_t k = (uint32_t)cadScan.weight[i] << (CAD_SFS - 1 - i);
+		int j = i;
+		while ((j > 0) && (key[j - 1] < k))
+		{
+			key[j] = key[j - 1];
+			cadScan.order[j] = cadScan.order[j - 1];
+			j--;
+		}
+		key[j] = k;
+		cadScan.order[j] = SF7 + i;
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Registra o fim de uma varredura do CAD: detect (com o número de passos e o tempo desde o
+// primeiro CAD) ou perda (todos os SF tentados sem detect).
+// ---------------------------------------------------------------------------------------------------------
+void cadScanEnd(bool detect)
+{
+	uint8_t m = (_cadAdapt ? 1 : 0);
+	if (detect)
+	{
+		scanHit(false);
+		cadScan.detects[m]++;
+		cadScan.steps[m] += cadScan.pos + 1;
+		cadScan.detectTime[m] += micros() - cadScan.start;
+	}
+	else
+	{
+		cadScan.misses[m]++;
+	}
+}
+
 // ---------------------------------------------------------------------------------------------------------
 // Primeira inicialização do modem LoRa.
 // Alterações subsequentes no estado do modem, etc. feitas por txLoraModem ou rxLoraModem.
@@ -883,6 +1340,9 @@ void initLoraModem()
 #endif
 	digitalWrite(pins.ss, HIGH);
 
+	// Após o reset todos os registradores voltam ao valor padrão, então a cópia-sombra não vale mais.
+	regCacheInvalidate(0xFF);
+
 	// Verifique a versão do chip primeiro.
 	uint8_t version = readRegister(REG_VERSION); // Leia o ID da versão do chip LoRa.
 	if (version == 0x22)
@@ -917,9 +1377,9 @@ void initLoraModem()
 	// 1 Set LoRa Mode
 	opmode(OPMODE_LORA); // defina o registrador 0x01 para 0x80.
 
-	// 3. Definir frequência com base no valor em freq.
-	ifreq = 0;
-	freq = freqs[0];
+	// 3. Definir frequência com base no valor em freq (o canal do rádio ativo, 0 no rádio 0).
+	ifreq = radios[radioActive].home;
+	freq = freqs[ifreq];
 	setFreq(freq); // definido como 868.1MHz (Alterado).
 
 	// 4. Defina o fator de espalhamento.
@@ -935,8 +1395,8 @@ void initLoraModem()
 	writeRegister(REG_INVERTIQ, 0x27); // 0x33, 0x27; para redefinir a partir do TX.
 
 	// O tamanho máximo da carga depende do buffer de 256 bytes. Na inicialização TX começa em
-  // 0x80 e RX em 0x00. RX, portanto, maximizado em 128 bytes.
-	writeRegister(REG_MAX_PAYLOAD_LENGTH, MAX_PAYLOAD_LENGTH); // defina 0x23 para 0x80 == 128 bytes.
+  // 0x80 e RX em 0x00. O RX pode usar o FIFO inteiro (half-duplex), até 255 bytes.
+	writeRegister(REG_MAX_PAYLOAD_LENGTH, MAX_PAYLOAD_LENGTH); // defina 0x23 para 0xFF == 255 bytes.
 	writeRegister(REG_PAYLOAD_LENGTH, PAYLOAD_LENGTH); // 0x22, 0x40==64Byte long.
 
 	writeRegister(REG_FIFO_ADDR_PTR, readRegister(REG_FIFO_RX_BASE_AD)); // definir reg 0x0D para 0x0F.
@@ -1023,15 +1483,21 @@ void stateMachine()
 		return;
 	}
 #endif
+	uint32_t spiStart = spiTrans; // Transações SPI deste evento, para as métricas.
+
 	// Determine quais flags de interrupção estão definidas.
 	uint8_t flags = readRegister(REG_IRQ_FLAGS);
 	uint8_t mask = readRegister(REG_IRQ_FLAGS_MASK);
 	uint8_t intr = flags & (~mask); // Reaja apenas em interrupções não mascaradas.
+	lastIrqFlags = flags;
+	lastIrqMask = mask;
 	uint8_t rssi;
+	TRACE(TR_IRQ, intr, 0);
 
 	if (intr == 0x00)
 	{
-#if DUSB >= 1
+		TRACE(TR_NO_IRQ, flags, 0);
+#if (DUSB >= 1) && (_TRACE == 0)
 		// Algo estranho aconteceu: Houve um evento e não temos um valor para interrupção.
 		if (debug >= 1)
 			Serial.println(F("stateMachine:: NO intr - não temos um valor para interrupção."));
@@ -1043,8 +1509,7 @@ void stateMachine()
 #endif
 		//_state = S_SCAN;
 		writeRegister(REG_IRQ_FLAGS, 0xFF); // Limpar TODAS as interrupções.
-		_event = 0;
-		return;
+		return; // A radioService() já limpou o flag de evento do rádio.
 	}
 
 	// Máquina de estado pequena dentro do manipulador de interrupção, pois as próximas ações dependem do estado em que estamos.
@@ -1055,7 +1520,7 @@ void stateMachine()
 	// Se o estado for init, estamos iniciando.
   // A função initLoraModem() já é chamada ini setup();
 	case S_INIT:
-#if DUSB >= 2
+#if (DUSB >= 2) && (_TRACE == 0)
 		if (debug >= 1)
 		{
 			Serial.println(F("S_INIT"));
@@ -1075,12 +1540,15 @@ void stateMachine()
     // Nós limpamos o CDDETD e o CDDONE e mudamos para o estado de leitura.
 		if (intr & IRQ_LORA_CDDETD_MASK)
 		{
-#if DUSB >= 2
+#if (DUSB >= 2) && (_TRACE == 0)
 			if (debug >= 3)
 			{
 				Serial.println(F("SCAN:: CADDETD, "));
 			}
 #endif
+			cadDetect = irqTime; // Início da latência CAD até RXDONE.
+			TRACE(TR_CAD_DETECT, 0, (uint8_t)sf);
+			cadScanEnd(true);
 
 			_state = S_RX; // Definir estado para receber.
 			opmode(OPMODE_RX_SINGLE); // defina reg 0x01 como 0x06.
@@ -1125,13 +1593,6 @@ void stateMachine()
 			writeRegister(REG_IRQ_FLAGS, 0xFF);
 		}
 
-		// Se não CDDETC e não CDDONE e sf == 12 nós temos que hop.
-		else if ((_hop) && (sf == 12))
-		{
-			hop();
-			sf = (sf_t)7;
-		}
-
 		// Se não mudarmos para o S_CAD, temos que pular.
     // Em vez de esperar por uma interrupção, fazemos isso com base no temporizador (mais regular).
 		else
@@ -1156,6 +1617,9 @@ void stateMachine()
 		// Temos que configurar o sf com base em um RSSI forte para este canal.
 		if (intr & IRQ_LORA_CDDETD_MASK)
 		{
+			cadDetect = irqTime; // Início da latência CAD até RXDONE.
+			TRACE(TR_CAD_DETECT, 0, (uint8_t)sf);
+			cadScanEnd(true);
 
 			_state = S_RX; // Definir estado para começar a receber.
 			opmode(OPMODE_RX_SINGLE); // configure reg 0x01 para 0x06, inicie o LER (a leitura).
@@ -1179,11 +1643,15 @@ void stateMachine()
 		// Então nós digitalizamos este SF e se não for alto o suficiente ... próximo.
 		else if (intr & IRQ_LORA_CDDONE_MASK)
 		{
-			// Se isso não for SF12, incremente o SF e tente novamente.
-      // Esperamos que em outro SF receba CDDETD.
-			if (((uint8_t)sf) < SF12)
+			// Se ainda há SF na ordem de varredura (na ordem fixa: não é SF12), passe para o
+      // próximo e tente novamente. Esperamos que em outro SF receba CDDETD.
+			// Com o HOP, só os SF da posição atual do agendador são tentados.
+			uint8_t next = cadStep(cadScan.pos + 1);
+			if (next < CAD_SFS)
 			{
-				sf = (sf_t)((uint8_t)sf + 1); // XXX Isso significaria SF7 nunca usado.
+				TRACE(TR_CAD_NEXT, 0, (uint8_t)sf);
+				cadScan.pos = next;
+				sf = (sf_t)cadSf(cadScan.pos);
 				setRate(sf, 0x04); // Definir SF com CRC == on.
 
 				opmode(OPMODE_CAD); // Modo de digitalização.
@@ -1195,13 +1663,10 @@ void stateMachine()
 				writeRegister(REG_IRQ_FLAGS, IRQ_LORA_CDDONE_MASK | IRQ_LORA_CDDETD_MASK);
 				//writeRegister(REG_IRQ_FLAGS, 0xFF );	// XXX isso impedirá que o CDDETD seja lido.
 			}
-			// Se chegarmos ao SF12, devemos voltar ao estado SCAN.
+			// Se tentamos todos os SF, devemos voltar ao estado SCAN.
 			else
 			{
-				if (_hop)
-				{
-					hop();
-				} // Se HOP começarmos na próxima frequência.
+				cadScanEnd(false);
 				_state = S_SCAN;
 				cadScanner(); // Que irá redefinir SF para SF7.
 				// Repor as interrupções.
@@ -1213,12 +1678,13 @@ void stateMachine()
     // é desconhecido neste estado. Então, nós limpamos a interrupção e damos um aviso.
 		else
 		{
-#if DUSB >= 2
+#if (DUSB >= 2) && (_TRACE == 0)
 			if (debug >= 1)
 			{
 				Serial.println(F("CAD:: Interrupção desconhecida."));
 			}
 #endif
+			TRACE(TR_UNKNOWN, intr, 0);
 			_state = S_SCAN;
 			cadScanner();
 			writeRegister(REG_IRQ_FLAGS, (uint8_t)0xFF); // Redefinir todas as interrupções.
@@ -1240,7 +1706,8 @@ void stateMachine()
       // Verificação de erros de CRC requer DIO3
 			if (intr & IRQ_LORA_CRCERR_MASK)
 			{
-#if DUSB >= 2
+				TRACE(TR_CRCERR, intr, 0);
+#if (DUSB >= 2) && (_TRACE == 0)
 				Serial.println(F("CRC erro"));
 				if (debug >= 2)
 					Serial.flush();
@@ -1262,56 +1729,86 @@ void stateMachine()
 				break;
 			}
 
-			if ((LoraUp.payLength = receivePkt(LoraUp.payLoad)) <= 0)
+			// O timestamp de recepção é o instante da interrupção RXDONE, gravado pelo manipulador;
+			// o tempo até o rádio ser atendido (fila, SPI, OLED) não entra no tmst.
+			uint32_t tmst = irqTime;
+			if (cadDetect != 0)
 			{
-#if DUSB >= 1
+				METRIC(MET_CAD_RX, tmst - cadDetect);
+				cadDetect = 0;
+			}
+
+			// Reserve um registro no anel. Se a netService() ainda não encaminhou os quadros
+			// anteriores e o anel está cheio, este quadro é perdido (e contado).
+			struct LoraUp *up = upRingSlot();
+			if (up == NULL)
+			{
+				cp_nb_rx_rcv++;
+				TRACE(TR_RING_FULL, 0, 0);
+#if (DUSB >= 1) && (_TRACE == 0)
+				if (debug >= 1)
+				{
+					Serial.println(F("sMachine:: Anel de uplink cheio."));
+				}
+#endif
+			}
+			else if ((up->payLength = receivePkt(up->payLoad)) <= 0)
+			{
+#if (DUSB >= 1) && (_TRACE == 0)
 				if (debug >= 0)
 				{
 					Serial.println(F("sMachine:: Erro S-RX"));
 				}
 #endif
 			}
-
-			// Fazer todo o processamento de registro nesta seção (interrupção).
-			uint8_t value = readRegister(REG_PKT_SNR_VALUE); // 0x19;
-			if (value & 0x80)
-			{ // O bit de sinal SNR é 1.
-
-				value = ((~value + 1) & 0xFF) >> 2; // Inverta e divida por 4.
-				LoraUp.snr = -value;
-			}
 			else
 			{
-				// Divida por 4.
-				LoraUp.snr = (value & 0xFF) >> 2;
-			}
+				// Fazer todo o processamento de registro nesta seção (interrupção).
+				uint8_t value = readRegister(REG_PKT_SNR_VALUE); // 0x19;
+				if (value & 0x80)
+				{ // O bit de sinal SNR é 1.
 
-			LoraUp.prssi = readRegister(REG_PKT_RSSI); // Leia o registrador 0x1A, pacote rssi.
+					value = ((~value + 1) & 0xFF) >> 2; // Inverta e divida por 4.
+					up->snr = -value;
+				}
+				else
+				{
+					// Divida por 4.
+					up->snr = (value & 0xFF) >> 2;
+				}
 
-			// Correção do valor de RSSI baseado no chip usado.
-			if (sx1272)
-			{ // É um rádio sx1272?
-				LoraUp.rssicorr = 139;
-			}
-			else
-			{ // Provavelmente SX1276 ou RFM95.
-				LoraUp.rssicorr = 157;
-			}
+				up->prssi = readRegister(REG_PKT_RSSI); // Leia o registrador 0x1A, pacote rssi.
 
-			LoraUp.sf = readRegister(REG_MODEM_CONFIG2) >> 4;
+				// Correção do valor de RSSI baseado no chip usado.
+				if (sx1272)
+				{ // É um rádio sx1272?
+					up->rssicorr = 139;
+				}
+				else
+				{ // Provavelmente SX1276 ou RFM95.
+					up->rssicorr = 157;
+				}
 
-			if (receivePacket() <= 0)
-			{ // ler não é bem sucedido.
-#if DUSB >= 1
-				Serial.println(F("sMach:: Erro no recebimendo do Pacote."));
-#endif
-			}
-#if DUSB >= 2
-			else if (debug >= 2)
-			{
-				Serial.println(F("sMach:: recebimento do Pacote OK."));
+				up->sf = readRegister(REG_MODEM_CONFIG2) >> 4;
+				up->ch = ifreq;
+				up->tmst = tmst;
+				TRACE(TR_RXDONE, 0, up->payLength);
+				cadLearn(up->sf);
+				scanHit(true);
+				radios[radioActive].frames++;
+
+				// Entregue o registro à netService(), que o encaminha com receivePacket(), a menos que
+				// o filtro de DevAddr ou a tabela de repetições o descarte.
+				uint8_t drop = upFilter(up->payLoad, up->payLength, tmst);
+				if (drop == UP_PASS)
+				{
+					upRingPush();
+				}
+				else
+				{
+					TRACE(TR_UP_DROP, drop, 0);
+				}
 			}
-#endif
 
 			// Configure o modem para receber ANTES de voltar ao espaço do usuário.
 			if (_cad)
@@ -1327,11 +1824,14 @@ void stateMachine()
 
 			writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t)0x00);
 			writeRegister(REG_IRQ_FLAGS, 0xFF); // Reponha a máscara de interrupção.
+			METRIC(MET_SPI, spiTrans - spiStart);
 		}
 
 		// Receba o tempo limite da mensagem.
 		else if (intr & IRQ_LORA_RXTOUT_MASK)
 		{
+			cadDetect = 0; // O CAD detect não terminou em RXDONE.
+			TRACE(TR_RXTOUT, 0, 0);
 
 			// Define o modem para a próxima ação de recebimento. Isso deve ser feito antes
       // a varredura ocorre porque não podemos fazer isso uma vez que o RXDETTD esteja configurado.
@@ -1354,12 +1854,13 @@ void stateMachine()
     // portanto, reiniciamos a sequência de varredura (captura tudo).
 		else
 		{
-#if DUSB >= 2
+#if (DUSB >= 2) && (_TRACE == 0)
 			if (debug >= 3)
 			{
 				Serial.println(F("S_RX:: Não RXDONE/RXTOUT, "));
 			}
 #endif
+			TRACE(TR_UNKNOWN, intr, 0);
 			initLoraModem(); // Repor toda a comunicação, 3.
 			if (_cad)
 			{
@@ -1380,27 +1881,15 @@ void stateMachine()
   
 	case S_TX:
 
-		// Iniciar a transmissão do buffer (no espaço de interrupção).
-		// Nós reagimos em TODAS as interrupções se estamos no estado de TEXAS.
-
-		txLoraModem(
-			LoraDown.payLoad,
-			LoraDown.payLength,
-			LoraDown.tmst,
-			LoraDown.sfTx,
-			LoraDown.powe,
-			LoraDown.fff,
-			LoraDown.crc,
-			LoraDown.iiq);
-
-#if DUSB >= 2
+		// O TX está armado (FIFO carregado, rádio em FSTX) e o temporizador ainda não disparou.
+		// Nenhuma interrupção é esperada agora; apenas limpe os sinalizadores.
+#if (DUSB >= 2) && (_TRACE == 0)
 		if (debug >= 0)
 		{
-			Serial.println(F("S_TX, "));
+			Serial.println(F("S_TX:: interrupção com TX armado."));
 		}
 #endif
-		_state = S_TXDONE;
-		writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t)0x00);
+		TRACE(TR_UNKNOWN, intr, 0);
 		writeRegister(REG_IRQ_FLAGS, (uint8_t)0xFF); // Redefinir sinalizadores de interrupção.
 
 		break; // S_TX
@@ -1414,7 +1903,11 @@ void stateMachine()
 	case S_TXDONE:
 		if (intr & IRQ_LORA_TXDONE_MASK)
 		{
-#if DUSB >= 1
+			TRACE(TR_TXDONE, 0, 0);
+#if _TX_CAL >= 1
+			txCalibrate();
+#endif
+#if (DUSB >= 1) && (_TRACE == 0)
 			Serial.println(F("TXFeito interromper."));
 #endif
 			// Após a transmissão, reinicie o receptor.
@@ -1432,7 +1925,7 @@ void stateMachine()
 
 			writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t)0x00);
 			writeRegister(REG_IRQ_FLAGS, (uint8_t)0xFF); // Redefinir sinalizadores de interrupção.
-#if DUSB >= 1
+#if (DUSB >= 1) && (_TRACE == 0)
 			if (debug >= 1)
 			{
 				Serial.println(F("TXFeito tratado."));
@@ -1443,7 +1936,7 @@ void stateMachine()
 		}
 		else
 		{
-#if DUSB >= 1
+#if (DUSB >= 1) && (_TRACE == 0)
 			if (debug >= 0)
 			{
 				Serial.println(F("TXFeito interrupção desconhecida."));
@@ -1451,6 +1944,7 @@ void stateMachine()
 					Serial.flush();
 			}
 #endif
+			TRACE(TR_UNKNOWN, intr, 0);
 		}
 		break; // S_TXDONE
 
@@ -1458,13 +1952,14 @@ void stateMachine()
 	// If _STATE está em estado indefinido.
   // Se tal coisa acontecer, devemos reinicializar a interface e certifique-se de que pegaremos a próxima interrupção.
 	default:
-#if DUSB >= 2
+#if (DUSB >= 2) && (_TRACE == 0)
 		if (debug >= 2)
 		{
 			Serial.print("E state=");
 			Serial.println(_state);
 		}
 #endif
+		TRACE(TR_UNKNOWN, intr, 0);
 		if (_cad)
 		{
 			_state = S_SCAN;
@@ -1483,8 +1978,205 @@ void stateMachine()
 #if MUTEX_INT == 1
 	ReleaseMutex(&inIntr);
 #endif
-	_event = 0;
-	return;
+	return; // A radioService() já limpou o flag de evento do rádio.
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Soma uma medição de duração (uSec) ao perfil da etapa stage, veja PROF_BEGIN() e PROF_END().
+// ---------------------------------------------------------------------------------------------------------
+void profAdd(uint8_t stage, uint32_t duration)
+{
+	prof[stage].calls++;
+	prof[stage].total += duration;
+	if (duration > prof[stage].max)
+	{
+		prof[stage].max = duration;
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Soma o valor v ao histograma h, veja METRIC(). O balde é o menor i com v <= 2^i.
+// ---------------------------------------------------------------------------------------------------------
+void metObserve(uint8_t h, uint32_t v)
+{
+	uint8_t i = ((v <= 1) ? 0 : 32 - __builtin_clz(v - 1));
+	if (i >= MET_BUCKETS)
+	{
+		i = MET_BUCKETS - 1;
+	}
+	metHist[h].sum += v;
+	metHist[h].bucket[i]++;
+}
+
+#if _TRACE >= 1
+// ---------------------------------------------------------------------------------------------------------
+// Grava um evento no anel do trace, veja TRACE(). O evento mais antigo é sobrescrito.
+// ---------------------------------------------------------------------------------------------------------
+void traceAdd(uint8_t event, uint8_t flags, uint16_t arg)
+{
+	uint32_t now = micros();
+
+	TRACE_LOCK();
+	struct traceEvent *t = &trace.ev[trace.head & (_TRACE_SIZE - 1)];
+	t->tmst = now;
+	t->arg = arg;
+	t->event = event;
+	t->state = (uint8_t)_state;
+	t->flags = flags;
+	t->sf = (uint8_t)sf;
+	t->ch = ifreq;
+	trace.head++;
+	TRACE_UNLOCK();
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------
+// Filtro de uplinks, chamado pela stateMachine() logo após receivePkt().
+// Só quadros de dados uplink (Unconfirmed e Confirmed Data Up) têm DevAddr e são filtrados:
+// 1. Regras de prefixo de DevAddr (upFilters[], _UP_FILTER);
+// 2. Repetições do mesmo DevAddr e FCnt dentro de _DEDUP_WINDOW mSec (só Unconfirmed Data Up).
+// Parâmetros:
+// - buf, len: PHYPayload recebido.
+// - tmst: micros() da recepção.
+// Retorna: UP_PASS ou o motivo do descarte (UP_DROP_DENY, UP_DROP_DUP), já contado em upDrop.
+// ---------------------------------------------------------------------------------------------------------
+uint8_t upFilter(const uint8_t *buf, uint8_t len, uint32_t tmst)
+{
+	uint8_t mtype = buf[0] >> 5;
+
+	// MHDR(1) | DevAddr(4) | FCtrl(1) | FCnt(2) | MIC(4).
+	if ((len < 12) || ((mtype != 0x02) && (mtype != 0x04)))
+	{
+		return (UP_PASS);
+	}
+	uint32_t devAddr = buf[1] | ((uint32_t)buf[2] << 8) | ((uint32_t)buf[3] << 16) | ((uint32_t)buf[4] << 24);
+
+#if _UP_FILTER >= 1
+	uint8_t action = _UP_FILTER_DEFAULT;
+	for (uint8_t i = 0; i < UP_RULES; i++)
+	{
+		uint32_t mask = (upFilters[i].bits ? 0xFFFFFFFFu << (32 - upFilters[i].bits) : 0);
+		if (((devAddr ^ upFilters[i].prefix) & mask) == 0)
+		{
+			action = upFilters[i].action;
+			break;
+		}
+	}
+	if (action == UP_DENY)
+	{
+		upDrop.deny++;
+		return (UP_DROP_DENY);
+	}
+#endif
+
+#if _DEDUP_WINDOW > 0
+	if (mtype == 0x02)
+	{
+		uint16_t fcnt = buf[6] | ((uint16_t)buf[7] << 8);
+		uint32_t h = (devAddr ^ ((uint32_t)fcnt * 0x9E3779B1)) * 0x9E3779B1; // Hash de Fibonacci.
+		uint8_t slot = 0; // Posição para a inserção: a primeira livre ou, sem nenhuma, a mais velha.
+		bool found = false;
+		uint32_t oldest = 0;
+
+		for (uint8_t p = 0; p < DEDUP_PROBE; p++)
+		{
+			uint8_t i = (uint8_t)((h >> 27) + p) & (DEDUP_SIZE - 1);
+			struct dedupEntry *e = &dedup[i];
+			uint32_t age = tmst - e->time;
+			if ((!e->used) || (age >= (uint32_t)_DEDUP_WINDOW * 1000))
+			{
+				if (!found)
+				{
+					slot = i;
+					found = true;
+				}
+				if (!e->used)
+					break; // Nenhuma entrada da sequência está depois de uma posição nunca usada.
+				continue;
+			}
+			if ((e->devAddr == devAddr) && (e->fcnt == fcnt))
+			{
+				upDrop.dup++;
+				return (UP_DROP_DUP);
+			}
+			if ((!found) && (age >= oldest))
+			{
+				slot = i;
+				oldest = age;
+			}
+		}
+		dedup[slot].devAddr = devAddr;
+		dedup[slot].fcnt = fcnt;
+		dedup[slot].time = tmst;
+		dedup[slot].used = true;
+	}
+#endif
+	return (UP_PASS);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Funções do anel de uplinks (upRing).
+// O produtor é a stateMachine(): upRingSlot() devolve o próximo registro livre (ou NULL quando
+// o anel está cheio) e upRingPush() publica o registro preenchido.
+// O consumidor é a netService(): upRingPeek() devolve o registro mais antigo (ou NULL quando
+// vazio) e upRingPop() o libera depois de encaminhado.
+// ---------------------------------------------------------------------------------------------------------
+struct LoraUp *upRingSlot()
+{
+	if ((uint8_t)(upRing.head - upRing.tail) >= UP_RING_SIZE)
+	{
+		upRing.overflow++;
+		return (NULL);
+	}
+	return (&upRing.rec[upRing.head & (UP_RING_SIZE - 1)]);
+}
+
+void upRingPush()
+{
+	__sync_synchronize(); // O registro tem que estar completo antes do head avançar.
+	upRing.head++;
+	uint8_t used = (uint8_t)(upRing.head - upRing.tail);
+	if (used > upRing.highWater)
+		upRing.highWater = used;
+#if _NET_TASK >= 1
+	if (netTask != NULL)
+	{
+		xTaskNotifyGive(netTask); // Encaminhe o quadro sem esperar o _NET_TICK.
+	}
+#endif
+}
+
+struct LoraUp *upRingPeek()
+{
+	if (upRing.tail == upRing.head)
+		return (NULL);
+	__sync_synchronize();
+	return (&upRing.rec[upRing.tail & (UP_RING_SIZE - 1)]);
+}
+
+void upRingPop()
+{
+	__sync_synchronize(); // Terminamos de ler o registro antes de liberá-lo.
+	upRing.tail++;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Acorda a tarefa do rádio (_RADIO_TASK) a partir de um manipulador de interrupção.
+// Sem a tarefa, o loop() verifica _event a cada volta e não há nada a fazer.
+// ---------------------------------------------------------------------------------------------------------
+void ICACHE_RAM_ATTR radioWake()
+{
+#if _RADIO_TASK >= 1
+	if (radioTask != NULL)
+	{
+		BaseType_t woken = pdFALSE;
+		vTaskNotifyGiveFromISR(radioTask, &woken);
+		if (woken == pdTRUE)
+		{
+			portYIELD_FROM_ISR();
+		}
+	}
+#endif
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -1497,7 +2189,9 @@ void stateMachine()
 // ---------------------------------------------------------------------------------------------------------
 void ICACHE_RAM_ATTR Interrupt_0()
 {
+	_eventTime = micros();
 	_event = 1;
+	radioWake();
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -1513,7 +2207,9 @@ void ICACHE_RAM_ATTR Interrupt_0()
 // ---------------------------------------------------------------------------------------------------------
 void ICACHE_RAM_ATTR Interrupt_1()
 {
+	_eventTime = micros();
 	_event = 1;
+	radioWake();
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -1521,5 +2217,322 @@ void ICACHE_RAM_ATTR Interrupt_1()
 // ---------------------------------------------------------------------------------------------------------
 void ICACHE_RAM_ATTR Interrupt_2()
 {
+	_eventTime = micros();
 	_event = 1;
+	radioWake();
 }
+
+// ---------------------------------------------------------------------------------------------------------
+// Rádios extras (_RADIOS > 1).
+// ---------------------------------------------------------------------------------------------------------
+
+// ---------------------------------------------------------------------------------------------------------
+// Guarda as globais do rádio ativo na sua instância em radios[].
+// ---------------------------------------------------------------------------------------------------------
+void radioSave()
+{
+	struct loraRadio *r = &radios[radioActive];
+	r->pins = pins;
+	r->state = _state;
+	r->sf = (uint8_t)sf;
+	r->freq = freq;
+	r->ifreq = ifreq;
+	r->rssi = _rssi;
+	r->sx1272 = sx1272;
+	r->cadDetect = cadDetect;
+	r->cad = cadScan;
+	memcpy(r->regCache, regCache, sizeof(regCache));
+	memcpy(r->regCacheValid, regCacheValid, sizeof(regCacheValid));
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Torna n o rádio ativo: guarda as globais do rádio atual e carrega as do rádio n.
+// ---------------------------------------------------------------------------------------------------------
+void radioSelect(uint8_t n)
+{
+	if (n == radioActive)
+	{
+		return;
+	}
+	radioSave();
+	radioActive = n;
+
+	struct loraRadio *r = &radios[n];
+	pins = r->pins;
+	_state = r->state;
+	sf = (sf_t)r->sf;
+	freq = r->freq;
+	ifreq = r->ifreq;
+	_rssi = r->rssi;
+	sx1272 = r->sx1272;
+	cadDetect = r->cadDetect;
+	cadScan = r->cad;
+	memcpy(regCache, r->regCache, sizeof(regCache));
+	memcpy(regCacheValid, r->regCacheValid, sizeof(regCacheValid));
+}
+
+#if _RADIOS > 1
+// Um manipulador de interrupção por rádio extra; marca o evento e o seu instante, como Interrupt_0().
+void ICACHE_RAM_ATTR InterruptRadio1()
+{
+	radios[1].eventTime = micros();
+	radios[1].event = 1;
+	radioWake();
+}
+#if _RADIOS > 2
+void ICACHE_RAM_ATTR InterruptRadio2()
+{
+	radios[2].eventTime = micros();
+	radios[2].event = 1;
+	radioWake();
+}
+#endif
+#if _RADIOS > 3
+void ICACHE_RAM_ATTR InterruptRadio3()
+{
+	radios[3].eventTime = micros();
+	radios[3].event = 1;
+	radioWake();
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------
+// Inicializa os rádios extras, depois do rádio 0 em setup(). Cada um é resetado, configurado no
+// seu canal e colocado no modo CAD ou RX, como o rádio 0. No fim o rádio 0 volta a ser o ativo.
+// ---------------------------------------------------------------------------------------------------------
+void radioSetup()
+{
+	void (*isr[])() = {NULL, InterruptRadio1,
+#if _RADIOS > 2
+					   InterruptRadio2,
+#endif
+#if _RADIOS > 3
+					   InterruptRadio3,
+#endif
+	};
+
+	for (uint8_t n = 1; n < _RADIOS; n++)
+	{
+		struct loraRadio *r = &radios[n];
+		r->pins.ss = radioPins[n - 1][0];
+		r->pins.rst = radioPins[n - 1][1];
+		r->pins.dio0 = radioPins[n - 1][2];
+		r->pins.dio1 = radioPins[n - 1][3];
+		r->pins.dio2 = radioPins[n - 1][4];
+		r->home = radioPins[n - 1][5];
+		r->state = S_INIT;
+		r->sf = (uint8_t)sf;
+		r->cad = cadScan;
+
+		radioSelect(n);
+		pinMode(pins.ss, OUTPUT);
+		pinMode(pins.rst, OUTPUT);
+		pinMode(pins.dio0, INPUT);
+		pinMode(pins.dio1, INPUT);
+		digitalWrite(pins.ss, HIGH);
+
+		initLoraModem(); // Também coloca o rádio no canal home.
+		if (_cad)
+		{
+			_state = S_SCAN;
+			cadScanner();
+		}
+		else
+		{
+			_state = S_RX;
+			rxLoraModem();
+		}
+		attachInterrupt(pins.dio0, isr[n], RISING);
+		if (pins.dio1 != pins.dio0)
+		{
+			attachInterrupt(pins.dio1, isr[n], RISING);
+		}
+#if DUSB >= 1
+		Serial.print(F("radioSetup:: Rádio "));
+		Serial.print(n);
+		Serial.print(F(" no canal "));
+		Serial.println(ifreq);
+#endif
+	}
+	radioSelect(0);
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------
+// Reinício do receptor.
+// level: RADIO_RX, RADIO_LISTEN ou RADIO_INIT (veja loraModem.h).
+// ---------------------------------------------------------------------------------------------------------
+void radioRestartNow(uint8_t level)
+{
+	scan.active = false; // O agendador de varredura recomeça na próxima posição.
+	if (level >= RADIO_INIT)
+	{
+		initLoraModem();
+	}
+	if ((level >= RADIO_LISTEN) && (_cad))
+	{
+		_state = S_SCAN;
+		cadScanner();
+	}
+	else if (level >= RADIO_LISTEN)
+	{
+		_state = S_RX;
+		rxLoraModem();
+	}
+	else
+	{
+		rxLoraModem();
+	}
+	if (level >= RADIO_INIT)
+	{
+		writeRegister(REG_IRQ_FLAGS_MASK, (uint8_t)0x00);
+		writeRegister(REG_IRQ_FLAGS, 0xFF); // Redefinir todos os sinalizadores de interrupção.
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Pede o reinício do receptor fora da tarefa do rádio (página web, PULL_DATA, sensor).
+// Com _RADIO_TASK o rádio pertence à tarefa do rádio: o pedido é guardado em radioRestartReq e
+// executado pela radioService() quando o rádio não está transmitindo. Sem a tarefa, o reinício é imediato.
+// O loop() e a tarefa da rede podem pedir ao mesmo tempo, então o maior pedido é gravado com
+// compare-and-swap.
+// ---------------------------------------------------------------------------------------------------------
+void radioRestart(uint8_t level)
+{
+#if _RADIO_TASK >= 1
+	if (radioTask != NULL)
+	{
+		uint32_t req = radioRestartReq;
+		while ((level > req) && !__atomic_compare_exchange_n(&radioRestartReq, &req, (uint32_t)level, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		{
+		}
+		xTaskNotifyGive(radioTask);
+		return;
+	}
+#endif
+	radioRestartNow(level);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Todo o trabalho do lado do rádio: eventos das interrupções, a fila de downlinks, os pedidos de
+// reinício e o agendador de varredura (HOP). Chamada pela tarefa do rádio (_RADIO_TASK) ou pelo loop().
+// Retorna: true se tratou um evento do rádio; nesse caso chame de novo antes de fazer outra coisa.
+// ---------------------------------------------------------------------------------------------------------
+bool radioService()
+{
+	uint32_t now = micros();
+
+	// O TX armado começou (txTrigger()); passe para S_TXDONE antes de tratar o TXDONE.
+	if (txTime.fired)
+	{
+		txFired();
+	}
+
+	// Verifica o valor do evento, o que significa que uma interrupção chegou.
+	// O flag é limpo antes da stateMachine(), para que uma interrupção durante ela não se perca.
+	if (_event != 0x00)
+	{
+		_event = 0; // Valor de reset.
+		irqTime = _eventTime; // Lido depois de limpar _event: no máximo fica com o instante mais novo.
+		PROF_BEGIN(PROF_STATE);
+		stateMachine(); // Inicie a máquina de estado.
+		PROF_END(PROF_STATE);
+		return (true);
+	}
+
+#if _RADIOS > 1
+	// Interrupções dos rádios extras. Enquanto o rádio 0 tem um TX armado (S_TX), ele continua
+	// ativo, pois o txTrigger() usa as globais dele; os eventos dos outros esperam o TX começar.
+	if (_state != S_TX)
+	{
+		for (uint8_t n = 1; n < _RADIOS; n++)
+		{
+			if (radios[n].event != 0)
+			{
+				radios[n].event = 0;
+				irqTime = radios[n].eventTime;
+				radioSelect(n);
+				PROF_BEGIN(PROF_STATE);
+				stateMachine();
+				PROF_END(PROF_STATE);
+				radioSelect(0); // O restante trabalha com o rádio 0.
+				return (true);
+			}
+		}
+	}
+#endif
+
+	// Entregue ao rádio o próximo downlink da fila quando o seu tmst estiver próximo.
+	downDispatch();
+
+	// Pedidos de reinício do loop() e da tarefa da rede (radioRestart()). Nunca durante uma transmissão.
+	if ((radioRestartReq != 0) && (_state != S_TX) && (_state != S_TXDONE))
+	{
+		uint8_t level = (uint8_t)__atomic_exchange_n(&radioRestartReq, 0, __ATOMIC_SEQ_CST);
+		radioRestartNow(level);
+	}
+
+	// Após um período de silêncio, certifique-se de reiniciar o modem.
+	// XXX Ainda tem que medir o período silencioso no stat [0];
+	// Por enquanto usamos msgTime
+	// Nunca durante uma transmissão (S_TX/S_TXDONE), pois o reset interromperia o downlink.
+	// statr[statHead].tmst e msgTime estão em millis(); as diferenças com sinal resistem ao rollover.
+	uint32_t nowMs = millis();
+	uint32_t lastRx = statr[statHead].tmst;
+	if ((((nowMs - lastRx) / 1000) > _MSG_INTERVAL) &&
+		((int32_t)(lastRx - msgTime) > 0) && (_state != S_TX) && (_state != S_TXDONE))
+	{
+#if DUSB >= 1
+		Serial.print("'r' - Após um período de silêncio, certifique-se de reiniciar o modem.");
+#endif
+		radioRestartNow(RADIO_INIT);
+		msgTime = nowMs;
+	}
+
+	// Agendador de varredura (HOP): no fim da permanência da posição atual, passe para a próxima.
+	// A troca espera o fim de uma varredura do CAD (S_CAD), de um RX (com o CAD) ou de um TX, para
+	// não perder o quadro; sem o CAD o receptor fica em S_RX e a troca é feita no instante previsto.
+	if (scanReload)
+	{
+		scanReload = false;
+		scanLoad();
+	}
+	if (!_hop)
+	{
+		scan.active = false;
+	}
+	else if (!scan.active || ((int32_t)(now - scan.deadline) >= 0))
+	{
+		if ((_state == S_SCAN) || ((_state == S_RX) && !_cad))
+		{
+			scanNext(now);
+		}
+		else if (scan.active && !scan.held)
+		{
+			scan.held = true;
+			scan.slot[scan.pos].held++;
+		}
+	}
+	return (false);
+}
+
+#if _RADIO_TASK >= 1
+// ---------------------------------------------------------------------------------------------------------
+// Tarefa do rádio, fixa no núcleo _RADIO_CORE. Dorme até uma interrupção do rádio (radioWake())
+// ou um pedido de reinício (radioRestart(), do loop() ou da tarefa da rede), ou no máximo
+// _RADIO_TICK mSec, para a fila de downlinks e o hop. Todo o acesso SPI ao rádio é feito aqui,
+// exceto a escrita do OPMODE_TX pelo txTrigger() na tarefa do esp_timer, que só acontece em S_TX,
+// quando esta tarefa não usa o SPI. A página web mostra as cópias dos registradores guardadas pela
+// stateMachine(), sem acessar o SPI.
+// ---------------------------------------------------------------------------------------------------------
+void radioLoop(void *)
+{
+	for (;;)
+	{
+		ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(_RADIO_TICK));
+		while (radioService())
+		{
+		}
+	}
+}
+#endif
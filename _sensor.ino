@@ -75,150 +75,41 @@ static int LoRaSensors(uint8_t *buf)
 }
 
 // ---------------------------------------------------------------------------------------------------------
-// XOR()
-// Executar função x ou para buffer e chave.
-// Como fazemos isso APENAS para chaves e X, Y sabemos que precisamos de XOR 16 bytes.
+// Chaves de sessão do nó do gateway, preparadas uma vez por sensorKeys() (veja _loraCrypto.ino).
 // ---------------------------------------------------------------------------------------------------------
-static void mXor(uint8_t *buf, uint8_t *key)
-{
-	for (uint8_t i = 0; i < 16; ++i)
-		buf[i] ^= key[i];
-}
+static struct aesKey appKey; // AppSKey, para o FRMPayload.
+static struct cmacKey nwkKey; // NwkSKey com as subchaves do CMAC, para o MIC.
+static bool keysReady = false;
 
-// ---------------------------------------------------------------------------------------------------------
-// SHIFT-LEFT
-// Shift o buf buffer deixado um bit.
-// Parâmetros:
-// - buf: Uma matriz de uint8_t bytes.
-// - len: Comprimento da matriz em bytes.
-// ---------------------------------------------------------------------------------------------------------
-static void shift_left(uint8_t *buf, uint8_t len)
+static uint32_t sensorAddr()
 {
-	while (len--)
-	{
-		uint8_t next = len ? buf[1] : 0; // len 0 to 15
-
-		uint8_t val = (*buf << 1);
-		if (next & 0x80)
-			val |= 0x01;
-		*buf++ = val;
-	}
+	return (((uint32_t)DevAddr[0] << 24) | ((uint32_t)DevAddr[1] << 16) | ((uint32_t)DevAddr[2] << 8) | DevAddr[3]);
 }
 
-// ---------------------------------------------------------------------------------------------------------
-// generate_subkey
-// RFC 4493, para 2.3
-// ---------------------------------------------------------------------------------------------------------
-static void generate_subkey(uint8_t *key, uint8_t *k1, uint8_t *k2)
+static void sensorKeys()
 {
-
-	memset(k1, 0, 16); // Preencha a subchave1 com 0x00.
-
-	// Passo 1: Assuma que k1 é um bloco todo zero.
-	AES_Encrypt(k1, key);
-
-	// Etapa 2: Analise o resultado da operação Criptografar (em k1), gere k1.
-	if (k1[0] & 0x80)
-	{
-		shift_left(k1, 16);
-		k1[15] ^= 0x87;
-	}
-	else
-	{
-		shift_left(k1, 16);
-	}
-
-	// Passo 3: Gerar k2.
-	for (uint8_t i = 0; i < 16; i++)
-		k2[i] = k1[i];
-	if (k1[0] & 0x80)
-	{ // use k1 (== k2) de acordo com rfc.
-		shift_left(k2, 16);
-		k2[15] ^= 0x87;
-	}
-	else
-	{
-		shift_left(k2, 16);
-	}
-
-	// passo 4: Feito, retorne k1 e k2.
-	return;
+	if (keysReady)
+		return;
+	const uint8_t AppSKey[16] = _APPSKEY; // Veja ESP32-GatewayLoRaWAN.h
+	const uint8_t NwkSKey[16] = _NWKSKEY;
+	aesSetKey(&appKey, AppSKey);
+	cmacSetKey(&nwkKey, NwkSKey);
+	keysReady = true;
 }
 
 // ---------------------------------------------------------------------------------------------------------
 // ENCODEPACKET (Códificar Pacote)
 // No modo Sensor, temos que codificar a carga útil do usuário antes de enviar.
-// Os arquivos da biblioteca para AES são adicionados ao diretório da biblioteca no AES.
-// Por enquanto usamos a biblioteca AES feita por Ideetron como esta biblioteca
-// também é usado na pilha LMIC e é de pequeno em tamanho.
+// A função abaixo segue exatamente a especificação LoRa (par. 4.3.3), veja loraCrypt().
 //
-// A função abaixo segue exatamente a especificação LoRa.
-//
-// O número de Bytes resultante é retornado pelas funções. Isso significa 16 bytes por bloco,
-// e à medida que adicionamos ao último bloco, também retornamos 16 bytes para o último bloco.
-//
-// O código LMIC não faz isso, então talvez nós encurtemos o último bloco para apenas
-// os bytes significativos no último bloco. Isso significa que o buffer codificado
+// O número de Bytes resultante é retornado pelas funções: o buffer codificado
 // é exatamente tão grande quanto a mensagem original.
-//
-// NOTE: Esteja ciente de que a LICENÇA dos arquivos da biblioteca AES usados
-// que chamamos com AES_Encrypt() é GPL3. É usado como é, mas não faz parte deste código.
-//
-// cmac = aes128_encrypt (K, Block_A [i]).
 // ---------------------------------------------------------------------------------------------------------
 uint8_t encodePacket(uint8_t *Data, uint8_t DataLength, uint16_t FrameCount, uint8_t Direction)
 {
-
-	unsigned char AppSKey[16] = _APPSKEY; // Veja ESP32-GatewayLoRaWAN.h
-	uint8_t i, j;
-	uint8_t Block_A[16];
-	uint8_t bLen = 16; // O tamanho do bloco é 16, exceto pelo último bloco na mensagem.
-
-	uint8_t restLength = DataLength % 16; // Nós trabalhamos em blocos de 16 bytes, este é o resto.
-	uint8_t numBlocks = DataLength / 16;  // Número de blocos inteiros para criptografar.
-	if (restLength > 0)
-		numBlocks++; // E adicione bloco para o resto, se houver.
-
-	for (i = 1; i <= numBlocks; i++)
-	{
-		Block_A[0] = 0x01;
-
-		Block_A[1] = 0x00;
-		Block_A[2] = 0x00;
-		Block_A[3] = 0x00;
-		Block_A[4] = 0x00;
-
-		Block_A[5] = Direction; // 0 é uplink
-
-		Block_A[6] = DevAddr[3]; // Só funciona para e com a ativação do tipo ABP.
-		Block_A[7] = DevAddr[2];
-		Block_A[8] = DevAddr[1];
-		Block_A[9] = DevAddr[0];
-
-		Block_A[10] = (FrameCount & 0x00FF);
-		Block_A[11] = ((FrameCount >> 8) & 0x00FF);
-		Block_A[12] = 0x00; // Bytes superiores do contador de quadros.
-		Block_A[13] = 0x00; // Estes não são usados, são 0.
-
-		Block_A[14] = 0x00;
-
-		Block_A[15] = i;
-
-		// Criptografar e calcular o S.
-		AES_Encrypt(Block_A, AppSKey);
-
-		// Último bloco? definir bLen para descansar.
-		if ((i == numBlocks) && (restLength > 0))
-			bLen = restLength;
-
-		for (j = 0; j < bLen; j++)
-		{
-			*Data = *Data ^ Block_A[j];
-			Data++;
-		}
-	}
-	//return(numBlocks*16); // Nós realmente queremos retornar todos os 16 bytes no lastblock.
-	return (DataLength); // ou apenas 16 * (numBlocks-1) + bLen;
+	sensorKeys();
+	loraCrypt(&appKey, Direction, sensorAddr(), FrameCount, Data, DataLength);
+	return (DataLength);
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -237,168 +128,16 @@ uint8_t encodePacket(uint8_t *Data, uint8_t DataLength, uint16_t FrameCount, uin
 // - FrameCount: contador de quadros de 16 bits.
 // - dir: 0 = up, 1 = down
 //
-// B0 = (0x49 | 4 x 0x00 | Dir | 4 x DevAddr | 4 x FCnt | 0x00 | len)
-// MIC é cmac [0: 3] de (aes128_cmac (NwkSKey, B0 | Data)
+// MIC é cmac [0: 3] de (aes128_cmac (NwkSKey, B0 | Data), veja loraMic().
+// Retornamos adicionando 4 bytes aos dados, portanto, deve haver espaço na matriz de dados.
 // ---------------------------------------------------------------------------------------------------------
 uint8_t micPacket(uint8_t *data, uint8_t len, uint16_t FrameCount, uint8_t dir)
 {
-
-	unsigned char NwkSKey[16] = _NWKSKEY;
-	uint8_t Block_B[16];
-	uint8_t X[16];
-	uint8_t Y[16];
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Constrói o bloco B usado pelo processo MIC.
-	Block_B[0] = 0x49; // 1 byte MIC código.
-
-	Block_B[1] = 0x00; // 4 byte 0x00.
-	Block_B[2] = 0x00;
-	Block_B[3] = 0x00;
-	Block_B[4] = 0x00;
-
-	Block_B[5] = dir; // 1 byte Direção.
-
-	Block_B[6] = DevAddr[3]; // 4 byte DevAddr.
-	Block_B[7] = DevAddr[2];
-	Block_B[8] = DevAddr[1];
-	Block_B[9] = DevAddr[0];
-
-	Block_B[10] = (FrameCount & 0x00FF); // 4 byte FCNT.
-	Block_B[11] = ((FrameCount >> 8) & 0x00FF);
-	Block_B[12] = 0x00; // Bytes superiores do contador de quadros.
-	Block_B[13] = 0x00; // Estes não são usados, são 0.
-
-	Block_B[14] = 0x00; // 1 byte 0x00.
-
-	Block_B[15] = len; // 1 byte len.
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Etapa 1: gerar as subchaves.
-	uint8_t k1[16];
-	uint8_t k2[16];
-	generate_subkey(NwkSKey, k1, k2);
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Copie os dados para um novo buffer que é precedido pelo bloco B0.
-	uint8_t micBuf[len + 16]; // B0 | dados.
-	for (uint8_t i = 0; i < 16; i++)
-		micBuf[i] = Block_B[i];
-	for (uint8_t i = 0; i < len; i++)
-		micBuf[i + 16] = data[i];
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Etapa 2: Calcular o número de blocos para o CMAC.
-	uint8_t numBlocks = len / 16 + 1; // Compensar o bloco B0.
-	if ((len % 16) != 0)
-		numBlocks++; // Se tivermos apenas um bloco de peça, leve tudo.
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Etapa 3: Calcular o preenchimento é necessário.
-	uint8_t restBits = len % 16; // se numBlocks não for um múltiplo de 16 bytes.
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Etapa 4: Se houver um bloco de descanso, retire-o.
-	// Último bloco. Nós movemos o Passo 4 para o final, pois precisamos de Y para calcular o último bloco.
-	// ---------------------------------------------------------------------------------------------------------
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Etapa 5: Faça um buffer de zeros.
-	memset(X, 0, 16);
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Etapa 6: faça a codificação real de acordo com o RFC.
-	for (uint8_t i = 0x0; i < (numBlocks - 1); i++)
-	{
-		for (uint8_t j = 0; j < 16; j++)
-			Y[j] = micBuf[(i * 16) + j];
-		mXor(Y, X);
-		AES_Encrypt(Y, NwkSKey);
-		for (uint8_t j = 0; j < 16; j++)
-			X[j] = Y[j];
-	}
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Passo 4: Se houver um bloco de descanso, retire-o.
-	// Último bloco. Nós movemos a Etapa 4 para o final, pois precisamos de Y para calcular o último bloco.
-	if (restBits)
-	{
-		for (uint8_t i = 0; i < 16; i++)
-		{
-			if (i < restBits)
-				Y[i] = micBuf[((numBlocks - 1) * 16) + i];
-			if (i == restBits)
-				Y[i] = 0x80;
-			if (i > restBits)
-				Y[i] = 0x00;
-		}
-		mXor(Y, k2);
-	}
-	else
-	{
-		for (uint8_t i = 0; i < 16; i++)
-		{
-			Y[i] = micBuf[((numBlocks - 1) * 16) + i];
-		}
-		mXor(Y, k1);
-	}
-	mXor(Y, X);
-	AES_Encrypt(Y, NwkSKey);
-
-	// ---------------------------------------------------------------------------------------------------------
-	// Passo 7: pronto, retorne o tamanho do MIC.
-	// Somente 4 bytes são retornados (32 bits), o que é menor do que o RFC recomenda.
-	// Retornamos adicionando 4 bytes aos dados, portanto, deve haver espaço na matriz de dados.
-	data[len + 0] = Y[0];
-	data[len + 1] = Y[1];
-	data[len + 2] = Y[2];
-	data[len + 3] = Y[3];
+	sensorKeys();
+	loraMic(&nwkKey, dir, sensorAddr(), FrameCount, data, len, data + len);
 	return 4;
 }
 
-#if _CHECK_MIC == 1
-// ---------------------------------------------------------------------------------------------------------
-// CHECKMIC
-// Função para verificar o MIC calculado para mensagens existentes e para novas mensagens.
-// Parâmetros:
-// - buf: buffer LoRa para verificar em bytes, os últimos 4 bytes contêm o MIC.
-// - len: Comprimento do buffer em bytes.
-// - key: Chave para usar no MIC. Normalmente este é o NwkSKey.
-// ---------------------------------------------------------------------------------------------------------
-static void checkMic(uint8_t *buf, uint8_t len, uint8_t *key)
-{
-	uint8_t cBuf[len + 1];
-
-	if (debug >= 2)
-	{
-		Serial.print(F("Antigo = "));
-		for (uint8_t i = 0; i < len; i++)
-		{
-			printHexDigit(buf[i]);
-			Serial.print(' ');
-		}
-		Serial.println();
-	}
-	for (uint8_t i = 0; i < len - 4; i++)
-		cBuf[i] = buf[i];
-	len -= 4;
-
-	uint16_t FrameCount = (cBuf[7] * 256) + cBuf[6];
-	len += micPacket(cBuf, len, FrameCount, 0);
-
-	if (debug >= 2)
-	{
-		Serial.print(F("Novo = "));
-		for (uint8_t i = 0; i < len; i++)
-		{
-			printHexDigit(cBuf[i]);
-			Serial.print(' ');
-		}
-		Serial.println();
-	}
-}
-#endif
-
 // ---------------------------------------------------------------------------------------------------------
 // SENSORPACKET
 // O gateway também pode ter sensores locais que precisam de relatórios.
@@ -428,9 +167,14 @@ int sensorPacket()
 {
 
 	uint8_t buff_up[512];	  // Declare o buffer aqui para evitar exceções.
-	uint8_t message[64] = {0}; // Carga útil, início para 0.
+	struct LoraUp up;		  // Registro de uplink "falso" para o buildPacket().
+	uint8_t *message = up.payLoad; // Carga útil.
 	uint8_t mlength = 0;
-	uint32_t tmst = micros();
+
+	memset(message, 0, 64);
+	up.tmst = micros();
+	up.ch = ifreq;
+	up.sf = sf;
 
 	// Nos próximos bytes, a falsa mensagem LoRa deve ser colocada.
 	// PHYPayload = MHDR | MACPAYLOAD | MIC
@@ -480,47 +224,35 @@ int sensorPacket()
 	// Então agora nosso pacote está pronto e podemos enviá-lo através da interface do gateway
   // Nota: Esteja ciente de que a mensagem do sensor (que é bytes) na mensagem deverá
   // ser expandido se o servidor expuser mensagens JSON.
-	int buff_index = buildPacket(tmst, buff_up, message, mlength, true);
+	up.payLength = mlength;
+	int buff_index = buildPacket(buff_up, &up, true);
 
 	frameCount++;
 
  // Para salvar a memória, só escrevemos o contador de quadros para EEPROM a cada 10 valores.
  // Isso também significa que vamos invalidar. Valor de 10 ao reiniciar o gateway.
 	if ((frameCount % 10) == 0)
-		writeGwayCfg(CONFIGFILE);
+	{
+		gwayConfig.fcnt = frameCount;
+		writeCounters();
+	}
 
 	//yield(); // XXX Podemos remover isso aqui?
 
-	if (buff_index > 512)
+	if ((buff_index < 0) || (buff_index > 512))
 	{
 		if (debug > 0)
 			Serial.println(F("sensorPacket:: Tamanho do buffer de erro muito grande."));
 		return (-1);
 	}
 
-	if (!sendUdp(ttnServer, _TTNPORT, buff_up, buff_index))
-	{
-		return (-1);
-	}
-#ifdef _THINGSERVER
-	if (!sendUdp(thingServer, _THINGPORT, buff_up, buff_index))
+	if (upSendAll(buff_up, buff_index, UP_FMT_ALL) == 0)
 	{
 		return (-1);
 	}
-#endif
 
-	if (_cad)
-	{
-		// Defina o estado para a varredura de CAD após o recebimento.
-		_state = S_SCAN; // Inicialize o scanner.
-		cadScanner();
-	}
-	else
-	{
-		// Reiniciar todas as coisas do RX lora.
-		_state = S_RX;
-		rxLoraModem();
-	}
+	// Volte a escutar: varredura de CAD ou RX, conforme _cad.
+	radioRestart(RADIO_LISTEN);
 
 	return (buff_index);
 }
@@ -34,15 +34,22 @@
 // Esta função faz toda a decodificação da mensagem do servidor e prepara um buffer de Payload.
 // A carga útil é realmente transmitida pela função sendPkt().
 // Esta função é usada para mensagens downstream regulares e para mensagens JOIN_ACCEPT.
+// O downlink decodificado não é transmitido aqui, mas inserido na fila downQ por ordem de tmst.
+//
+// Retorna valores:
+// - < 0 quando o txpk não pôde ser decodificado.
+// - TXACK_NONE quando o downlink entrou na fila.
+// - TXACK_TOO_LATE, TXACK_TOO_EARLY ou TXACK_COLLISION_PACKET quando foi recusado.
 //
 // NOTA: Esta não é uma função de interrupção, mas é iniciada por loop().
 // ---------------------------------------------------------------------------------------------------------
-int sendPacket(uint8_t *buf, uint8_t length)
+int sendPacket(uint8_t *buf, uint16_t length)
 {
 	// Pacote recebido com metadados:
 	// codr	: "4/5"
 	// data	: "Kuc5CSwJ7/a5JgPHrP29X9K6kf/Vs5kU6g==" // por exemplo.
 	// freq	: 868.1 // 868100000
+	// imme	: true/false // Transmissão imediata, tmst é ignorado.
 	// ipol	: true/false
 	// modu : "LORA"
 	// powe	: 14 // Definir por padrão.
@@ -63,86 +70,52 @@ int sendPacket(uint8_t *buf, uint8_t length)
 	// CFList (fill to 16 bytes)
 
 	int i = 0;
-	StaticJsonBuffer<312> jsonBuffer;
-	char *bufPtr = (char *)(buf);
-	buf[length] = 0;
+	struct LoraBuffer pkt; // Downlink decodificado, copiado para a fila por downQueueAdd().
+	struct txpkFields tx;
 
 #if DUSB >= 1
 	if (debug >= 2)
 	{
-		Serial.println((char *)buf);
+		Serial.write(buf, length); // buf não termina com '\0'.
+		Serial.println();
 		Serial.print(F("<"));
 		Serial.flush();
 	}
 #endif
-  // Use JSON para decodificar a string após os primeiros 4 bytes.
-  // Os dados para o nó estão no campo "data". Esta função destrói o buffer original.
-	JsonObject &root = jsonBuffer.parseObject(bufPtr);
-
-	if (!root.success())
+	// Metadados enviados pelo servidor (exemplo).
+	// {"txpk":{"codr":"4/5","data":"YCkEAgIABQABGmIwYX/kSn4Y","freq":868.1,"ipol":true,"modu":"LORA","powe":14,"rfch":0,"size":18,"tmst":1890991792,"datr":"SF7BW125"}}
+	//
+	// txpkParse() lê todos os campos numa passada só, direto do buffer recebido, e decodifica
+	// o campo "data" direto em pkt.payLoad. modu, codr e rfch não são usados.
+	int decLength = txpkParse(buf, length, &tx, pkt.payLoad);
+	if (decLength < 0)
 	{
 #if DUSB >= 1
 		Serial.print(F("sendPacket:: ERRO na decodificação do JSON."));
 		if (debug >= 2)
 		{
 			Serial.print(':');
-			Serial.println(bufPtr);
+			Serial.write(buf, length);
+			Serial.println();
 		}
 		Serial.flush();
 #endif
 		return (-1);
 	}
-	delay(1);
-	// Metadados enviados pelo servidor (exemplo).
-	// {"txpk":{"codr":"4/5","data":"YCkEAgIABQABGmIwYX/kSn4Y","freq":868.1,"ipol":true,"modu":"LORA","powe":14,"rfch":0,"size":18,"tmst":1890991792,"datr":"SF7BW125"}}
 
-	// Usado no protocolo:
-	const char *data = root["txpk"]["data"];
-	uint8_t psize = root["txpk"]["size"];
-	bool ipol = root["txpk"]["ipol"];
-	uint8_t powe = root["txpk"]["powe"];
-	uint32_t tmst = (uint32_t)root["txpk"]["tmst"].as<unsigned long>();
-
-	// Não usado no protocolo:
-	const char *datr = root["txpk"]["datr"]; // eg "SF7BW125".
-	const float ff = root["txpk"]["freq"]; // eg 869.525.
-	const char *modu = root["txpk"]["modu"]; // =="LORA".
-	const char *codr = root["txpk"]["codr"];
-	//if (root["txpk"].containsKey("imme") ) {
-	//	const bool imme = root["txpk"]["imme"]; // Transmissão Imediata (tmst não se importe).
-	//}
-
-	if (data != NULL)
-	{
-#if DUSB >= 1
-		if (debug >= 2)
-		{
-			Serial.print(F("data: "));
-			Serial.println((char *)data);
-			if (debug >= 2)
-				Serial.flush();
-		}
-#endif
-	}
-	else
-	{
-#if DUSB >= 1
-		Serial.println(F("Enviar Pacote:: ERRO: os dados são NULOS."));
-		if (debug >= 2)
-			Serial.flush();
-#endif
-		return (-1);
-	}
-
-	uint8_t iiq = (ipol ? 0x40 : 0x27); // se ipol==true 0x40 se não 0x27.
+	uint8_t iiq = (tx.ipol ? 0x40 : 0x27); // se ipol==true 0x40 se não 0x27.
 	uint8_t crc = 0x00; // desligue o CRC para TX.
-	uint8_t payLength = base64_dec_len((char *)data, strlen(data));
+	uint8_t payLength = decLength;
+	uint8_t powe = ((tx.found & TXPK_POWE) ? tx.powe : 14); // 14 dBm por padrão.
 
-	// Encha a carga útil com a mensagem decodificada.
-	base64_decode((char *)payLoad, (char *)data, strlen(data));
+	// Com imme o servidor pede a transmissão o mais cedo possível. downQueueAdd() lê o micros()
+	// de novo e recusa menos de _TX_MIN_AHEAD, então damos a folga de _TX_LEAD (o mesmo tempo
+	// que downDispatch() usa para carregar o rádio antes do tmst).
+	uint32_t tmst = (tx.imme ? micros() + _TX_MIN_AHEAD + _TX_LEAD : tx.tmst);
 
-	// Calcular o tempo de espera em microssegundos.
-	uint32_t w = (uint32_t)(tmst - micros());
+	// Calcular o tempo de espera em microssegundos. A diferença com sinal de 32 bits continua
+	// correta quando o micros() passa por 2^32 entre o uplink e o downlink.
+	int32_t w = (int32_t)(tmst - micros());
 
 #if _STRICT_1CH == 1
 	// Use o intervalo de tempo RX1 como esta é a nossa frequência.
@@ -159,25 +132,20 @@ int sendPacket(uint8_t *buf, uint8_t length)
 	const uint8_t sfTx = sfi; // Tome cuidado, TX sf não deve ser misturado com o SCAN.
 	const uint32_t fff = freq;
 #else
-	const uint8_t sfTx = atoi(datr + 2); // Converte "SF9BW125" para 9
-	// converter frequência dupla (MHz) em frequência uint32_t em Hz.
-	const uint32_t fff = (uint32_t)((uint32_t)((ff + 0.000035) * 1000)) * 1000;
+	const uint8_t sfTx = tx.sf; // "SF9BW125" já convertido para 9.
+	const uint32_t fff = tx.freq; // Frequência já em Hz, sem float.
 #endif
 
 	// Todos os dados estão em Payload e em parâmetros e precisam ser transmitidos.
   // A função é chamada no espaço do usuário.
-	_state = S_TX; // _state definido para transmitir.
-
-	LoraDown.payLoad = payLoad;
-	LoraDown.payLength = payLength;
-	LoraDown.tmst = tmst;
-	LoraDown.sfTx = sfTx;
-	LoraDown.powe = powe;
-	LoraDown.fff = fff;
-	LoraDown.crc = crc;
-	LoraDown.iiq = iiq;
-
-	Serial.println(F("Enviar Pacote:: LoraDown preenchido."));
+	pkt.payLength = payLength;
+	pkt.tmst = tmst;
+	pkt.sfTx = sfTx;
+	pkt.powe = powe;
+	pkt.fff = fff;
+	pkt.crc = crc;
+	pkt.iiq = iiq;
+	pkt.airtime = airTime(sfTx, payLength);
 
 #if DUSB >= 1
 	if (debug >= 2)
@@ -185,13 +153,15 @@ int sendPacket(uint8_t *buf, uint8_t length)
 		Serial.print(F("Requisição:: "));
 		Serial.print(F(" tmst="));
 		Serial.print(tmst);
+		Serial.print(F(" imme="));
+		Serial.print(tx.imme);
 		Serial.print(F(" aguardar="));
 		Serial.println(w);
 
 		Serial.print(F(" strict="));
 		Serial.print(_STRICT_1CH);
-		Serial.print(F(" datr="));
-		Serial.println(datr);
+		Serial.print(F(" datr=SF"));
+		Serial.println(tx.sf);
 		Serial.print(F(" freq="));
 		Serial.print(freq);
 		Serial.print(F(" ->"));
@@ -201,26 +171,22 @@ int sendPacket(uint8_t *buf, uint8_t length)
 		Serial.print(F(" ->"));
 		Serial.print(sfTx);
 
-		Serial.print(F(" modu="));
-		Serial.print(modu);
 		Serial.print(F(" powe="));
-		Serial.print(powe);
-		Serial.print(F(" codr="));
-		Serial.println(codr);
+		Serial.println(powe);
 
 		Serial.print(F(" ipol="));
-		Serial.println(ipol);
+		Serial.println(tx.ipol);
 		Serial.println(); // linha vazia entre mensagens.
 	}
 #endif
 
-	if (payLength != psize)
+	if ((tx.found & TXPK_SIZE) && (payLength != tx.size))
 	{
 #if DUSB >= 1
 		Serial.print(F("Envio de Pacote:: AVISO Comprimento de carga útil: "));
 		Serial.print(payLength);
-		Serial.print(F(", psize="));
-		Serial.println(psize);
+		Serial.print(F(", size="));
+		Serial.println(tx.size);
 		if (debug >= 2)
 			Serial.flush();
 #endif
@@ -230,7 +196,7 @@ int sendPacket(uint8_t *buf, uint8_t length)
 	{
 		for (i = 0; i < payLength; i++)
 		{
-			Serial.print(payLoad[i], HEX);
+			Serial.print(pkt.payLoad[i], HEX);
 			Serial.print(':');
 		}
 		Serial.println();
@@ -238,43 +204,338 @@ int sendPacket(uint8_t *buf, uint8_t length)
 			Serial.flush();
 	}
 #endif
-	cp_up_pkt_fwd++;
 
+	DOWN_LOCK();
+	int res = downQueueAdd(&pkt);
+	DOWN_UNLOCK();
 #if DUSB >= 1
-	Serial.println(F("Envio de pacote:: Concluído OK"));
+	if (res != TXACK_NONE)
+	{
+		Serial.print(F("Envio de pacote:: Recusado, erro="));
+		Serial.println(res);
+	}
+	else if (debug >= 1)
+	{
+		Serial.println(F("Envio de pacote:: Na fila OK"));
+	}
 #endif
-	return 1;
+	return (res);
 } //sendPacket
 
+// ---------------------------------------------------------------------------------------------------------
+// Insere um downlink na fila downQ, mantendo a fila ordenada por tmst.
+// Todas as comparações de tempo usam a diferença com sinal de 32 bits, então o rollover
+// do micros() (a cada 71 minutos) não atrapalha.
+//
+// O downlink é recusado com:
+// - TXACK_TOO_LATE se o tmst está a menos de _TX_MIN_AHEAD uSec no futuro (ou no passado).
+// - TXACK_TOO_EARLY se o tmst está a mais de _TX_MAX_AHEAD uSec no futuro.
+// - TXACK_COLLISION_PACKET se a fila está cheia ou se o intervalo [tmst - _TX_LEAD, tmst + airtime]
+//   se sobrepõe ao de um downlink que já está na fila.
+// ---------------------------------------------------------------------------------------------------------
+int downQueueAdd(struct LoraBuffer *pkt)
+{
+	int32_t ahead = (int32_t)(pkt->tmst - micros());
+
+	if (ahead < _TX_MIN_AHEAD)
+	{
+		downQ.tooLate++;
+		return (TXACK_TOO_LATE);
+	}
+	if (ahead > _TX_MAX_AHEAD)
+	{
+		downQ.tooEarly++;
+		return (TXACK_TOO_EARLY);
+	}
+	if (downQ.count >= DOWN_QUEUE_SIZE)
+	{
+		downQ.collision++;
+		return (TXACK_COLLISION_PACKET);
+	}
+
+	// Encontre a posição de inserção e verifique a sobreposição com os vizinhos.
+	uint8_t pos = 0;
+	while ((pos < downQ.count) && ((int32_t)(downQ.pkt[pos].tmst - pkt->tmst) <= 0))
+	{
+		pos++;
+	}
+	if ((pos > 0) &&
+		((int32_t)(downQ.pkt[pos - 1].tmst + downQ.pkt[pos - 1].airtime - (pkt->tmst - _TX_LEAD)) > 0))
+	{
+		downQ.collision++;
+		return (TXACK_COLLISION_PACKET);
+	}
+	if ((pos < downQ.count) &&
+		((int32_t)(pkt->tmst + pkt->airtime - (downQ.pkt[pos].tmst - _TX_LEAD)) > 0))
+	{
+		downQ.collision++;
+		return (TXACK_COLLISION_PACKET);
+	}
+
+	memmove(&downQ.pkt[pos + 1], &downQ.pkt[pos], (downQ.count - pos) * sizeof(struct LoraBuffer));
+	downQ.pkt[pos] = *pkt;
+	downQ.count++;
+	downQ.queued++;
+	if (downQ.count > downQ.highWater)
+	{
+		downQ.highWater = downQ.count;
+	}
+	return (TXACK_NONE);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Um downlink retirado da fila porque o seu tmst já passou. Chamado fora do DOWN_LOCK().
+// ---------------------------------------------------------------------------------------------------------
+static void downLate(int32_t ahead)
+{
+	downQ.lateDispatch++;
+#if DUSB >= 1
+	if (debug >= 1)
+	{
+		Serial.print(F("downDispatch:: Tarde demais, uSec="));
+		Serial.println(-ahead);
+	}
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Chamado pela radioService(). Quando o primeiro downlink da fila está a menos de _TX_LEAD uSec do seu
+// tmst, ele é copiado para LoraDown, carregado no rádio e armado (estado S_TX). Um downlink cujo
+// tmst já passou é descartado, pois o nó não está mais escutando; o receptor continua escutando.
+// ---------------------------------------------------------------------------------------------------------
+void downDispatch()
+{
+	if ((downQ.count == 0) || (_state == S_TX) || (_state == S_TXDONE))
+	{
+		return;
+	}
+
+	// Com _RADIO_TASK o readUdp() pode inserir na fila ao mesmo tempo; o teste e a retirada
+	// do primeiro downlink são feitos dentro do mesmo DOWN_LOCK().
+	DOWN_LOCK();
+	if (downQ.count == 0)
+	{
+		DOWN_UNLOCK();
+		return;
+	}
+	int32_t ahead = (int32_t)(downQ.pkt[0].tmst - micros());
+	if (ahead > _TX_LEAD)
+	{
+		DOWN_UNLOCK();
+		return;
+	}
+	if (ahead < 0)
+	{
+		// Descartado antes de parar o receptor.
+		downQ.count--;
+		memmove(&downQ.pkt[0], &downQ.pkt[1], downQ.count * sizeof(struct LoraBuffer));
+		DOWN_UNLOCK();
+		downLate(ahead);
+		return;
+	}
+	DOWN_UNLOCK();
+
+	// Pare o receptor antes de carregar o TX. Um quadro que terminou agora (RXDONE levantado, mas
+	// a interrupção ainda não atendida) está inteiro no FIFO e seria apagado pelo txLoraModem(),
+	// que limpa os flags: deixe a stateMachine() lê-lo primeiro, o downlink sai na próxima chamada.
+	bool stopped = false;
+	if (_state == S_RX)
+	{
+		opmode(OPMODE_STANDBY);
+		if (readRegister(REG_IRQ_FLAGS) & IRQ_LORA_RXDONE_MASK)
+		{
+			return;
+		}
+		stopped = true;
+	}
+
+	DOWN_LOCK();
+	bool found = (downQ.count > 0);
+	if (found)
+	{
+		ahead = (int32_t)(downQ.pkt[0].tmst - micros());
+		LoraDown = downQ.pkt[0];
+		downQ.count--;
+		memmove(&downQ.pkt[0], &downQ.pkt[1], downQ.count * sizeof(struct LoraBuffer));
+	}
+	DOWN_UNLOCK();
+
+	if (!found || (ahead < 0))
+	{
+		if (found)
+		{
+			downLate(ahead);
+		}
+		// Nada a transmitir: o receptor parado acima volta a escutar.
+		if (stopped)
+		{
+			if (_cad)
+			{
+				_state = S_SCAN;
+				cadScanner();
+			}
+			else
+			{
+				_state = S_RX;
+				rxLoraModem();
+			}
+		}
+		return;
+	}
+
+	// Carregue o FIFO agora e arme o temporizador; txTrigger() inicia o TX no tmst exato.
+	// Até lá o estado é S_TX e o loop() continua livre.
+	txLoraModem(
+		LoraDown.payLoad,
+		LoraDown.payLength,
+		LoraDown.sfTx,
+		LoraDown.powe,
+		LoraDown.fff,
+		LoraDown.crc,
+		LoraDown.iiq);
+	txArm(LoraDown.tmst);
+	downQ.sent++;
+	cp_up_pkt_fwd++;
+}
+
+#if STATISTICS >= 1
+// ---------------------------------------------------------------------------------------------------------
+// Atualiza a entrada do nó em nodes[] com um uplink de dados (Unconfirmed ou Confirmed Data Up).
+// A consulta examina no máximo NODE_PROBE posições; um nó novo usa a primeira posição livre ou,
+// sem nenhuma, a do nó visto há mais tempo.
+// Parâmetros:
+// - message, len: PHYPayload recebido.
+// - sf: fator de espalhamento.
+// - rssi, snr: pRSSI (dBm) e SNR (dB) do pacote.
+// ---------------------------------------------------------------------------------------------------------
+void nodeStat(const uint8_t *message, uint8_t len, uint8_t sf, int rssi, int snr)
+{
+	uint8_t mtype = message[0] >> 5;
+
+	// MHDR(1) | DevAddr(4) | FCtrl(1) | FCnt(2) | MIC(4).
+	if ((len < 12) || ((mtype != 0x02) && (mtype != 0x04)))
+	{
+		return;
+	}
+	uint32_t devAddr = message[1] | ((uint32_t)message[2] << 8) | ((uint32_t)message[3] << 16) | ((uint32_t)message[4] << 24);
+	uint16_t fcnt = message[6] | ((uint16_t)message[7] << 8);
+	uint32_t now = millis();
+	uint32_t h = devAddr * 0x9E3779B1; // Hash de Fibonacci.
+	struct nodeEntry *n = NULL;
+	uint16_t slot = 0;
+	uint32_t oldest = 0;
+
+	for (uint8_t p = 0; p < NODE_PROBE; p++)
+	{
+		uint16_t i = (uint16_t)((h >> 16) + p) & (_NODES - 1);
+		struct nodeEntry *e = &nodes[i];
+		if (e->packets == 0)
+		{
+			slot = i; // Nenhuma entrada da sequência está depois de uma posição livre.
+			break;
+		}
+		if (e->devAddr == devAddr)
+		{
+			n = e;
+			break;
+		}
+		if ((now - e->last) >= oldest)
+		{
+			slot = i;
+			oldest = now - e->last;
+		}
+	}
+
+	if (n == NULL)
+	{
+		n = &nodes[slot];
+		if (n->packets == 0)
+			nodeCount.used++;
+		else
+			nodeCount.evicted++;
+		memset(n, 0, sizeof(*n));
+		n->devAddr = devAddr;
+		n->rssi = rssi * 16;
+		n->snr = snr * 16;
+	}
+	else
+	{
+		uint16_t gap = fcnt - n->fcnt;
+		if ((gap > 1) && (gap <= NODE_GAP_MAX))
+			n->lost += gap - 1;
+		n->rssi += (rssi * 16 - n->rssi) / 8; // Peso 1/8 para o valor novo.
+		n->snr += (snr * 16 - n->snr) / 8;
+	}
+	n->fcnt = fcnt;
+	n->last = now;
+	n->packets++;
+	if ((sf >= 7) && (sf <= 12) && (n->sf[sf - 7] < 0xFFFF))
+		n->sf[sf - 7]++;
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------
+// Escreve o objeto rxpk {...} de up em w. Os nomes e os valores constantes são literais de tamanho
+// conhecido em tempo de compilação (jwLit); só tmst, freq, SF, lsnr, rssi, size e data são formatados.
+// O payload é codificado em base64 uma única vez, direto no datagrama.
+// Separada de buildRxpk() para o benchmark de tools/host (bench_rxpk) medir só a serialização.
+// ---------------------------------------------------------------------------------------------------------
+void rxpkJson(struct jsonWriter *w, struct LoraUp *up, long SNR, int rssi)
+{
+	jwLit(w, "{\"tmst\":");
+	jwUint(w, up->tmst);
+	jwLit(w, ",\"chan\":0,\"rfch\":0,\"freq\":");
+	jwFixed(w, freqs[up->ch], 6); // Hz para MHz com 6 casas decimais, sem float.
+	jwLit(w, ",\"stat\":1,\"modu\":\"LORA\",\"datr\":\"SF");
+	jwUint(w, up->sf);
+	jwLit(w, "BW125\",\"codr\":\"4/5\",\"lsnr\":");
+	jwInt(w, SNR);
+	jwLit(w, ",\"rssi\":");
+	jwInt(w, rssi);
+	jwLit(w, ",\"size\":");
+	jwUint(w, up->payLength);
+	jwLit(w, ",\"data\":\"");
+	jwBase64(w, up->payLoad, up->payLength);
+	jwLit(w, "\"}");
+}
+
 // ---------------------------------------------------------------------------------------------------------
 // UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP
 // Baseado na informação lida do transceptor LoRa (ou mensagem falsa)
-// cria uma mensagem de gateway para enviar upstream.
+// cria um objeto rxpk {...} (sem o cabeçalho nem o array) para enviar upstream.
+// Também atualiza as estatísticas de recepção, o Serial e o OLED para este quadro.
 //
 // Parâmetros:
-// tmst: registro de data e hora para incluir na mensagem ascendente.
-// buff_up: O buffer que é gerado para o desenvolvedor.
-// message: A mensagem de payload para incluir no buff_up.
-// messageLength: O número de bytes recebidos pelo transceptor LoRa.
+// w: O jsonWriter sobre o buffer do datagrama, posicionado onde o objeto é escrito.
+// up: O registro de uplink com a mensagem, o tmst, o canal e os valores de rádio.
 // internal: valor booleano para indicar se o sensor local é processado.
+// Retorna: true se o objeto coube no buffer.
 // ---------------------------------------------------------------------------------------------------------
-int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool internal)
+bool buildRxpk(struct jsonWriter *w, struct LoraUp *up, bool internal)
 {
 	long SNR;
 	int rssicorr;
 	int prssi; // pacote rssi.
 
-	char cfreq[12] = {0}; // Array de caracteres para manter a frequência em MHz.
+	uint32_t tmst = up->tmst;
 	lastTmst = tmst; // Seguindo/de acordo com especificação.
-	int buff_index = 0;
-	char b64[256];
 
-	uint8_t *message = LoraUp.payLoad;
-	char messageLength = LoraUp.payLength;
+	uint8_t *message = up->payLoad;
+	uint8_t messageLength = up->payLength;
 
-#if _CHECK_MIC == 1
-	unsigned char NwkSKey[16] = _NWKSKEY;
-	checkMic(message, messageLength, NwkSKey);
+#if _CHECK_MIC >= 1
+	// O MIC é verificado aqui, no lado da rede, e não na stateMachine(): com as chaves já
+	// preparadas o custo é de poucos blocos AES e não atrasa o rádio.
+	if (!internal)
+	{
+		uint8_t mic = micCheck(message, messageLength);
+#if DUSB >= 1
+		if ((mic == MIC_FAIL) && (debug >= 1))
+		{
+			Serial.println(F("buildRxpk:: MIC incorreto."));
+		}
+#endif
+	}
 #endif
 
 	// Leia SNR e RSSI do registro. Nota: Não para sensores internos!
@@ -287,26 +548,27 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 	}
 	else
 	{
-		SNR = LoraUp.snr;
-		prssi = LoraUp.prssi; // leia o registrador 0x1A, pacote rssi.
-		rssicorr = LoraUp.rssicorr;
+		SNR = up->snr;
+		prssi = up->prssi; // leia o registrador 0x1A, pacote rssi.
+		rssicorr = up->rssicorr;
 	}
 
 #if STATISTICS >= 1
-	// Receber estatísticas.
-	for (int m = (MAX_STAT - 1); m > 0; m--)
-		statr[m] = statr[m - 1];
-	statr[0].tmst = millis();
-	statr[0].ch = ifreq;
-	statr[0].prssi = prssi - rssicorr;
+	// Receber estatísticas: a mensagem mais antiga do anel é substituída.
+	statHead = ((statHead + 1 < MAX_STAT) ? statHead + 1 : 0);
+	struct stat_t *st = &statr[statHead];
+	st->tmst = millis();
+	st->ch = up->ch;
+	st->prssi = prssi - rssicorr;
 #if RSSI == 1
-	statr[0].rssi = _rssi - rssicorr;
+	st->rssi = _rssi - rssicorr;
 #endif
-	statr[0].sf = LoraUp.sf;
-	statr[0].node = (message[1] << 24 | message[2] << 16 | message[3] << 8 | message[4]);
+	st->sf = up->sf;
+	st->node = (message[1] << 24 | message[2] << 16 | message[3] << 8 | message[4]);
+	nodeStat(message, messageLength, up->sf, prssi - rssicorr, SNR);
 
 #if STATISTICS >= 2
-	switch (statr[0].sf)
+	switch (st->sf)
 	{
 	case SF7:
 		statc.sf7++;
@@ -395,25 +657,72 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 	yield();
 #endif
 
-	int j;
+	uint32_t encStart = micros();
+	int encIndex = w->index;
+	rxpkJson(w, up, SNR, prssi - rssicorr);
+	if (!internal)
+	{
+		batch.jsonUs += micros() - encStart;
+		batch.jsonBytes += w->index - encIndex;
+		batch.jsonFrames++;
+	}
 
-// A biblioteca XXX Base64 é nopad.
-// Portanto, talvez tenhamos que adicionar caracteres de preenchimento até que o Comprimento da mensagem seja múltiplo de 4!
-// Codifica a mensagem com messageLength em b64.
-	int encodedLen = base64_enc_len(messageLength); // máximo 341.
 #if DUSB >= 1
-	if ((debug >= 1) && (encodedLen > 255))
+	if ((w->overflow) && (debug >= 1))
 	{
-		Serial.println(F("buildPacket:: b64 erro."));
-		if (debug >= 2)
-			Serial.flush();
+		Serial.println(F("buildRxpk:: Erro, buffer pequeno demais."));
 	}
 #endif
-	base64_encode(b64, (char *)message, messageLength); // máximo 341.
+	return (!w->overflow);
+} // buildRxpk
+
+// ---------------------------------------------------------------------------------------------------------
+// Acrescenta o quadro up ao lote binário (batch.bin), veja PKT_PUSH_BIN em loraModem.h.
+// Retorna: o tamanho do registro, ou -1 se não coube.
+// ---------------------------------------------------------------------------------------------------------
+int rxbinAdd(struct LoraUp *up)
+{
+	uint32_t start = micros();
+	uint8_t *p = batch.bin + batch.binIndex;
+	uint32_t freq = freqs[up->ch];
+	int16_t rssi = up->prssi - up->rssicorr;
+	int len = RXBIN_HDR + up->payLength;
+
+	if (batch.binIndex + len > _RXPK_BUDGET)
+	{
+		return (-1);
+	}
+	p[0] = up->tmst;
+	p[1] = up->tmst >> 8;
+	p[2] = up->tmst >> 16;
+	p[3] = up->tmst >> 24;
+	p[4] = freq;
+	p[5] = freq >> 8;
+	p[6] = freq >> 16;
+	p[7] = freq >> 24;
+	p[8] = up->sf;
+	p[9] = (int8_t)up->snr;
+	p[10] = rssi;
+	p[11] = rssi >> 8;
+	p[12] = up->payLength;
+	memcpy(p + RXBIN_HDR, up->payLoad, up->payLength);
+	batch.binIndex += len;
+
+	batch.binUs += micros() - start;
+	batch.binBytes += len;
+	batch.binFrames++;
+	return (len);
+}
 
+// ---------------------------------------------------------------------------------------------------------
+// Escreve o cabeçalho de 12 bytes de um PUSH_DATA com o identificador ident (PKT_PUSH_DATA ou
+// PKT_PUSH_BIN) e um token aleatório.
+// ---------------------------------------------------------------------------------------------------------
+void pushHeader(uint8_t *buff_up, uint8_t ident)
+{
 	// Preencha o buffer de dados com campos fixos.
 	buff_up[0] = PROTOCOL_VERSION; // 0x01 entretanto.
-	buff_up[3] = PKT_PUSH_DATA;	// 0x00
+	buff_up[3] = ident;
 
 	// LEIA MAC ENDEREÇO DO ESP8266, e insira 0xFF 0xFF no meio.
 	buff_up[4] = MAC_array[0];
@@ -426,90 +735,29 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 	buff_up[11] = MAC_array[5];
 
 	// Começa a compor o datagrama com o cabeçalho.
-	uint8_t token_h = (uint8_t)rand(); // token aleatório.
-	uint8_t token_l = (uint8_t)rand(); // token aleatório.
-	buff_up[1] = token_h;
-	buff_up[2] = token_l;
-	buff_index = 12; // Cabeçalho binário de 12 bytes (!).
+	buff_up[1] = (uint8_t)rand(); // token aleatório.
+	buff_up[2] = (uint8_t)rand(); // token aleatório.
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Escreve o cabeçalho binário de 12 bytes de um PUSH_DATA e o início do JSON {"rxpk":[
+// Retorna: o índice em buff_up onde o primeiro objeto rxpk deve ser escrito.
+// ---------------------------------------------------------------------------------------------------------
+int rxpkHeader(uint8_t *buff_up)
+{
+	pushHeader(buff_up, PKT_PUSH_DATA); // 0x00
 
 	// Início da estrutura JSON que fará a carga útil.
-	memcpy((void *)(buff_up + buff_index), (void *)"{\"rxpk\":[", 9);
-	buff_index += 9;
-	buff_up[buff_index] = '{';
-	++buff_index;
-	j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, "\"tmst\":%u", tmst);
-#if DUSB >= 1
-	if ((j < 0) && (debug >= 1))
-	{
-		Serial.println(F("buildPacket:: Erro."));
-	}
-#endif
-	buff_index += j;
-	ftoa((double)freq / 1000000, cfreq, 6); // XXX Isso pode ser feito melhor.
-	j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"chan\":%1u,\"rfch\":%1u,\"freq\":%s", 0, 0, cfreq);
-	buff_index += j;
-	memcpy((void *)(buff_up + buff_index), (void *)",\"stat\":1", 9);
-	buff_index += 9;
-	memcpy((void *)(buff_up + buff_index), (void *)",\"modu\":\"LORA\"", 14);
-	buff_index += 14;
-
-	/* Taxa de dados e largura de banda do Lora, 16-19 gráficos úteis. */
-	switch (LoraUp.sf)
-	{
-	case SF6:
-		memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF6", 12);
-		buff_index += 12;
-		break;
-	case SF7:
-		memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF7", 12);
-		buff_index += 12;
-		break;
-	case SF8:
-		memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF8", 12);
-		buff_index += 12;
-		break;
-	case SF9:
-		memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF9", 12);
-		buff_index += 12;
-		break;
-	case SF10:
-		memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF10", 13);
-		buff_index += 13;
-		break;
-	case SF11:
-		memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF11", 13);
-		buff_index += 13;
-		break;
-	case SF12:
-		memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF12", 13);
-		buff_index += 13;
-		break;
-	default:
-		memcpy((void *)(buff_up + buff_index), (void *)",\"datr\":\"SF?", 12);
-		buff_index += 12;
-	}
-	memcpy((void *)(buff_up + buff_index), (void *)"BW125\"", 6);
-	buff_index += 6;
-	memcpy((void *)(buff_up + buff_index), (void *)",\"codr\":\"4/5\"", 13);
-	buff_index += 13;
-	j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"lsnr\":%li", SNR);
-	buff_index += j;
-	j = snprintf((char *)(buff_up + buff_index), TX_BUFF_SIZE - buff_index, ",\"rssi\":%d,\"size\":%u", prssi - rssicorr, messageLength);
-	buff_index += j;
-	memcpy((void *)(buff_up + buff_index), (void *)",\"data\":\"", 9);
-	buff_index += 9;
-
-	// Use a biblioteca gBase64 para preencher a string de dados.
-	encodedLen = base64_enc_len(messageLength); // máximo 341.
-	j = base64_encode((char *)(buff_up + buff_index), (char *)message, messageLength);
-
-	buff_index += j;
-	buff_up[buff_index] = '"';
-	++buff_index;
+	memcpy((void *)(buff_up + 12), (void *)"{\"rxpk\":[", 9);
+	return (12 + 9); // Cabeçalho binário de 12 bytes (!).
+}
 
-	// Fim da serialização de pacotes.
-	buff_up[buff_index] = '}';
-	++buff_index;
+// ---------------------------------------------------------------------------------------------------------
+// Fecha o array rxpk e o objeto JSON a partir de buff_index.
+// Retorna: o comprimento final do datagrama.
+// ---------------------------------------------------------------------------------------------------------
+int rxpkClose(uint8_t *buff_up, int buff_index)
+{
 	buff_up[buff_index] = ']';
 	++buff_index;
 
@@ -530,76 +778,214 @@ int buildPacket(uint32_t tmst, uint8_t *buff_up, struct LoraUp LoraUp, bool inte
 	}
 #endif
 	return (buff_index);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Monta um PUSH_DATA completo com um único rxpk (usado pelo sensor interno).
+//
+// Parâmetros:
+// buff_up: O buffer de TX_BUFF_SIZE bytes que é gerado para o desenvolvedor.
+// up: O registro de uplink.
+// internal: valor booleano para indicar se o sensor local é processado.
+// ---------------------------------------------------------------------------------------------------------
+int buildPacket(uint8_t *buff_up, struct LoraUp *up, bool internal)
+{
+	struct jsonWriter w;
+	jwInit(&w, buff_up, TX_BUFF_SIZE - 2, rxpkHeader(buff_up)); // Reserve "]}" para rxpkClose().
+	PROF_BEGIN(PROF_RXPK);
+	bool ok = buildRxpk(&w, up, internal);
+	PROF_END(PROF_RXPK);
+	if (!ok)
+	{
+		return (-1);
+	}
+	return (rxpkClose(buff_up, w.index));
 } // buildPacket
 
+// ---------------------------------------------------------------------------------------------------------
+// UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP
+// Envia o lote de rxpk montado por receivePacket() para os servidores.
+// Retorna valores:
+// - retorna o tamanho do datagrama enviado.
+// - retorna 0 quando o lote está vazio.
+// - retorna < 0 quando o envio UDP falhou.
+// ---------------------------------------------------------------------------------------------------------
+int rxpkFlush()
+{
+	if (batch.count == 0)
+	{
+		return (0);
+	}
+	int build_index = rxpkClose(batch.buf, batch.index);
+
+	// Latência adicionada: para cada quadro, o tempo entre entrar no lote e ser enviado.
+	uint32_t now = micros();
+	uint32_t wait = (uint32_t)batch.count * now - batch.sumIn;
+	batch.sumWait += wait;
+	if ((now - batch.firstIn) > batch.maxWait)
+	{
+		batch.maxWait = now - batch.firstIn; // O primeiro quadro é o que mais esperou.
+	}
+	batch.datagrams++;
+	batch.frames += batch.count;
+	if (batch.count > batch.maxFrames)
+	{
+		batch.maxFrames = batch.count;
+	}
+#if _METRICS >= 1
+	uint8_t frames = batch.count;
+#endif
+	batch.count = 0;
+	batch.index = 0;
+	int binIndex = batch.binIndex;
+	batch.binIndex = 0;
+
+#if _JOURNAL >= 1
+	// Sem WLAN, nem tente enviar: guarde o datagrama no journal para reenviar depois.
+	if (WiFi.status() != WL_CONNECTED)
+	{
+		journalAdd(batch.buf, build_index);
+		return (-1);
+	}
+#endif
+
+#if _PUSH_RETRY >= 1
+	// Guarde cópias para o reenvio, caso o PUSH_ACK não chegue (veja ackCheck()).
+	pushCopyAdd(batch.buf, build_index);
+	if (binIndex > 12)
+	{
+		pushCopyAdd(batch.bin, binIndex);
+	}
+#endif
+
+	// Esta é uma das possíveis áreas problemáticas.
+	// Se possível, o tráfego USB deve ficar de fora das rotinas de interrupção
+	// rxpk PUSH_DATA recebido do nó é rxpk (* 2, par. 3.2).
+	// O mesmo datagrama vai para todos os servidores do formato; só vai para o journal se nenhum
+	// servidor recebeu o lote. O journal é reenviado em JSON a todos, que o agregador também aceita.
+	int sent = upSendAll(batch.buf, build_index, UP_FMT_JSON);
+	if (binIndex > 12)
+	{
+		sent += upSendAll(batch.bin, binIndex, UP_FMT_BIN);
+	}
+	if (sent == 0)
+	{
+#if _JOURNAL >= 1
+		journalAdd(batch.buf, build_index);
+#endif
+		return (-1);
+	}
+#if _METRICS >= 1
+	// Latência de cada quadro, do RXDONE até o PUSH_DATA enviado.
+	now = micros();
+	for (uint8_t i = 0; (i < frames) && (i < RXPK_FRAMES); i++)
+	{
+		METRIC(MET_RX_UDP, now - batch.rxTmst[i]);
+	}
+#endif
+	return (build_index);
+} // rxpkFlush
+
 // ---------------------------------------------------------------------------------------------------------
 // UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP UP
 // Receber um pacote LoRa pelo ar, LoRa.
 //
-// Recebe uma mensagem LoRa e preenche o buffer de buff_up char.
+// Consome o registro mais antigo do anel de uplinks (upRing), preenchido pela stateMachine(),
+// e o acrescenta ao lote de rxpk. Como a especificação Semtech Gateway permite vários rxpk
+// em uma mensagem UDP, o lote só é enviado quando o próximo quadro não caberia mais em
+// _RXPK_BUDGET ou, pela netService(), quando o primeiro quadro esperou _RXPK_LATENCY mSec.
+//
 // Retorna valores:
-// - retorna o tamanho da string retornada em buff_up.
+// - retorna o tamanho do objeto rxpk acrescentado ao lote.
 // - retorna -1 quando nenhuma mensagem chegou.
 //
-// Esta é a função "highlevel" chamada por loop().
-// _state é S_RX ao iniciar e _state é S_STANDBY ao sair da função.
+// Esta é a função "highlevel" chamada pela netService().
 // ---------------------------------------------------------------------------------------------------------
 int receivePacket()
 {
-	uint8_t buff_up[TX_BUFF_SIZE]; // buffer para compor o pacote upstream para o servidor backend.
-	long SNR;
-	uint8_t message[128] = {0x00}; // O tamanho do MSG é de 128 bytes para rx.
-	uint8_t messageLength = 0;
-
-  // Mensagem regular recebida, consulte a tabela de especificações SX1276 18.
-  // Próximo comando também pode ser um "while" para combinar várias mensagens recebidas
-  // em uma mensagem UDP, pois a especificação Semtech Gateway permite isso.
-  // XXX Ainda não suportado
-
-  // Pegue o timestamp o mais rápido possível, para ter um timestamp de recepção preciso.
-  // TODO: tmst pode pular se estouro micros().
-  uint32_t tmst = (uint32_t)micros(); // Apenas microssegundos, rollover em.
-	lastTmst = tmst; // Seguindo/de acordo com especificação.
+	// O registro mais antigo do anel; o tmst já foi pego na stateMachine() no RXDONE.
+	struct LoraUp *up = upRingPeek();
+	if (up == NULL)
+	{
+		return (-1); // Nenhuma mensagem chegou.
+	}
+	lastTmst = up->tmst; // Seguindo/de acordo com especificação.
 
-	// Manipule os dados físicos lidos no LoraUp.
-	if (LoraUp.payLength > 0)
+	// Se este quadro não cabe mais no lote atual (mais a vírgula e o fechamento "]}"), envie o lote primeiro.
+	if ((batch.count > 0) && (batch.index + 1 + RXPK_MAX_LEN(up->payLength) + 3 > _RXPK_BUDGET))
 	{
+		rxpkFlush();
+	}
 
-		// Pacote recebido externamente, então o último parâmetro é falso (== LoRa externo).
-		int build_index = buildPacket(tmst, buff_up, LoraUp, false);
+	if (batch.count == 0)
+	{
+		batch.index = rxpkHeader(batch.buf);
+		batch.start = millis();
+		batch.sumIn = 0;
+		pushHeader(batch.bin, PKT_PUSH_BIN);
+		batch.binIndex = 12;
+	}
+	else
+	{
+		batch.buf[batch.index] = ',';
+		++batch.index;
+	}
 
-		// REPEATER é uma função especial em que retransmitimos a mensagem recebida em _ICHANN para _OCHANN.
-		// Nota: No momento, o OCHANN não pode ser o mesmo que o _ICHANN.
-#if REPEATER == 1
-		if (!sendLora(LoraUp.payLoad, LoraUp.payLength))
+	// Pacote recebido externamente, então o último parâmetro é falso (== LoRa externo).
+	// O writer reserva os 2 bytes do fechamento "]}" no fim do buffer.
+	struct jsonWriter w;
+	jwInit(&w, batch.buf, TX_BUFF_SIZE - 2, batch.index);
+	PROF_BEGIN(PROF_RXPK);
+	bool ok = buildRxpk(&w, up, false);
+	PROF_END(PROF_RXPK);
+	if (!ok)
+	{
+		upRingPop(); // Não cabe nem num lote vazio: descarte o quadro.
+		if (batch.count > 0)
 		{
-			return (-3);
+			batch.index--; // Remova a vírgula.
 		}
-#endif
-
-		LoraUp.payLength = 0;
-		LoraUp.payLoad[0] = 0x00;
+		return (-1);
+	}
+	int j = w.index - batch.index;
+	batch.index = w.index;
+	if (upBinary())
+	{
+		rxbinAdd(up);
+	}
+	uint32_t in = micros();
+	if (batch.count == 0)
+	{
+		batch.firstIn = in;
+	}
+	if (batch.count < RXPK_FRAMES)
+	{
+		batch.rxTmst[batch.count] = up->tmst;
+	}
+	batch.count++;
+	batch.sumIn += in;
 
-		// Esta é uma das possíveis áreas problemáticas.
-		// Se possível, o tráfego USB deve ficar de fora das rotinas de interrupção
-		// rxpk PUSH_DATA recebido do nó é rxpk (* 2, par. 3.2).
-#ifdef _TTNSERVER
-		if (!sendUdp(ttnServer, _TTNPORT, buff_up, build_index))
-		{
-			return (-1); // Recebeu uma mensagem.
-		}
-		yield();
+	// REPEATER é uma função especial em que retransmitimos a mensagem recebida em _ICHANN para _OCHANN.
+	// Nota: No momento, o OCHANN não pode ser o mesmo que o _ICHANN.
+#if REPEATER == 1
+	if (!sendLora((char *)up->payLoad, up->payLength))
+	{
+		upRingPop();
+		return (-3);
+	}
 #endif
 
-#ifdef _THINGSERVER
-		if (!sendUdp(thingServer, _THINGPORT, buff_up, build_index))
+	// O quadro já está no lote, então o registro pode ser liberado para o produtor.
+	upRingPop();
+
+	// Sem agrupamento, ou sem espaço para mais um quadro máximo: envie agora.
+	if ((_RXPK_LATENCY == 0) || (batch.index + 1 + RXPK_MAX_LEN(MAX_PAYLOAD_LENGTH) + 3 > _RXPK_BUDGET))
+	{
+		if (rxpkFlush() < 0)
 		{
-			return (-2); // Recebeu uma mensagem.
+			return (-1);
 		}
-#endif
-		return (build_index);
 	}
-
-	return (0); // Falha nenhuma mensagem lida.
+	return (j);
 
 } //receivePacket
@@ -25,13 +25,12 @@
 //
 // Notas:
 //
-// O servidor Web ESP trabalha com Strings para exibir o conteúdo html.
-// É preciso ter cuidado para que nem todos os dados sejam enviados para o servidor da Web em uma cadeia
-// como isso vai usar um monte de memória e possivelmente matar o heap (causa sistema falha ou outro comportamento não confiável.)
-// Em vez disso, a saída das várias tabelas na página da Web deve ser exibida em mandris para que as cordas sejam limitadas em tamanho.
-// Esteja ciente de que não usar strings, mas somente chamadas sendContent() tem seu próprio desvantagem de que estas chamadas demorem
-// muito tempo e façam com que a página seja exibido como uma velha máquina de escrever.
-// Então, o truque é fazer mandris que são enviados para o site usando uma string de resposta, mas não torna essas Strings muito grandes.
+// O servidor Web ESP envia a página em partes (chunked) com sendContent().
+// Montar a página inteira numa String usaria muita memória e fragmentaria o heap (causa falhas do sistema
+// ou outro comportamento não confiável), e chamar sendContent() para cada pedaço pequeno deixa a página
+// lenta como uma velha máquina de escrever.
+// Por isso todas as seções escrevem em um único buffer estático (wwwOut, veja loraWww.h) que é enviado
+// sempre que enche. A página é gerada sem nenhuma alocação no heap.
 // =========================================================================================================
 
 // PRINT IP
@@ -55,37 +54,66 @@ static void printIP(IPAddress ipa, const char sep, String &response)
 // =========================================================================================================
 // DECLARAÇÕES DO WEBSERVER
 
-// Nenhum no momento.
+// Buffer usado por todas as páginas. Quando enche ele é enviado com wwwSend().
+struct wwwChunk wwwOut;
+
+// Memória livre e maior bloco livre antes e depois de montar a última página,
+// para verificar que gerar a página não consome nem fragmenta o heap.
+struct wwwHeap
+{
+	uint32_t freeBefore;
+	uint32_t freeAfter;
+	uint32_t blockBefore;
+	uint32_t blockAfter;
+} wwwHeap;
 
 // =========================================================================================================
 // FUNÇÕES DO WEBSERVER
 
 // ---------------------------------------------------------------------------------------------------------
-// Imprimir uma string HEXadecimal de uma cadeia char de 4 bytes.
+// Envia os bytes do buffer wwwOut para o navegador, como mais uma parte da resposta.
 // ---------------------------------------------------------------------------------------------------------
-static void printHEX(char *hexa, const char sep, String &response)
+void wwwSend(const char *buf, int len)
 {
-	char m;
-	m = hexa[0];
-	if (m < 016)
-		response += '0';
-	response += String(m, HEX);
-	response += sep;
-	m = hexa[1];
-	if (m < 016)
-		response += '0';
-	response += String(m, HEX);
+	server.sendContent_P(buf, len);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Maior bloco livre do heap. No ESP8266 não há essa informação, então devolve a memória livre.
+// ---------------------------------------------------------------------------------------------------------
+static uint32_t heapBlock()
+{
+#ifdef ESP32BUILD
+	return (heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+#else
+	return (ESP.getFreeHeap());
+#endif
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Mesmo que printIP() acima, mas escrevendo no buffer da página.
+// ---------------------------------------------------------------------------------------------------------
+static void printIP(IPAddress ipa, const char sep, struct wwwChunk &response)
+{
+	response += ipa[0];
 	response += sep;
-	m = hexa[2];
-	if (m < 016)
-		response += '0';
-	response += String(m, HEX);
+	response += ipa[1];
 	response += sep;
-	m = hexa[3];
-	if (m < 016)
-		response += '0';
-	response += String(m, HEX);
+	response += ipa[2];
 	response += sep;
+	response += ipa[3];
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Imprimir uma string HEXadecimal de uma cadeia char de 4 bytes.
+// ---------------------------------------------------------------------------------------------------------
+static void printHEX(char *hexa, const char sep, struct wwwChunk &response)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		response.hex((uint8_t)hexa[i], 2);
+		response += sep;
+	}
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -94,7 +122,7 @@ static void printHEX(char *hexa, const char sep, String &response)
 // t contém o número de milli segundos desde o início do sistema que o evento aconteceu.
 // Portanto, um valor de 100 significaria que o evento ocorreu em 1 minuto e 40 segundos atrás.
 // ---------------------------------------------------------------------------------------------------------
-static void stringTime(unsigned long t, String &response)
+static void stringTime(unsigned long t, struct wwwChunk &response)
 {
 
 	if (t == 0)
@@ -133,19 +161,24 @@ static void stringTime(unsigned long t, String &response)
 		response += "Sabado ";
 		break;
 	}
-	response += String() + day(eventTime) + "-";
-	response += String() + month(eventTime) + "-";
-	response += String() + year(eventTime) + " ";
+	response += day(eventTime);
+	response += "-";
+	response += month(eventTime);
+	response += "-";
+	response += year(eventTime);
+	response += " ";
 
 	if (_hour < 10)
 		response += "0";
-	response += String() + _hour + ":";
+	response += _hour;
+	response += ":";
 	if (_minute < 10)
 		response += "0";
-	response += String() + _minute + ":";
+	response += _minute;
+	response += ":";
 	if (_second < 10)
 		response += "0";
-	response += String() + _second;
+	response += _second;
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -187,7 +220,7 @@ static void setVariables(const char *cmd, const char *arg)
 		{
 			ifreq = 0;
 			freq = freqs[0];
-			rxLoraModem();
+			radioRestart(RADIO_RX);
 		}
 		writeGwayCfg(CONFIGFILE); // Salvar configuração no arquivo.
 	}
@@ -215,7 +248,7 @@ static void setVariables(const char *cmd, const char *arg)
 			else
 				sf = (sf_t)((int)sf - 1);
 		}
-		rxLoraModem(); // Redefinir o rádio com o novo fator de espalhamento.
+		radioRestart(RADIO_RX); // Redefinir o rádio com o novo fator de espalhamento.
 		writeGwayCfg(CONFIGFILE); // Salvar a configuração no arquivo.
 	}
 
@@ -242,7 +275,7 @@ static void setVariables(const char *cmd, const char *arg)
 		}
 
 		freq = freqs[ifreq];
-		rxLoraModem(); // Redefinir o rádio com a nova frequência.
+		radioRestart(RADIO_RX); // Redefinir o rádio com a nova frequência.
 		writeGwayCfg(CONFIGFILE); // Salvar a configuração no arquivo.
 	}
 
@@ -265,7 +298,7 @@ static void setVariables(const char *cmd, const char *arg)
 	if (strcmp(cmd, "FCNT") == 0)
 	{
 		frameCount = 0;
-		rxLoraModem(); // Redefinir o rádio com a nova frequência.
+		radioRestart(RADIO_RX); // Redefinir o rádio com a nova frequência.
 		writeGwayCfg(CONFIGFILE);
 	}
 #endif
@@ -310,7 +343,7 @@ static void openWebPage()
 #if A_REFRESH == 1
 	//server.client().stop(); // Experimental, pare o servidor no caso de algo ainda estar em execução!
 #endif
-	String response = "";
+	struct wwwChunk &response = wwwOut;
 
 	server.sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
 	server.sendHeader("Pragma", "no-cache");
@@ -323,9 +356,11 @@ static void openWebPage()
 #if A_REFRESH == 1
 	if (gwayConfig.refresh)
 	{
-		response += String() + "<!DOCTYPE HTML><HTML><HEAD><meta http-equiv='refresh' content='" + _WWW_INTERVAL + ";http://";
+		response += "<!DOCTYPE HTML><HTML><HEAD><meta http-equiv='refresh' content='";
+		response += _WWW_INTERVAL;
+		response += ";http://";
 		printIP((IPAddress)WiFi.localIP(), '.', response);
-#ifdef ESP32BUILD == 1
+#ifdef ESP32BUILD
 		response += "'><TITLE>ESP32 LoRaWANGateway</TITLE>";
 #else
 		response += "'><TITLE>ESP8266 LoRaWANGateway</TITLE>";
@@ -333,10 +368,10 @@ static void openWebPage()
 	}
 	else
 	{
-		response += String() + "<!DOCTYPE HTML><HTML><HEAD><TITLE>ESP32 1ch LoRaGateway</TITLE>";
+		response += "<!DOCTYPE HTML><HTML><HEAD><TITLE>ESP32 1ch LoRaGateway</TITLE>";
 	}
 #else
-	response += String() + "<!DOCTYPE HTML><HTML><HEAD><TITLE>ESP8266 1ch LoRaGateway</TITLE>";
+	response += "<!DOCTYPE HTML><HTML><HEAD><TITLE>ESP8266 1ch LoRaGateway</TITLE>";
 #endif
 	response += "<META HTTP-EQUIV='CONTENT-TYPE' CONTENT='text/html; charset=UTF-8'>";
 	response += "<META NAME='AUTHOR' CONTENT='AdailSilva (adail101@hotmail.com)'>";
@@ -366,19 +401,21 @@ static void openWebPage()
 	uint8_t _hour = hour(secs);
 	uint8_t _minute = minute(secs);
 	uint8_t _second = second(secs);
-	response += String() + days + "-";
+	response += days;
+	response += "-";
 	if (_hour < 10)
 		response += "0";
-	response += String() + _hour + ":";
+	response += _hour;
+	response += ":";
 	if (_minute < 10)
 		response += "0";
-	response += String() + _minute + ":";
+	response += _minute;
+	response += ":";
 	if (_second < 10)
 		response += "0";
-	response += String() + _second;
+	response += _second;
 	response += ".<br>";
 
-	server.sendContent(response);
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -386,8 +423,8 @@ static void openWebPage()
 // ---------------------------------------------------------------------------------------------------------
 static void configData()
 {
-	String response = "";
-	String bg = "";
+	struct wwwChunk &response = wwwOut;
+	const char *bg;
 
 	response += "<h2>Configurações do LoRaGateway</h2>";
 
@@ -398,8 +435,7 @@ static void configData()
 	response += "<th colspan=\"2\" style=\"background-color: green; color: white; width:100px;\">Fixar</th>";
 	response += "</tr>";
 
-	bg = " background-color: ";
-	bg += (_cad ? "LightGreen" : "orange");
+	bg = (_cad ? " background-color: LightGreen" : " background-color: orange");
 	response += "<tr><td class=\"cell\">CAD</td>";
 	response += "<td style=\"border: 1px solid black;";
 	response += bg;
@@ -409,8 +445,7 @@ static void configData()
 	response += "<td style=\"border: 1px solid black; width:40px;\"><a href=\"CAD=0\"><button>OFF</button></a></td>";
 	response += "</tr>";
 
-	bg = " background-color: ";
-	bg += (_hop ? "LightGreen" : "orange");
+	bg = (_hop ? " background-color: LightGreen" : " background-color: orange");
 	response += "<tr><td class=\"cell\">HOP</td>";
 	response += "<td style=\"border: 1px solid black;";
 	response += bg;
@@ -442,7 +477,7 @@ static void configData()
 	}
 	else
 	{
-		response += String() + ifreq;
+		response += ifreq;
 		response += "</td>";
 		response += "<td class=\"cell\"><a href=\"FREQ=-1\"><button>-</button></a></td>";
 		response += "<td class=\"cell\"><a href=\"FREQ=1\"><button>+</button></a></td>";
@@ -475,10 +510,11 @@ static void configData()
 	response += "<button><a href=\"/FCNT\">Reiniciar</a></button></td>";
 	response += "</tr>";
 
-	bg = " background-color: ";
-	bg += ((gwayConfig.isNode == 1) ? "LightGreen" : "orange");
+	bg = ((gwayConfig.isNode == 1) ? " background-color: LightGreen" : " background-color: orange");
 	response += "<tr><td class=\"cell\">Gateway Node</td>";
-	response += "<td class=\"cell\" style=\"border: 1px solid black;" + bg + "\">";
+	response += "<td class=\"cell\" style=\"border: 1px solid black;";
+	response += bg;
+	response += "\">";
 	response += ((gwayConfig.isNode == true) ? "ON" : "OFF");
 	response += "<td style=\"border: 1px solid black; width:40px;\"><a href=\"NODE=1\"><button>ON</button></a></td>";
 	response += "<td style=\"border: 1px solid black; width:40px;\"><a href=\"NODE=0\"><button>OFF</button></a></td>";
@@ -486,10 +522,11 @@ static void configData()
 #endif
 
 #if A_REFRESH == 1
-	bg = " background-color: ";
-	bg += ((gwayConfig.refresh == 1) ? "LightGreen" : "orange");
+	bg = ((gwayConfig.refresh == 1) ? " background-color: LightGreen" : " background-color: orange");
 	response += "<tr><td class=\"cell\">Atualização da GUI</td>";
-	response += "<td class=\"cell\" style=\"border: 1px solid black;" + bg + "\">";
+	response += "<td class=\"cell\" style=\"border: 1px solid black;";
+	response += bg;
+	response += "\">";
 	response += ((gwayConfig.refresh == 1) ? "ON" : "OFF");
 	response += "<td style=\"border: 1px solid black; width:40px;\"><a href=\"REFR=1\"><button>ON</button></a></td>";
 	response += "<td style=\"border: 1px solid black; width:40px;\"><a href=\"REFR=0\"><button>OFF</button></a></td>";
@@ -505,11 +542,15 @@ static void configData()
 	// Repor todas as estatísticas.
 #if STATISTICS >= 1
 	response += "<tr><td class=\"cell\">Estatisticas</td>";
-	response += String() + "<td class=\"cell\">" + statc.resets + "</td>";
+	response += "<td class=\"cell\">";
+	response += statc.resets;
+	response += "</td>";
 	response += "<td colspan=\"2\" class=\"cell\"><a href=\"/RESET\"><button>Reiniciar</button></a></td></tr>";
 
 	response += "<tr><td class=\"cell\">Boots e Redefinições</td>";
-	response += String() + "<td class=\"cell\">" + gwayConfig.boots + "</td>";
+	response += "<td class=\"cell\">";
+	response += gwayConfig.boots;
+	response += "</td>";
 	response += "<td colspan=\"2\" class=\"cell\"><a href=\"/BOOT\"><button>Reiniciar</button></a></td></tr>";
 #endif
 	response += "</table>";
@@ -519,21 +560,22 @@ static void configData()
 	response += "<td class=\"cell\"></td><td colspan=\"2\" class=\"cell\"><a href=\"/UPDATE=1\"><button>Reiniciar</button></a></td></tr>";
 	response += "</table>";
 
-	server.sendContent(response);
 }
 
 // ---------------------------------------------------------------------------------------------------------
 // INTERRUPÇÃO DE DADOS.
 // Exibir dados de interrupção, mas apenas para depuração >= 2.
+// Bandeiras e máscara são as da última stateMachine() (lastIrqFlags, lastIrqMask): o SPI é da
+// tarefa do rádio e não é lido daqui.
 // ---------------------------------------------------------------------------------------------------------
 static void interruptData()
 {
-	uint8_t flags = readRegister(REG_IRQ_FLAGS);
-	uint8_t mask = readRegister(REG_IRQ_FLAGS_MASK);
+	uint8_t flags = lastIrqFlags;
+	uint8_t mask = lastIrqMask;
 
 	if (debug >= 2)
 	{
-		String response = "";
+		struct wwwChunk &response = wwwOut;
 
 		response += "<h2>Estado do sistema e interrupção</h2>";
 
@@ -571,31 +613,27 @@ static void interruptData()
 
 		response += "<tr><td class=\"cell\">Bandeiras (8 bits)</td>";
 		response += "<td class=\"cell\">0x";
-		if (flags < 16)
-			response += "0";
-		response += String(flags, HEX);
+		response.hex(flags, 2);
 		response += "</td></tr>";
 
 		response += "<tr><td class=\"cell\">Máscara (8 bits)</td>";
 		response += "<td class=\"cell\">0x";
-		if (mask < 16)
-			response += "0";
-		response += String(mask, HEX);
+		response.hex(mask, 2);
 		response += "</td></tr>";
 
 		response += "<tr><td class=\"cell\">Contador Re-Entrante</td>";
 		response += "<td class=\"cell\">";
-		response += String() + gwayConfig.reents;
+		response += gwayConfig.reents;
 		response += "</td></tr>";
 
 		response += "<tr><td class=\"cell\">Contador de Chamada NTP</td>";
 		response += "<td class=\"cell\">";
-		response += String() + gwayConfig.ntps;
+		response += gwayConfig.ntps;
 		response += "</td></tr>";
 
 		response += "<tr><td class=\"cell\">Contador de Erros NTP</td>";
 		response += "<td class=\"cell\">";
-		response += String() + gwayConfig.ntpErr;
+		response += gwayConfig.ntpErr;
 		response += "</td>";
 		response += "<td colspan=\"2\" style=\"border: 1px solid black;\">";
 		stringTime(gwayConfig.ntpErrTime, response);
@@ -611,16 +649,212 @@ static void interruptData()
 
 		response += "</table>";
 
-		server.sendContent(response);
 	} // if debug>=2
 }
 
+// ---------------------------------------------------------------------------------------------------------
+// PERFIL DAS ETAPAS.
+// Mostra, para cada etapa medida com PROF_BEGIN()/PROF_END(), o número de chamadas e a duração
+// média e máxima, e a taxa de pacotes recebidos desde a última visualização da página.
+// ---------------------------------------------------------------------------------------------------------
+#if PROFILE >= 1
+static void profileData()
+{
+	static const char *stageName[PROF_STAGES] = {"stateMachine()", "receivePkt()", "buildRxpk()", "sendPacket()", "readUdp()"};
+	static uint32_t lastRcv = 0; // cp_nb_rx_rcv na última visualização.
+	static uint32_t lastMs = 0; // millis() na última visualização.
+	struct wwwChunk &response = wwwOut;
+
+	response += "<h2>Perfil das etapas</h2>";
+
+	response += "<table class=\"config_table\">";
+	response += "<tr>";
+	response += "<th class=\"thead\">Etapa</th>";
+	response += "<th class=\"thead\">Chamadas</th>";
+	response += "<th class=\"thead\">Média (uSec)</th>";
+	response += "<th class=\"thead\">Máx. (uSec)</th>";
+	response += "</tr>";
+
+	for (int i = 0; i < PROF_STAGES; i++)
+	{
+		response += "<tr><td class=\"cell\">";
+		response += stageName[i];
+		response += "</td><td class=\"cell\">";
+		response += prof[i].calls;
+		response += "</td><td class=\"cell\">";
+		response += (prof[i].calls > 0 ? (uint32_t)(prof[i].total / prof[i].calls) : 0);
+		response += "</td><td class=\"cell\">";
+		response += prof[i].max;
+		response += "</td></tr>";
+	}
+
+	uint32_t ms = millis();
+	response += "<tr><td class=\"cell\">Pacotes/s (desde a última página)</td><td class=\"cell\">";
+	response += (ms != lastMs ? (float)(cp_nb_rx_rcv - lastRcv) * 1000 / (ms - lastMs) : 0.0);
+	response += "</td></tr>";
+	lastRcv = cp_nb_rx_rcv;
+	lastMs = ms;
+
+	response += "</table>";
+
+}
+#endif
+
+// ---------------------------------------------------------------------------------------------------------
+// VARREDURA DO CAD.
+// Mostra a ordem de SF usada pelo CAD, o peso aprendido de cada SF e, para a ordem fixa e a
+// adaptativa, as varreduras com detect, as perdas (todos os SF sem detect), os passos médios e o
+// tempo médio do primeiro CAD até o detect. Os botões trocam a ordem para comparar as duas.
+// ---------------------------------------------------------------------------------------------------------
+static void cadData()
+{
+	static const char *modeName[2] = {"Fixa", "Adaptativa"};
+	struct wwwChunk &response = wwwOut;
+
+	if (!_cad)
+		return;
+
+	response += "<h2>Varredura do CAD</h2>";
+
+	response += "<table class=\"config_table\">";
+	response += "<tr><td class=\"cell\">Ordem (";
+	response += modeName[_cadAdapt ? 1 : 0];
+	response += ")</td><td class=\"cell\" colspan=\"2\">";
+	for (int i = 0; i < CAD_SFS; i++)
+	{
+		response += "SF";
+		response += (_cadAdapt ? cadScan.order[i] : SF7 + i);
+		response += ' ';
+	}
+	response += "</td><td class=\"cell\"><a href=\"CADORD=1\"><button>Adaptativa</button></a></td>";
+	response += "<td class=\"cell\"><a href=\"CADORD=0\"><button>Fixa</button></a></td></tr>";
+
+	response += "<tr><td class=\"cell\">Peso (SF7..SF12)</td><td class=\"cell\" colspan=\"4\">";
+	for (int i = 0; i < CAD_SFS; i++)
+	{
+		response += cadScan.weight[i];
+		response += ' ';
+	}
+	response += "</td></tr>";
+
+	response += "<tr>";
+	response += "<th class=\"thead\">Ordem</th>";
+	response += "<th class=\"thead\">Detects</th>";
+	response += "<th class=\"thead\">Perdas</th>";
+	response += "<th class=\"thead\">Passos médios</th>";
+	response += "<th class=\"thead\">Tempo até o detect (uSec)</th>";
+	response += "</tr>";
+	for (int m = 0; m < 2; m++)
+	{
+		uint32_t d = cadScan.detects[m];
+		response += "<tr><td class=\"cell\">";
+		response += modeName[m];
+		response += "</td><td class=\"cell\">";
+		response += d;
+		response += "</td><td class=\"cell\">";
+		response += cadScan.misses[m];
+		response += " (";
+		response += (d + cadScan.misses[m] > 0 ? 100.0 * cadScan.misses[m] / (d + cadScan.misses[m]) : 0.0);
+		response += "%)</td><td class=\"cell\">";
+		response += (d > 0 ? (double)cadScan.steps[m] / d : 0.0);
+		response += "</td><td class=\"cell\">";
+		response += (d > 0 ? (uint32_t)(cadScan.detectTime[m] / d) : 0);
+		response += "</td></tr>";
+	}
+	response += "</table>";
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// AGENDADOR DE VARREDURA.
+// Mostra a tabela do agendador de varredura (HOP) e, para cada posição, a permanência configurada
+// e a atual, as visitas, a parcela do tempo no canal (ocupação), os CAD detects, os quadros
+// recebidos, as visitas com a troca atrasada (perdidas) e as que esperaram um quadro (adiadas).
+// Os botões ligam e desligam a permanência adaptativa.
+// ---------------------------------------------------------------------------------------------------------
+static void scanData()
+{
+	struct wwwChunk &response = wwwOut;
+	uint64_t total = 0;
+
+	if (!_hop)
+		return;
+
+	for (int i = 0; i < _SCAN_SLOTS; i++)
+	{
+		total += scan.slot[i].occupancy;
+	}
+
+	response += "<h2>Agendador de varredura</h2>";
+
+	response += "<table class=\"config_table\">";
+	response += "<tr><td class=\"cell\">Permanência (";
+	response += (_scanAdapt ? "Adaptativa" : "Fixa");
+	response += ")</td><td class=\"cell\" colspan=\"4\">Voltas: ";
+	response += scan.cycles;
+	response += ", maior atraso de troca: ";
+	response += scan.lateMax;
+	response += " uSec</td>";
+	response += "<td class=\"cell\" colspan=\"2\"><a href=\"SCANADAPT=1\"><button>Adaptativa</button></a></td>";
+	response += "<td class=\"cell\" colspan=\"2\"><a href=\"SCANADAPT=0\"><button>Fixa</button></a></td></tr>";
+
+	response += "<tr>";
+	response += "<th class=\"thead\">Posição</th>";
+	response += "<th class=\"thead\">Frequência</th>";
+	response += "<th class=\"thead\">SF</th>";
+	response += "<th class=\"thead\">Permanência (mSec)</th>";
+	response += "<th class=\"thead\">Visitas</th>";
+	response += "<th class=\"thead\">Ocupação</th>";
+	response += "<th class=\"thead\">Detects / Quadros</th>";
+	response += "<th class=\"thead\">Perdidas</th>";
+	response += "<th class=\"thead\">Adiadas</th>";
+	response += "</tr>";
+	for (int i = 0; i < _SCAN_SLOTS; i++)
+	{
+		struct scanSlot *s = &scan.slot[i];
+		if (!scanValid(i))
+			continue;
+		response += "<tr><td class=\"cell\">";
+		response += i;
+		if (scan.active && (scan.pos == i))
+			response += " *";
+		response += "</td><td class=\"cell\">";
+		response += (double)freqs[s->ch] / 1000000;
+		response += "</td><td class=\"cell\">";
+		for (int k = 0; k < CAD_SFS; k++)
+		{
+			if (s->sfMask & (1 << k))
+			{
+				response += SF7 + k;
+				response += ' ';
+			}
+		}
+		response += "</td><td class=\"cell\">";
+		response += gwayConfig.scan[i].dwell;
+		response += " / ";
+		response += s->dwell;
+		response += "</td><td class=\"cell\">";
+		response += s->visits;
+		response += "</td><td class=\"cell\">";
+		response += (total > 0 ? 100.0 * s->occupancy / total : 0.0);
+		response += "%</td><td class=\"cell\">";
+		response += s->detects;
+		response += " / ";
+		response += s->packets;
+		response += "</td><td class=\"cell\">";
+		response += s->missed;
+		response += "</td><td class=\"cell\">";
+		response += s->held;
+		response += "</td></tr>";
+	}
+	response += "</table>";
+}
+
 // ---------------------------------------------------------------------------------------------------------
 // DADOS DE ESTATÍSTICA.
 // ---------------------------------------------------------------------------------------------------------
 static void statisticsData()
 {
-	String response = "";
+	struct wwwChunk &response = wwwOut;
 
 	response += "<h2>Estatísticas do pacote</h2>";
 
@@ -632,14 +866,139 @@ static void statisticsData()
 	response += "</tr>";
 
 	response += "<tr><td class=\"cell\">Total de Pacotes de Uplink</td>";
-	response += "<td class=\"cell\">" + String(cp_nb_rx_rcv) + "</td>";
-	response += "<td class=\"cell\">" + String((cp_nb_rx_rcv * 3600) / (millis() / 1000)) + "</td></tr>";
+	response += "<td class=\"cell\">";
+	response += cp_nb_rx_rcv;
+	response += "</td>";
+	response += "<td class=\"cell\">";
+	response += (millis() >= 1000 ? (cp_nb_rx_rcv * 3600) / (millis() / 1000) : 0); // No primeiro segundo o divisor é 0.
+	response += "</td></tr>";
 	response += "<tr><td class=\"cell\">Pacotes Uplink Completados</td><td class=\"cell\">";
 	response += cp_nb_rx_ok;
 	response += "</tr>";
 	response += "<tr><td class=\"cell\">Pacotes de Downlink</td><td class=\"cell\">";
 	response += cp_up_pkt_fwd;
 	response += "</tr>";
+	response += "<tr><td class=\"cell\">Downlinks na fila (aceitos / ocupação máx.)</td><td class=\"cell\">";
+	response += downQ.queued;
+	response += " / ";
+	response += downQ.highWater;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Downlinks recusados (TOO_LATE / TOO_EARLY / COLLISION)</td><td class=\"cell\">";
+	response += downQ.tooLate;
+	response += " / ";
+	response += downQ.tooEarly;
+	response += " / ";
+	response += downQ.collision;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Downlinks perdidos na fila (atrasados)</td><td class=\"cell\">";
+	response += downQ.lateDispatch;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Jitter do TX (último / mín. / máx. / média uSec)</td><td class=\"cell\">";
+	response += txTime.last;
+	response += " / ";
+	response += txTime.min;
+	response += " / ";
+	response += txTime.max;
+	response += " / ";
+	response += (txTime.count > 0 ? (int32_t)(txTime.sum / txTime.count) : 0);
+	response += "</tr>";
+#if _TX_CAL >= 1
+	response += "<tr><td class=\"cell\">Atraso do rádio no TX (uSec / medidas)</td><td class=\"cell\">";
+	response += txTime.lag;
+	response += " / ";
+	response += txTime.calCount;
+	response += "</tr>";
+#endif
+#if ((GATEWAYNODE == 1) || (_CHECK_MIC >= 1)) && (_CRYPTO_TEST >= 1)
+	response += "<tr><td class=\"cell\">Autoteste AES/CMAC (ciclos por MIC)</td><td class=\"cell\">";
+	response += (cryptoBench.passed ? "OK" : "ERRO");
+	response += " (";
+	response += cryptoBench.micCycles;
+	response += ")</tr>";
+#endif
+#if _CHECK_MIC >= 1
+	response += "<tr><td class=\"cell\">MIC dos uplinks (correto / incorreto / desconhecido)</td><td class=\"cell\">";
+	response += micCount.ok;
+	response += " / ";
+	response += micCount.fail;
+	response += " / ";
+	response += micCount.unknown;
+	response += "</tr>";
+#endif
+	response += "<tr><td class=\"cell\">Uplinks descartados (DevAddr recusado / repetição)</td><td class=\"cell\">";
+	response += upDrop.deny;
+	response += " / ";
+	response += upDrop.dup;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Configuração (leitura uSec / gravações / contadores / erros)</td><td class=\"cell\">";
+	response += cfgState.loadUs;
+	response += " / ";
+	response += cfgState.writes;
+	response += " / ";
+	response += cfgState.cntAppends;
+	response += " / ";
+	response += cfgState.errors;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Transações SPI (total)</td><td class=\"cell\">";
+	response += spiTrans;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Transações SPI último pacote</td><td class=\"cell\">";
+	response += rxSpiTrans;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Leitura último pacote (uSec)</td><td class=\"cell\">";
+	response += rxSpiMicros;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Escritas SPI evitadas (cache)</td><td class=\"cell\">";
+	response += spiWriteSkip;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Anel de uplink (ocupação máx.)</td><td class=\"cell\">";
+	response += upRing.highWater;
+	response += " / ";
+	response += UP_RING_SIZE;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Uplinks perdidos (anel cheio)</td><td class=\"cell\">";
+	response += upRing.overflow;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Datagramas PUSH_DATA (rxpk)</td><td class=\"cell\">";
+	response += batch.datagrams;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">rxpk JSON (bytes / uSec por quadro)</td><td class=\"cell\">";
+	response += (batch.jsonFrames > 0 ? (float)batch.jsonBytes / batch.jsonFrames : 0.0);
+	response += " / ";
+	response += (batch.jsonFrames > 0 ? (float)batch.jsonUs / batch.jsonFrames : 0.0);
+	response += "</tr>";
+	if (batch.binFrames > 0)
+	{
+		response += "<tr><td class=\"cell\">rxpk binário (bytes / uSec por quadro)</td><td class=\"cell\">";
+		response += (float)batch.binBytes / batch.binFrames;
+		response += " / ";
+		response += (float)batch.binUs / batch.binFrames;
+		response += "</tr>";
+	}
+	response += "<tr><td class=\"cell\">Quadros por datagrama (média / máx.)</td><td class=\"cell\">";
+	response += (batch.datagrams > 0 ? (float)batch.frames / batch.datagrams : 0.0);
+	response += " / ";
+	response += batch.maxFrames;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Latência do lote (média / máx. mSec)</td><td class=\"cell\">";
+	response += (batch.frames > 0 ? (uint32_t)(batch.sumWait / batch.frames) / 1000 : 0);
+	response += " / ";
+	response += (batch.maxWait / 1000);
+	response += "</tr>";
+#if _JOURNAL >= 1
+	response += "<tr><td class=\"cell\">Journal (guardados / reenviados / descartados / pendentes)</td><td class=\"cell\">";
+	response += journal.queued;
+	response += " / ";
+	response += journal.replayed;
+	response += " / ";
+	response += journal.evicted;
+	response += " / ";
+	response += (journal.head - journal.tail);
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Journal erros SPIFFS</td><td class=\"cell\">";
+	response += journal.errors;
+	response += "</tr>";
+#endif
 
 	// Forneça uma tabela com todos os dados do SF, incluindo a porcentagem de mensagens.
 #if STATISTICS >= 2
@@ -647,43 +1006,48 @@ static void statisticsData()
 	response += "<td class=\"cell\">";
 	response += statc.sf7;
 	response += "<td class=\"cell\">";
-	response += String(cp_nb_rx_rcv > 0 ? 100 * statc.sf7 / cp_nb_rx_rcv : 0) + " %";
+	response += (cp_nb_rx_rcv > 0 ? 100 * statc.sf7 / cp_nb_rx_rcv : 0);
+	response += " %";
 	response += "</td></tr>";
 	response += "<tr><td class=\"cell\">SF8 rcvd</td>";
 	response += "<td class=\"cell\">";
 	response += statc.sf8;
 	response += "<td class=\"cell\">";
-	response += String(cp_nb_rx_rcv > 0 ? 100 * statc.sf8 / cp_nb_rx_rcv : 0) + " %";
+	response += (cp_nb_rx_rcv > 0 ? 100 * statc.sf8 / cp_nb_rx_rcv : 0);
+	response += " %";
 	response += "</td></tr>";
 	response += "<tr><td class=\"cell\">SF9 rcvd</td>";
 	response += "<td class=\"cell\">";
 	response += statc.sf9;
 	response += "<td class=\"cell\">";
-	response += String(cp_nb_rx_rcv > 0 ? 100 * statc.sf9 / cp_nb_rx_rcv : 0) + " %";
+	response += (cp_nb_rx_rcv > 0 ? 100 * statc.sf9 / cp_nb_rx_rcv : 0);
+	response += " %";
 	response += "</td></tr>";
 	response += "<tr><td class=\"cell\">SF10 rcvd</td>";
 	response += "<td class=\"cell\">";
 	response += statc.sf10;
 	response += "<td class=\"cell\">";
-	response += String(cp_nb_rx_rcv > 0 ? 100 * statc.sf10 / cp_nb_rx_rcv : 0) + " %";
+	response += (cp_nb_rx_rcv > 0 ? 100 * statc.sf10 / cp_nb_rx_rcv : 0);
+	response += " %";
 	response += "</td></tr>";
 	response += "<tr><td class=\"cell\">SF11 rcvd</td>";
 	response += "<td class=\"cell\">";
 	response += statc.sf11;
 	response += "<td class=\"cell\">";
-	response += String(cp_nb_rx_rcv > 0 ? 100 * statc.sf11 / cp_nb_rx_rcv : 0) + " %";
+	response += (cp_nb_rx_rcv > 0 ? 100 * statc.sf11 / cp_nb_rx_rcv : 0);
+	response += " %";
 	response += "</td></tr>";
 	response += "<tr><td class=\"cell\">SF12 rcvd</td>";
 	response += "<td class=\"cell\">";
 	response += statc.sf12;
 	response += "<td class=\"cell\">";
-	response += String(cp_nb_rx_rcv > 0 ? 100 * statc.sf12 / cp_nb_rx_rcv : 0) + " %";
+	response += (cp_nb_rx_rcv > 0 ? 100 * statc.sf12 / cp_nb_rx_rcv : 0);
+	response += " %";
 	response += "</td></tr>";
 #endif
 
 	response += "</table>";
 
-	server.sendContent(response);
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -697,7 +1061,7 @@ static void statisticsData()
 static void sensorData()
 {
 #if STATISTICS >= 1
-	String response = "";
+	struct wwwChunk &response = wwwOut;
 
 	response += "<h2>Histórico de Mensagens</h2>";
 	response += "<table class=\"config_table\">";
@@ -714,47 +1078,116 @@ static void sensorData()
 	}
 #endif
 	response += "</tr>";
-	server.sendContent(response);
 
+	// Do mais novo (statr[statHead]) para o mais antigo.
 	for (int i = 0; i < MAX_STAT; i++)
 	{
-		if (statr[i].sf == 0)
+		struct stat_t *st = &statr[(statHead + MAX_STAT - i) % MAX_STAT];
+		if (st->sf == 0)
 			break;
 
-		response = "";
 
-		response += String() + "<tr><td class=\"cell\">";
-		stringTime(statr[i].tmst, response);
+		response += "<tr><td class=\"cell\">";
+		stringTime(st->tmst, response);
 		response += "</td>";
-		response += String() + "<td class=\"cell\">";
-		printHEX((char *)(&(statr[i].node)), ' ', response);
+		response += "<td class=\"cell\">";
+		printHEX((char *)(&(st->node)), ' ', response);
+		response += "</td>";
+		response += "<td class=\"cell\">";
+		response += st->ch;
+		response += "</td>";
+		response += "<td class=\"cell\">";
+		response += freqs[st->ch];
+		response += "</td>";
+		response += "<td class=\"cell\">";
+		response += st->sf;
 		response += "</td>";
-		response += String() + "<td class=\"cell\">" + statr[i].ch + "</td>";
-		response += String() + "<td class=\"cell\">" + freqs[statr[i].ch] + "</td>";
-		response += String() + "<td class=\"cell\">" + statr[i].sf + "</td>";
 
-		response += String() + "<td class=\"cell\">" + statr[i].prssi + "</td>";
+		response += "<td class=\"cell\">";
+		response += st->prssi;
+		response += "</td>";
 #if RSSI == 1
 		if (debug > 1)
 		{
-			response += String() + "<td class=\"cell\">" + statr[i].rssi + "</td>";
+			response += "<td class=\"cell\">";
+			response += st->rssi;
+			response += "</td>";
 		}
 #endif
 		response += "</tr>";
-		server.sendContent(response);
 	}
 
-	server.sendContent("</table>");
+	response += "</table>";
 
 #endif
 }
 
+// ---------------------------------------------------------------------------------------------------------
+// Exibe a tabela de estatísticas por nó (nodes[]): último uplink, pacotes, uplinks por SF,
+// médias de pRSSI e SNR e a perda estimada pelos saltos do FCnt.
+// ---------------------------------------------------------------------------------------------------------
+static void nodeData()
+{
+#if STATISTICS >= 1
+	struct wwwChunk &response = wwwOut;
+
+	response += "<h2>Estatísticas por Nó</h2>";
+	response += "<p>Nós: ";
+	response += nodeCount.used;
+	response += " / ";
+	response += _NODES;
+	response += ", substituídos: ";
+	response += nodeCount.evicted;
+	response += "</p>";
+	response += "<table class=\"config_table\">";
+	response += "<tr>";
+	response += "<th class=\"thead\">DevAddr</th>";
+	response += "<th class=\"thead\">Último</th>";
+	response += "<th class=\"thead\">Pacotes</th>";
+	response += "<th class=\"thead\">SF7 / 8 / 9 / 10 / 11 / 12</th>";
+	response += "<th class=\"thead\">pRSSI</th>";
+	response += "<th class=\"thead\">SNR</th>";
+	response += "<th class=\"thead\">Perda (%)</th>";
+	response += "</tr>";
+
+	for (int i = 0; i < _NODES; i++)
+	{
+		struct nodeEntry *n = &nodes[i];
+		if (n->packets == 0)
+			continue;
+
+		response += "<tr><td class=\"cell\">";
+		response.hex(n->devAddr, 8);
+		response += "</td><td class=\"cell\">";
+		stringTime(n->last, response);
+		response += "</td><td class=\"cell\">";
+		response += n->packets;
+		response += "</td><td class=\"cell\">";
+		for (int s = 0; s < 6; s++)
+		{
+			if (s > 0)
+				response += " / ";
+			response += n->sf[s];
+		}
+		response += "</td><td class=\"cell\">";
+		response += n->rssi / 16.0;
+		response += "</td><td class=\"cell\">";
+		response += n->snr / 16.0;
+		response += "</td><td class=\"cell\">";
+		response += 100.0 * n->lost / (n->packets + n->lost);
+		response += "</td></tr>";
+	}
+
+	response += "</table>";
+#endif
+}
+
 // ---------------------------------------------------------------------------------------------------------
 // DADOS DO SISTEMA.
 // ---------------------------------------------------------------------------------------------------------
 static void systemData()
 {
-	String response = "";
+	struct wwwChunk &response = wwwOut;
 	response += "<h2>Estado do Sistema</h2>";
 
 	response += "<table class=\"config_table\">";
@@ -766,30 +1199,35 @@ static void systemData()
 
 	response += "<tr><td style=\"border: 1px solid black; width:120px;\">Identificador do Gateway</td>";
 	response += "<td class=\"cell\">";
-	if (MAC_array[0] < 0x10)
-		response += '0';
-	response += String(MAC_array[0], HEX); // O array MAC é sempre retornado em letras minúsculas.
-	if (MAC_array[1] < 0x10)
-		response += '0';
-	response += String(MAC_array[1], HEX);
-	if (MAC_array[2] < 0x10)
-		response += '0';
-	response += String(MAC_array[2], HEX);
+	response.hex(MAC_array[0], 2); // O array MAC é sempre retornado em letras minúsculas.
+	response.hex(MAC_array[1], 2);
+	response.hex(MAC_array[2], 2);
 	response += "FFFF";
-	if (MAC_array[3] < 0x10)
-		response += '0';
-	response += String(MAC_array[3], HEX);
-	if (MAC_array[4] < 0x10)
-		response += '0';
-	response += String(MAC_array[4], HEX);
-	if (MAC_array[5] < 0x10)
-		response += '0';
-	response += String(MAC_array[5], HEX);
+	response.hex(MAC_array[3], 2);
+	response.hex(MAC_array[4], 2);
+	response.hex(MAC_array[5], 2);
 	response += "</tr>";
 
 	response += "<tr><td class=\"cell\">Pilha Livre</td><td class=\"cell\">";
 	response += ESP.getFreeHeap();
 	response += "</tr>";
+	response += "<tr><td class=\"cell\">Maior Bloco Livre</td><td class=\"cell\">";
+	response += heapBlock();
+	response += "</tr>";
+#ifdef ESP32BUILD
+	response += "<tr><td class=\"cell\">Menor Pilha Livre</td><td class=\"cell\">";
+	response += esp_get_minimum_free_heap_size();
+	response += "</tr>";
+#endif
+	response += "<tr><td class=\"cell\">Pilha na Página (antes / depois)</td><td class=\"cell\">";
+	response += wwwHeap.freeBefore;
+	response += " / ";
+	response += wwwHeap.freeAfter;
+	response += " (bloco ";
+	response += wwwHeap.blockBefore;
+	response += " / ";
+	response += wwwHeap.blockAfter;
+	response += ")</tr>";
 	response += "<tr><td class=\"cell\">Frequência da CPU</td><td class=\"cell\">";
 	response += ESP.getCpuFreqMHz();
 	response += "MHz";
@@ -809,6 +1247,19 @@ static void systemData()
 	response += "<tr><td class=\"cell\">Identificador do Chip ESP</td><td class=\"cell\">";
 	response += ESP.getChipId();
 	response += "</tr>";
+#endif
+#if _RADIOS > 1
+	// Rádios: o rádio 0 é sempre o ativo enquanto a página é montada.
+	for (int n = 0; n < _RADIOS; n++)
+	{
+		response += "<tr><td class=\"cell\">Rádio ";
+		response += n;
+		response += "</td><td class=\"cell\">";
+		response += freqs[(n == 0 ? ifreq : radios[n].ifreq)];
+		response += " Hz, ";
+		response += radios[n].frames;
+		response += " quadros</td></tr>";
+	}
 #endif
 	response += "<tr><td class=\"cell\">Tipo do OLED</td><td class=\"cell\">";
 	response += OLED;
@@ -824,7 +1275,58 @@ static void systemData()
 #endif
 
 	response += "</table>";
-	server.sendContent(response);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Acrescenta em response as estatísticas de acks do servidor upstream s (veja upSrv[]).
+// ---------------------------------------------------------------------------------------------------------
+static void ackData(int s, struct wwwChunk &response)
+{
+	struct upServer *u = &upSrv[s];
+	uint32_t acked = u->pushAcked + u->pullAcked;
+
+	response += "<tr><td class=\"cell\">PUSH_DATA / PUSH_ACK / PULL_DATA / PULL_ACK</td><td class=\"cell\">";
+	response += u->pushSent;
+	response += " / ";
+	response += u->pushAcked;
+	response += " / ";
+	response += u->pullSent;
+	response += " / ";
+	response += u->pullAcked;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Acks perdidos / desconhecidos / reenvios</td><td class=\"cell\">";
+	response += u->lost;
+	response += " / ";
+	response += u->unknown;
+	response += " / ";
+	response += u->retries;
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">RTT (último / médio / máx. mSec)</td><td class=\"cell\">";
+	response += (u->rttLast / 1000);
+	response += " / ";
+	response += (acked > 0 ? (uint32_t)(u->rttSum / acked) / 1000 : 0);
+	response += " / ";
+	response += (u->rttMax / 1000);
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">RTT histograma (mSec)</td><td class=\"cell\">";
+	for (int b = 0; b < RTT_BINS; b++)
+	{
+		response += (b < RTT_BINS - 1 ? "&lt;" : "&ge;");
+		response += rttLimit[b < RTT_BINS - 1 ? b : RTT_BINS - 2];
+		response += ": ";
+		response += u->rtt[b];
+		response += " ";
+	}
+	response += "</tr>";
+	response += "<tr><td class=\"cell\">Envios (ok / falhas / médio / máx. uSec)</td><td class=\"cell\">";
+	response += u->sendCount;
+	response += " / ";
+	response += u->sendFail;
+	response += " / ";
+	response += ((u->sendCount + u->sendFail) > 0 ? (uint32_t)(u->sendSum / (u->sendCount + u->sendFail)) : 0);
+	response += " / ";
+	response += u->sendMax;
+	response += "</tr>";
 }
 
 // ---------------------------------------------------------------------------------------------------------
@@ -833,7 +1335,7 @@ static void systemData()
 // ---------------------------------------------------------------------------------------------------------
 static void wifiData()
 {
-	String response = "";
+	struct wwwChunk &response = wwwOut;
 	response += "<h2>Configurações do WiFi</h2>";
 
 	response += "<table class=\"config_table\">";
@@ -862,25 +1364,796 @@ static void wifiData()
 	response += "<tr><td class=\"cell\">Servidor NTP</td><td class=\"cell\">";
 	response += NTP_TIMESERVER;
 	response += "</tr>";
-	response += "<tr><td class=\"cell\">Roteador LoRa</td><td class=\"cell\">";
-	response += _TTNSERVER;
-	response += "</tr>";
-	response += "<tr><td class=\"cell\">IP Roteador LoRa</td><td class=\"cell\">";
-	printIP((IPAddress)ttnServer, '.', response);
-	response += "</tr>";
-#ifdef _THINGSERVER
-	response += "<tr><td class=\"cell\">Roteador LoRa</td><td class=\"cell\">";
-	response += _THINGSERVER;
-	response += String() + ":" + _THINGPORT + "</tr>";
-	response += "<tr><td class=\"cell\">IP Roteador LoRa</td><td class=\"cell\">";
-	printIP((IPAddress)thingServer, '.', response);
-	response += "</tr>";
-#endif
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		struct upServerCfg *c = &gwayConfig.up[s];
+		if (c->host[0] == 0)
+			continue;
+		response += "<tr><td class=\"cell\">Roteador LoRa ";
+		response += s;
+		response += "</td><td class=\"cell\">";
+		response += c->host;
+		response += ":";
+		response += c->port;
+		response += (gwayConfig.upFormat[s] == UP_FMT_BIN ? " binário" : " JSON");
+		response += " (PULL ";
+		response += c->pullInterval;
+		response += " s, stat ";
+		response += c->statInterval;
+		response += " s)</tr>";
+		response += "<tr><td class=\"cell\">IP Roteador LoRa</td><td class=\"cell\">";
+		if (upSrv[s].resolved)
+			printIP((IPAddress)upSrv[s].ip, '.', response);
+		else
+			response += "--";
+		response += "</tr>";
+		ackData(s, response);
+	}
 	response += "</table>";
 
-	server.sendContent(response);
 }
 
+// ---------------------------------------------------------------------------------------------------------
+// API STATUS
+// Estado do gateway em JSON, para ser lido por programas (GET /api/status). A resposta vai em
+// pedaços (chunked) pelo wwwOut, como em /api/servers, então não tem limite de tamanho.
+// ---------------------------------------------------------------------------------------------------------
+static void apiStatus()
+{
+	struct wwwChunk &response = wwwOut;
+	uint32_t freeBefore = ESP.getFreeHeap();
+	uint32_t blockBefore = heapBlock();
+
+	response.len = 0;
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "application/json", "");
+
+	response += "{\"uptime\":";
+	response += millis() / 1000;
+	response += ",\"rx\":{\"rcv\":";
+	response += cp_nb_rx_rcv;
+	response += ",\"ok\":";
+	response += cp_nb_rx_ok;
+	response += ",\"fwd\":";
+	response += cp_up_pkt_fwd;
+#if STATISTICS >= 2
+	response += ",\"sf\":[";
+	response += statc.sf7;
+	response += ',';
+	response += statc.sf8;
+	response += ',';
+	response += statc.sf9;
+	response += ',';
+	response += statc.sf10;
+	response += ',';
+	response += statc.sf11;
+	response += ',';
+	response += statc.sf12;
+	response += ']';
+#endif
+	response += "},\"ring\":{\"used\":";
+	response += (uint8_t)(upRing.head - upRing.tail);
+	response += ",\"high\":";
+	response += upRing.highWater;
+	response += ",\"overflow\":";
+	response += upRing.overflow;
+	response += "},\"batch\":{\"datagrams\":";
+	response += batch.datagrams;
+	response += ",\"frames\":";
+	response += batch.frames;
+	response += ",\"maxWait\":";
+	response += batch.maxWait;
+	response += "},\"down\":{\"queued\":";
+	response += downQ.queued;
+	response += ",\"sent\":";
+	response += downQ.sent;
+	response += ",\"tooLate\":";
+	response += downQ.tooLate;
+	response += ",\"tooEarly\":";
+	response += downQ.tooEarly;
+	response += ",\"collision\":";
+	response += downQ.collision;
+	response += '}';
+#if _JOURNAL >= 1
+	response += ",\"journal\":{\"queued\":";
+	response += journal.queued;
+	response += ",\"replayed\":";
+	response += journal.replayed;
+	response += ",\"evicted\":";
+	response += journal.evicted;
+	response += '}';
+#endif
+	// Só os servidores configurados; i é a posição na lista de /api/servers.
+	response += ",\"servers\":[";
+	bool first = true;
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		struct upServer *u = &upSrv[s];
+		uint32_t acked = u->pushAcked + u->pullAcked;
+		if (gwayConfig.up[s].host[0] == 0)
+			continue;
+		if (!first)
+			response += ',';
+		first = false;
+		response += "{\"i\":";
+		response += s;
+		response += ",\"host\":\"";
+		response += gwayConfig.up[s].host;
+		response += "\",\"pushSent\":";
+		response += u->pushSent;
+		response += ",\"pushAcked\":";
+		response += u->pushAcked;
+		response += ",\"pullSent\":";
+		response += u->pullSent;
+		response += ",\"pullAcked\":";
+		response += u->pullAcked;
+		response += ",\"lost\":";
+		response += u->lost;
+		response += ",\"rttAvg\":";
+		response += (acked > 0 ? (uint32_t)(u->rttSum / acked) : 0);
+		response += ",\"rttMax\":";
+		response += u->rttMax;
+		response += '}';
+	}
+	response += ']';
+#if STATISTICS >= 1
+	response += ",\"nodes\":{\"used\":";
+	response += nodeCount.used;
+	response += ",\"size\":";
+	response += _NODES;
+	response += ",\"evicted\":";
+	response += nodeCount.evicted;
+	response += '}';
+#endif
+	response += ",\"spi\":{\"trans\":";
+	response += spiTrans;
+	response += ",\"skip\":";
+	response += spiWriteSkip;
+	response += "},\"heap\":{\"free\":";
+	response += freeBefore;
+	response += ",\"block\":";
+	response += blockBefore;
+#ifdef ESP32BUILD
+	response += ",\"min\":";
+	response += esp_get_minimum_free_heap_size();
+#endif
+	response += ",\"pageBefore\":";
+	response += wwwHeap.freeBefore;
+	response += ",\"pageAfter\":";
+	response += wwwHeap.freeAfter;
+	response += "}}";
+	response.flush();
+	server.sendContent(""); // Fim da resposta (chunked).
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// API SERVERS
+// GET /api/servers: a lista de servidores upstream em JSON, com o endereço resolvido e as
+// estatísticas dos envios de cada um.
+// Com o argumento i (0 a _UP_SERVERS - 1) altera a posição i antes de responder:
+// host (vazio apaga o servidor), port, pull e stat (intervalos em segundos) e fmt ("json" ou "bin",
+// o formato do rxpk). A lista é gravada na configuração e o servidor é resolvido de novo no
+// próximo netService().
+// Exemplo: /api/servers?i=1&host=router.eu.thethings.network&port=1700&pull=30&stat=60
+// ---------------------------------------------------------------------------------------------------------
+static void apiServers()
+{
+	struct wwwChunk &response = wwwOut;
+
+	if (server.hasArg("i"))
+	{
+		int i = server.arg("i").toInt();
+		if ((i < 0) || (i >= _UP_SERVERS))
+		{
+			server.send(400, "text/plain", "i");
+			return;
+		}
+		struct upServerCfg c = gwayConfig.up[i];
+		uint8_t fmt = gwayConfig.upFormat[i];
+		if (server.hasArg("host"))
+		{
+			String host = server.arg("host");
+			// Só nomes e endereços IP, para que o valor possa ir sem escape no HTML e no JSON.
+			const char *h = host.c_str();
+			for (unsigned int k = 0; k < host.length(); k++)
+			{
+				char ch = h[k];
+				if (!isalnum(ch) && (ch != '.') && (ch != '-') && (ch != ':'))
+				{
+					server.send(400, "text/plain", "host");
+					return;
+				}
+			}
+			if (host.length() >= sizeof(c.host))
+			{
+				server.send(400, "text/plain", "host");
+				return;
+			}
+			host.toCharArray(c.host, sizeof(c.host));
+			if (c.port == 0)
+				c.port = _TTNPORT;
+			if (c.pullInterval == 0)
+				c.pullInterval = _PULL_INTERVAL;
+			if (c.statInterval == 0)
+				c.statInterval = _STAT_INTERVAL;
+		}
+		if (server.hasArg("port"))
+			c.port = server.arg("port").toInt();
+		if (server.hasArg("pull"))
+			c.pullInterval = server.arg("pull").toInt();
+		if (server.hasArg("stat"))
+			c.statInterval = server.arg("stat").toInt();
+		if (server.hasArg("fmt"))
+			fmt = (server.arg("fmt") == "bin" ? UP_FMT_BIN : UP_FMT_JSON);
+		NET_LOCK(); // upSrv[] e gwayConfig.up[] são usados pela netService().
+		gwayConfig.up[i] = c;
+		gwayConfig.upFormat[i] = fmt;
+		upReset(i);
+		writeGwayCfg(CONFIGFILE);
+		NET_UNLOCK();
+	}
+
+	response.len = 0;
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "application/json", "");
+
+	response += '[';
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		struct upServerCfg *c = &gwayConfig.up[s];
+		struct upServer *u = &upSrv[s];
+		uint32_t sends = u->sendCount + u->sendFail;
+		if (s > 0)
+			response += ',';
+		response += "{\"i\":";
+		response += s;
+		response += ",\"host\":\"";
+		response += c->host;
+		response += "\",\"port\":";
+		response += c->port;
+		response += ",\"pull\":";
+		response += c->pullInterval;
+		response += ",\"stat\":";
+		response += c->statInterval;
+		response += ",\"fmt\":\"";
+		response += (gwayConfig.upFormat[s] == UP_FMT_BIN ? "bin" : "json");
+		response += "\",\"ip\":\"";
+		if (u->resolved)
+			printIP((IPAddress)u->ip, '.', response);
+		response += "\",\"sent\":";
+		response += u->sendCount;
+		response += ",\"failed\":";
+		response += u->sendFail;
+		response += ",\"sendAvg\":";
+		response += (sends > 0 ? (uint32_t)(u->sendSum / sends) : 0);
+		response += ",\"sendMax\":";
+		response += u->sendMax;
+		response += '}';
+	}
+	response += ']';
+	response.flush();
+	server.sendContent(""); // Fim da resposta (chunked).
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// API SCAN
+// GET /api/scan: a tabela do agendador de varredura (HOP) em JSON, com as estatísticas de cada
+// posição desde a última carga da tabela (occupancy em mSec).
+// Com o argumento i (0 a _SCAN_SLOTS - 1) altera a posição i antes de responder: ch (índice em
+// freqs[]), sf (lista de SF separados por vírgula, por exemplo 7,8,9,10) e dwell (mSec, 0 desativa a
+// posição). A tabela é gravada na configuração e recarregada pela tarefa do rádio, o que zera as
+// estatísticas.
+// Exemplo: /api/scan?i=3&ch=3&sf=7,8,9&dwell=150
+// ---------------------------------------------------------------------------------------------------------
+static void apiScan()
+{
+	struct wwwChunk &response = wwwOut;
+
+	if (server.hasArg("i"))
+	{
+		int i = server.arg("i").toInt();
+		if ((i < 0) || (i >= _SCAN_SLOTS))
+		{
+			server.send(400, "text/plain", "i");
+			return;
+		}
+		struct scanSlotCfg c = gwayConfig.scan[i];
+		if (server.hasArg("ch"))
+		{
+			int ch = server.arg("ch").toInt();
+			if ((ch < 0) || (ch >= (int)(sizeof(freqs) / sizeof(int))))
+			{
+				server.send(400, "text/plain", "ch");
+				return;
+			}
+			c.ch = ch;
+		}
+		if (server.hasArg("sf"))
+		{
+			String list = server.arg("sf");
+			const char *p = list.c_str();
+			uint8_t mask = 0;
+			while (*p != 0)
+			{
+				char *e;
+				long v = strtol(p, &e, 10);
+				if ((e == p) || (v < SF7) || (v > SF12) || ((*e != ',') && (*e != 0)))
+				{
+					server.send(400, "text/plain", "sf");
+					return;
+				}
+				mask |= 1 << (v - SF7);
+				p = (*e == ',' ? e + 1 : e);
+			}
+			if (mask == 0)
+			{
+				server.send(400, "text/plain", "sf");
+				return;
+			}
+			c.sfMask = mask;
+		}
+		if (server.hasArg("dwell"))
+		{
+			long d = server.arg("dwell").toInt();
+			if ((d < 0) || (d > 65535))
+			{
+				server.send(400, "text/plain", "dwell");
+				return;
+			}
+			c.dwell = d;
+		}
+		if (c.sfMask == 0)
+			c.sfMask = SCAN_SF_ALL;
+		gwayConfig.scan[i] = c;
+		writeGwayCfg(CONFIGFILE);
+		scanReload = true;
+	}
+
+	response.len = 0;
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "application/json", "");
+
+	response += "{\"hop\":";
+	response += (_hop ? "true" : "false");
+	response += ",\"adapt\":";
+	response += (_scanAdapt ? "true" : "false");
+	response += ",\"pos\":";
+	response += scan.pos;
+	response += ",\"cycles\":";
+	response += scan.cycles;
+	response += ",\"lateMax\":";
+	response += scan.lateMax;
+	response += ",\"slots\":[";
+	for (int i = 0; i < _SCAN_SLOTS; i++)
+	{
+		struct scanSlotCfg *c = &gwayConfig.scan[i];
+		struct scanSlot *s = &scan.slot[i];
+		if (i > 0)
+			response += ',';
+		response += "{\"i\":";
+		response += i;
+		response += ",\"ch\":";
+		response += c->ch;
+		response += ",\"sf\":[";
+		bool first = true;
+		for (int k = 0; k < CAD_SFS; k++)
+		{
+			if (c->sfMask & (1 << k))
+			{
+				if (!first)
+					response += ',';
+				response += SF7 + k;
+				first = false;
+			}
+		}
+		response += "],\"dwell\":";
+		response += c->dwell;
+		response += ",\"dwellNow\":";
+		response += s->dwell;
+		response += ",\"activity\":";
+		response += s->activity;
+		response += ",\"visits\":";
+		response += s->visits;
+		response += ",\"occupancy\":";
+		response += (uint32_t)(s->occupancy / 1000);
+		response += ",\"detects\":";
+		response += s->detects;
+		response += ",\"packets\":";
+		response += s->packets;
+		response += ",\"missed\":";
+		response += s->missed;
+		response += ",\"held\":";
+		response += s->held;
+		response += '}';
+	}
+	response += "]}";
+	response.flush();
+	server.sendContent(""); // Fim da resposta (chunked).
+}
+
+#if STATISTICS >= 1
+// ---------------------------------------------------------------------------------------------------------
+// API NODES
+// Tabela de estatísticas por nó em JSON (GET /api/nodes): um objeto por nó em nodes[], com rssi
+// e snr médios, uplinks por SF (SF7 a SF12) e os uplinks perdidos estimados pelo FCnt.
+// Com centenas de nós a resposta passa do tamanho do wwwOut, então é enviada em partes.
+// ---------------------------------------------------------------------------------------------------------
+static void apiNodes()
+{
+	struct wwwChunk &response = wwwOut;
+	response.len = 0;
+	bool first = true;
+
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "application/json", "");
+
+	response += '[';
+	for (int i = 0; i < _NODES; i++)
+	{
+		struct nodeEntry *n = &nodes[i];
+		if (n->packets == 0)
+			continue;
+		if (!first)
+			response += ',';
+		first = false;
+		response += "{\"devAddr\":\"";
+		response.hex(n->devAddr, 8);
+		response += "\",\"age\":";
+		response += (millis() - n->last) / 1000;
+		response += ",\"packets\":";
+		response += n->packets;
+		response += ",\"lost\":";
+		response += n->lost;
+		response += ",\"fcnt\":";
+		response += n->fcnt;
+		response += ",\"sf\":[";
+		for (int s = 0; s < 6; s++)
+		{
+			if (s > 0)
+				response += ',';
+			response += n->sf[s];
+		}
+		response += "],\"rssi\":";
+		response += n->rssi / 16.0;
+		response += ",\"snr\":";
+		response += n->snr / 16.0;
+		response += '}';
+	}
+	response += ']';
+	response.flush();
+	server.sendContent(""); // Fim da resposta (chunked).
+}
+#endif
+
+#if _METRICS >= 1
+// ---------------------------------------------------------------------------------------------------------
+// MÉTRICAS
+// Nome e descrição de cada histograma de metHist[], na ordem dos índices MET_*.
+// ---------------------------------------------------------------------------------------------------------
+static const char *metName[MET_HISTS] = {
+	"gateway_cad_rx_latency_us",
+	"gateway_rx_udp_latency_us",
+	"gateway_loop_duration_us",
+	"gateway_rx_spi_transactions",
+	"gateway_send_udp_duration_us",
+	"gateway_down_schedule_error_us"};
+static const char *metHelp[MET_HISTS] = {
+	"Tempo do CAD detect ate o RXDONE.",
+	"Tempo do RXDONE ate o PUSH_DATA enviado, por quadro.",
+	"Duracao de uma iteracao do loop().",
+	"Transacoes SPI por pacote recebido.",
+	"Duracao de sendUdp().",
+	"Erro absoluto do inicio do TX em relacao ao horario agendado."};
+
+// ---------------------------------------------------------------------------------------------------------
+// Escreve um valor (type: "counter" ou "gauge") no formato texto do Prometheus.
+// ---------------------------------------------------------------------------------------------------------
+static void metricValue(struct wwwChunk &response, const char *name, const char *help, const char *type, uint32_t v)
+{
+	response += "# HELP ";
+	response += name;
+	response += ' ';
+	response += help;
+	response += "\n# TYPE ";
+	response += name;
+	response += ' ';
+	response += type;
+	response += '\n';
+	response += name;
+	response += ' ';
+	response += v;
+	response += '\n';
+}
+
+static void metricCounter(struct wwwChunk &response, const char *name, const char *help, uint32_t v)
+{
+	metricValue(response, name, help, "counter", v);
+}
+
+static void metricGauge(struct wwwChunk &response, const char *name, const char *help, uint32_t v)
+{
+	metricValue(response, name, help, "gauge", v);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Escreve o histograma h no formato texto do Prometheus, com os baldes acumulados.
+// Trabalha sobre uma cópia, e o count é a soma dos baldes, para que +Inf e count sejam iguais
+// mesmo que a stateMachine() ou o txTrigger() atualizem o histograma durante a leitura.
+// ---------------------------------------------------------------------------------------------------------
+static void metricHist(struct wwwChunk &response, uint8_t h)
+{
+	struct metHist m = metHist[h];
+	const char *name = metName[h];
+	uint32_t count = 0;
+
+	response += "# HELP ";
+	response += name;
+	response += ' ';
+	response += metHelp[h];
+	response += "\n# TYPE ";
+	response += name;
+	response += " histogram\n";
+	for (int i = 0; i < MET_BUCKETS; i++)
+	{
+		count += m.bucket[i];
+		response += name;
+		response += "_bucket{le=\"";
+		if (i < MET_BUCKETS - 1)
+			response += ((uint32_t)1 << i);
+		else
+			response += "+Inf";
+		response += "\"} ";
+		response += count;
+		response += '\n';
+	}
+	response += name;
+	response += "_sum ";
+	response += m.sum;
+	response += '\n';
+	response += name;
+	response += "_count ";
+	response += count;
+	response += '\n';
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// GET /metrics: contadores e histogramas do gateway no formato texto do Prometheus.
+// A resposta é enviada em partes pelo buffer wwwOut, como a página principal.
+// ---------------------------------------------------------------------------------------------------------
+static void metricsPage()
+{
+	struct wwwChunk &response = wwwOut;
+	response.len = 0;
+
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, "text/plain; version=0.0.4", "");
+
+	metricCounter(response, "gateway_uptime_seconds_total", "Segundos desde o boot.", millis() / 1000);
+	metricCounter(response, "gateway_rx_received_total", "Pacotes recebidos pelo radio.", cp_nb_rx_rcv);
+	metricCounter(response, "gateway_rx_ok_total", "Pacotes recebidos com CRC correto.", cp_nb_rx_ok);
+	metricCounter(response, "gateway_up_forwarded_total", "Pacotes encaminhados ao servidor.", cp_up_pkt_fwd);
+	metricCounter(response, "gateway_up_ring_overflow_total", "Quadros perdidos com o anel de uplinks cheio.", upRing.overflow);
+	metricCounter(response, "gateway_down_sent_total", "Downlinks entregues ao radio.", downQ.sent);
+	metricCounter(response, "gateway_interrupt_reentries_total", "Chamadas reentrantes do manipulador de interrupcao.", gwayConfig.reents);
+	metricCounter(response, "gateway_spi_transactions_total", "Transacoes SPI desde o boot.", spiTrans);
+	response += "# HELP gateway_up_dropped_total Uplinks descartados antes do encaminhamento, por motivo.\n";
+	response += "# TYPE gateway_up_dropped_total counter\n";
+	response += "gateway_up_dropped_total{reason=\"devaddr\"} ";
+	response += upDrop.deny;
+	response += "\ngateway_up_dropped_total{reason=\"duplicate\"} ";
+	response += upDrop.dup;
+	response += '\n';
+	response += "# HELP gateway_up_encoded_bytes_total Bytes dos rxpk codificados, por formato.\n";
+	response += "# TYPE gateway_up_encoded_bytes_total counter\n";
+	response += "gateway_up_encoded_bytes_total{format=\"json\"} ";
+	response += batch.jsonBytes;
+	response += "\ngateway_up_encoded_bytes_total{format=\"bin\"} ";
+	response += batch.binBytes;
+	response += "\n# HELP gateway_up_encoded_frames_total Quadros codificados, por formato.\n";
+	response += "# TYPE gateway_up_encoded_frames_total counter\n";
+	response += "gateway_up_encoded_frames_total{format=\"json\"} ";
+	response += batch.jsonFrames;
+	response += "\ngateway_up_encoded_frames_total{format=\"bin\"} ";
+	response += batch.binFrames;
+	response += "\n# HELP gateway_up_encode_us_total Tempo de codificacao dos rxpk (uSec), por formato.\n";
+	response += "# TYPE gateway_up_encode_us_total counter\n";
+	response += "gateway_up_encode_us_total{format=\"json\"} ";
+	response += batch.jsonUs;
+	response += "\ngateway_up_encode_us_total{format=\"bin\"} ";
+	response += batch.binUs;
+	response += '\n';
+	response += "# HELP gateway_up_send_total Datagramas enviados a cada servidor upstream.\n";
+	response += "# TYPE gateway_up_send_total counter\n";
+	for (int s = 0; s < _UP_SERVERS; s++)
+	{
+		if (gwayConfig.up[s].host[0] == 0)
+			continue;
+		response += "gateway_up_send_total{server=\"";
+		response += s;
+		response += "\",result=\"ok\"} ";
+		response += upSrv[s].sendCount;
+		response += "\ngateway_up_send_total{server=\"";
+		response += s;
+		response += "\",result=\"failed\"} ";
+		response += upSrv[s].sendFail;
+		response += '\n';
+	}
+#if _CHECK_MIC >= 1
+	metricCounter(response, "gateway_mic_ok_total", "Uplinks com MIC correto.", micCount.ok);
+	metricCounter(response, "gateway_mic_fail_total", "Uplinks com MIC incorreto.", micCount.fail);
+#endif
+
+	// Ocupação das filas entre o rádio e a rede (tarefa do rádio e netService()).
+	metricGauge(response, "gateway_up_ring_depth", "Quadros no anel de uplinks.", (uint8_t)(upRing.head - upRing.tail));
+	metricGauge(response, "gateway_up_ring_high_water", "Maior ocupacao do anel de uplinks.", upRing.highWater);
+	metricGauge(response, "gateway_down_queue_depth", "Downlinks na fila.", downQ.count);
+	metricGauge(response, "gateway_down_queue_high_water", "Maior ocupacao da fila de downlinks.", downQ.highWater);
+#if STATISTICS >= 1
+	metricGauge(response, "gateway_nodes", "Nos na tabela de estatisticas por no.", nodeCount.used);
+	metricCounter(response, "gateway_nodes_evicted_total", "Nos substituidos com a tabela cheia.", nodeCount.evicted);
+#endif
+	if (_hop)
+	{
+		// Uma série por posição válida do agendador de varredura, com o canal.
+		static const char *scanName[4] = {"visits", "detects", "packets", "missed"};
+		static const char *scanHelp[4] = {
+			"Visitas a cada posicao do agendador de varredura.",
+			"CAD detects em cada posicao do agendador de varredura.",
+			"Quadros recebidos em cada posicao do agendador de varredura.",
+			"Visitas com a troca de posicao atrasada mais que _SCAN_LATE."};
+		for (int m = 0; m < 4; m++)
+		{
+			response += "# HELP gateway_scan_";
+			response += scanName[m];
+			response += "_total ";
+			response += scanHelp[m];
+			response += "\n# TYPE gateway_scan_";
+			response += scanName[m];
+			response += "_total counter\n";
+			for (int i = 0; i < _SCAN_SLOTS; i++)
+			{
+				struct scanSlot *sl = &scan.slot[i];
+				if (!scanValid(i))
+					continue;
+				const uint32_t v[4] = {sl->visits, sl->detects, sl->packets, sl->missed};
+				response += "gateway_scan_";
+				response += scanName[m];
+				response += "_total{slot=\"";
+				response += i;
+				response += "\",ch=\"";
+				response += sl->ch;
+				response += "\"} ";
+				response += v[m];
+				response += '\n';
+			}
+		}
+		yield();
+	}
+#if STATISTICS >= 2
+	const unsigned long sfCount[6] = {statc.sf7, statc.sf8, statc.sf9, statc.sf10, statc.sf11, statc.sf12};
+	response += "# HELP gateway_rx_sf_total Pacotes recebidos por fator de espalhamento.\n";
+	response += "# TYPE gateway_rx_sf_total counter\n";
+	for (int i = 0; i < 6; i++)
+	{
+		response += "gateway_rx_sf_total{sf=\"";
+		response += i + 7;
+		response += "\"} ";
+		response += sfCount[i];
+		response += '\n';
+	}
+#endif
+	yield();
+
+	for (uint8_t h = 0; h < MET_HISTS; h++)
+	{
+		metricHist(response, h);
+		yield();
+	}
+
+	response.flush();
+	server.sendContent(""); // Fim da resposta (chunked).
+}
+#endif
+
+#if _TRACE >= 1
+// ---------------------------------------------------------------------------------------------------------
+// TRACE
+// Nomes dos eventos TR_* e dos estados do rádio, para a linha do tempo em /trace.
+// ---------------------------------------------------------------------------------------------------------
+static const char *traceName[TR_EVENTS] = {
+	"?", "IRQ", "NO_IRQ", "CAD_DETECT", "CAD_NEXT", "RXDONE", "CRCERR", "RXTOUT",
+	"RING_FULL", "UNKNOWN", "TX_LOAD", "TXDONE", "UDP_IN", "UDP_OUT", "UP_DROP", "SCAN_SLOT"};
+static const char *traceState[S_TXDONE + 1] = {"INIT", "SCAN", "CAD", "RX", "TX", "TXDONE"};
+
+// ---------------------------------------------------------------------------------------------------------
+// Escreve v alinhado à direita em width colunas.
+// ---------------------------------------------------------------------------------------------------------
+static void tracePad(struct wwwChunk &response, uint32_t v, uint8_t width)
+{
+	uint32_t p = 10;
+	uint8_t digits = 1;
+	while ((digits < 10) && (v >= p))
+	{
+		digits++;
+		p *= 10;
+	}
+	while (width-- > digits)
+		response += ' ';
+	response += v;
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// GET /trace: o anel do trace como linha do tempo em texto, do evento mais antigo ao mais novo.
+// Para cada evento: micros(), intervalo desde o evento anterior, evento, estado, SF, canal,
+// flags (hexadecimal) e argumento.
+// GET /trace.bin: o mesmo anel em binário: "TRC1", head (uint32), _TRACE_SIZE (uint16),
+// sizeof(struct traceEvent) (uint16), seguidos dos eventos, o mais antigo primeiro (little-endian).
+// O anel continua sendo gravado enquanto a resposta é montada: cada evento é copiado dentro de
+// TRACE_LOCK(), e um evento sobrescrito no meio da resposta aparece com o tmst fora de ordem.
+// ---------------------------------------------------------------------------------------------------------
+static void tracePage(bool binary)
+{
+	struct wwwChunk &response = wwwOut;
+	uint32_t head = trace.head;
+	uint32_t n = (head < _TRACE_SIZE ? head : _TRACE_SIZE);
+	uint32_t prev = 0;
+
+	response.len = 0;
+	server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+	server.send(200, (binary ? "application/octet-stream" : "text/plain"), "");
+
+	if (binary)
+	{
+		uint16_t size = _TRACE_SIZE;
+		uint16_t evSize = sizeof(struct traceEvent);
+		response.add("TRC1", 4);
+		response.add((const char *)&head, sizeof(head));
+		response.add((const char *)&size, sizeof(size));
+		response.add((const char *)&evSize, sizeof(evSize));
+	}
+	else
+	{
+		response += "# ";
+		response += n;
+		response += " de ";
+		response += head;
+		response += " eventos\n#      tmst    delta evento     estado  sf ch flags   arg\n";
+	}
+	for (uint32_t i = head - n; i != head; i++)
+	{
+		struct traceEvent ev;
+		TRACE_LOCK();
+		ev = trace.ev[i & (_TRACE_SIZE - 1)];
+		TRACE_UNLOCK();
+		struct traceEvent *t = &ev;
+		if (binary)
+		{
+			response.add((const char *)t, sizeof(struct traceEvent));
+			continue;
+		}
+		tracePad(response, t->tmst, 11);
+		tracePad(response, (i == head - n ? 0 : t->tmst - prev), 9);
+		response += ' ';
+		const char *name = (t->event < TR_EVENTS ? traceName[t->event] : traceName[0]);
+		response += name;
+		for (int k = strlen(name); k < 11; k++)
+			response += ' ';
+		response += (t->state <= S_TXDONE ? traceState[t->state] : "?");
+		tracePad(response, t->sf, (t->state <= S_TXDONE ? 10 - strlen(traceState[t->state]) : 9));
+		tracePad(response, t->ch, 3);
+		response += "    ";
+		response.hex(t->flags, 2);
+		tracePad(response, t->arg, 6);
+		response += '\n';
+		prev = t->tmst;
+		if ((i & 63) == 63)
+			yield();
+	}
+	response.flush();
+	server.sendContent(""); // Fim da resposta (chunked).
+}
+#endif
+
 // ---------------------------------------------------------------------------------------------------------
 // ENVIAR PÁGINA WEB()
 // Ligue para o servidor web e envie o conteúdo padrão e o conteúdo que é passou pelo parâmetro.
@@ -889,6 +2162,10 @@ static void wifiData()
 // ---------------------------------------------------------------------------------------------------------
 void sendWebPage(const char *cmd, const char *arg)
 {
+	wwwHeap.freeBefore = ESP.getFreeHeap();
+	wwwHeap.blockBefore = heapBlock();
+	wwwOut.len = 0;
+
 	openWebPage();
 	yield();
 
@@ -897,8 +2174,18 @@ void sendWebPage(const char *cmd, const char *arg)
 
 	statisticsData();
 	yield(); // Estatísticas de nós.
+#if PROFILE >= 1
+	profileData();
+	yield(); // Duração de cada etapa do gateway.
+#endif
+	cadData();
+	yield(); // Ordem e eficiência da varredura do CAD.
+	scanData();
+	yield(); // Tabela e estatísticas do agendador de varredura.
 	sensorData();
 	yield(); // Exibe o histórico do sensor, as estatísticas da mensagem.
+	nodeData();
+	yield(); // Estatísticas por nó.
 	systemData();
 	yield(); // Estatísticas do sistema, como heap etc.
 	wifiData();
@@ -911,11 +2198,15 @@ void sendWebPage(const char *cmd, const char *arg)
 	yield(); // Exibir interrompe somente quando depurar >= 2.
 
 	// Feche a conexão do cliente para o servidor.
-	server.sendContent(String() + "<br><br />Clique <a href=\"/HELP\">aqui</a> para explicar as opções de Ajuda sobre REST<br>");
-	server.sendContent(String() + "</BODY></HTML>");
-	server.sendContent("");
+	wwwOut += "<br><br />Clique <a href=\"/HELP\">aqui</a> para explicar as opções de Ajuda sobre REST<br>";
+	wwwOut += "</BODY></HTML>";
+	wwwOut.flush();
+	server.sendContent(""); // Fim da resposta (chunked).
 	yield();
 
+	wwwHeap.freeAfter = ESP.getFreeHeap();
+	wwwHeap.blockAfter = heapBlock();
+
 	server.client().stop();
 }
 
@@ -953,6 +2244,42 @@ void setupWWW()
 		server.send(302, "text/plain", "");
 	});
 
+	// Estado do gateway em JSON, veja apiStatus().
+	server.on("/api/status", []() {
+		apiStatus();
+	});
+	// Lista de servidores upstream, veja apiServers().
+	server.on("/api/servers", []() {
+		apiServers();
+	});
+	// Tabela do agendador de varredura, veja apiScan().
+	server.on("/api/scan", []() {
+		apiScan();
+	});
+#if STATISTICS >= 1
+	// Estatísticas por nó em JSON, veja apiNodes().
+	server.on("/api/nodes", []() {
+		apiNodes();
+	});
+#endif
+
+#if _METRICS >= 1
+	// Métricas no formato texto do Prometheus, veja metricsPage().
+	server.on("/metrics", []() {
+		metricsPage();
+	});
+#endif
+
+#if _TRACE >= 1
+	// Linha do tempo do trace, em texto e em binário, veja tracePage().
+	server.on("/trace", []() {
+		tracePage(false);
+	});
+	server.on("/trace.bin", []() {
+		tracePage(true);
+	});
+#endif
+
 	server.on("/HELP", []() {
 		sendWebPage("HELP", ""); // Envie a string da WebPage.
 		server.sendHeader("Location", String("/"), true);
@@ -962,6 +2289,7 @@ void setupWWW()
 	// Redefinir as estatísticas.
 	server.on("/RESET", []() {
 		Serial.println(F("RESET"));
+		NET_LOCK(); // nodes[] e os contadores são atualizados pela netService().
 		cp_nb_rx_rcv = 0;
 		cp_nb_rx_ok = 0;
 		cp_up_pkt_fwd = 0;
@@ -970,6 +2298,10 @@ void setupWWW()
 		{
 			statr[i].sf = 0;
 		}
+		memset(nodes, 0, sizeof(nodes));
+		nodeCount.used = 0;
+		nodeCount.evicted = 0;
+		scanReload = true;
 #if STATISTICS >= 2
 		statc.sf7 = 0;
 		statc.sf8 = 0;
@@ -982,6 +2314,7 @@ void setupWWW()
 		writeGwayCfg(CONFIGFILE);
 #endif
 #endif
+		NET_UNLOCK();
 		server.sendHeader("Location", String("/"), true);
 		server.send(302, "text/plain", "");
 	});
@@ -1081,6 +2414,29 @@ void setupWWW()
 		server.sendHeader("Location", String("/"), true);
 		server.send(302, "text/plain", "");
 	});
+	// Ordem adaptativa (1) ou fixa (0) de SF no CAD.
+	server.on("/CADORD=1", []() {
+		_cadAdapt = (bool)1;
+		server.sendHeader("Location", String("/"), true);
+		server.send(302, "text/plain", "");
+	});
+	server.on("/CADORD=0", []() {
+		_cadAdapt = (bool)0;
+		server.sendHeader("Location", String("/"), true);
+		server.send(302, "text/plain", "");
+	});
+	// Permanência adaptativa (1) ou fixa (0) no agendador de varredura.
+	server.on("/SCANADAPT=1", []() {
+		_scanAdapt = (bool)1;
+		server.sendHeader("Location", String("/"), true);
+		server.send(302, "text/plain", "");
+	});
+	server.on("/SCANADAPT=0", []() {
+		_scanAdapt = (bool)0;
+		scanReload = true; // Volta às permanências configuradas.
+		server.sendHeader("Location", String("/"), true);
+		server.send(302, "text/plain", "");
+	});
 	server.on("/CAD=0", []() {
 		_cad = (bool)0;
 		writeGwayCfg(CONFIGFILE); // Salvar configuração no arquivo.
@@ -1110,7 +2466,7 @@ void setupWWW()
 	// Contador de quadros do nó Gateway.
 	server.on("/FCNT", []() {
 		frameCount = 0;
-		rxLoraModem(); // Repor o radio com a nova frequência.
+		radioRestart(RADIO_RX); // Repor o radio com a nova frequência.
 		writeGwayCfg(CONFIGFILE);
 
 		//sendWebPage("",""); // Envie a string da WebPage.
@@ -1146,7 +2502,7 @@ void setupWWW()
 		_hop = false;
 		ifreq = 0;
 		freq = freqs[0];
-		rxLoraModem();
+		radioRestart(RADIO_RX);
 		server.sendHeader("Location", String("/"), true);
 		server.send(302, "text/plain", "");
 	});
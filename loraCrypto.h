@@ -0,0 +1,94 @@
+// =========================================================================================================
+// =========== LoRaWAN Gateway de Canal único para ESP32/ESP8266 ===========
+// Copyright (c) 2016, 2017 Maarten Westenberg versão para ESP32/ESP8266
+// Versão 5.0.1
+// Data: 15-11-2017
+// Autor: Maarten Westenberg, E-mail: mw12554@hotmail.com
+// Contibuições de Dorijan Morelj e Andreas Spies pelo suporte a OLED.
+//
+// ========== Tradução: AdailSilva, E-mail: adail101@hotmail.com ===========
+//
+// Baseado no trabalho feito por Thomas Telkamp para o gateway Raspberry PI de canal único e muitos outros.
+//
+// Todos os direitos reservados. Este programa e os materiais acompanhantes são disponibilizados
+// sob os termos da licença MIT que acompanha esta distribuição e está disponível em:
+// https://opensource.org/licenses/mit-license.php
+//
+// NENHUMA GARANTIA DE QUALQUER TIPO É FORNECIDA.
+//
+// Os protocolos e especificações usados para este gateway de canal único:
+//
+// 1. Especificação LoRa Versão V1.0 e V1.1 para comunicação Gateway-Node;
+//
+// 2. Protocolo de comunicação Semtech Básico entre o gateway LoRa e a versão 3.0.0 do servidor
+//  https://github.com/Lora-net/packet_forwarder/blob/master/PROTOCOL.TXT.
+//
+// Notas:
+//
+// Este arquivo contém as estruturas do módulo de criptografia LoRaWAN (AES-128, CMAC e MIC).
+// As funções estão em _loraCrypto.ino.
+// =========================================================================================================
+
+// Chave AES-128 com a expansão (key schedule) já calculada, para que cada bloco custe só as
+// 10 rodadas. Com _CRYPTO_HW usamos o contexto do mbedtls, que no ESP32 usa o acelerador AES.
+struct aesKey
+{
+#if _CRYPTO_HW >= 1
+	mbedtls_aes_context ctx;
+#else
+	uint32_t rk[44]; // 11 chaves de rodada de 4 palavras (big-endian).
+#endif
+};
+
+// Chave CMAC (RFC 4493): a chave AES e as subchaves k1 e k2, calculadas uma vez por chave de sessão.
+struct cmacKey
+{
+	struct aesKey aes;
+	uint8_t k1[16];
+	uint8_t k2[16];
+};
+
+#if _CHECK_MIC >= 1
+// Dispositivos ABP cujo MIC é verificado em todo uplink: DevAddr e NwkSKey.
+// Os uplinks de outros DevAddr são contados como desconhecidos e encaminhados normalmente.
+struct micDevice
+{
+	uint32_t devAddr;
+	uint8_t nwkSKey[16];
+};
+
+const struct micDevice micDevices[] = {
+	{0x26000000, {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}}, // Exemplo.
+};
+#define MIC_DEVICES (sizeof(micDevices) / sizeof(micDevices[0]))
+
+// Estado de cada dispositivo: a chave CMAC pronta e o último FCnt de 32 bits, para reconstruir
+// os 16 bits superiores que não vão no quadro.
+struct micState
+{
+	struct cmacKey key;
+	uint32_t fcnt; // Último FCnt aceito (32 bits).
+	uint32_t ok; // Uplinks com MIC correto.
+	uint32_t fail; // Uplinks com MIC errado.
+} micState[MIC_DEVICES];
+
+// Resultado de micCheck().
+#define MIC_UNKNOWN 0 // Não é um uplink de dados ou o DevAddr não está em micDevices[].
+#define MIC_OK 1
+#define MIC_FAIL 2
+
+struct micCount
+{
+	uint32_t ok;
+	uint32_t fail;
+	uint32_t unknown;
+} micCount;
+#endif
+
+// Resultado do autoteste (_CRYPTO_TEST) e tempo de um MIC, mostrados na página web.
+struct cryptoBench
+{
+	bool tested; // O autoteste foi executado.
+	bool passed; // Todos os vetores conferem.
+	uint32_t micCycles; // Ciclos de CPU de um MIC de um uplink de 32 bytes.
+} cryptoBench;
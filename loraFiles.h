@@ -31,7 +31,32 @@
 // de memória de não ter código demais compilado e carregado em seu ESP8266.
 // =========================================================================================================
 
+// Formato dos PUSH_DATA de rxpk para cada servidor (gwayConfig.upFormat[]).
+#define UP_FMT_JSON 0 // JSON da especificação Semtech.
+#define UP_FMT_BIN 1 // Binário (PKT_PUSH_BIN), veja loraModem.h.
+#define UP_FMT_ALL 0xFF // Em upSendAll(): todos os servidores, qualquer formato.
+
+// Um servidor upstream da lista gwayConfig.up[]. Uma posição com host vazio está livre.
+struct upServerCfg
+{
+	char host[48]; // Nome ou endereço IP do servidor.
+	uint16_t port; // Porta UDP.
+	uint16_t pullInterval; // Segundos entre PULL_DATA.
+	uint16_t statInterval; // Segundos entre mensagens stat.
+};
+
+// Uma posição da tabela do agendador de varredura (gwayConfig.scan[]). dwell 0 desativa a posição.
+#define SCAN_SF_ALL 0x3F // sfMask: bit 0 = SF7 ... bit 5 = SF12.
+struct scanSlotCfg
+{
+	uint8_t ch; // Índice em freqs[].
+	uint8_t sfMask; // SF tentados pelo CAD nesta posição.
+	uint16_t dwell; // Permanência configurada (mSec).
+};
+
 // Definição do registro de configuração lido na inicialização e escrito quando as configurações são alteradas.
+// O registro é gravado em binário, como está na memória (veja writeConfig()); ao mudar esta
+// estrutura, incremente CFG_VERSION.
 struct espGwayConfig
 {
 	uint16_t fcnt;   // =0 como o valor do init XXX Pode ser de 32 bits.
@@ -53,6 +78,84 @@ struct espGwayConfig
 	bool isNode; // O nó do gateway está ativado.
 	bool refresh; // A atualização do navegador da Web está ativada?
 
-	String ssid; // SSID da última rede WiFi conectada.
-	String pass; // Senha.
+	char ssid[33]; // SSID da última rede WiFi conectada.
+	char pass[65]; // Senha.
+
+	uint32_t cntSeq; // Último registro do COUNTERFILE já incluído neste registro.
+
+	// Campos novos vão sempre no fim, com CFG_VERSION incrementada. O tamanho das tabelas depende
+	// de _UP_SERVERS e _SCAN_SLOTS, que são gravados no cabeçalho e precisam conferir.
+	struct upServerCfg up[_UP_SERVERS]; // Servidores upstream.
+	uint8_t upFormat[_UP_SERVERS]; // Formato do rxpk para cada servidor (UP_FMT_JSON ou UP_FMT_BIN).
+	struct scanSlotCfg scan[_SCAN_SLOTS]; // Tabela do agendador de varredura (HOP).
 } gwayConfig;
+
+// Cada registro de configuração é: cfgHeader | espGwayConfig | CRC-32 (do cabeçalho e dos dados).
+// Há dois arquivos (CONFIGFILE ".0" e ".1") usados alternadamente: writeConfig() sempre grava o que
+// não tem o registro atual, então uma queda de energia durante a gravação perde no máximo a
+// alteração em curso. readConfig() usa o registro válido com o maior seq.
+#define CFG_MAGIC 0x46435747 // "GWCF"
+#define CFG_VERSION 2 // 2: up[], upFormat[] e scan[]; _UP_SERVERS e _SCAN_SLOTS no cabeçalho.
+struct cfgHeader
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t len; // sizeof(struct espGwayConfig) na versão que gravou o registro.
+	uint32_t seq; // Incrementado a cada gravação.
+	uint8_t upServers; // _UP_SERVERS da versão que gravou o registro.
+	uint8_t scanSlots; // _SCAN_SLOTS da versão que gravou o registro.
+	uint16_t res; // Reservado.
+};
+
+// Os contadores que mudam com frequência (fcnt, boots, wifis) não regravam a configuração: um
+// registro de 16 bytes é acrescentado ao COUNTERFILE. Com _CNT_LOG_MAX registros, a configuração
+// é gravada com os contadores atuais e o arquivo é truncado.
+struct cntRecord
+{
+	uint32_t seq;
+	uint32_t fcnt;
+	uint16_t boots;
+	uint16_t wifis;
+	uint32_t crc;
+};
+
+// Estado e medidas do armazenamento da configuração, mostrados na página web.
+struct cfgState
+{
+	int8_t slot; // Arquivo (0 ou 1) com o registro atual, -1 se nenhum.
+	uint32_t seq; // seq do registro atual.
+	uint32_t loadUs; // Tempo de readConfig() no boot (uSec).
+	uint32_t writeUs; // Tempo da última gravação da configuração (uSec).
+	uint32_t writes; // Gravações da configuração.
+	uint32_t cntSeq; // seq do último registro de contadores.
+	uint16_t cntRecords; // Registros no COUNTERFILE.
+	uint32_t cntAppends; // Registros de contadores gravados.
+	uint32_t errors; // Registros inválidos (CRC) ou erros de gravação.
+} cfgState = {-1, 0, 0, 0, 0, 0, 0, 0, 0};
+
+// Cabeçalho de cada registro do journal de uplinks (JOURNALFILE). O registro ocupa JOURNAL_SLOT
+// bytes: o cabeçalho e o datagrama PUSH_DATA completo (com o cabeçalho UDP de 12 bytes e o tmst
+// original de cada rxpk). O registro do número de sequência seq fica na posição seq % _JOURNAL_SLOTS.
+#define JOURNAL_MAGIC 0x4C4E524A // "JRNL"; magic == 0 marca um registro já reenviado.
+struct journalHdr
+{
+	uint32_t magic;
+	uint32_t seq; // Número de sequência do registro.
+	uint16_t len; // Comprimento do datagrama.
+	uint16_t res; // Reservado.
+};
+#define JOURNAL_SLOT (sizeof(struct journalHdr) + _RXPK_BUDGET)
+
+// Estado do journal em memória. Os registros pendentes são os de sequência tail até head - 1;
+// em journalInit() eles são recuperados do arquivo, então sobrevivem a uma reinicialização.
+struct journalState
+{
+	uint32_t head; // Sequência do próximo registro a escrever.
+	uint32_t tail; // Sequência do registro mais antigo ainda não reenviado.
+	uint32_t queued; // Datagramas guardados.
+	uint32_t replayed; // Datagramas reenviados.
+	uint32_t evicted; // Registros descartados porque o journal estava cheio.
+	uint32_t errors; // Erros de leitura/escrita no SPIFFS.
+	uint32_t lastReplay; // millis() do último reenvio.
+	bool ready; // O arquivo foi aberto (ou criado) com sucesso.
+} journal;
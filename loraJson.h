@@ -0,0 +1,76 @@
+// =========================================================================================================
+// =========== LoRaWAN Gateway de Canal único para ESP32/ESP8266 ===========
+// Copyright (c) 2016, 2017 Maarten Westenberg versão para ESP32/ESP8266
+// Versão 5.0.1
+// Data: 15-11-2017
+// Autor: Maarten Westenberg, E-mail: mw12554@hotmail.com
+// Contibuições de Dorijan Morelj e Andreas Spies pelo suporte a OLED.
+//
+// ========== Tradução: AdailSilva, E-mail: adail101@hotmail.com ===========
+//
+// Baseado no trabalho feito por Thomas Telkamp para o gateway Raspberry PI de canal único e muitos outros.
+//
+// Todos os direitos reservados. Este programa e os materiais acompanhantes são disponibilizados
+// sob os termos da licença MIT que acompanha esta distribuição e está disponível em:
+// https://opensource.org/licenses/mit-license.php
+//
+// NENHUMA GARANTIA DE QUALQUER TIPO É FORNECIDA.
+//
+// Os protocolos e especificações usados para este gateway de canal único:
+//
+// 1. Especificação LoRa Versão V1.0 e V1.1 para comunicação Gateway-Node;
+//
+// 2. Protocolo de comunicação Semtech Básico entre o gateway LoRa e a versão 3.0.0 do servidor
+//  https://github.com/Lora-net/packet_forwarder/blob/master/PROTOCOL.TXT.
+//
+// Notas:
+//
+// Este arquivo contém as definições do gerador de JSON usado nas mensagens upstream
+// (rxpk e stat) e do leitor do txpk das mensagens downstream. As funções estão em _loraJson.ino.
+// =========================================================================================================
+
+// Gerador (writer) de JSON sem alocação. Escreve direto no buffer do datagrama, sempre
+// verificando o limite; se algo não couber, overflow é marcado e nada mais é escrito.
+struct jsonWriter
+{
+	uint8_t *buf; // Buffer de saída (o datagrama inteiro, incluindo o cabeçalho).
+	int size; // Tamanho de buf.
+	int index; // Próxima posição livre.
+	bool overflow; // true quando algum campo não coube em buf.
+};
+
+// Escreve um literal de string. O comprimento é calculado em tempo de compilação,
+// então os nomes e separadores dos campos viram um único memcpy() de tamanho constante.
+#define jwLit(w, s) jwRaw((w), (s), sizeof(s) - 1)
+
+// Leitor (reader) de JSON sem alocação, usado para o txpk do PULL_RESP. Lê o buffer
+// recebido no lugar, sem copiar strings e sem depender de um terminador '\0'.
+struct jsonReader
+{
+	const char *p; // Próximo caractere a ler.
+	const char *end; // Fim do buffer (primeiro byte depois do JSON).
+};
+
+// Bits de txpkFields.found, um para cada campo encontrado no txpk.
+#define TXPK_TMST 0x01
+#define TXPK_IMME 0x02
+#define TXPK_FREQ 0x04
+#define TXPK_DATR 0x08
+#define TXPK_POWE 0x10
+#define TXPK_IPOL 0x20
+#define TXPK_SIZE 0x40
+#define TXPK_DATA 0x80
+
+// Campos de um txpk decodificados por txpkParse(). O payload (campo "data") é decodificado
+// direto no buffer passado pelo chamador.
+struct txpkFields
+{
+	uint32_t tmst; // Hora de envio, no relógio micros() do gateway.
+	uint32_t freq; // Frequência em Hz (o JSON traz MHz, convertido sem float).
+	uint8_t sf; // Fator de espalhamento de "datr", 7 a 12.
+	uint8_t powe; // Potência de TX em dBm.
+	bool imme; // Transmitir imediatamente, ignorando tmst.
+	bool ipol; // Polaridade invertida.
+	uint16_t size; // O campo "size", comparado com o tamanho decodificado.
+	uint8_t found; // Campos TXPK_* encontrados.
+};
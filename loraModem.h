@@ -196,21 +196,67 @@ enum state_t
 
 volatile state_t _state;
 volatile uint8_t _event = 0;
+volatile uint32_t _eventTime = 0; // micros() na interrupção do rádio 0, gravado pelo manipulador.
+uint32_t irqTime = 0; // micros() da interrupção que a stateMachine() está tratando.
 
 // rssi é medido em momentos específicos e relatado em outros,
 // então precisamos armazenar o valor atual que gostamos de trabalhar.
 uint8_t _rssi;
 
-// Para tornar o comportamento do CAD dinâmico, definimos uma variável
-// quando as funções do CAD são definidas. Valor de 3 é frequências mínimas a
-// o gateway deve suportar para ser totalmente compatível com o LoRa.
-#define NUM_HOPS 3
-
 bool _cad = (bool)_CAD; // Defina como verdadeiro para Detecção de atividade do canal, somente quando o dio 1 estiver conectado.
-bool _hop = false; // Experimental; salto de frequência. Use somente quando o dio2 estiver conectado.
-bool inHop = false;
+bool _hop = false; // Varredura de canais pelo agendador de varredura, veja scanNext().
+bool _cadAdapt = (bool)_CAD_ADAPT; // Ordem adaptativa de SF no CAD, veja cadLearn().
+
+// Ordem de varredura do CAD. cadScanner() começa em order[0] e o S_CAD avança em order[] a cada
+// CAD done sem detect; com _cadAdapt falso, order[] é SF7..SF12.
+// weight[] é a média exponencial dos uplinks recebidos em cada SF (escala 4096 = todos os uplinks).
+// As estatísticas são separadas para a ordem fixa (0) e a adaptativa (1), para comparação.
+#define CAD_SFS 6
+struct cadScan
+{
+	uint16_t weight[CAD_SFS]; // Índice 0 = SF7.
+	uint8_t order[CAD_SFS]; // SF a tentar em cada passo.
+	uint8_t pos; // Passo atual em order[].
+	uint32_t start; // micros() do primeiro CAD da varredura atual.
+
+	uint32_t detects[2]; // Varreduras terminadas em CAD detect.
+	uint32_t misses[2]; // Varreduras com energia (S_CAD) que passaram por todos os SF sem detect.
+	uint32_t steps[2]; // Soma dos passos (CADs) até o detect.
+	uint64_t detectTime[2]; // Soma do tempo (uSec) do primeiro CAD até o detect.
+} cadScan = {{0}, {SF7, SF8, SF9, SF10, SF11, SF12}, 0, 0, {0}, {0}, {0}, {0}};
+
+// Agendador de varredura de canais (HOP), veja scanNext(). slot[] é a tabela em uso, copiada de
+// gwayConfig.scan[] por scanLoad(), com as estatísticas de cada posição desde a última carga.
+// Uma visita termina com permanência perdida (missed) quando a troca atrasa mais que _SCAN_LATE
+// sem um quadro em curso; as trocas que esperaram um quadro são contadas em held.
+struct scanSlot
+{
+	uint8_t ch; // Índice em freqs[].
+	uint8_t sfMask; // SF tentados pelo CAD (SCAN_SF_ALL = todos).
+	uint16_t dwell; // Permanência atual (mSec), ajustada por scanAdapt().
+	uint16_t activity; // Média exponencial (1/8) das visitas com atividade, escala 256.
+	uint32_t visits; // Visitas à posição.
+	uint32_t detects; // CAD detects.
+	uint32_t packets; // Quadros recebidos.
+	uint32_t missed; // Visitas com a troca atrasada pelo agendador.
+	uint32_t held; // Visitas prolongadas por uma varredura do CAD, RX ou TX em curso.
+	uint64_t occupancy; // Tempo total na posição (uSec).
+};
+struct scanState
+{
+	struct scanSlot slot[_SCAN_SLOTS];
+	uint8_t pos; // Posição atual.
+	bool active; // O agendador está em uma posição; falso até a primeira troca e após um reinício.
+	bool held; // A troca da visita atual já esperou um quadro.
+	uint16_t hits; // Detects e quadros na visita atual.
+	uint32_t start; // micros() do início da visita atual.
+	uint32_t deadline; // micros() do fim da permanência da visita atual.
+	uint32_t lateMax; // Maior atraso de troca sem quadro em curso (uSec).
+	uint32_t cycles; // Voltas completas pela tabela.
+} scan;
+volatile bool scanReload = true; // Pede a scanLoad() na tarefa do rádio (tabela alterada, /RESET).
+bool _scanAdapt = (bool)_SCAN_ADAPT; // Permanência adaptativa, veja scanAdapt().
 unsigned long nowTime = 0;
-unsigned long hopTime = 0;
 unsigned long msgTime = 0;
 
 #if _PIN_OUT == 1
@@ -263,6 +309,40 @@ struct pins
 #error "Definições de PIN _PIN_OUT deve ser 1 (HALLARD) ou 2 (COMRESULT)"
 #endif
 
+#if _RADIOS > 1
+// Pinos e canal dos rádios extras (rádio 1 em diante), uma linha por rádio:
+// ss, rst, dio0, dio1, dio2 e o índice do canal em freqs[].
+const uint8_t radioPins[_RADIOS - 1][6] = {
+	{23, 13, 34, 35, 39, 1}, // Rádio 1: exemplo para o Heltec, canal freqs[1].
+};
+#endif
+
+// Instância de rádio. O driver (_loraModem.ino) trabalha sobre as globais pins, _state, sf, freq,
+// ifreq, _rssi etc., que são as do rádio ativo. radioSelect() guarda as globais do rádio ativo na
+// sua instância e carrega as do rádio escolhido, então cada rádio tem o seu chip select, pinos DIO,
+// máquina de estado, canal, cache de registradores e varredura do CAD.
+// O flag de interrupção do rádio 0 continua sendo _event; os outros usam event.
+struct loraRadio
+{
+	struct pins pins;
+	uint8_t home; // Canal (índice em freqs[]) usado por initLoraModem().
+	volatile uint8_t event; // Interrupção pendente (rádio 1 em diante).
+	volatile uint32_t eventTime; // micros() da interrupção pendente.
+	state_t state;
+	uint8_t sf;
+	uint32_t freq;
+	uint8_t ifreq;
+	uint8_t rssi;
+	bool sx1272;
+	uint32_t cadDetect;
+	struct cadScan cad;
+	uint8_t regCache[0x80];
+	uint8_t regCacheValid[0x80 / 8];
+	uint32_t frames; // Quadros recebidos por este rádio.
+} radios[_RADIOS];
+
+uint8_t radioActive = 0; // Rádio cujas variáveis estão nas globais.
+
 // STATR contém os statictis que são mantidos por mensagem.
 // A cada hora que uma mensagem é recebida ou enviada, as estatísticas são atualizadas.
 // No caso de STATISTICS == 1, definimos as últimas mensagens MAX_STAT como estatísticas.
@@ -279,9 +359,33 @@ struct stat_t
 } stat_t;
 
 #if STATISTICS >= 1
-// Histórico de mensagens de uplink recebidas de nós.
+// Histórico de mensagens de uplink recebidas de nós. É um anel: statr[statHead] é a mensagem
+// mais nova, e cada mensagem nova só avança statHead, sem copiar o histórico.
 struct stat_t statr[MAX_STAT];
 
+// Estatísticas por nó (DevAddr), atualizadas por nodeStat() a cada uplink de dados.
+// Endereçamento aberto com sondagem linear, como a tabela de repetições. Uma entrada com
+// packets == 0 está livre; entradas só são substituídas, nunca removidas.
+#define NODE_PROBE 8 // Máximo de posições examinadas por consulta.
+#define NODE_GAP_MAX 256 // Saltos do FCnt maiores que isto valem como reinício do contador.
+struct nodeEntry
+{
+	uint32_t devAddr;
+	uint32_t last; // millis() do último uplink.
+	uint32_t packets; // Uplinks recebidos.
+	uint32_t lost; // Uplinks perdidos, estimados pelos saltos do FCnt.
+	uint16_t sf[6]; // Uplinks por SF, de SF7 a SF12.
+	uint16_t fcnt; // Último FCnt.
+	int16_t rssi; // Média móvel exponencial do pRSSI, em 1/16 dBm.
+	int16_t snr; // Média móvel exponencial do SNR, em 1/16 dB.
+} nodes[_NODES];
+
+struct nodeCount
+{
+	uint16_t used; // Entradas ocupadas.
+	uint32_t evicted; // Nós substituídos com a tabela cheia.
+} nodeCount;
+
 // STATC contém a estatística que é relacionada ao gateway e não por mensagem.
 // Exemplo: Número de mensagens recebidas no SF7 ou número de (re) botas.
 // Então, onde statr contém as estatísticas reunidas por pacote, o statc contém estática geral do nó.
@@ -303,13 +407,21 @@ struct stat_c statc;
 #else // STATISTICS==0
 struct stat_t statr[1]; // Sempre tenha pelo menos um elemento para armazenar.
 #endif
+uint8_t statHead = 0; // Índice da mensagem mais nova em statr.
+
+// ---------------------------------------------------------------------------------------------------------
+// Usado por REG_PAYLOAD_LENGTH para definir o recebimento do payload len.
+// O LoRa permite até 255 bytes por quadro. Como o rádio é half-duplex, o RX pode usar o FIFO
+// inteiro de 256 bytes (começando em 0x00) e ultrapassar a base do TX (0x80) sem problemas.
+#define PAYLOAD_LENGTH 0x40	// 64 bytes.
+#define MAX_PAYLOAD_LENGTH 0xFF // 255 bytes.
 
 // Definir a estrutura de payload usada para separar as interrupções e as SPI.
 // processamento da parte loop().
-uint8_t payLoad[128]; // Carga útil i.
+// Um downlink decodificado do txpk. LoraDown é o downlink que está sendo transmitido agora.
 struct LoraBuffer
 {
-	uint8_t *payLoad;
+	uint8_t payLoad[MAX_PAYLOAD_LENGTH];
 	uint8_t payLength;
 	uint32_t tmst;
 	uint8_t sfTx;
@@ -317,23 +429,283 @@ struct LoraBuffer
 	uint32_t fff;
 	uint8_t crc;
 	uint8_t iiq;
+	uint32_t airtime; // Tempo no ar (uSec), calculado por airTime().
 } LoraDown;
 
+// Fila de downlinks ordenada por tmst (just-in-time). sendPacket() insere e o loop() entrega
+// o primeiro da fila ao rádio _TX_LEAD uSec antes do seu tmst.
+#define DOWN_QUEUE_SIZE 4
+struct downQueue
+{
+	struct LoraBuffer pkt[DOWN_QUEUE_SIZE]; // pkt[0] é o próximo a transmitir.
+	uint8_t count;
+
+	uint32_t queued; // Downlinks aceitos na fila.
+	uint32_t sent; // Downlinks entregues ao rádio.
+	uint32_t tooLate; // Recusados com TOO_LATE.
+	uint32_t tooEarly; // Recusados com TOO_EARLY.
+	uint32_t collision; // Recusados com COLLISION_PACKET (sobreposição ou fila cheia).
+	uint32_t lateDispatch; // Retirados da fila porque o loop() chegou tarde demais.
+	uint8_t highWater; // Maior ocupação observada.
+} downQ;
+
+// A fila de downlinks é preenchida pelo readUdp() (netService()) e esvaziada pelo downDispatch(), que roda
+// na tarefa do rádio com _RADIO_TASK. As duas partes acessam downQ dentro de DOWN_LOCK().
+#if _RADIO_TASK >= 1
+portMUX_TYPE downMux = portMUX_INITIALIZER_UNLOCKED;
+#define DOWN_LOCK() portENTER_CRITICAL(&downMux)
+#define DOWN_UNLOCK() portEXIT_CRITICAL(&downMux)
+#else
+#define DOWN_LOCK()
+#define DOWN_UNLOCK()
+#endif
+
+// Pedidos de reinício do receptor feitos fora da tarefa do rádio (página web, PULL_DATA, sensor),
+// veja radioRestart(). O maior pedido pendente é executado pela tarefa do rádio.
+#define RADIO_RX 1 // Apenas rxLoraModem(), depois de mudar SF ou frequência.
+#define RADIO_LISTEN 2 // Volta a escutar: cadScanner() ou rxLoraModem(), conforme _cad.
+#define RADIO_INIT 3 // initLoraModem() e volta a escutar.
+volatile uint32_t radioRestartReq = 0; // 32 bits para o compare-and-swap do Xtensa.
+#if _RADIO_TASK >= 1
+TaskHandle_t radioTask = NULL; // Tarefa do rádio, criada no setup() depois do initLoraModem().
+#endif
+
+// Com _NET_TASK o estado da rede (upSrv[], gwayConfig.up[], Udp, lotes e journal) é da tarefa da
+// rede, que segura NET_LOCK() durante cada netService(). As páginas que alteram os servidores e as
+// gravações da configuração (writeConfig(), writeCounters()) também entram em NET_LOCK(). O mutex é
+// recursivo porque a netService() grava os contadores (WlanConnect()) com ele já tomado.
+#if _NET_TASK >= 1
+TaskHandle_t netTask = NULL; // Tarefa da rede, criada no setup().
+SemaphoreHandle_t netMutex = NULL; // Criado no início do setup().
+#define NET_LOCK() xSemaphoreTakeRecursive(netMutex, portMAX_DELAY)
+#define NET_UNLOCK() xSemaphoreGiveRecursive(netMutex)
+#else
+#define NET_LOCK()
+#define NET_UNLOCK()
+#endif
+
+// Estado do TX armado: o FIFO está carregado, o rádio em FSTX, e txTrigger() escreve
+// txOpmode (OPMODE_TX) no instante txTarget. Estatísticas do jitter real - agendado (uSec).
+// txTrigger() escreve só start e fired; o restante é da tarefa do rádio (txArm(), txFired()).
+struct txTiming
+{
+	uint32_t target; // micros() agendado (tmst + txDelay).
+	uint8_t opmode; // Valor de REG_OPMODE que inicia o TX.
+	uint32_t count; // TX disparados.
+	int32_t last; // Último jitter.
+	int32_t min; // Menor jitter.
+	int32_t max; // Maior jitter.
+	int64_t sum; // Soma dos jitters, para a média.
+	uint32_t start; // micros() logo após a escrita de OPMODE_TX.
+	volatile bool fired; // txTrigger() iniciou o TX e txFired() ainda não o registrou.
+	int32_t lag; // Atraso mediano (uSec) entre OPMODE_TX e o início real do TX (_TX_CAL).
+	uint32_t calCount; // Medidas aceitas para lag.
+	int32_t calRing[_TX_CAL_N]; // Últimas _TX_CAL_N medidas aceitas.
+} txTime;
+
+// Códigos de erro do TX_ACK (protocolo v2), devolvidos por sendPacket().
+#define TXACK_NONE 0
+#define TXACK_TOO_LATE 1
+#define TXACK_TOO_EARLY 2
+#define TXACK_COLLISION_PACKET 3
+
 // Up buffer (do Lora para o UDP).
+// Um registro por quadro recebido, com tudo que o buildPacket() precisa para montar o rxpk.
 struct LoraUp
 {
-	uint8_t payLoad[128];
+	uint8_t payLoad[MAX_PAYLOAD_LENGTH];
 	uint8_t payLength;
 	int prssi;
 	long snr;
 	int rssicorr;
 	uint8_t sf;
-} LoraUp;
+	uint8_t ch;	// Índice em freqs[] no momento da recepção.
+	uint32_t tmst; // micros() no RXDONE.
+};
+
+// Anel (ring) de uplinks entre a stateMachine() (produtor) e a netService() (consumidor).
+// Só o produtor altera head e só o consumidor altera tail, então não há necessidade de mutex.
+// head e tail são contadores livres de 8 bits, o índice é (contador & (UP_RING_SIZE - 1)).
+#define UP_RING_SIZE 8 // Potência de 2, no máximo 128.
+struct upRing
+{
+	struct LoraUp rec[UP_RING_SIZE];
+	volatile uint8_t head; // Próximo registro a ser escrito pelo produtor.
+	volatile uint8_t tail; // Próximo registro a ser lido pelo consumidor.
+	uint32_t overflow; // Quadros perdidos porque o anel estava cheio.
+	uint8_t highWater; // Maior ocupação observada.
+} upRing;
+
+#if _UP_FILTER >= 1
+// Regras do filtro de DevAddr. A primeira regra cujo prefixo (os bits mais altos, bits de 1 a 32)
+// combina com o DevAddr decide; sem nenhuma, vale _UP_FILTER_DEFAULT. Join Request e quadros
+// sem DevAddr sempre passam. Para encaminhar somente o TTN, use _UP_FILTER_DEFAULT UP_DENY com a
+// regra abaixo.
+#define UP_ALLOW 1
+#define UP_DENY 0
+#define _UP_FILTER_DEFAULT UP_ALLOW
+struct upRule
+{
+	uint32_t prefix; // DevAddr com os bits do prefixo.
+	uint8_t bits; // Tamanho do prefixo em bits.
+	uint8_t action; // UP_ALLOW ou UP_DENY.
+};
+const struct upRule upFilters[] = {
+	{0x26000000, 7, UP_ALLOW}, // NetID 0x000013 (TTN), DevAddr 26/27.
+};
+#define UP_RULES (sizeof(upFilters) / sizeof(upFilters[0]))
+#endif
+
+// Tabela de repetições (_DEDUP_WINDOW): endereçamento aberto com sondagem linear,
+// chave DevAddr + FCnt. Uma entrada mais velha que a janela vale como livre.
+#define DEDUP_SIZE 32 // Potência de 2.
+#define DEDUP_PROBE 8 // Máximo de posições examinadas por consulta.
+struct dedupEntry
+{
+	uint32_t devAddr;
+	uint16_t fcnt;
+	bool used;
+	uint32_t time; // tmst (micros()) da primeira recepção.
+} dedup[DEDUP_SIZE];
+
+// Motivos de descarte de uplinks antes do encaminhamento, veja upFilter().
+#define UP_PASS 0
+#define UP_DROP_DENY 1 // DevAddr recusado pelo filtro.
+#define UP_DROP_DUP 2 // Repetição dentro da janela.
+struct upDrop
+{
+	uint32_t deny;
+	uint32_t dup;
+} upDrop;
+
+// Contadores de SPI. Cada chamada de readRegister(), writeRegister(), readBuffer() ou writeBuffer()
+// é uma transação (beginTransaction/CS/endTransaction). Para o último pacote recebido guardamos
+// quantas transações e quantos microssegundos o receivePkt() gastou antes de o rádio poder ser re-armado.
+uint32_t spiTrans = 0; // Total de transações SPI desde o boot.
+uint32_t rxSpiTrans = 0; // Transações SPI do último receivePkt().
+uint32_t rxSpiMicros = 0; // Duração (uSec) do último receivePkt().
+
+// IRQ_FLAGS e IRQ_FLAGS_MASK lidos pela última stateMachine(), para a página web. O SPI é da
+// tarefa do rádio, então o loop() mostra esta cópia em vez de ler os registradores.
+volatile uint8_t lastIrqFlags = 0;
+volatile uint8_t lastIrqMask = 0;
+
+// Cópia-sombra (shadow) dos registradores de configuração do rádio. writeRegister() não escreve
+// um registrador de configuração quando o valor na cópia é igual ao novo valor. A cópia é
+// invalidada por regCacheInvalidate() sempre que o chip é resetado (initLoraModem()).
+// Registradores que o próprio chip altera (FIFO, IRQ_FLAGS, OPMODE etc.) nunca entram no cache.
+uint8_t regCache[0x80]; // Último valor escrito em cada endereço.
+uint8_t regCacheValid[0x80 / 8]; // Bit por endereço: 1 == regCache[addr] é válido.
+uint32_t spiWriteSkip = 0; // Número de escritas SPI evitadas pelo cache.
+
+// Perfil de desempenho por etapa (PROFILE >= 1). PROF_BEGIN() marca o início da etapa e
+// PROF_END() soma a duração em prof[], veja profAdd().
+#define PROF_STATE 0 // stateMachine(), chamada pelo loop() depois de uma interrupção.
+#define PROF_RECEIVE 1 // receivePkt(), leitura do FIFO do rádio.
+#define PROF_RXPK 2 // buildRxpk(), montagem do JSON de um quadro.
+#define PROF_TXPK 3 // sendPacket(), decodificação do txpk e inserção na fila.
+#define PROF_READUDP 4 // readUdp(), uma mensagem UDP do servidor.
+#define PROF_STAGES 5
+
+struct stageProf
+{
+	uint32_t calls; // Número de chamadas.
+	uint64_t total; // Soma das durações (uSec).
+	uint32_t max; // Maior duração (uSec).
+} prof[PROF_STAGES];
+
+#if PROFILE >= 1
+#define PROF_BEGIN(s) uint32_t profStart##s = micros()
+#define PROF_END(s) profAdd((s), micros() - profStart##s)
+#else
+#define PROF_BEGIN(s)
+#define PROF_END(s)
+#endif
+
+// Histogramas das métricas (_METRICS >= 1), exportados em /metrics. Os baldes (buckets) são
+// logarítmicos de base 2: o balde i conta os valores v <= 2^i que não couberam no balde anterior,
+// e o último balde conta todo o resto (+Inf). Cada histograma tem um único escritor entre as
+// tarefas: MET_CAD_RX, MET_SPI e MET_DOWN_ERR só são gravados pela tarefa do rádio, MET_RX_UDP
+// e MET_SENDUDP só pela netService() (tarefa da rede) e MET_LOOP só pelo loop(). Por isso
+// metObserve() não precisa de mutex; quem lê pode ver um valor a menos no count. Um histograma
+// novo deve seguir a mesma regra.
+#define MET_CAD_RX 0 // CAD detect até RXDONE (uSec).
+#define MET_RX_UDP 1 // RXDONE até o PUSH_DATA enviado (uSec).
+#define MET_LOOP 2 // Duração de uma iteração do loop() (uSec).
+#define MET_SPI 3 // Transações SPI por pacote recebido.
+#define MET_SENDUDP 4 // Duração de sendUdp() (uSec).
+#define MET_DOWN_ERR 5 // Erro (absoluto) do instante do TX em relação ao agendado (uSec).
+#define MET_HISTS 6
+#define MET_BUCKETS 24 // 2^0 .. 2^22 e +Inf.
+
+struct metHist
+{
+	uint32_t bucket[MET_BUCKETS];
+	uint64_t sum;
+} metHist[MET_HISTS];
+
+uint32_t cadDetect = 0; // micros() do último CAD detect ainda sem RXDONE, ou 0.
+
+// Eventos do trace (_TRACE >= 1). Cada TRACE(e, f, a) grava o evento e, os flags f (8 bits) e o
+// argumento a (16 bits), junto com micros(), o _state, o SF e o canal do momento.
+#define TR_IRQ 1 // stateMachine() chamada; f = interrupções não mascaradas.
+#define TR_NO_IRQ 2 // Evento sem interrupção; f = flags.
+#define TR_CAD_DETECT 3 // CAD detect; a = SF.
+#define TR_CAD_NEXT 4 // CAD done sem detect, próximo SF.
+#define TR_RXDONE 5 // Quadro recebido; a = tamanho.
+#define TR_CRCERR 6 // Quadro com erro de CRC.
+#define TR_RXTOUT 7 // Tempo limite do RX.
+#define TR_RING_FULL 8 // Anel de uplinks cheio, quadro perdido.
+#define TR_UNKNOWN 9 // Interrupção inesperada para o estado; f = interrupções.
+#define TR_TX_LOAD 10 // txLoraModem() carregou o FIFO; a = tamanho.
+#define TR_TXDONE 11 // TX terminado.
+#define TR_UDP_IN 12 // readUdp(); f = identificador, a = tamanho.
+#define TR_UDP_OUT 13 // sendUdp(); f = identificador, a = tamanho.
+#define TR_UP_DROP 14 // Uplink descartado por upFilter(); f = motivo.
+#define TR_SCAN_SLOT 15 // Troca de posição do agendador de varredura; f = posição, a = canal.
+#define TR_EVENTS 16
+
+// O evento ocupa 12 bytes e é gravado direto no anel, sem formatação. O anel é escrito pela
+// tarefa do rádio (stateMachine(), txLoraModem()) e pela rede (readUdp(), sendUdp()), então
+// traceAdd() grava dentro de TRACE_LOCK().
+struct traceEvent
+{
+	uint32_t tmst; // micros().
+	uint16_t arg;
+	uint8_t event; // TR_*.
+	uint8_t state; // _state.
+	uint8_t flags;
+	uint8_t sf;
+	uint8_t ch; // ifreq.
+	uint8_t res;
+};
 
-// ---------------------------------------------------------------------------------------------------------
-// Usado por REG_PAYLOAD_LENGTH para definir o recebimento do payload len.
-#define PAYLOAD_LENGTH 0x40	// 64 bytes.
-#define MAX_PAYLOAD_LENGTH 0x80 // 128 bytes.
+#if _TRACE >= 1
+struct traceRing
+{
+	struct traceEvent ev[_TRACE_SIZE];
+	uint32_t head; // Eventos gravados desde o boot; o índice é head & (_TRACE_SIZE - 1).
+} trace;
+
+#if _RADIO_TASK >= 1
+portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+#define TRACE_LOCK() portENTER_CRITICAL(&traceMux)
+#define TRACE_UNLOCK() portEXIT_CRITICAL(&traceMux)
+#else
+#define TRACE_LOCK()
+#define TRACE_UNLOCK()
+#endif
+
+#define TRACE(e, f, a) traceAdd((e), (f), (a))
+#else
+#define TRACE(e, f, a)
+#endif
+
+#if _METRICS >= 1
+#define METRIC(h, v) metObserve((h), (v))
+#else
+#define METRIC(h, v)
+#endif
 
 // Não altere essas configurações para detecção de RSSI. Eles são usados para CAD.
 // Dado o fator de correção de 157, podemos chegar a -120dB com essa classificação.
@@ -510,6 +882,14 @@ struct LoraUp
 #define PKT_PULL_ACK 0x04
 #define PKT_TX_ACK 0x05
 
+// PUSH_DATA binário (não é da especificação Semtech), para agregadores próprios, veja
+// tools/upAggregator.cpp. Depois do cabeçalho de 12 bytes vem um registro por quadro, com os
+// campos em little-endian: tmst (4), freq em Hz (4), SF (1), lsnr em dB (int8), rssi em dBm
+// (int16), size (1) e o payload sem base64. Os demais campos do rxpk são sempre os mesmos neste
+// gateway (chan 0, rfch 0, stat 1, LORA, BW125, 4/5). O servidor responde com PUSH_ACK.
+#define PKT_PUSH_BIN 0x20
+#define RXBIN_HDR 13 // Bytes de um registro antes do payload.
+
 #define MGT_RESET 0x15 // Não é uma mensagem de especificação do Gateway LoRa.
 #define MGT_SET_SF 0x16
 #define MGT_SET_FREQ 0x17
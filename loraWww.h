@@ -0,0 +1,156 @@
+// =========================================================================================================
+// =========== LoRaWAN Gateway de Canal único para ESP32/ESP8266 ===========
+// Copyright (c) 2016, 2017 Maarten Westenberg versão para ESP32/ESP8266
+// Versão 5.0.1
+// Data: 15-11-2017
+// Autor: Maarten Westenberg, E-mail: mw12554@hotmail.com
+// Contibuições de Dorijan Morelj e Andreas Spies pelo suporte a OLED.
+//
+// ========== Tradução: AdailSilva, E-mail: adail101@hotmail.com ===========
+//
+// Baseado no trabalho feito por Thomas Telkamp para o gateway Raspberry PI de canal único e muitos outros.
+//
+// Todos os direitos reservados. Este programa e os materiais acompanhantes são disponibilizados
+// sob os termos da licença MIT que acompanha esta distribuição e está disponível em:
+// https://opensource.org/licenses/mit-license.php
+//
+// NENHUMA GARANTIA DE QUALQUER TIPO É FORNECIDA.
+//
+// Os protocolos e especificações usados para este gateway de canal único:
+//
+// 1. Especificação LoRa Versão V1.0 e V1.1 para comunicação Gateway-Node;
+//
+// 2. Protocolo de comunicação Semtech Básico entre o gateway LoRa e a versão 3.0.0 do servidor
+//  https://github.com/Lora-net/packet_forwarder/blob/master/PROTOCOL.TXT.
+//
+// Notas:
+//
+// Este arquivo contém o buffer de saída (wwwChunk) usado pelas páginas do servidor web.
+// As funções das páginas estão em _wwwServer.ino.
+// =========================================================================================================
+
+// Tamanho do buffer de saída das páginas web. Quando o buffer enche, ele é enviado ao navegador
+// com sendContent() e reutilizado, então a página inteira é montada sem usar o heap.
+#define WWW_CHUNK 1024
+
+void wwwSend(const char *buf, int len); // Em _wwwServer.ino.
+
+// Buffer de saída de tamanho fixo das páginas web. Os operadores += aceitam os mesmos tipos que
+// a String do Arduino (texto, números e caracteres), mas escrevem direto no buffer em vez de
+// alocar memória, e enviam o conteúdo em pedaços de WWW_CHUNK bytes.
+struct wwwChunk
+{
+	char buf[WWW_CHUNK];
+	int len;
+
+	void flush()
+	{
+		if (len > 0)
+		{
+			wwwSend(buf, len);
+			len = 0;
+		}
+	}
+	void add(const char *s, int n)
+	{
+		while (n > 0)
+		{
+			int k = ((n < WWW_CHUNK - len) ? n : WWW_CHUNK - len);
+			memcpy(buf + len, s, k);
+			len += k;
+			s += k;
+			n -= k;
+			if (len == WWW_CHUNK)
+			{
+				flush();
+			}
+		}
+	}
+	void num(uint64_t v, bool neg)
+	{
+		char tmp[21]; // Sinal e 20 dígitos.
+		int n = sizeof(tmp);
+		do
+		{
+			tmp[--n] = '0' + (v % 10);
+			v /= 10;
+		} while (v > 0);
+		if (neg)
+		{
+			tmp[--n] = '-';
+		}
+		add(tmp + n, sizeof(tmp) - n);
+	}
+	// Escreve v em hexadecimal minúsculo, com pelo menos digits dígitos (zeros à esquerda).
+	void hex(uint32_t v, uint8_t digits)
+	{
+		char tmp[8];
+		int n = sizeof(tmp);
+		do
+		{
+			tmp[--n] = "0123456789abcdef"[v & 0x0F];
+			v >>= 4;
+		} while ((v > 0) || (sizeof(tmp) - n < digits));
+		add(tmp + n, sizeof(tmp) - n);
+	}
+
+	wwwChunk &operator+=(const char *s)
+	{
+		add(s, strlen(s));
+		return (*this);
+	}
+	wwwChunk &operator+=(const String &s)
+	{
+		add(s.c_str(), s.length());
+		return (*this);
+	}
+	wwwChunk &operator+=(char c)
+	{
+		add(&c, 1);
+		return (*this);
+	}
+	wwwChunk &operator+=(unsigned char v)
+	{
+		num(v, false);
+		return (*this);
+	}
+	wwwChunk &operator+=(int v)
+	{
+		num((v < 0) ? (uint32_t)(-(v + 1)) + 1 : (uint32_t)v, (v < 0));
+		return (*this);
+	}
+	wwwChunk &operator+=(unsigned int v)
+	{
+		num(v, false);
+		return (*this);
+	}
+	wwwChunk &operator+=(long v)
+	{
+		num((v < 0) ? (uint32_t)(-(v + 1)) + 1 : (uint32_t)v, (v < 0));
+		return (*this);
+	}
+	wwwChunk &operator+=(unsigned long v)
+	{
+		num(v, false);
+		return (*this);
+	}
+	wwwChunk &operator+=(unsigned long long v)
+	{
+		num(v, false);
+		return (*this);
+	}
+	// Como a String do Arduino: duas casas decimais.
+	wwwChunk &operator+=(double v)
+	{
+		bool neg = (v < 0);
+		uint32_t c = (uint32_t)((neg ? -v : v) * 100 + 0.5);
+		num(c / 100, neg);
+		*this += '.';
+		if ((c % 100) < 10)
+		{
+			*this += '0';
+		}
+		num(c % 100, false);
+		return (*this);
+	}
+};
@@ -0,0 +1,187 @@
+// =========================================================================================================
+// bench.cpp: benchmark do gateway no alvo host.
+//
+// Um sxInjector põe uplinks no ar na taxa pedida, o SX1276 simulado os recebe e gera as interrupções,
+// e o gateway roda com as suas tarefas (rádio, rede e loop()). O servidor de teste conta os rxpk
+// encaminhados e, com -d N, responde a cada N-ésimo uplink com um downlink (PULL_RESP) para a janela
+// RX1 (tmst + 1 s), o que exercita sendPacket(), readUdp() e o TX no instante pedido.
+//
+// Relatório:
+// - quadros injetados, RXDONE no rádio, rxpk encaminhados e pacotes/s;
+// - por etapa (prof[], PROFILE >= 1): chamadas, média e máximo em uSec de stateMachine(),
+//   receivePkt(), buildRxpk(), sendPacket() e readUdp();
+// - downlinks pedidos e transmitidos e o erro do início do TX em relação ao tmst.
+//
+//   bench [-r quadros/s] [-t segundos] [-l bytes] [-f sf] [-s escala] [-p] [-d N] [-c]
+// =========================================================================================================
+#include "host.h"
+#include "sx1276.h"
+#include <getopt.h>
+#include <algorithm>
+
+#include "sketch.cpp"
+
+static std::atomic<uint32_t> rxpkCount(0), downAsked(0), downRefused(0);
+static std::mutex downM;
+static std::vector<uint32_t> downTmst; // tmst de cada downlink pedido.
+static uint32_t downEvery = 0;
+static uint32_t downFreq = 923300000;
+
+// Lê o valor inteiro depois de key em s (JSON do rxpk), a partir de *pos.
+static bool jsonUint(const std::string &s, const char *key, size_t *pos, uint32_t *v)
+{
+	size_t p = s.find(key, *pos);
+	if (p == std::string::npos)
+		return (false);
+	p += strlen(key);
+	*v = (uint32_t)strtoul(s.c_str() + p, NULL, 10);
+	*pos = p;
+	return (true);
+}
+
+// Servidor de teste: conta os rxpk e pede um downlink para a RX1 de cada downEvery-ésimo uplink.
+static void serverUp(const hostDatagram &d)
+{
+	if ((d.data.size() <= 12) || (d.data[3] != 0x00))
+		return;
+	std::string json(d.data.begin() + 12, d.data.end());
+	size_t pos = 0;
+	uint32_t tmst, datr;
+	while (jsonUint(json, "\"tmst\":", &pos, &tmst))
+	{
+		size_t sfPos = pos;
+		if (!jsonUint(json, "\"datr\":\"SF", &sfPos, &datr))
+			datr = 7;
+		uint32_t n = ++rxpkCount;
+		if ((downEvery == 0) || (n % downEvery != 0))
+			continue;
+
+		uint8_t payload[17] = {0x60, 0x01, 0x00, 0x00, 0x26, 0x00, (uint8_t)n, (uint8_t)(n >> 8), 0x01};
+		char data[32];
+		base64_encode(data, (char *)payload, sizeof(payload));
+		char txpk[320];
+		int len = snprintf(txpk + 4, sizeof(txpk) - 4,
+						   "{\"txpk\":{\"imme\":false,\"tmst\":%u,\"freq\":%u.%u,\"rfch\":0,\"powe\":14,"
+						   "\"modu\":\"LORA\",\"datr\":\"SF%uBW125\",\"codr\":\"4/5\",\"ipol\":true,\"size\":%u,\"data\":\"%s\"}}",
+						   tmst + 1000000, downFreq / 1000000, (downFreq % 1000000) / 100000, datr,
+						   (unsigned)sizeof(payload), data);
+		txpk[0] = 2;
+		txpk[1] = (uint8_t)n;
+		txpk[2] = (uint8_t)(n >> 8);
+		txpk[3] = 0x03; // PULL_RESP.
+		{
+			std::lock_guard<std::mutex> l(downM);
+			downTmst.push_back(tmst + 1000000);
+		}
+		downAsked++;
+		hostNetDown(d.ip, d.port, (uint8_t *)txpk, len + 4);
+	}
+}
+
+static void usage()
+{
+	fprintf(stderr, "uso: bench [-r quadros/s] [-t segundos] [-l bytes] [-f sf] [-s escala] [-p] [-d N] [-c]\n"
+					"  -r  uplinks por segundo (10)\n"
+					"  -t  duração da medida em segundos (10)\n"
+					"  -l  tamanho do uplink em bytes, >= 13 (20)\n"
+					"  -f  SF dos uplinks (7)\n"
+					"  -s  escala do tempo no ar do modelo (1.0 = tempo real)\n"
+					"  -p  intervalos exponenciais (Poisson) em vez de fixos\n"
+					"  -d  downlink RX1 a cada N uplinks (0 = nenhum)\n"
+					"  -c  gateway em CAD (RX_SINGLE) em vez de RX contínuo\n");
+	hostExit(2);
+}
+
+int main(int argc, char **argv)
+{
+	double rateArg = 10.0, seconds = 10.0;
+	int lenArg = 20, sfArg = 7, opt;
+	bool poisson = false, cadArg = false;
+	while ((opt = getopt(argc, argv, "r:t:l:f:s:pd:c")) != -1)
+	{
+		switch (opt)
+		{
+		case 'r': rateArg = atof(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		case 'l': lenArg = atoi(optarg); break;
+		case 'f': sfArg = atoi(optarg); break;
+		case 's': sxScale = atof(optarg); break;
+		case 'p': poisson = true; break;
+		case 'd': downEvery = (uint32_t)atoi(optarg); break;
+		case 'c': cadArg = true; break;
+		default: usage();
+		}
+	}
+	if ((lenArg < 13) || (lenArg > 255) || (sfArg < 7) || (sfArg > 12) || (rateArg <= 0) || (sxScale <= 0))
+		usage();
+
+	sx1276 radio0(pins.ss, pins.rst, pins.dio0, pins.dio1, pins.dio2);
+	hostOnUp = serverUp;
+	hostBoot();
+
+	// Configuração do teste, como a página web faz (CAD=, SF=): o SF dos uplinks e, com -c, o CAD.
+	// O reinício é executado pela tarefa do rádio.
+	_cad = cadArg;
+	_hop = false;
+	sf = (sf_t)sfArg;
+	radioRestart(RADIO_LISTEN);
+	delay(100);
+	memset(prof, 0, sizeof(prof));
+	uint32_t rxDone0 = radio0.rxDone, rxpk0 = rxpkCount;
+
+	sxInjector inj;
+	inj.freq = freqs[ifreq];
+	inj.sf = sfArg;
+	inj.len = lenArg;
+	inj.rate = rateArg;
+	inj.poisson = poisson;
+	int64_t t0 = hostTime();
+	inj.start();
+	delay((uint32_t)(seconds * 1000));
+	inj.stop();
+	int64_t t1 = hostTime();
+	delay(downEvery > 0 ? 1500 : 300); // Últimos quadros e downlinks.
+
+	uint32_t rxDone = radio0.rxDone - rxDone0, rxpk = rxpkCount - rxpk0;
+	double dt = (t1 - t0) / 1e6;
+	printf("config: taxa %.1f/s%s, SF%d, %d bytes, escala %.3f, %s, %.1f s\n", rateArg, (poisson ? " (Poisson)" : ""), sfArg,
+		   lenArg, sxScale, (cadArg ? "CAD" : "RX contínuo"), dt);
+	printf("quadros: injetados %u (adiados %u), RXDONE %u, CRC %u, rxpk encaminhados %u\n", (uint32_t)inj.sent,
+		   (uint32_t)inj.deferred, rxDone, (uint32_t)radio0.crcErr, rxpk);
+	printf("vazão: %.1f pacotes/s (%.1f%% dos injetados)\n", rxpk / dt, (inj.sent > 0 ? 100.0 * rxpk / inj.sent : 0.0));
+
+	static const char *names[PROF_STAGES] = {"stateMachine", "receivePkt", "buildRxpk", "sendPacket", "readUdp"};
+	printf("%-14s %8s %10s %10s\n", "etapa", "chamadas", "média uSec", "máx uSec");
+	for (int i = 0; i < PROF_STAGES; i++)
+	{
+		printf("%-14s %8u %10.1f %10u\n", names[i], prof[i].calls,
+			   (prof[i].calls > 0 ? (double)prof[i].total / prof[i].calls : 0.0), prof[i].max);
+	}
+
+	if (downEvery > 0)
+	{
+		// Cada TX do rádio é casado com o tmst pedido mais próximo; o erro é o início do TX menos o tmst.
+		std::vector<sxTx> txs = radio0.txLog();
+		std::vector<int32_t> err;
+		std::lock_guard<std::mutex> l(downM);
+		for (size_t i = 0; i < txs.size(); i++)
+		{
+			uint32_t start = (uint32_t)txs[i].start;
+			int32_t best = INT32_MAX;
+			for (size_t j = 0; j < downTmst.size(); j++)
+			{
+				int32_t e = (int32_t)(start - downTmst[j]);
+				if (abs(e) < abs(best))
+					best = e;
+			}
+			if (best != INT32_MAX)
+				err.push_back(best);
+		}
+		std::sort(err.begin(), err.end());
+		printf("downlinks: pedidos %u, transmitidos %u, fila: tooLate %u tooEarly %u collision %u\n", (uint32_t)downAsked,
+			   (uint32_t)txs.size(), downQ.tooLate, downQ.tooEarly, downQ.collision);
+		if (!err.empty())
+			printf("erro do TX (uSec): min %d, mediana %d, max %d\n", err.front(), err[err.size() / 2], err.back());
+	}
+	hostExit(0);
+}
@@ -0,0 +1,247 @@
+// =========================================================================================================
+// bench_rxpk.cpp: microbenchmark da serialização do rxpk.
+//
+// Compara rxpkJson() (jsonWriter, _txRx.ino) com a versão anterior de buildRxpk(), copiada abaixo sem
+// alterações na parte do JSON: snprintf() para os números, ftoa() para a frequência, o switch do SF e
+// o payload codificado em base64 duas vezes (primeiro em b64[344], depois no datagrama).
+// Só a serialização é medida; as estatísticas, o Serial e o OLED são iguais nas duas versões.
+//
+// Para cada tamanho de payload:
+// - ciclos por chamada (rdtsc, o menor de REPS médias de ITER chamadas);
+// - bytes de pilha: a função roda numa thread cuja pilha foi pintada com PAINT, e a pilha usada é a
+//   parte que deixou de ter o padrão, menos a de uma função vazia (a própria thread e a glibc).
+//
+//   bench_rxpk
+// =========================================================================================================
+#include "host.h"
+#include <pthread.h>
+
+#include "sketch.cpp"
+
+#define ITER 20000
+#define REPS 5
+#define STACK_SIZE (64 * 1024)
+#define PAINT 0xA5
+
+// ---------------------------------------------------------------------------------------------------------
+// A versão anterior (antes do jsonWriter), só com as variáveis de estatística e a frequência passadas
+// como parâmetros, como em rxpkJson().
+// ---------------------------------------------------------------------------------------------------------
+void oldFtoa(float f, char *val, int p)
+{
+	int j = 1;
+	int ival, fval;
+	char b[7] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+
+	for (int i = 0; i < p; i++)
+	{
+		j = j * 10;
+	}
+
+	ival = (int)f; // Faz parte do inteiro.
+	fval = (int)((f - ival) * j); // Faz fração, tem o mesmo sinal que a parte inteira.
+	if (fval < 0)
+		fval = -fval; // Então, se for negativo, faça a fração positiva novamente.
+	// "sprintf" NÃO se encaixa na memória.
+	strcat(val, itoa(ival, b, 10)); // Copia a parte inteira primeiro, base 10, terminada em null.
+	strcat(val, "."); // Copiar ponto decimal.
+
+	itoa(fval, b, 10); // Copiar a parte da fração base 10.
+	for (int i = 0; (size_t)i < (p - strlen(b)); i++)
+	{
+		strcat(val, "0"); // Primeiro número de 0 da fração?
+	}
+
+	// Fração pode ser qualquer coisa de 0 a 10 ^ p, então pode ter menos dígitos.
+	strcat(val, b);
+}
+
+int oldRxpkJson(uint8_t *buff, int size, struct LoraUp *up, long SNR, int rssi)
+{
+	char cfreq[12] = {0}; // Array de caracteres para manter a frequência em MHz.
+	uint32_t tmst = up->tmst;
+	int buff_index = 0;
+	char b64[344]; // base64_enc_len(MAX_PAYLOAD_LENGTH) == 340, mais o terminador.
+	uint8_t *message = up->payLoad;
+	uint8_t messageLength = up->payLength;
+	int j;
+
+	int encodedLen = base64_enc_len(messageLength); // máximo 341.
+	base64_encode(b64, (char *)message, messageLength); // máximo 341.
+
+	buff[buff_index] = '{';
+	++buff_index;
+	j = snprintf((char *)(buff + buff_index), size - buff_index, "\"tmst\":%u", tmst);
+	buff_index += j;
+	oldFtoa((double)freqs[up->ch] / 1000000, cfreq, 6); // XXX Isso pode ser feito melhor.
+	j = snprintf((char *)(buff + buff_index), size - buff_index, ",\"chan\":%1u,\"rfch\":%1u,\"freq\":%s", 0, 0, cfreq);
+	buff_index += j;
+	memcpy((void *)(buff + buff_index), (void *)",\"stat\":1", 9);
+	buff_index += 9;
+	memcpy((void *)(buff + buff_index), (void *)",\"modu\":\"LORA\"", 14);
+	buff_index += 14;
+
+	/* Taxa de dados e largura de banda do Lora, 16-19 gráficos úteis. */
+	switch (up->sf)
+	{
+	case SF6:
+		memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF6", 12);
+		buff_index += 12;
+		break;
+	case SF7:
+		memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF7", 12);
+		buff_index += 12;
+		break;
+	case SF8:
+		memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF8", 12);
+		buff_index += 12;
+		break;
+	case SF9:
+		memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF9", 12);
+		buff_index += 12;
+		break;
+	case SF10:
+		memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF10", 13);
+		buff_index += 13;
+		break;
+	case SF11:
+		memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF11", 13);
+		buff_index += 13;
+		break;
+	case SF12:
+		memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF12", 13);
+		buff_index += 13;
+		break;
+	default:
+		memcpy((void *)(buff + buff_index), (void *)",\"datr\":\"SF?", 12);
+		buff_index += 12;
+	}
+	memcpy((void *)(buff + buff_index), (void *)"BW125\"", 6);
+	buff_index += 6;
+	memcpy((void *)(buff + buff_index), (void *)",\"codr\":\"4/5\"", 13);
+	buff_index += 13;
+	j = snprintf((char *)(buff + buff_index), size - buff_index, ",\"lsnr\":%li", SNR);
+	buff_index += j;
+	j = snprintf((char *)(buff + buff_index), size - buff_index, ",\"rssi\":%d,\"size\":%u", rssi, messageLength);
+	buff_index += j;
+	memcpy((void *)(buff + buff_index), (void *)",\"data\":\"", 9);
+	buff_index += 9;
+
+	// Use a biblioteca gBase64 para preencher a string de dados.
+	encodedLen = base64_enc_len(messageLength); // máximo 341.
+	j = base64_encode((char *)(buff + buff_index), (char *)message, messageLength);
+
+	buff_index += j;
+	buff[buff_index] = '"';
+	++buff_index;
+
+	// Fim da serialização do objeto rxpk.
+	buff[buff_index] = '}';
+	++buff_index;
+	return (buff_index);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// As duas versões escrevem no mesmo lugar do datagrama: depois do cabeçalho e de {"rxpk":[.
+// ---------------------------------------------------------------------------------------------------------
+static struct LoraUp benchUp;
+static uint8_t benchBuf[TX_BUFF_SIZE];
+static int benchLen;
+
+static void __attribute__((noinline)) runNone()
+{
+	benchLen = 0;
+}
+
+static void __attribute__((noinline)) runOld()
+{
+	benchLen = 21 + oldRxpkJson(benchBuf + 21, TX_BUFF_SIZE - 21 - 3, &benchUp, benchUp.snr, benchUp.prssi - benchUp.rssicorr);
+}
+
+static void __attribute__((noinline)) runNew()
+{
+	struct jsonWriter w;
+	jwInit(&w, benchBuf, TX_BUFF_SIZE - 2, 21);
+	rxpkJson(&w, &benchUp, benchUp.snr, benchUp.prssi - benchUp.rssicorr);
+	benchLen = w.index;
+}
+
+// Menor média de ciclos por chamada.
+static double cycles(void (*fn)())
+{
+	double best = 1e30;
+	for (int r = 0; r < REPS; r++)
+	{
+		uint64_t t0 = hostCycles();
+		for (int i = 0; i < ITER; i++)
+		{
+			fn();
+			__asm__ __volatile__("" ::: "memory");
+		}
+		double c = (double)(hostCycles() - t0) / ITER;
+		if (c < best)
+			best = c;
+	}
+	return (best);
+}
+
+// Bytes de pilha usados por fn numa thread com a pilha pintada.
+static void *stackRun(void *fn)
+{
+	((void (*)())fn)();
+	return (NULL);
+}
+
+static size_t stackDepth(void (*fn)())
+{
+	static uint8_t stack[STACK_SIZE] __attribute__((aligned(64)));
+	memset(stack, PAINT, sizeof(stack));
+	pthread_attr_t a;
+	pthread_attr_init(&a);
+	pthread_attr_setstack(&a, stack, sizeof(stack));
+	pthread_t t;
+	pthread_create(&t, &a, stackRun, (void *)fn);
+	pthread_join(t, NULL);
+	pthread_attr_destroy(&a);
+	size_t i = 0;
+	while ((i < sizeof(stack)) && (stack[i] == PAINT))
+		i++;
+	return (sizeof(stack) - i);
+}
+
+int main()
+{
+	static const int lens[] = {13, 51, 115, 222};
+	benchUp.sf = SF9;
+	benchUp.ch = 0;
+	benchUp.snr = -7;
+	benchUp.prssi = 50;
+	benchUp.rssicorr = 157;
+	benchUp.tmst = 3123456789u;
+	for (int i = 0; i < MAX_PAYLOAD_LENGTH; i++)
+		benchUp.payLoad[i] = (uint8_t)(i * 37 + 11);
+
+	size_t none = stackDepth(runNone);
+	size_t oldStack = stackDepth(runOld) - none;
+	size_t newStack = stackDepth(runNew) - none;
+
+	printf("%-8s %12s %12s %8s %8s\n", "payload", "antes ciclos", "agora ciclos", "razão", "bytes");
+	for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++)
+	{
+		benchUp.payLength = lens[l];
+		double o = cycles(runOld);
+		double n = cycles(runNew);
+		printf("%-8d %12.0f %12.0f %8.2f %8d\n", lens[l], o, n, o / n, benchLen - 21);
+	}
+	printf("pilha (bytes): antes %u, agora %u\n", (unsigned)oldStack, (unsigned)newStack);
+
+	// As saídas só diferem na frequência: ftoa() passa por float e perde a última casa.
+	benchUp.payLength = 13;
+	runOld();
+	benchBuf[benchLen] = 0;
+	printf("antes: %s\n", (char *)benchBuf + 21);
+	runNew();
+	benchBuf[benchLen] = 0;
+	printf("agora: %s\n", (char *)benchBuf + 21);
+	hostExit(0);
+}
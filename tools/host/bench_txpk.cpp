@@ -0,0 +1,139 @@
+// =========================================================================================================
+// bench_txpk.cpp: tempo de decodificação de um txpk (PULL_RESP), em ciclos por mensagem.
+//
+// Mede txpkParse() (_loraJson.ino) em três mensagens: o exemplo do protocolo Semtech, um downlink RX1
+// típico e um payload de MAX_PAYLOAD_LENGTH bytes. Com "make bench_txpk ARDUINOJSON=<dir>" (o diretório
+// com o ArduinoJson.h da versão 5, que tem StaticJsonBuffer) mede também o caminho anterior do
+// sendPacket(): parseObject() num StaticJsonBuffer<312> e os campos lidos com root["txpk"][...],
+// seguido do base64_decode() do "data". O delay(1) que havia depois do parseObject() fica de fora.
+//
+// As duas versões recebem uma cópia da mensagem a cada chamada, porque o ArduinoJson escreve no
+// buffer; a cópia entra nas duas medidas.
+//
+//   bench_txpk
+// =========================================================================================================
+#include "host.h"
+
+#include "sketch.cpp"
+
+#ifdef ARDUINOJSON
+#include <ArduinoJson.h>
+#endif
+
+#define ITER 20000
+#define REPS 5
+
+static std::string msgs[3];
+static const char *names[3] = {"semtech", "rx1", "max"};
+static uint8_t work[1024];
+static uint8_t payLoad[MAX_PAYLOAD_LENGTH + 1];
+static volatile int sink;
+
+static void __attribute__((noinline)) runNew(const std::string &m)
+{
+	struct txpkFields tx;
+	memcpy(work, m.data(), m.size());
+	sink = txpkParse(work, (int)m.size(), &tx, payLoad);
+}
+
+#ifdef ARDUINOJSON
+// O sendPacket() antes do txpkParse(), só a parte que decodifica o txpk.
+static int oldParse(uint8_t *buf, uint16_t length)
+{
+	StaticJsonBuffer<312> jsonBuffer;
+	char *bufPtr = (char *)(buf);
+	buf[length] = 0;
+	JsonObject &root = jsonBuffer.parseObject(bufPtr);
+	if (!root.success())
+	{
+		return (-1);
+	}
+	const char *data = root["txpk"]["data"];
+	uint8_t psize = root["txpk"]["size"];
+	bool ipol = root["txpk"]["ipol"];
+	uint8_t powe = root["txpk"]["powe"];
+	uint32_t tmst = (uint32_t)root["txpk"]["tmst"].as<unsigned long>();
+	const char *datr = root["txpk"]["datr"];
+	const float ff = root["txpk"]["freq"];
+	const char *modu = root["txpk"]["modu"];
+	const char *codr = root["txpk"]["codr"];
+	if (data == NULL)
+	{
+		return (-1);
+	}
+	int decLength = base64_dec_len((char *)data, strlen(data));
+	if (decLength > MAX_PAYLOAD_LENGTH)
+	{
+		return (-1);
+	}
+	base64_decode((char *)payLoad, (char *)data, strlen(data));
+	const uint8_t sfTx = atoi(datr + 2);
+	const uint32_t fff = (uint32_t)((uint32_t)((ff + 0.000035) * 1000)) * 1000;
+	return (decLength + psize + ipol + powe + tmst + sfTx + fff + (modu != NULL) + (codr != NULL));
+}
+
+static void __attribute__((noinline)) runOld(const std::string &m)
+{
+	memcpy(work, m.data(), m.size());
+	sink = oldParse(work, (uint16_t)m.size());
+}
+#endif
+
+// Menor média de ciclos por chamada.
+static double cycles(void (*fn)(const std::string &), const std::string &m)
+{
+	double best = 1e30;
+	for (int r = 0; r < REPS; r++)
+	{
+		uint64_t t0 = hostCycles();
+		for (int i = 0; i < ITER; i++)
+			fn(m);
+		double c = (double)(hostCycles() - t0) / ITER;
+		if (c < best)
+			best = c;
+	}
+	return (best);
+}
+
+int main()
+{
+	char b64[400];
+	uint8_t data[MAX_PAYLOAD_LENGTH];
+	for (int i = 0; i < MAX_PAYLOAD_LENGTH; i++)
+		data[i] = (uint8_t)(i * 37 + 11);
+
+	msgs[0] = "{\"txpk\":{\"codr\":\"4/5\",\"data\":\"YCkEAgIABQABGmIwYX/kSn4Y\",\"freq\":868.1,\"ipol\":true,\"modu\":\"LORA\","
+			  "\"powe\":14,\"rfch\":0,\"size\":18,\"tmst\":1890991792,\"datr\":\"SF7BW125\"}}";
+	base64_encode(b64, (char *)data, 33);
+	msgs[1] = std::string("{\"txpk\":{\"imme\":false,\"tmst\":3123456789,\"freq\":923.3,\"rfch\":0,\"powe\":20,\"modu\":\"LORA\","
+						  "\"datr\":\"SF9BW500\",\"codr\":\"4/5\",\"ipol\":true,\"size\":33,\"data\":\"") + b64 + "\"}}";
+	base64_encode(b64, (char *)data, MAX_PAYLOAD_LENGTH);
+	msgs[2] = std::string("{\"txpk\":{\"imme\":false,\"tmst\":3123456789,\"freq\":923.3,\"rfch\":0,\"powe\":20,\"modu\":\"LORA\","
+						  "\"datr\":\"SF7BW500\",\"codr\":\"4/5\",\"ipol\":true,\"size\":255,\"data\":\"") + b64 + "\"}}";
+
+#ifdef ARDUINOJSON
+	printf("%-8s %6s %14s %14s %8s\n", "txpk", "bytes", "ArduinoJson", "txpkParse", "razão");
+#else
+	printf("%-8s %6s %14s\n", "txpk", "bytes", "txpkParse");
+#endif
+	for (int i = 0; i < 3; i++)
+	{
+		runNew(msgs[i]);
+		if (sink < 0)
+		{
+			printf("%s: txpkParse() recusou a mensagem\n", names[i]);
+			hostExit(1);
+		}
+		double n = cycles(runNew, msgs[i]);
+#ifdef ARDUINOJSON
+		double o = cycles(runOld, msgs[i]);
+		printf("%-8s %6u %14.0f %14.0f %8.2f\n", names[i], (unsigned)msgs[i].size(), o, n, o / n);
+#else
+		printf("%-8s %6u %14.0f\n", names[i], (unsigned)msgs[i].size(), n);
+#endif
+	}
+#ifndef ARDUINOJSON
+	printf("(sem ARDUINOJSON=<dir>: a comparação com o ArduinoJson não foi compilada)\n");
+#endif
+	hostExit(0);
+}
@@ -0,0 +1,215 @@
+// =========================================================================================================
+// fuzz_txpk.cpp: corpus e fuzzer do txpkParse() (_loraJson.ino).
+//
+// 1. Corpus (corpus/txpk): cada ok_*.json tem que ser aceito, com o payload igual ao campo "data"
+//    decodificado à parte, e cada bad_*.json recusado (-1).
+// 2. Mutações: a partir do corpus, n entradas com 1 a 4 mutações cada (bit trocado, byte ou token
+//    JSON inserido, trecho apagado ou duplicado, corte, emenda com outro arquivo). Para cada uma:
+//    - o resultado é -1 ou um comprimento de 0 a MAX_PAYLOAD_LENGTH;
+//    - nada é escrito depois dos MAX_PAYLOAD_LENGTH bytes do payload (guarda);
+//    - um txpk aceito tem freq, datr (SF7 a SF12), data e tmst ou imme, e powe e size na faixa.
+//    A entrada fica num buffer do tamanho exato, sem '\0': com "make fuzz" (AddressSanitizer) uma
+//    leitura depois do fim do datagrama é apontada.
+//
+//   fuzz_txpk [-n entradas] [-s semente] [-d diretório do corpus]
+// =========================================================================================================
+#include "host.h"
+#include "test.h"
+#include <dirent.h>
+#include <getopt.h>
+#include <algorithm>
+
+#include "sketch.cpp"
+
+#define GUARD 32
+#define GUARD_BYTE 0xEE
+
+struct corpusFile
+{
+	std::string name;
+	std::vector<uint8_t> data;
+};
+
+static std::vector<corpusFile> corpus;
+static uint64_t rnd = 0x9E3779B97F4A7C15ull;
+
+// xorshift64: a mesma semente dá as mesmas entradas.
+static uint32_t rand32()
+{
+	rnd ^= rnd << 13;
+	rnd ^= rnd >> 7;
+	rnd ^= rnd << 17;
+	return ((uint32_t)rnd);
+}
+
+static bool loadCorpus(const char *dir)
+{
+	DIR *d = opendir(dir);
+	if (d == NULL)
+		return (false);
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL)
+	{
+		std::string n(e->d_name);
+		if ((n.size() < 5) || (n.compare(n.size() - 5, 5, ".json") != 0))
+			continue;
+		FILE *f = fopen((std::string(dir) + "/" + n).c_str(), "rb");
+		if (f == NULL)
+			continue;
+		corpusFile c;
+		c.name = n;
+		int ch;
+		while ((ch = fgetc(f)) != EOF)
+			c.data.push_back((uint8_t)ch);
+		fclose(f);
+		corpus.push_back(c);
+	}
+	closedir(d);
+	std::sort(corpus.begin(), corpus.end(), [](const corpusFile &a, const corpusFile &b) { return (a.name < b.name); });
+	return (!corpus.empty());
+}
+
+// Chama txpkParse() com a entrada num buffer do tamanho exato e verifica as invariantes.
+// Retorna o resultado do txpkParse(); o payload fica em payLoad.
+static uint8_t payLoad[MAX_PAYLOAD_LENGTH + GUARD];
+static int parse(const std::vector<uint8_t> &in, const char *what)
+{
+	uint8_t *buf = (uint8_t *)malloc(in.empty() ? 1 : in.size()); // malloc(0) pode devolver NULL.
+	if (!in.empty())
+		memcpy(buf, in.data(), in.size());
+	memset(payLoad + MAX_PAYLOAD_LENGTH, GUARD_BYTE, GUARD);
+	struct txpkFields tx;
+
+	int res = txpkParse(buf, (int)in.size(), &tx, payLoad);
+	free(buf);
+
+	bool guard = true;
+	for (int i = 0; i < GUARD; i++)
+		guard = guard && (payLoad[MAX_PAYLOAD_LENGTH + i] == GUARD_BYTE);
+	CHECK(guard, "%s: escrita depois do payload", what);
+	CHECK((res >= -1) && (res <= MAX_PAYLOAD_LENGTH), "%s: resultado %d", what, res);
+	if (res >= 0)
+	{
+		CHECK((tx.found & TXPK_FREQ) && (tx.found & TXPK_DATR) && (tx.found & TXPK_DATA), "%s: campos 0x%02x", what, tx.found);
+		CHECK((tx.found & TXPK_TMST) || tx.imme, "%s: sem tmst nem imme", what);
+		CHECK((tx.sf >= 7) && (tx.sf <= 12), "%s: SF%u", what, tx.sf);
+		CHECK(tx.powe <= 30, "%s: powe %u", what, tx.powe);
+		CHECK(tx.size <= MAX_PAYLOAD_LENGTH, "%s: size %u", what, tx.size);
+	}
+	return (res);
+}
+
+static const char *tokens[] = {"{", "}", "[", "]", "\"", ":", ",", "\\", " ", "\"txpk\":", "\"tmst\":", "\"imme\":",
+							   "\"freq\":", "\"datr\":", "\"powe\":", "\"size\":", "\"data\":\"", "true", "false", "null",
+							   "4294967295", "4294967296", "99999999999999999999", "923.3", "0.", "-1", "\"SF7BW125\"",
+							   "\"SF12BW125\"", "\"SF\"", "AAEC", "====", "{\"a\":[{\"b\":\"}\"}]}"};
+
+static void mutate(std::vector<uint8_t> &d)
+{
+	int n = 1 + rand32() % 4;
+	for (int m = 0; m < n; m++)
+	{
+		size_t pos = (d.empty() ? 0 : rand32() % (d.size() + 1));
+		switch (rand32() % 7)
+		{
+		case 0: // Bit trocado.
+			if (!d.empty())
+				d[rand32() % d.size()] ^= (uint8_t)(1 << (rand32() % 8));
+			break;
+		case 1: // Byte qualquer inserido.
+			d.insert(d.begin() + pos, (uint8_t)rand32());
+			break;
+		case 2: // Token JSON inserido.
+		{
+			const char *t = tokens[rand32() % (sizeof(tokens) / sizeof(tokens[0]))];
+			d.insert(d.begin() + pos, t, t + strlen(t));
+			break;
+		}
+		case 3: // Trecho apagado.
+			if (pos < d.size())
+				d.erase(d.begin() + pos, d.begin() + std::min(d.size(), pos + 1 + rand32() % 16));
+			break;
+		case 4: // Trecho duplicado.
+			if (pos < d.size())
+			{
+				std::vector<uint8_t> s(d.begin() + pos, d.begin() + std::min(d.size(), pos + 1 + rand32() % 32));
+				size_t at = rand32() % (d.size() + 1);
+				d.insert(d.begin() + at, s.begin(), s.end());
+			}
+			break;
+		case 5: // Corte.
+			d.resize(pos);
+			break;
+		case 6: // Emenda: o começo desta entrada com o fim de outro arquivo do corpus.
+		{
+			const std::vector<uint8_t> &o = corpus[rand32() % corpus.size()].data;
+			size_t from = (o.empty() ? 0 : rand32() % o.size());
+			d.resize(pos);
+			d.insert(d.end(), o.begin() + from, o.end());
+			break;
+		}
+		}
+	}
+}
+
+int main(int argc, char **argv)
+{
+	uint32_t iter = 200000;
+	const char *dir = "corpus/txpk";
+	int opt;
+	while ((opt = getopt(argc, argv, "n:s:d:")) != -1)
+	{
+		switch (opt)
+		{
+		case 'n': iter = (uint32_t)strtoul(optarg, NULL, 10); break;
+		case 's': rnd = strtoull(optarg, NULL, 0) | 1; break;
+		case 'd': dir = optarg; break;
+		default:
+			fprintf(stderr, "uso: fuzz_txpk [-n entradas] [-s semente] [-d diretório do corpus]\n");
+			hostExit(2);
+		}
+	}
+	CHECK(loadCorpus(dir), "corpus %s vazio", dir);
+	if (corpus.empty())
+		testEnd("fuzz_txpk");
+
+	// 1. Corpus.
+	uint32_t ok = 0, bad = 0;
+	for (size_t i = 0; i < corpus.size(); i++)
+	{
+		const char *n = corpus[i].name.c_str();
+		int res = parse(corpus[i].data, n);
+		if (strncmp(n, "ok_", 3) == 0)
+		{
+			CHECK(res >= 0, "%s recusado", n);
+			std::string j(corpus[i].data.begin(), corpus[i].data.end());
+			size_t p = j.find('"', j.find(':', j.find("\"data\"")) + 1) + 1;
+			std::string data = j.substr(p, j.find('"', p) - p);
+			char ref[512];
+			int refLen = base64_decode(ref, (char *)data.c_str(), (int)data.size());
+			CHECK((res == refLen) && (memcmp(payLoad, ref, refLen) == 0), "%s: payload de %d bytes, esperado %d", n, res, refLen);
+			ok++;
+		}
+		else
+		{
+			CHECK(res == -1, "%s aceito (%d)", n, res);
+			bad++;
+		}
+	}
+
+	// 2. Mutações. Até 10 falhas são mostradas com a entrada.
+	uint32_t accepted = 0;
+	for (uint32_t i = 0; (i < iter) && (testFails < 10); i++)
+	{
+		std::vector<uint8_t> d = corpus[rand32() % corpus.size()].data;
+		mutate(d);
+		int fails = testFails;
+		if (parse(d, "mutação") >= 0)
+			accepted++;
+		if (testFails != fails)
+			printf("  entrada %u: %.*s\n", i, (int)d.size(), (const char *)d.data());
+	}
+
+	printf("fuzz_txpk: corpus %u ok + %u bad, %u mutações (%u aceitas)\n", ok, bad, iter, accepted);
+	testEnd("fuzz_txpk");
+}
@@ -0,0 +1,1355 @@
+// =========================================================================================================
+// host.cpp: implementação das bibliotecas de include/ para o alvo host (tools/host). Veja host.h.
+//
+// - Tempo: esp_timer_get_time() é CLOCK_MONOTONIC desde o início mais hostMicrosOffset; micros() e
+//   millis() derivam dele, como no core ESP32, então os dois dão a volta juntos com o offset.
+// - FreeRTOS: cada tarefa é uma pthread; a notificação é um contador com mutex e variável de
+//   condição; o portMUX é um spinlock recursivo; o esp_timer tem uma thread própria, que chama os
+//   callbacks com espera ativa nos últimos HOST_SPIN uSec.
+// - SPIFFS em memória, WLAN sempre disponível (hostWifi), UDP para a rede simulada e servidor web
+//   atendido na thread do loop().
+// =========================================================================================================
+#include "host.h"
+#include "sx1276.h"
+
+#include <FS.h>
+#include <SPI.h>
+#include <SPIFFS.h>
+#include <SSD1306.h>
+#include <TimeLib.h>
+#include <WebServer.h>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include <esp_heap_caps.h>
+#include <esp_timer.h>
+#include <gBase64.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <x86intrin.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+void setup();
+void loop();
+
+volatile int64_t hostMicrosOffset = 0;
+volatile bool hostFastDelay = false;
+bool hostSerial = (getenv("HOST_SERIAL") != NULL) && (atoi(getenv("HOST_SERIAL")) > 0);
+volatile bool hostWifi = true;
+volatile bool hostAutoAck = true;
+std::function<void(const hostDatagram &)> hostOnUp;
+
+static std::atomic<bool> loopRunning(false);
+
+// =========================================================================================================
+// Tempo
+// =========================================================================================================
+static int64_t monoUs()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static int64_t monoStart = monoUs();
+
+int64_t hostTime()
+{
+	return (monoUs() - monoStart + hostMicrosOffset);
+}
+
+void hostMicrosSet(uint32_t value)
+{
+	int64_t t = monoUs() - monoStart;
+	hostMicrosOffset = (int64_t)value - (int64_t)(uint32_t)t;
+	if (t + hostMicrosOffset < 0)
+		hostMicrosOffset += 0x100000000LL; // esp_timer_get_time() nunca é negativo.
+}
+
+void hostSleepUntil(int64_t t)
+{
+	int64_t w = t - HOST_SPIN - hostTime();
+	if (w > 0)
+		usleep((useconds_t)w);
+	while (hostTime() < t)
+		_mm_pause();
+}
+
+void hostRealtime(int prio)
+{
+	struct sched_param sp;
+	sp.sched_priority = prio;
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &sp);
+}
+
+uint64_t hostCycles()
+{
+	return (__rdtsc());
+}
+
+int64_t esp_timer_get_time()
+{
+	return (hostTime());
+}
+
+unsigned long micros()
+{
+	return ((uint32_t)hostTime());
+}
+
+unsigned long millis()
+{
+	return ((uint32_t)(hostTime() / 1000));
+}
+
+void delay(uint32_t ms)
+{
+	if (hostFastDelay)
+	{
+		sched_yield();
+		return;
+	}
+	usleep(ms * 1000);
+}
+
+void delayMicroseconds(uint32_t us)
+{
+	int64_t end = hostTime() + us;
+	while (hostTime() < end)
+		_mm_pause();
+}
+
+void yield()
+{
+	sched_yield();
+}
+
+char *itoa(int value, char *buf, int radix)
+{
+	sprintf(buf, (radix == 16 ? "%x" : "%d"), value);
+	return (buf);
+}
+
+char *utoa(unsigned value, char *buf, int radix)
+{
+	sprintf(buf, (radix == 16 ? "%x" : "%u"), value);
+	return (buf);
+}
+
+// =========================================================================================================
+// GPIO e interrupções
+// =========================================================================================================
+static void (*isrs[256])(void);
+static int isrMode[256];
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+	sxPinWrite(pin, val);
+}
+
+int digitalRead(uint8_t pin)
+{
+	return (LOW);
+}
+
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode)
+{
+	isrMode[pin] = mode;
+	isrs[pin] = isr;
+}
+
+void detachInterrupt(uint8_t pin)
+{
+	isrs[pin] = NULL;
+}
+
+void noInterrupts() {}
+void interrupts() {}
+
+void hostIrq(uint8_t pin)
+{
+	void (*isr)(void) = isrs[pin];
+	if ((isr != NULL) && (isrMode[pin] != FALLING))
+		isr();
+}
+
+// =========================================================================================================
+// String, Print, Stream, Serial
+// =========================================================================================================
+static std::string numStr(unsigned long long v, int base, bool neg)
+{
+	static const char digits[] = "0123456789ABCDEF";
+	char buf[72];
+	int i = sizeof(buf) - 1;
+	buf[i] = 0;
+	if ((base < 2) || (base > 16))
+		base = 10;
+	do
+	{
+		buf[--i] = digits[v % base];
+		v /= base;
+	} while (v != 0);
+	if (neg)
+		buf[--i] = '-';
+	return (std::string(buf + i));
+}
+
+static std::string signedStr(long long v, int base)
+{
+	// Como no core: números negativos só têm sinal na base 10.
+	if ((v < 0) && (base == 10))
+		return (numStr((unsigned long long)(-v), 10, true));
+	return (numStr((unsigned long long)(unsigned long)v, base, false));
+}
+
+String::String(int v, unsigned char base) : s(signedStr(v, base)) {}
+String::String(unsigned v, unsigned char base) : s(numStr(v, base, false)) {}
+String::String(long v, unsigned char base) : s(signedStr(v, base)) {}
+String::String(unsigned long v, unsigned char base) : s(numStr(v, base, false)) {}
+String::String(unsigned char v, unsigned char base) : s(numStr(v, base, false)) {}
+
+String::String(double v, unsigned int decimals)
+{
+	char t[64];
+	snprintf(t, sizeof(t), "%.*f", (int)decimals, v);
+	s = t;
+}
+
+String &String::operator+=(const IPAddress &o)
+{
+	s += o.toString().s;
+	return (*this);
+}
+
+void String::toCharArray(char *buf, unsigned n) const
+{
+	if (n == 0)
+		return;
+	size_t len = s.size() < n - 1 ? s.size() : n - 1;
+	memcpy(buf, s.c_str(), len);
+	buf[len] = 0;
+}
+
+int String::indexOf(char c) const
+{
+	size_t p = s.find(c);
+	return (p == std::string::npos ? -1 : (int)p);
+}
+
+String String::substring(unsigned from, unsigned to) const
+{
+	if (to > s.size())
+		to = s.size();
+	if (from >= to)
+		return (String());
+	return (String(s.substr(from, to - from).c_str()));
+}
+
+size_t Print::write(const uint8_t *buf, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		write(buf[i]);
+	return (n);
+}
+
+size_t Print::print(const char *s) { return (write((const uint8_t *)s, strlen(s))); }
+size_t Print::print(const __FlashStringHelper *s) { return (print((const char *)s)); }
+size_t Print::print(const String &s) { return (write((const uint8_t *)s.c_str(), s.length())); }
+size_t Print::print(char c) { return (write((uint8_t)c)); }
+size_t Print::print(int v, int base) { return (print(String(signedStr(v, base).c_str()))); }
+size_t Print::print(unsigned v, int base) { return (print(String(numStr(v, base, false).c_str()))); }
+size_t Print::print(long v, int base) { return (print(String(signedStr(v, base).c_str()))); }
+size_t Print::print(unsigned long v, int base) { return (print(String(numStr(v, base, false).c_str()))); }
+size_t Print::print(unsigned char v, int base) { return (print(String(numStr(v, base, false).c_str()))); }
+size_t Print::print(double v, int decimals) { return (print(String(v, (unsigned)decimals))); }
+size_t Print::print(const IPAddress &ip) { return (print(ip.toString())); }
+size_t Print::println() { return (print("\r\n")); }
+
+size_t Print::printf(const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+	va_start(ap, fmt);
+	int n = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return (0);
+	return (write((const uint8_t *)buf, (size_t)n < sizeof(buf) ? (size_t)n : sizeof(buf) - 1));
+}
+
+String Stream::readStringUntil(char terminator)
+{
+	String r;
+	int c;
+	while (((c = read()) >= 0) && (c != terminator))
+		r += (char)c;
+	return (r);
+}
+
+size_t Stream::readBytes(uint8_t *buf, size_t n)
+{
+	size_t i = 0;
+	int c;
+	while ((i < n) && ((c = read()) >= 0))
+		buf[i++] = (uint8_t)c;
+	return (i);
+}
+
+HardwareSerial Serial;
+
+void HardwareSerial::begin(unsigned long baud) {}
+
+void HardwareSerial::flush()
+{
+	if (hostSerial)
+		fflush(stderr);
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+	if (hostSerial)
+		fputc(c, stderr);
+	return (1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buf, size_t n)
+{
+	if (hostSerial)
+		fwrite(buf, 1, n, stderr);
+	return (n);
+}
+
+// =========================================================================================================
+// FreeRTOS
+// =========================================================================================================
+struct hostTask
+{
+	std::mutex m;
+	std::condition_variable cv;
+	uint32_t count = 0; // Valor da notificação.
+	void (*fn)(void *) = NULL;
+	void *arg = NULL;
+	std::string name;
+};
+
+static thread_local hostTask *curTask = NULL;
+
+static hostTask *selfTask()
+{
+	if (curTask == NULL)
+		curTask = new hostTask(); // A thread principal (loopTask) e as threads dos testes.
+	return (curTask);
+}
+
+static void *taskRun(void *p)
+{
+	hostTask *t = (hostTask *)p;
+	curTask = t;
+	pthread_setname_np(pthread_self(), t->name.substr(0, 15).c_str());
+	t->fn(t->arg);
+	return (NULL);
+}
+
+BaseType_t xTaskCreatePinnedToCore(void (*fn)(void *), const char *name, uint32_t stack, void *arg,
+								   UBaseType_t prio, TaskHandle_t *handle, BaseType_t core)
+{
+	hostTask *t = new hostTask();
+	t->fn = fn;
+	t->arg = arg;
+	t->name = name;
+	if (handle != NULL)
+		*handle = t; // Antes da tarefa rodar, como no FreeRTOS.
+
+	// A pilha do ESP32 é medida em bytes de código Xtensa; no x86-64 sem otimização o código usa
+	// bem mais, então cada tarefa recebe pelo menos 1 MB.
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, (stack * 16 > (1 << 20) ? stack * 16 : (1 << 20)));
+	pthread_t th;
+	int r = pthread_create(&th, &attr, taskRun, t);
+	pthread_attr_destroy(&attr);
+	if (r != 0)
+		return (pdFALSE);
+	pthread_detach(th);
+	return (pdPASS);
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+	hostTask *t = selfTask();
+	std::unique_lock<std::mutex> l(t->m);
+	if (ticks == portMAX_DELAY)
+		t->cv.wait(l, [t] { return (t->count > 0); });
+	else if (ticks > 0)
+		t->cv.wait_for(l, std::chrono::milliseconds(ticks), [t] { return (t->count > 0); });
+	uint32_t v = t->count;
+	if (v > 0)
+		t->count = (clear ? 0 : v - 1);
+	return (v);
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+	std::lock_guard<std::mutex> l(task->m);
+	task->count++;
+	task->cv.notify_one();
+	return (pdPASS);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+	xTaskNotifyGive(task);
+	if (woken != NULL)
+		*woken = pdTRUE;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+	usleep(ticks * 1000);
+}
+
+struct hostMutex
+{
+	std::recursive_timed_mutex m;
+};
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex()
+{
+	return (new hostMutex());
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t m, TickType_t ticks)
+{
+	if (ticks == portMAX_DELAY)
+	{
+		m->m.lock();
+		return (pdPASS);
+	}
+	return (m->m.try_lock_for(std::chrono::milliseconds(ticks)) ? pdPASS : pdFALSE);
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t m)
+{
+	m->m.unlock();
+	return (pdPASS);
+}
+
+static thread_local char threadTag; // O endereço identifica a thread.
+
+void portENTER_CRITICAL(portMUX_TYPE *mux)
+{
+	uintptr_t me = (uintptr_t)&threadTag;
+	if (__atomic_load_n(&mux->owner, __ATOMIC_ACQUIRE) == me)
+	{
+		mux->count++;
+		return;
+	}
+	uintptr_t free = 0;
+	while (!__atomic_compare_exchange_n(&mux->owner, &free, me, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	{
+		free = 0;
+		_mm_pause();
+	}
+	mux->count = 1;
+}
+
+void portEXIT_CRITICAL(portMUX_TYPE *mux)
+{
+	if (--mux->count == 0)
+		__atomic_store_n(&mux->owner, (uintptr_t)0, __ATOMIC_RELEASE);
+}
+
+// =========================================================================================================
+// esp_timer: uma thread despacha os callbacks na ordem dos prazos.
+// =========================================================================================================
+struct esp_timer
+{
+	esp_timer_cb_t callback;
+	void *arg;
+	int64_t deadline; // -1 desarmado.
+};
+
+static std::mutex timerM;
+static std::condition_variable timerCv;
+static std::vector<esp_timer *> timers;
+static uint32_t timerGen = 0; // Muda a cada start/stop, para a thread recalcular o prazo.
+
+static void timerRun()
+{
+	pthread_setname_np(pthread_self(), "esp_timer");
+	hostRealtime(2);
+	std::unique_lock<std::mutex> l(timerM);
+	for (;;)
+	{
+		esp_timer *t = NULL;
+		for (size_t i = 0; i < timers.size(); i++)
+		{
+			if ((timers[i]->deadline >= 0) && ((t == NULL) || (timers[i]->deadline < t->deadline)))
+				t = timers[i];
+		}
+		if (t == NULL)
+		{
+			timerCv.wait(l);
+			continue;
+		}
+		uint32_t gen = timerGen;
+		int64_t w = t->deadline - HOST_SPIN - hostTime();
+		if (w > 0)
+		{
+			timerCv.wait_for(l, std::chrono::microseconds(w));
+			continue;
+		}
+		int64_t deadline = t->deadline;
+		l.unlock();
+		while (hostTime() < deadline)
+			_mm_pause();
+		l.lock();
+		if ((gen != timerGen) || (t->deadline != deadline))
+			continue; // Parado ou reprogramado durante a espera.
+		t->deadline = -1;
+		l.unlock();
+		t->callback(t->arg);
+		l.lock();
+	}
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *handle)
+{
+	static bool started = false;
+	esp_timer *t = new esp_timer();
+	t->callback = args->callback;
+	t->arg = args->arg;
+	t->deadline = -1;
+	std::lock_guard<std::mutex> l(timerM);
+	timers.push_back(t);
+	if (!started)
+	{
+		started = true;
+		std::thread(timerRun).detach();
+	}
+	*handle = t;
+	return (ESP_OK);
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+	std::lock_guard<std::mutex> l(timerM);
+	if (timer->deadline >= 0)
+		return (ESP_ERR_INVALID_STATE); // Como no IDF: já está armado.
+	timer->deadline = hostTime() + (int64_t)timeout_us;
+	timerGen++;
+	timerCv.notify_one();
+	return (ESP_OK);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+	std::lock_guard<std::mutex> l(timerM);
+	if (timer->deadline < 0)
+		return (ESP_ERR_INVALID_STATE);
+	timer->deadline = -1;
+	timerGen++;
+	timerCv.notify_one();
+	return (ESP_OK);
+}
+
+// =========================================================================================================
+// ESP, heap
+// =========================================================================================================
+EspClass ESP;
+
+uint32_t EspClass::getFreeHeap() { return (180000); }
+uint32_t EspClass::getMinFreeHeap() { return (150000); }
+uint32_t EspClass::getMaxAllocHeap() { return (110000); }
+uint32_t EspClass::getCpuFreqMHz() { return (240); }
+uint64_t EspClass::getEfuseMac() { return (0x563412C40A24ULL); }
+uint32_t EspClass::getCycleCount() { return ((uint32_t)hostCycles()); }
+
+void EspClass::restart()
+{
+	fprintf(stderr, "host: ESP.restart()\n");
+	hostExit(3);
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps) { return (110000); }
+uint32_t esp_get_minimum_free_heap_size(void) { return (150000); }
+
+String IPAddress::toString() const
+{
+	char b[16];
+	sprintf(b, "%u.%u.%u.%u", a[0], a[1], a[2], a[3]);
+	return (String(b));
+}
+
+// =========================================================================================================
+// SPIFFS em memória
+// =========================================================================================================
+struct hostFile
+{
+	std::vector<uint8_t> data;
+};
+
+static std::recursive_mutex fsM;
+static std::map<std::string, std::shared_ptr<hostFile>> files;
+FSClass SPIFFS;
+
+File::File(std::shared_ptr<hostFile> f, const char *name, bool rd, bool wr, bool append)
+	: _f(f), _name(name), _rd(rd), _wr(wr), _append(append)
+{
+	_pos = (append ? f->data.size() : 0);
+}
+
+size_t File::write(uint8_t c)
+{
+	return (write(&c, 1));
+}
+
+size_t File::write(const uint8_t *buf, size_t n)
+{
+	if (!_f || !_wr)
+		return (0);
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	if (_append)
+		_pos = _f->data.size();
+	if (_pos + n > _f->data.size())
+		_f->data.resize(_pos + n);
+	memcpy(&_f->data[_pos], buf, n);
+	_pos += n;
+	return (n);
+}
+
+int File::available()
+{
+	if (!_f || !_rd)
+		return (0);
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	return (_pos < _f->data.size() ? (int)(_f->data.size() - _pos) : 0);
+}
+
+int File::read()
+{
+	uint8_t c;
+	return (read(&c, 1) == 1 ? c : -1);
+}
+
+int File::peek()
+{
+	if (!_f || !_rd)
+		return (-1);
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	return (_pos < _f->data.size() ? _f->data[_pos] : -1);
+}
+
+size_t File::read(uint8_t *buf, size_t n)
+{
+	if (!_f || !_rd)
+		return (0);
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	size_t left = (_pos < _f->data.size() ? _f->data.size() - _pos : 0);
+	if (n > left)
+		n = left;
+	if (n > 0)
+		memcpy(buf, &_f->data[_pos], n);
+	_pos += n;
+	return (n);
+}
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+	if (!_f)
+		return (false);
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	size_t base = (mode == SeekSet ? 0 : (mode == SeekCur ? _pos : _f->data.size()));
+	if (base + pos > _f->data.size())
+		return (false);
+	_pos = base + pos;
+	return (true);
+}
+
+size_t File::size() const
+{
+	if (!_f)
+		return (0);
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	return (_f->data.size());
+}
+
+bool FSClass::begin(bool formatOnFail) { return (true); }
+
+bool FSClass::format()
+{
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	files.clear();
+	return (true);
+}
+
+bool FSClass::exists(const char *path)
+{
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	return (files.count(path) > 0);
+}
+
+File FSClass::open(const char *path, const char *mode)
+{
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	auto it = files.find(path);
+	bool plus = (strchr(mode, '+') != NULL);
+	switch (mode[0])
+	{
+	case 'r':
+		if (it == files.end())
+			return (File());
+		return (File(it->second, path, true, plus, false));
+	case 'w':
+	{
+		std::shared_ptr<hostFile> f = std::make_shared<hostFile>();
+		files[path] = f;
+		return (File(f, path, plus, true, false));
+	}
+	case 'a':
+	{
+		if (it == files.end())
+			it = files.insert(std::make_pair(std::string(path), std::make_shared<hostFile>())).first;
+		return (File(it->second, path, plus, true, true));
+	}
+	default:
+		return (File());
+	}
+}
+
+bool FSClass::remove(const char *path)
+{
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	return (files.erase(path) > 0);
+}
+
+bool FSClass::rename(const char *from, const char *to)
+{
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	auto it = files.find(from);
+	if (it == files.end())
+		return (false);
+	files[to] = it->second;
+	files.erase(from);
+	return (true);
+}
+
+size_t FSClass::totalBytes() { return (1374476); }
+
+size_t FSClass::usedBytes()
+{
+	std::lock_guard<std::recursive_mutex> l(fsM);
+	size_t n = 0;
+	for (auto &f : files)
+		n += f.second->data.size();
+	return (n);
+}
+
+// =========================================================================================================
+// SPI
+// =========================================================================================================
+SPIClass SPI;
+static std::recursive_mutex spiBus; // O paramLock do SPIClass do core ESP32.
+
+void SPIClass::begin(int8_t sck, int8_t miso, int8_t mosi, int8_t ss) {}
+void SPIClass::beginTransaction(SPISettings settings) { spiBus.lock(); }
+void SPIClass::endTransaction() { spiBus.unlock(); }
+uint8_t SPIClass::transfer(uint8_t data) { return (sxTransfer(data)); }
+
+void SPIClass::transfer(void *data, uint32_t size)
+{
+	uint8_t *p = (uint8_t *)data;
+	for (uint32_t i = 0; i < size; i++)
+		p[i] = sxTransfer(p[i]);
+}
+
+void SPIClass::transferBytes(const uint8_t *out, uint8_t *in, uint32_t size)
+{
+	for (uint32_t i = 0; i < size; i++)
+	{
+		uint8_t r = sxTransfer(out != NULL ? out[i] : 0xFF);
+		if (in != NULL)
+			in[i] = r;
+	}
+}
+
+void SPIClass::writeBytes(const uint8_t *data, uint32_t size)
+{
+	transferBytes(data, NULL, size);
+}
+
+// =========================================================================================================
+// WLAN e rede simulada
+// =========================================================================================================
+WiFiClass WiFi;
+static volatile bool wifiUp = false;
+static std::string wifiSsid;
+static std::string wifiHostname = "esp32";
+static std::mutex netM;
+static std::vector<std::string> hostNames; // hostByName(): o nome i recebe 10.0.1.(i + 1).
+static std::deque<hostDatagram> down; // Datagramas para o gateway.
+static std::vector<hostDatagram> up; // Datagramas do gateway.
+static const IPAddress localIp(192, 168, 4, 2);
+static const IPAddress ntpIp(10, 0, 0, 123);
+
+int WiFiClass::status() { return ((wifiUp && hostWifi) ? WL_CONNECTED : WL_DISCONNECTED); }
+
+int WiFiClass::begin(const char *ssid, const char *passphrase)
+{
+	wifiSsid = (ssid != NULL ? ssid : "");
+	wifiUp = hostWifi;
+	return (status());
+}
+
+bool WiFiClass::disconnect(bool wifioff)
+{
+	wifiUp = false;
+	return (true);
+}
+
+bool WiFiClass::mode(int m) { return (true); }
+
+uint8_t *WiFiClass::macAddress(uint8_t *mac)
+{
+	static const uint8_t m[6] = {0x24, 0x0A, 0xC4, 0x12, 0x34, 0x56};
+	memcpy(mac, m, 6);
+	return (mac);
+}
+
+bool WiFiClass::setHostname(const char *name)
+{
+	wifiHostname = name;
+	return (true);
+}
+
+const char *WiFiClass::getHostname() { return (wifiHostname.c_str()); }
+String WiFiClass::SSID() { return (String(wifiSsid.c_str())); }
+IPAddress WiFiClass::localIP() { return (status() == WL_CONNECTED ? localIp : IPAddress()); }
+IPAddress WiFiClass::gatewayIP() { return (IPAddress(192, 168, 4, 1)); }
+int8_t WiFiClass::RSSI() { return (-60); }
+
+IPAddress hostServerIP(const char *host)
+{
+	std::lock_guard<std::mutex> l(netM);
+	size_t i;
+	for (i = 0; i < hostNames.size(); i++)
+	{
+		if (hostNames[i] == host)
+			break;
+	}
+	if (i == hostNames.size())
+		hostNames.push_back(host);
+	return (IPAddress(10, 0, 1, (uint8_t)(i + 1)));
+}
+
+int WiFiClass::hostByName(const char *host, IPAddress &ip)
+{
+	if (status() != WL_CONNECTED)
+		return (0);
+#ifdef NTP_TIMESERVER
+	if (strcmp(host, NTP_TIMESERVER) == 0)
+	{
+		ip = ntpIp;
+		return (1);
+	}
+#endif
+	if (strstr(host, "pool.ntp.org") != NULL)
+	{
+		ip = ntpIp;
+		return (1);
+	}
+	ip = hostServerIP(host);
+	return (1);
+}
+
+// Resposta do servidor NTP: a hora do Linux nos segundos de transmissão (bytes 40-43).
+static void ntpReply(const hostDatagram &q)
+{
+	hostDatagram r;
+	r.ip = q.ip;
+	r.port = 123;
+	r.time = hostTime();
+	r.data.assign(48, 0);
+	r.data[0] = 0x24; // LI 0, versão 4, modo 4 (servidor).
+	uint32_t secs = (uint32_t)(time(NULL) + 2208988800UL);
+	r.data[40] = secs >> 24;
+	r.data[41] = secs >> 16;
+	r.data[42] = secs >> 8;
+	r.data[43] = secs;
+	down.push_back(r);
+}
+
+// O servidor de teste: responde como um servidor Semtech (PUSH_ACK e PULL_ACK com o mesmo token).
+static void serverReceive(const hostDatagram &d)
+{
+	std::function<void(const hostDatagram &)> cb;
+	{
+		std::lock_guard<std::mutex> l(netM);
+		if (d.port == 123)
+		{
+			ntpReply(d);
+			return;
+		}
+		up.push_back(d);
+		if (hostAutoAck && (d.data.size() >= 4) && ((d.data[3] == 0x00) || (d.data[3] == 0x20) || (d.data[3] == 0x02)))
+		{
+			hostDatagram a;
+			a.ip = d.ip;
+			a.port = d.port;
+			a.time = hostTime();
+			a.data.assign(d.data.begin(), d.data.begin() + 4);
+			a.data[3] = (d.data[3] == 0x02 ? 0x04 : 0x01); // PULL_ACK ou PUSH_ACK.
+			down.push_back(a);
+		}
+		cb = hostOnUp;
+	}
+	if (cb)
+		cb(d);
+}
+
+void hostNetDown(IPAddress ip, uint16_t port, const uint8_t *data, size_t len)
+{
+	hostDatagram d;
+	d.ip = ip;
+	d.port = port;
+	d.time = hostTime();
+	d.data.assign(data, data + len);
+	std::lock_guard<std::mutex> l(netM);
+	down.push_back(d);
+}
+
+std::vector<hostDatagram> hostNetUp()
+{
+	std::lock_guard<std::mutex> l(netM);
+	return (up);
+}
+
+void hostNetClear()
+{
+	std::lock_guard<std::mutex> l(netM);
+	up.clear();
+}
+
+uint8_t WiFiUDP::begin(uint16_t port)
+{
+	_port = port;
+	return (1);
+}
+
+void WiFiUDP::stop() { _port = 0; }
+
+int WiFiUDP::parsePacket()
+{
+	if (!_txOpen)
+		_tx.clear();
+	std::lock_guard<std::mutex> l(netM);
+	if (down.empty() || (WiFi.status() != WL_CONNECTED))
+		return (0);
+	hostDatagram d = down.front();
+	down.pop_front();
+	_rx = d.data;
+	_rxPos = 0;
+	_rxIp = d.ip;
+	_rxPort = d.port;
+	return ((int)_rx.size());
+}
+
+int WiFiUDP::read()
+{
+	return (_rxPos < _rx.size() ? _rx[_rxPos++] : -1);
+}
+
+int WiFiUDP::read(uint8_t *buf, size_t len)
+{
+	size_t left = _rx.size() - _rxPos;
+	if (len > left)
+		len = left;
+	if (len > 0)
+		memcpy(buf, &_rx[_rxPos], len);
+	_rxPos += len;
+	return ((int)len);
+}
+
+int WiFiUDP::peek() { return (_rxPos < _rx.size() ? _rx[_rxPos] : -1); }
+int WiFiUDP::available() { return ((int)(_rx.size() - _rxPos)); }
+
+void WiFiUDP::flush()
+{
+	_rx.clear();
+	_rxPos = 0;
+}
+
+IPAddress WiFiUDP::remoteIP() { return (_rxIp); }
+uint16_t WiFiUDP::remotePort() { return (_rxPort); }
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port)
+{
+	if (WiFi.status() != WL_CONNECTED)
+		return (0);
+	_txIp = ip;
+	_txPort = port;
+	_tx.clear();
+	_txOpen = true;
+	return (1);
+}
+
+int WiFiUDP::endPacket()
+{
+	if (!_txOpen || (WiFi.status() != WL_CONNECTED))
+	{
+		_txOpen = false;
+		return (0);
+	}
+	_txOpen = false;
+	hostDatagram d;
+	d.ip = _txIp;
+	d.port = _txPort;
+	d.time = hostTime();
+	d.data = _tx;
+	serverReceive(d);
+	return (1);
+}
+
+size_t WiFiUDP::write(uint8_t c)
+{
+	return (write(&c, 1));
+}
+
+size_t WiFiUDP::write(const uint8_t *buf, size_t n)
+{
+	if (!_txOpen)
+		return (0);
+	if (_tx.size() + n > 1460)
+		n = 1460 - _tx.size(); // Como o lwIP: o datagrama não passa do MTU.
+	_tx.insert(_tx.end(), buf, buf + n);
+	return (n);
+}
+
+// =========================================================================================================
+// Servidor web
+// =========================================================================================================
+WebServer *WebServer::instance = NULL;
+static std::mutex webM;
+static std::condition_variable webCv;
+static std::deque<std::string> webReq;
+static std::map<uint64_t, std::string> webResp;
+static uint64_t webNext = 0, webDone = 0;
+
+WebServer::WebServer(int port)
+{
+	instance = this;
+	_client.server = this;
+}
+
+size_t WiFiClient::write(const uint8_t *buf, size_t n)
+{
+	if (server != NULL)
+		server->out.append((const char *)buf, n);
+	return (n);
+}
+
+void WebServer::on(const String &uri, THandlerFunction handler)
+{
+	_handlers[uri.c_str()] = handler;
+}
+
+void WebServer::onNotFound(THandlerFunction handler)
+{
+	_notFound = handler;
+}
+
+void WebServer::send(int c, const char *type, const String &content)
+{
+	code = c;
+	out.append(content.c_str(), content.length());
+}
+
+void WebServer::send_P(int c, const char *type, const char *content, size_t len)
+{
+	code = c;
+	out.append(content, len);
+}
+
+void WebServer::sendContent(const char *content, size_t len)
+{
+	out.append(content, len);
+}
+
+static std::string urlDecode(const std::string &s)
+{
+	std::string r;
+	for (size_t i = 0; i < s.size(); i++)
+	{
+		if ((s[i] == '%') && (i + 2 < s.size()))
+		{
+			r += (char)strtol(s.substr(i + 1, 2).c_str(), NULL, 16);
+			i += 2;
+		}
+		else
+			r += (s[i] == '+' ? ' ' : s[i]);
+	}
+	return (r);
+}
+
+std::string WebServer::serve(const std::string &request)
+{
+	size_t q = request.find('?');
+	_uri = request.substr(0, q);
+	_args.clear();
+	if (q != std::string::npos)
+	{
+		std::string query = request.substr(q + 1);
+		size_t p = 0;
+		while (p <= query.size())
+		{
+			size_t e = query.find('&', p);
+			if (e == std::string::npos)
+				e = query.size();
+			std::string kv = query.substr(p, e - p);
+			size_t eq = kv.find('=');
+			if (!kv.empty())
+				_args.push_back(std::make_pair(urlDecode(kv.substr(0, eq)), (eq == std::string::npos ? "" : urlDecode(kv.substr(eq + 1)))));
+			p = e + 1;
+		}
+	}
+	out.clear();
+	code = 0;
+	auto it = _handlers.find(_uri);
+	if (it != _handlers.end())
+		it->second();
+	else if (_notFound)
+		_notFound();
+	else
+		send(404, "text/plain", "Not found");
+	return (out);
+}
+
+String WebServer::arg(const char *name)
+{
+	for (size_t i = 0; i < _args.size(); i++)
+	{
+		if (_args[i].first == name)
+			return (String(_args[i].second.c_str()));
+	}
+	return (String());
+}
+
+bool WebServer::hasArg(const char *name)
+{
+	for (size_t i = 0; i < _args.size(); i++)
+	{
+		if (_args[i].first == name)
+			return (true);
+	}
+	return (false);
+}
+
+// Como no core ESP32: sem cliente, handleClient() espera 1 mSec (_nullDelay).
+void WebServer::handleClient()
+{
+	std::string req;
+	uint64_t id;
+	{
+		std::lock_guard<std::mutex> l(webM);
+		if (webReq.empty())
+		{
+			req.clear();
+		}
+		else
+		{
+			req = webReq.front();
+			webReq.pop_front();
+			id = webDone++;
+		}
+	}
+	if (req.empty())
+	{
+		delay(1);
+		return;
+	}
+	std::string r = serve(req);
+	std::lock_guard<std::mutex> l(webM);
+	webResp[id] = r;
+	webCv.notify_all();
+}
+
+std::string hostWebGet(const char *uri)
+{
+	if (!loopRunning)
+		return (WebServer::instance->serve(uri));
+	std::unique_lock<std::mutex> l(webM);
+	uint64_t id = webNext++;
+	webReq.push_back(uri);
+	webCv.wait(l, [id] { return (webResp.count(id) > 0); });
+	std::string r = webResp[id];
+	webResp.erase(id);
+	return (r);
+}
+
+// =========================================================================================================
+// TimeLib
+// =========================================================================================================
+static time_t timeBase = 0;
+static uint32_t timeBaseMs = 0;
+static timeStatus_t timeState = timeNotSet;
+
+time_t now() { return (timeBase + (time_t)((uint32_t)(millis() - timeBaseMs) / 1000)); }
+
+void setTime(time_t t)
+{
+	timeBase = t;
+	timeBaseMs = millis();
+	timeState = timeSet;
+}
+
+timeStatus_t timeStatus() { return (timeState); }
+void setSyncProvider(getExternalTime f) {}
+void setSyncInterval(time_t interval) {}
+
+static struct tm tmOf(time_t t)
+{
+	struct tm r;
+	gmtime_r(&t, &r);
+	return (r);
+}
+
+int hour(time_t t) { return (tmOf(t).tm_hour); }
+int minute(time_t t) { return (tmOf(t).tm_min); }
+int second(time_t t) { return (tmOf(t).tm_sec); }
+int day(time_t t) { return (tmOf(t).tm_mday); }
+int month(time_t t) { return (tmOf(t).tm_mon + 1); }
+int year(time_t t) { return (tmOf(t).tm_year + 1900); }
+int weekday(time_t t) { return (tmOf(t).tm_wday + 1); } // Domingo é 1.
+int hour() { return (hour(now())); }
+int minute() { return (minute(now())); }
+int second() { return (second(now())); }
+int day() { return (day(now())); }
+int month() { return (month(now())); }
+int year() { return (year(now())); }
+int weekday() { return (weekday(now())); }
+
+// =========================================================================================================
+// arduino-base64 (adamvr): a mesma semântica, inclusive o terminador escrito pelo encode e pelo decode.
+// =========================================================================================================
+static const char b64Alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+int base64_encode(char *output, char *input, int inputLen)
+{
+	int n = 0;
+	for (int i = 0; i < inputLen; i += 3)
+	{
+		uint32_t v = (uint8_t)input[i] << 16;
+		if (i + 1 < inputLen)
+			v |= (uint8_t)input[i + 1] << 8;
+		if (i + 2 < inputLen)
+			v |= (uint8_t)input[i + 2];
+		output[n++] = b64Alphabet[(v >> 18) & 0x3F];
+		output[n++] = b64Alphabet[(v >> 12) & 0x3F];
+		output[n++] = (i + 1 < inputLen) ? b64Alphabet[(v >> 6) & 0x3F] : '=';
+		output[n++] = (i + 2 < inputLen) ? b64Alphabet[v & 0x3F] : '=';
+	}
+	output[n] = 0;
+	return (n);
+}
+
+static int b64Lookup(char c)
+{
+	const char *p = strchr(b64Alphabet, c);
+	return ((c != 0) && (p != NULL) ? (int)(p - b64Alphabet) : -1);
+}
+
+int base64_decode(char *output, char *input, int inputLen)
+{
+	int n = 0, i = 0;
+	uint8_t a4[4];
+	while (inputLen-- > 0)
+	{
+		if (*input == '=')
+			break;
+		int v = b64Lookup(*input++);
+		a4[i++] = (uint8_t)(v < 0 ? 0 : v);
+		if (i == 4)
+		{
+			output[n++] = (a4[0] << 2) | (a4[1] >> 4);
+			output[n++] = (a4[1] << 4) | (a4[2] >> 2);
+			output[n++] = (a4[2] << 6) | a4[3];
+			i = 0;
+		}
+	}
+	if (i > 0)
+	{
+		for (int j = i; j < 4; j++)
+			a4[j] = 0;
+		uint8_t a3[3] = {(uint8_t)((a4[0] << 2) | (a4[1] >> 4)), (uint8_t)((a4[1] << 4) | (a4[2] >> 2)), (uint8_t)((a4[2] << 6) | a4[3])};
+		for (int j = 0; j < i - 1; j++)
+			output[n++] = a3[j];
+	}
+	output[n] = 0;
+	return (n);
+}
+
+int base64_enc_len(int inputLen)
+{
+	return ((inputLen + 2 - ((inputLen + 2) % 3)) / 3 * 4);
+}
+
+int base64_dec_len(char *input, int inputLen)
+{
+	int eq = 0;
+	for (int i = inputLen - 1; (i >= 0) && (input[i] == '='); i--)
+		eq++;
+	return (((6 * inputLen) / 8) - eq);
+}
+
+// =========================================================================================================
+// Fontes do display (não desenhado).
+// =========================================================================================================
+const uint8_t ArialMT_Plain_10[] = {0};
+const uint8_t ArialMT_Plain_16[] = {0};
+const uint8_t ArialMT_Plain_24[] = {0};
+
+// =========================================================================================================
+// Execução
+// =========================================================================================================
+static void *loopTask(void *arg)
+{
+	pthread_setname_np(pthread_self(), "loopTask");
+	for (;;)
+		loop();
+	return (NULL);
+}
+
+void hostBoot(bool withLoopTask)
+{
+	hostFastDelay = true;
+	setup();
+	hostFastDelay = false;
+	if (withLoopTask)
+	{
+		loopRunning = true;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setstacksize(&attr, 1 << 20);
+		pthread_t th;
+		pthread_create(&th, &attr, loopTask, NULL);
+		pthread_attr_destroy(&attr);
+		pthread_detach(th);
+	}
+}
+
+void hostExit(int code)
+{
+	fflush(stdout);
+	fflush(stderr);
+	_exit(code);
+}
@@ -0,0 +1,83 @@
+// =========================================================================================================
+// host.h: API do alvo host para os testes e o benchmark de tools/host.
+//
+// O gateway (todos os .ino, concatenados em build/<cfg>/sketch.cpp pelo sketch.py) roda no Linux
+// sobre as bibliotecas de include/, implementadas em host.cpp: as tarefas do FreeRTOS são pthreads,
+// o SPIFFS fica em memória, a WLAN e o UDP são uma rede simulada com um servidor Semtech de teste,
+// e o SPI e os pinos DIO vão para os SX1276 simulados de sx1276.h.
+//
+// Uso típico (veja bench.cpp):
+//   sx1276 radio0(pins.ss, pins.rst, pins.dio0, pins.dio1, pins.dio2);
+//   hostBoot();         // setup() com delay() acelerado e a thread do loop() (loopTask do ESP32).
+//   ... sxInject() / hostNetDown() / hostWebGet() ...
+//   hostExit(0);        // Sai sem destruir as globais com as tarefas ainda rodando.
+// =========================================================================================================
+#pragma once
+#include <Arduino.h>
+#include <Esp.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+// ---------------------------------------------------------------------------------------------------------
+// Tempo
+// ---------------------------------------------------------------------------------------------------------
+int64_t hostTime(); // esp_timer_get_time(): uSec desde o início, mais hostMicrosOffset.
+void hostMicrosSet(uint32_t value); // Ajusta hostMicrosOffset para micros() valer value agora.
+extern volatile int64_t hostMicrosOffset;
+extern volatile bool hostFastDelay; // delay() só cede a CPU, sem dormir (usado no setup()).
+void hostSleepUntil(int64_t t); // Dorme até hostTime() == t; os últimos HOST_SPIN uSec em espera ativa.
+// Espera ativa antes de um instante marcado (hostSleepUntil(), esp_timer, bordas dos pinos DIO). Maior
+// que a latência de acordar uma thread SCHED_FIFO numa máquina virtual (até ~1.5 mSec).
+#define HOST_SPIN 1000
+
+// Põe a thread que chama em SCHED_FIFO com a prioridade prio, se o sistema permitir (root ou
+// CAP_SYS_NICE); senão ela continua em SCHED_OTHER. Usada pelas threads que no ESP32 estão acima das
+// tarefas do gateway: o esp_timer (prioridade 22), o hardware do rádio e os nós no ar. Elas só
+// esperam em mutex, nunca num portMUX, então não travam uma CPU única.
+void hostRealtime(int prio);
+
+// ---------------------------------------------------------------------------------------------------------
+// Execução do gateway
+// ---------------------------------------------------------------------------------------------------------
+// Chama setup() com hostFastDelay e, com loopTask, cria a thread que chama loop() sem parar, como a
+// loopTask do core ESP32. Sem loopTask o teste chama loop() quando quiser (_RADIO_TASK/_NET_TASK 0).
+void hostBoot(bool loopTask = true);
+void hostExit(int code); // Termina o processo sem os destrutores globais (as tarefas não terminam).
+extern bool hostSerial; // Saída do Serial em stderr (HOST_SERIAL=1 no ambiente).
+
+// ---------------------------------------------------------------------------------------------------------
+// Interrupções: chamada pelo modelo do rádio na borda de subida de um pino DIO.
+// ---------------------------------------------------------------------------------------------------------
+void hostIrq(uint8_t pin);
+
+// ---------------------------------------------------------------------------------------------------------
+// Rede simulada. O gateway tem um único endereço; todo datagrama dele que não vai para a porta 123
+// vai para o servidor de teste, que o registra, responde PUSH_ACK/PULL_ACK (hostAutoAck) e chama
+// hostOnUp. A porta 123 é o servidor NTP, que responde com a hora do Linux.
+// ---------------------------------------------------------------------------------------------------------
+struct hostDatagram
+{
+	IPAddress ip; // Destino (do gateway) ou origem (para o gateway).
+	uint16_t port;
+	int64_t time; // hostTime() do envio.
+	std::vector<uint8_t> data;
+};
+extern volatile bool hostWifi; // A WLAN está disponível.
+extern volatile bool hostAutoAck; // O servidor responde PUSH_ACK e PULL_ACK.
+extern std::function<void(const hostDatagram &)> hostOnUp; // Chamada na thread que enviou.
+void hostNetDown(IPAddress ip, uint16_t port, const uint8_t *data, size_t len); // Servidor -> gateway.
+std::vector<hostDatagram> hostNetUp(); // Cópia de todos os datagramas enviados pelo gateway.
+void hostNetClear();
+IPAddress hostServerIP(const char *host); // Endereço que hostByName() devolve para host.
+
+// ---------------------------------------------------------------------------------------------------------
+// Servidor web: pede uri (com a query) e devolve a resposta. Com a thread do loop() o pedido é
+// atendido por server.handleClient() nela; sem ela, na thread de quem chamou.
+// ---------------------------------------------------------------------------------------------------------
+std::string hostWebGet(const char *uri);
+
+// ---------------------------------------------------------------------------------------------------------
+// Ciclos da CPU (rdtsc), usados por ESP.getCycleCount() e pelos benchmarks.
+// ---------------------------------------------------------------------------------------------------------
+uint64_t hostCycles();
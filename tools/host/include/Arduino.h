@@ -0,0 +1,198 @@
+// =========================================================================================================
+// Arduino.h do alvo host (tools/host): a parte do core Arduino-ESP32 e do FreeRTOS que o gateway usa,
+// implementada em host.cpp sobre POSIX (pthreads e clock_gettime).
+// Só o que os arquivos .ino chamam está aqui; a semântica segue a do core ESP32 1.0.x.
+// =========================================================================================================
+#pragma once
+#include <math.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <functional>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define ICACHE_RAM_ATTR
+#define ICACHE_FLASH_ATTR
+#define IRAM_ATTR
+#define PROGMEM
+#define HIGH 1
+#define LOW 0
+#define INPUT 0x01
+#define OUTPUT 0x02
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+#define BIN 2
+#define OCT 8
+#define DEC 10
+#define HEX 16
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *)(s))
+#define PSTR(s) (s)
+#define FPSTR(s) ((const __FlashStringHelper *)(s))
+
+inline size_t strlen_P(const char *s) { return (strlen(s)); }
+inline void *memcpy_P(void *d, const void *s, size_t n) { return (memcpy(d, s, n)); }
+inline uint8_t pgm_read_byte(const void *p) { return (*(const uint8_t *)p); }
+char *itoa(int value, char *buf, int radix);
+char *utoa(unsigned value, char *buf, int radix);
+
+// Tempo: micros() e millis() vêm de esp_timer_get_time(), como no core ESP32.
+unsigned long micros();
+unsigned long millis();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void yield();
+
+// GPIO: os pinos de chip select e reset vão para o modelo do SX1276 (sx1276.cpp).
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t pin);
+void noInterrupts();
+void interrupts();
+
+// ---------------------------------------------------------------------------------------------------------
+// String
+// ---------------------------------------------------------------------------------------------------------
+class IPAddress;
+class String
+{
+public:
+	std::string s;
+	String() {}
+	String(const char *c) : s(c ? c : "") {}
+	String(const String &o) = default;
+	String &operator=(const String &o) = default;
+	String(const __FlashStringHelper *c) : s((const char *)c) {}
+	String(char c) : s(1, c) {}
+	String(int v, unsigned char base = 10);
+	String(unsigned v, unsigned char base = 10);
+	String(long v, unsigned char base = 10);
+	String(unsigned long v, unsigned char base = 10);
+	String(unsigned char v, unsigned char base = 10);
+	String(double v, unsigned int decimals = 2);
+	String &operator+=(const String &o) { s += o.s; return (*this); }
+	String &operator+=(const char *o) { s += (o ? o : ""); return (*this); }
+	String &operator+=(char o) { s += o; return (*this); }
+	String &operator+=(int o) { return (*this += String(o)); }
+	String &operator+=(unsigned o) { return (*this += String(o)); }
+	String &operator+=(long o) { return (*this += String(o)); }
+	String &operator+=(unsigned long o) { return (*this += String(o)); }
+	String &operator+=(unsigned char o) { return (*this += String(o)); }
+	String &operator+=(double o) { return (*this += String(o)); }
+	String &operator+=(const IPAddress &o);
+	bool operator==(const char *o) const { return (s == o); }
+	bool operator==(const String &o) const { return (s == o.s); }
+	bool operator!=(const char *o) const { return (s != o); }
+	bool operator!=(const String &o) const { return (s != o.s); }
+	char operator[](unsigned i) const { return (i < s.size() ? s[i] : 0); }
+	unsigned length() const { return (s.size()); }
+	const char *c_str() const { return (s.c_str()); }
+	long toInt() const { return (atol(s.c_str())); }
+	float toFloat() const { return ((float)atof(s.c_str())); }
+	void toCharArray(char *buf, unsigned n) const;
+	int indexOf(char c) const;
+	String substring(unsigned from) const { return (from < s.size() ? String(s.substr(from).c_str()) : String()); }
+	String substring(unsigned from, unsigned to) const;
+	bool reserve(unsigned n) { s.reserve(n); return (true); }
+};
+template <typename T> String operator+(const String &a, const T &b) { String r(a); r += b; return (r); }
+inline String operator+(const char *a, const String &b) { String r(a); r += b; return (r); }
+
+// ---------------------------------------------------------------------------------------------------------
+// Print, Stream e Serial
+// ---------------------------------------------------------------------------------------------------------
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+	virtual size_t write(const uint8_t *buf, size_t n);
+	size_t write(const char *str) { return (write((const uint8_t *)str, strlen(str))); }
+	size_t print(const char *s);
+	size_t print(const __FlashStringHelper *s);
+	size_t print(const String &s);
+	size_t print(char c);
+	size_t print(int v, int base = DEC);
+	size_t print(unsigned v, int base = DEC);
+	size_t print(long v, int base = DEC);
+	size_t print(unsigned long v, int base = DEC);
+	size_t print(unsigned char v, int base = DEC);
+	size_t print(double v, int decimals = 2);
+	size_t print(const IPAddress &ip);
+	size_t println();
+	template <typename T> size_t println(T t) { size_t n = print(t); return (n + println()); }
+	template <typename T> size_t println(T t, int b) { size_t n = print(t, b); return (n + println()); }
+	size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print
+{
+public:
+	virtual int available() { return (0); }
+	virtual int read() { return (-1); }
+	virtual int peek() { return (-1); }
+	String readStringUntil(char terminator);
+	size_t readBytes(uint8_t *buf, size_t n);
+	size_t readBytes(char *buf, size_t n) { return (readBytes((uint8_t *)buf, n)); }
+};
+
+// A saída do Serial vai para stderr somente com HOST_SERIAL=1 no ambiente (veja host.cpp).
+class HardwareSerial : public Stream
+{
+public:
+	void begin(unsigned long baud);
+	void flush();
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t *buf, size_t n) override;
+	using Print::write;
+};
+extern HardwareSerial Serial;
+
+// ---------------------------------------------------------------------------------------------------------
+// FreeRTOS: tarefas em pthreads, notificações com mutex e variável de condição (host.cpp).
+// ---------------------------------------------------------------------------------------------------------
+typedef struct hostTask *TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdPASS 1
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+#define portTICK_PERIOD_MS 1
+#define pdMS_TO_TICKS(x) ((TickType_t)(x))
+
+BaseType_t xTaskCreatePinnedToCore(void (*fn)(void *), const char *name, uint32_t stack, void *arg,
+								   UBaseType_t prio, TaskHandle_t *handle, BaseType_t core);
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken);
+void vTaskDelay(TickType_t ticks);
+#define portYIELD_FROM_ISR()
+
+typedef struct hostMutex *SemaphoreHandle_t;
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex();
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t m, TickType_t ticks);
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t m);
+
+// Seção crítica do ESP32: spinlock recursivo; no host não há interrupções para desligar.
+typedef struct
+{
+	volatile uintptr_t owner;
+	volatile uint32_t count;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0, 0}
+void portENTER_CRITICAL(portMUX_TYPE *mux);
+void portEXIT_CRITICAL(portMUX_TYPE *mux);
+#define portENTER_CRITICAL_ISR(m) portENTER_CRITICAL(m)
+#define portEXIT_CRITICAL_ISR(m) portEXIT_CRITICAL(m)
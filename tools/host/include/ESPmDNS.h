@@ -0,0 +1,2 @@
+// ESPmDNS.h do alvo host: nada é usado pelo gateway no ESP32.
+#pragma once
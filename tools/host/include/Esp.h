@@ -0,0 +1,31 @@
+// Esp.h do alvo host: IPAddress e a classe ESP (heap, ciclos, MAC), implementadas em host.cpp.
+#pragma once
+#include "Arduino.h"
+
+class IPAddress
+{
+public:
+	uint8_t a[4] = {0, 0, 0, 0};
+	IPAddress() {}
+	IPAddress(uint32_t v) { memcpy(a, &v, 4); }
+	IPAddress(uint8_t x, uint8_t y, uint8_t z, uint8_t w) { a[0] = x; a[1] = y; a[2] = z; a[3] = w; }
+	uint8_t operator[](int i) const { return (a[i]); }
+	uint8_t &operator[](int i) { return (a[i]); }
+	operator uint32_t() const { uint32_t v; memcpy(&v, a, 4); return (v); }
+	bool operator==(const IPAddress &o) const { return (memcmp(a, o.a, 4) == 0); }
+	bool operator!=(const IPAddress &o) const { return (memcmp(a, o.a, 4) != 0); }
+	String toString() const;
+};
+
+class EspClass
+{
+public:
+	uint32_t getFreeHeap();
+	uint32_t getMinFreeHeap();
+	uint32_t getMaxAllocHeap();
+	uint32_t getCpuFreqMHz();
+	uint64_t getEfuseMac();
+	uint32_t getCycleCount();
+	void restart();
+};
+extern EspClass ESP;
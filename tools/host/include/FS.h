@@ -0,0 +1,55 @@
+// FS.h do alvo host: o SPIFFS é um sistema de arquivos em memória (host.cpp), com os modos
+// "r", "w", "a" e "r+" do SPIFFS do ESP32.
+#pragma once
+#include "Arduino.h"
+#include <memory>
+#include <vector>
+
+enum SeekMode
+{
+	SeekSet = 0,
+	SeekCur = 1,
+	SeekEnd = 2
+};
+
+struct hostFile; // Conteúdo de um arquivo, compartilhado pelos File abertos.
+
+class File : public Stream
+{
+public:
+	File() {}
+	File(std::shared_ptr<hostFile> f, const char *name, bool rd, bool wr, bool append);
+	operator bool() const { return (_f != nullptr); }
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t *buf, size_t n) override;
+	using Print::write;
+	int available() override;
+	int read() override;
+	int peek() override;
+	size_t read(uint8_t *buf, size_t n);
+	bool seek(uint32_t pos, SeekMode mode = SeekSet);
+	size_t position() const { return (_pos); }
+	size_t size() const;
+	void flush() {}
+	void close() { _f.reset(); }
+	const char *name() const { return (_name.c_str()); }
+
+private:
+	std::shared_ptr<hostFile> _f;
+	std::string _name;
+	size_t _pos = 0;
+	bool _rd = false, _wr = false, _append = false;
+};
+
+class FSClass
+{
+public:
+	bool begin(bool formatOnFail = false);
+	bool format();
+	bool exists(const char *path);
+	File open(const char *path, const char *mode);
+	bool remove(const char *path);
+	bool rename(const char *from, const char *to);
+	size_t totalBytes();
+	size_t usedBytes();
+};
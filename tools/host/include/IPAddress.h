@@ -0,0 +1,3 @@
+// IPAddress do alvo host: a classe está em Esp.h, como a usa o gateway.
+#pragma once
+#include "Esp.h"
@@ -0,0 +1,27 @@
+// SPI.h do alvo host: cada byte transferido vai para o SX1276 simulado cujo chip select está em
+// LOW (sx1276.cpp). beginTransaction() toma o lock do barramento, como o paramLock do core ESP32.
+#pragma once
+#include "Arduino.h"
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings
+{
+public:
+	SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock) {}
+	uint32_t clock;
+};
+
+class SPIClass
+{
+public:
+	void begin(int8_t sck = -1, int8_t miso = -1, int8_t mosi = -1, int8_t ss = -1);
+	void beginTransaction(SPISettings settings);
+	void endTransaction();
+	uint8_t transfer(uint8_t data);
+	void transfer(void *data, uint32_t size);
+	void transferBytes(const uint8_t *out, uint8_t *in, uint32_t size);
+	void writeBytes(const uint8_t *data, uint32_t size);
+};
+extern SPIClass SPI;
@@ -0,0 +1,4 @@
+// SPIFFS.h do alvo host: veja FS.h.
+#pragma once
+#include "FS.h"
+extern FSClass SPIFFS;
@@ -0,0 +1,23 @@
+// SSD1306.h do alvo host: o display OLED não faz nada.
+#pragma once
+#include "Arduino.h"
+
+#define TEXT_ALIGN_LEFT 0
+#define TEXT_ALIGN_CENTER 1
+#define TEXT_ALIGN_RIGHT 2
+extern const uint8_t ArialMT_Plain_10[];
+extern const uint8_t ArialMT_Plain_16[];
+extern const uint8_t ArialMT_Plain_24[];
+
+class SSD1306
+{
+public:
+	SSD1306(uint8_t addr, int sda, int scl) {}
+	bool init() { return (true); }
+	void flipScreenVertically() {}
+	void setFont(const uint8_t *font) {}
+	void setTextAlignment(int align) {}
+	void drawString(int16_t x, int16_t y, const String &text) {}
+	void clear() {}
+	void display() {}
+};
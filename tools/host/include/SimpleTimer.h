@@ -0,0 +1,9 @@
+// SimpleTimer.h do alvo host: o gateway não agenda nada com ele.
+#pragma once
+
+class SimpleTimer
+{
+public:
+	void run() {}
+	int setTimeout(long d, void (*f)()) { return (-1); }
+};
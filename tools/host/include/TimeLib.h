@@ -0,0 +1,32 @@
+// TimeLib.h do alvo host: o relógio de now() é o acertado por setTime() (NTP do gateway), contado
+// com millis(), como na biblioteca Time.
+#pragma once
+#include <time.h>
+
+enum timeStatus_t
+{
+	timeNotSet,
+	timeNeedsSync,
+	timeSet
+};
+typedef time_t (*getExternalTime)();
+
+time_t now();
+int hour();
+int hour(time_t t);
+int minute();
+int minute(time_t t);
+int second();
+int second(time_t t);
+int day();
+int day(time_t t);
+int month();
+int month(time_t t);
+int year();
+int year(time_t t);
+int weekday();
+int weekday(time_t t);
+void setTime(time_t t);
+timeStatus_t timeStatus();
+void setSyncProvider(getExternalTime f);
+void setSyncInterval(time_t interval);
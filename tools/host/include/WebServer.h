@@ -0,0 +1,65 @@
+// WebServer.h do alvo host: registra as rotas do gateway. As páginas são pedidas pelos testes com
+// hostWebGet() (host.h) e atendidas em handleClient(), na thread do loop(), como no ESP32.
+#pragma once
+#include "Esp.h"
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+#define CONTENT_LENGTH_NOT_SET ((size_t)-2)
+
+class WebServer;
+
+class WiFiClient
+{
+public:
+	size_t write(const uint8_t *buf, size_t n);
+	size_t write(const char *buf, size_t n) { return (write((const uint8_t *)buf, n)); }
+	void stop() {}
+	bool connected() { return (true); }
+	WebServer *server = nullptr;
+};
+
+class WebServer
+{
+public:
+	typedef std::function<void(void)> THandlerFunction;
+	WebServer(int port);
+	void begin() {}
+	void handleClient();
+	void on(const String &uri, THandlerFunction handler);
+	void onNotFound(THandlerFunction handler);
+	void sendHeader(const String &name, const String &value, bool first = false) {}
+	void setContentLength(size_t len) {}
+	void send(int code, const char *type = NULL, const String &content = String(""));
+	void send(int code, const String &type, const String &content) { send(code, type.c_str(), content); }
+	void send_P(int code, const char *type, const char *content) { send(code, type, String(content)); }
+	void send_P(int code, const char *type, const char *content, size_t len);
+	void sendContent(const String &content) { sendContent(content.c_str(), content.length()); }
+	void sendContent(const char *content) { sendContent(content, strlen(content)); }
+	void sendContent(const char *content, size_t len);
+	void sendContent_P(const char *content) { sendContent(content, strlen(content)); }
+	void sendContent_P(const char *content, size_t len) { sendContent(content, len); }
+	WiFiClient &client() { return (_client); }
+	String uri() { return (String(_uri.c_str())); }
+	String arg(const char *name);
+	String arg(const String &name) { return (arg(name.c_str())); }
+	bool hasArg(const char *name);
+	bool hasArg(const String &name) { return (hasArg(name.c_str())); }
+
+	// Atende um pedido (uri com a query, por exemplo "/?DEBUG=1") e devolve a resposta inteira.
+	// Usado pelo host.cpp; os testes usam hostWebGet().
+	std::string serve(const std::string &request);
+	int code = 0; // Código HTTP da última resposta.
+	std::string out; // Resposta em montagem.
+	static WebServer *instance;
+
+private:
+	std::map<std::string, THandlerFunction> _handlers;
+	THandlerFunction _notFound;
+	std::string _uri;
+	std::vector<std::pair<std::string, std::string>> _args;
+	WiFiClient _client;
+};
@@ -0,0 +1,31 @@
+// WiFi.h do alvo host: a WLAN conecta no primeiro begin() enquanto hostWifi for true, e
+// hostByName() devolve endereços fixos da rede simulada (host.cpp).
+#pragma once
+#include "Esp.h"
+
+#define WL_IDLE_STATUS 0
+#define WL_NO_SSID_AVAIL 1
+#define WL_CONNECTED 3
+#define WL_CONNECT_FAILED 4
+#define WL_DISCONNECTED 6
+#define WIFI_STA 1
+#define WIFI_AP 2
+#define WIFI_AP_STA 3
+
+class WiFiClass
+{
+public:
+	int status();
+	int begin(const char *ssid, const char *passphrase = NULL);
+	bool disconnect(bool wifioff = false);
+	bool mode(int m);
+	uint8_t *macAddress(uint8_t *mac);
+	bool setHostname(const char *name);
+	const char *getHostname();
+	String SSID();
+	IPAddress localIP();
+	IPAddress gatewayIP();
+	int hostByName(const char *host, IPAddress &ip);
+	int8_t RSSI();
+};
+extern WiFiClass WiFi;
@@ -0,0 +1,2 @@
+// WiFiClient.h do alvo host: nada é usado pelo gateway no ESP32.
+#pragma once
@@ -0,0 +1,37 @@
+// WiFiUdp.h do alvo host: os datagramas vão para a rede simulada de host.cpp, onde o servidor
+// Semtech de teste responde os PUSH_DATA e PULL_DATA e o servidor NTP responde na porta 123.
+#pragma once
+#include "Esp.h"
+#include <vector>
+
+class WiFiUDP : public Stream
+{
+public:
+	uint8_t begin(uint16_t port);
+	void stop();
+	int parsePacket();
+	int read() override;
+	int read(uint8_t *buf, size_t len);
+	int read(char *buf, size_t len) { return (read((uint8_t *)buf, len)); }
+	int peek() override;
+	int available() override;
+	void flush();
+	IPAddress remoteIP();
+	uint16_t remotePort();
+	int beginPacket(IPAddress ip, uint16_t port);
+	int endPacket();
+	size_t write(uint8_t c) override;
+	size_t write(const uint8_t *buf, size_t n) override;
+	using Print::write;
+
+private:
+	uint16_t _port = 0;
+	std::vector<uint8_t> _rx; // Datagrama em leitura.
+	size_t _rxPos = 0;
+	IPAddress _rxIp;
+	uint16_t _rxPort = 0;
+	std::vector<uint8_t> _tx; // Datagrama em montagem.
+	IPAddress _txIp;
+	uint16_t _txPort = 0;
+	bool _txOpen = false;
+};
@@ -0,0 +1,8 @@
+// esp_heap_caps.h do alvo host: valores fixos de um ESP32 depois do boot.
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+size_t heap_caps_get_largest_free_block(uint32_t caps);
+uint32_t esp_get_minimum_free_heap_size(void);
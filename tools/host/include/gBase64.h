@@ -0,0 +1,7 @@
+// gBase64.h do alvo host: a API da arduino-base64 (adamvr), implementada em host.cpp.
+#pragma once
+
+int base64_encode(char *output, char *input, int inputLen);
+int base64_decode(char *output, char *input, int inputLen);
+int base64_enc_len(int inputLen);
+int base64_dec_len(char *input, int inputLen);
@@ -0,0 +1,2 @@
+// pins_arduino.h do alvo host: nada é usado pelo gateway no ESP32.
+#pragma once
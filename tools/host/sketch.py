@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# =========================================================================================================
+# sketch.py: monta o sketch para o alvo host, como o Arduino IDE faz.
+#
+#   python3 sketch.py <repo> <dir> [NOME=VALOR ...]
+#
+# - Copia os .h do repositório para <dir>, trocando o valor de cada "#define NOME ..." pedido (todas as
+#   ocorrências, inclusive as dos ramos #if) para configurar o gateway sem mexer no repositório.
+# - Concatena os .ino em <dir>/sketch.cpp: primeiro o .ino principal e depois os outros em ordem
+#   alfabética, cada um com a sua diretiva #line, para os erros e avisos apontarem para o .ino.
+# - Gera os protótipos das funções dos .ino (o gateway chama funções definidas mais adiante) e os
+#   insere antes da primeira função, depois das declarações globais, como o arduino-builder.
+# =========================================================================================================
+import os
+import re
+import subprocess
+import sys
+
+MAIN = 'LoRaWAN_GatewayESP32-Heltec_AU915.ino'
+FIRST = 'void die(const char *s)'
+KEYWORDS = {'if', 'while', 'for', 'switch', 'return', 'else', 'sizeof'}
+
+
+def headers(repo, out, defs):
+	for f in sorted(os.listdir(repo)):
+		if not f.endswith('.h'):
+			continue
+		text = open(os.path.join(repo, f), encoding='utf-8').read()
+		for name, value in defs:
+			text = re.sub(r'^#define %s\b.*$' % re.escape(name), '#define %s %s' % (name, value), text, flags=re.M)
+		# _DEVADDR sem a vírgula do último byte, só compilado com GATEWAYNODE.
+		text = text.replace('0x00 0x00 }', '0x00, 0x00 }')
+		open(os.path.join(out, f), 'w', encoding='utf-8').write(text)
+
+
+def prototypes(src, out, cxx, flags):
+	raw = os.path.join(out, 'sketch_raw.cpp')
+	open(raw, 'w', encoding='utf-8').write(src)
+	pp = subprocess.run([cxx, '-std=gnu++11', '-E'] + flags + ['-include', 'Arduino.h', raw],
+						stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+	if pp.returncode:
+		sys.stderr.write(pp.stderr)
+		sys.exit(1)
+	# Só o código dos .ino, já sem comentários e com os #if resolvidos.
+	cur = None
+	lines = []
+	for l in pp.stdout.split('\n'):
+		m = re.match(r'# \d+ "([^"]+)"', l)
+		if m:
+			cur = m.group(1)
+			continue
+		if cur and cur.endswith('.ino'):
+			lines.append(l)
+	text = '\n'.join(lines)
+	protos = []
+	for m in re.finditer(r'^((?:static\s+|inline\s+)?[A-Za-z_][\w\s\*&:<>]*?[\s\*&])([A-Za-z_]\w*)\s*\(([^;{}()]*)\)\s*\n?\s*\{', text, re.M):
+		ret, name, args = m.group(1).strip(), m.group(2), m.group(3)
+		if name in KEYWORDS or ret.split()[-1] in KEYWORDS or ret.startswith('else') or ret.startswith('return'):
+			continue
+		protos.append('%s %s(%s);' % (ret, name, args))
+	return (protos)
+
+
+def main():
+	if len(sys.argv) < 3:
+		sys.stderr.write('uso: sketch.py <repo> <dir> [NOME=VALOR ...]\n')
+		sys.exit(2)
+	repo, out = sys.argv[1], sys.argv[2]
+	defs = [a.split('=', 1) for a in sys.argv[3:]]
+	here = os.path.dirname(os.path.abspath(__file__))
+	cxx = os.environ.get('CXX', 'g++')
+	os.makedirs(out, exist_ok=True)
+	headers(repo, out, defs)
+
+	inos = [MAIN] + sorted(f for f in os.listdir(repo) if f.endswith('.ino') and f != MAIN)
+	src = ''
+	for f in inos:
+		src += '#line 1 "%s"\n' % f
+		src += open(os.path.join(repo, f), encoding='utf-8').read() + '\n'
+
+	protos = prototypes(src, out, cxx, ['-I' + os.path.join(here, 'include'), '-I' + out])
+	mainsrc = open(os.path.join(repo, MAIN), encoding='utf-8').read().split('\n')
+	line = mainsrc.index(FIRST) + 1
+	src = src.replace(FIRST + '\n', '\n'.join(protos) + '\n#line %d "%s"\n%s\n' % (line, MAIN, FIRST), 1)
+	open(os.path.join(out, 'sketch.cpp'), 'w', encoding='utf-8').write('#include <Arduino.h>\n' + src)
+	os.remove(os.path.join(out, 'sketch_raw.cpp'))
+
+
+if __name__ == '__main__':
+	main()
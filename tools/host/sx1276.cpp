@@ -0,0 +1,756 @@
+// =========================================================================================================
+// sx1276.cpp: modelo do SX1276 para o alvo host. Veja sx1276.h.
+// =========================================================================================================
+#include "sx1276.h"
+#include "host.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+#include <condition_variable>
+#include <random>
+
+// Registradores usados pelo modelo (os mesmos nomes de loraModem.h, sem o prefixo REG_).
+#define R_FIFO 0x00
+#define R_OPMODE 0x01
+#define R_FRF_MSB 0x06
+#define R_FRF_MID 0x07
+#define R_FRF_LSB 0x08
+#define R_FIFO_ADDR_PTR 0x0D
+#define R_FIFO_TX_BASE 0x0E
+#define R_FIFO_RX_BASE 0x0F
+#define R_FIFO_RX_CURRENT 0x10
+#define R_IRQ_FLAGS_MASK 0x11
+#define R_IRQ_FLAGS 0x12
+#define R_RX_NB_BYTES 0x13
+#define R_PKT_SNR 0x19
+#define R_PKT_RSSI 0x1A
+#define R_RSSI 0x1B
+#define R_MC1 0x1D
+#define R_MC2 0x1E
+#define R_SYMB_TIMEOUT_LSB 0x1F
+#define R_PREAMBLE_MSB 0x20
+#define R_PREAMBLE_LSB 0x21
+#define R_PAYLOAD_LENGTH 0x22
+#define R_FIFO_RX_BYTE_ADDR 0x25
+#define R_MC3 0x26
+#define R_INVERTIQ 0x33
+#define R_DIO_MAPPING_1 0x40
+#define R_VERSION 0x42
+
+#define M_SLEEP 0
+#define M_STANDBY 1
+#define M_TX 3
+#define M_RX 5
+#define M_RX_SINGLE 6
+#define M_CAD 7
+
+#define I_RXTOUT 0x80
+#define I_RXDONE 0x40
+#define I_CRCERR 0x20
+#define I_HEADER 0x10
+#define I_TXDONE 0x08
+#define I_CDDONE 0x04
+#define I_FHSS 0x02
+#define I_CDDETD 0x01
+
+#define RX_LOCK 6 // O receptor precisa estar escutando antes deste símbolo do preâmbulo.
+#define NOISE -125 // Ruído (dBm) em REG_RSSI_VALUE sem quadro no ar.
+
+double sxScale = 1.0;
+std::vector<sx1276 *> sxRadios;
+
+static std::mutex radiosM; // Protege sxRadios.
+static std::mutex airM; // Protege air e airId.
+static std::vector<sxFrame> air;
+static uint32_t airId = 0;
+static std::mutex hwM;
+static std::condition_variable hwCv;
+static std::atomic<bool> hwKick(false);
+static bool hwStarted = false;
+
+// ---------------------------------------------------------------------------------------------------------
+// Tempo no ar, seção 4.1.1.7 do datasheet.
+// ---------------------------------------------------------------------------------------------------------
+uint32_t sxAirTime(uint8_t sf, uint8_t len, bool crc, bool implicitHdr, bool ldro, uint16_t bw, uint8_t preamble, uint8_t cr)
+{
+	double tsym = (double)(1UL << sf) * 1000.0 / bw;
+	double num = 8.0 * len - 4.0 * sf + 28 + (crc ? 16 : 0) - (implicitHdr ? 20 : 0);
+	double nsym = 8 + fmax(ceil(num / (4.0 * (sf - (ldro ? 2 : 0)))) * (cr + 4), 0);
+	return ((uint32_t)(((preamble + 4.25) * tsym + nsym * tsym) * sxScale));
+}
+
+uint32_t sxSymbol(uint8_t sf, uint16_t bw)
+{
+	return ((uint32_t)((double)(1UL << sf) * 1000.0 / bw * sxScale));
+}
+
+uint32_t sxAirSend(sxFrame f)
+{
+	uint32_t id;
+	f.end = f.start + sxAirTime(f.sf, f.len, f.crc, false, (f.sf >= 11));
+	{
+		std::lock_guard<std::mutex> l(airM);
+		id = f.id = ++airId;
+		int64_t old = hostTime() - 2000000; // Ninguém olha quadros terminados há mais de 2 segundos.
+		size_t n = 0;
+		for (size_t i = 0; i < air.size(); i++)
+		{
+			if (air[i].end >= old)
+				air[n++] = air[i];
+		}
+		air.resize(n);
+		air.push_back(f);
+	}
+	sxWake();
+	return (id);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Thread de hardware: avança todos os rádios, chama os manipuladores das bordas e dorme até o próximo
+// evento, com espera ativa nos últimos HOST_SPIN uSec.
+// ---------------------------------------------------------------------------------------------------------
+static void hwRun()
+{
+	pthread_setname_np(pthread_self(), "sx1276");
+	hostRealtime(3);
+	std::vector<uint8_t> edges;
+	std::vector<sx1276 *> radios;
+	for (;;)
+	{
+		int64_t now = hostTime();
+		int64_t idle = now + 10000; // No máximo 10 mSec sem olhar.
+		int64_t next = idle;
+		{
+			std::lock_guard<std::mutex> l(radiosM);
+			radios = sxRadios;
+		}
+		edges.clear();
+		for (size_t i = 0; i < radios.size(); i++)
+		{
+			radios[i]->tick(now, edges, next);
+		}
+		for (size_t i = 0; i < edges.size(); i++)
+		{
+			hostIrq(edges[i]);
+		}
+		if (next <= now)
+		{
+			continue;
+		}
+		// Dorme até HOST_SPIN antes do próximo evento e espera o resto ativamente; sem evento, só dorme.
+		{
+			std::unique_lock<std::mutex> l(hwM);
+			int64_t wait = (next < idle ? next - HOST_SPIN : next) - hostTime();
+			if (!hwKick && (wait > 0))
+			{
+				hwCv.wait_for(l, std::chrono::microseconds(wait), [] { return (hwKick.load()); });
+			}
+		}
+		while (!hwKick && (next < idle) && (hostTime() < next))
+		{
+			__builtin_ia32_pause();
+		}
+		hwKick = false;
+	}
+}
+
+void sxWake()
+{
+	std::lock_guard<std::mutex> l(hwM);
+	hwKick = true;
+	hwCv.notify_one();
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Ponte com host.cpp.
+// ---------------------------------------------------------------------------------------------------------
+void sxPinWrite(uint8_t pin, uint8_t level)
+{
+	std::vector<sx1276 *> radios;
+	{
+		std::lock_guard<std::mutex> l(radiosM);
+		radios = sxRadios;
+	}
+	for (size_t i = 0; i < radios.size(); i++)
+	{
+		if (pin == radios[i]->pinSs)
+			radios[i]->select(level == LOW);
+		if (pin == radios[i]->pinRst)
+			radios[i]->resetPin(level);
+	}
+}
+
+uint8_t sxTransfer(uint8_t out)
+{
+	// Todos os rádios veem o byte; só o que está com o chip select em LOW responde. Com dois chips
+	// selecionados ao mesmo tempo o MISO fica com o AND dos dois, como no barramento real.
+	std::vector<sx1276 *> radios;
+	{
+		std::lock_guard<std::mutex> l(radiosM);
+		radios = sxRadios;
+	}
+	uint8_t in = 0xFF; // MISO em aberto.
+	for (size_t i = 0; i < radios.size(); i++)
+	{
+		in &= radios[i]->transfer(out);
+	}
+	return (in);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// sx1276
+// ---------------------------------------------------------------------------------------------------------
+sx1276::sx1276(uint8_t ss, uint8_t rst, uint8_t dio0, uint8_t dio1, uint8_t dio2)
+{
+	pinSs = ss;
+	pinRst = rst;
+	pinDio[0] = dio0;
+	pinDio[1] = dio1;
+	pinDio[2] = dio2;
+	reset();
+	{
+		std::lock_guard<std::mutex> l(radiosM);
+		index = (int)sxRadios.size();
+		sxRadios.push_back(this);
+	}
+	std::lock_guard<std::mutex> l(hwM);
+	if (!hwStarted)
+	{
+		hwStarted = true;
+		std::thread(hwRun).detach();
+	}
+}
+
+sx1276::~sx1276()
+{
+	std::lock_guard<std::mutex> l(radiosM);
+	for (size_t i = 0; i < sxRadios.size(); i++)
+	{
+		if (sxRadios[i] == this)
+		{
+			sxRadios.erase(sxRadios.begin() + i);
+			break;
+		}
+	}
+}
+
+// Valores de reset do modo LoRa (tabela 41 do datasheet).
+void sx1276::reset()
+{
+	std::lock_guard<std::recursive_mutex> l(m);
+	memset(regs, 0, sizeof(regs));
+	memset(fifo, 0, sizeof(fifo));
+	regs[R_OPMODE] = 0x09;
+	regs[R_FRF_MSB] = 0x6C;
+	regs[R_FRF_MID] = 0x80;
+	regs[0x09] = 0x4F; // PA_CONFIG
+	regs[0x0A] = 0x09; // PA_RAMP
+	regs[0x0B] = 0x2B; // OCP
+	regs[0x0C] = 0x20; // LNA
+	regs[R_FIFO_TX_BASE] = 0x80;
+	regs[R_MC1] = 0x72;
+	regs[R_MC2] = 0x70;
+	regs[R_SYMB_TIMEOUT_LSB] = 0x64;
+	regs[R_PREAMBLE_LSB] = 0x08;
+	regs[R_PAYLOAD_LENGTH] = 0x01;
+	regs[0x23] = 0xFF; // MAX_PAYLOAD_LENGTH
+	regs[R_INVERTIQ] = 0x27;
+	regs[0x39] = 0x12; // SYNC_WORD
+	regs[R_VERSION] = 0x12;
+	regs[0x4D] = 0x84; // PA_DAC
+	selected = false;
+	nbytes = 0;
+	rxActive = false;
+	rxWrite = 0;
+	memset(dioLevel, 0, sizeof(dioLevel));
+}
+
+void sx1276::resetPin(uint8_t level)
+{
+	// O NRESET do SX1276 é ativo em nível baixo: o chip volta ao estado de reset na descida.
+	if (level == LOW)
+	{
+		reset();
+		resets++;
+	}
+}
+
+void sx1276::select(bool sel)
+{
+	std::lock_guard<std::recursive_mutex> l(m);
+	selected = sel;
+	nbytes = 0;
+}
+
+uint8_t sx1276::transfer(uint8_t out)
+{
+	std::vector<uint8_t> edges;
+	uint8_t in = 0xFF;
+	{
+		std::lock_guard<std::recursive_mutex> l(m);
+		if (!selected)
+		{
+			return (0xFF);
+		}
+		spiBytes++;
+		if (nbytes++ == 0)
+		{
+			addr = out & 0x7F;
+			write = (out & 0x80) != 0;
+			return (0x00);
+		}
+		int64_t now = hostTime();
+		int64_t next = INT64_MAX;
+		advance(now, next); // Os registradores refletem o instante da leitura.
+		if (write)
+			writeReg(addr, out, now, edges);
+		else
+			in = readReg(addr, now);
+		if (addr != R_FIFO)
+			addr = (addr + 1) & 0x7F; // Burst: o endereço anda, exceto no FIFO.
+		dio(edges);
+	}
+	for (size_t i = 0; i < edges.size(); i++)
+	{
+		hostIrq(edges[i]);
+	}
+	return (in);
+}
+
+uint8_t sx1276::reg(uint8_t a)
+{
+	std::lock_guard<std::recursive_mutex> l(m);
+	return (regs[a & 0x7F]);
+}
+
+uint8_t sx1276::mode()
+{
+	std::lock_guard<std::recursive_mutex> l(m);
+	return (regs[R_OPMODE] & 0x07);
+}
+
+uint32_t sx1276::freq()
+{
+	std::lock_guard<std::recursive_mutex> l(m);
+	uint64_t frf = ((uint64_t)regs[R_FRF_MSB] << 16) | ((uint64_t)regs[R_FRF_MID] << 8) | regs[R_FRF_LSB];
+	// O gateway calcula frf = (freq << 19) / 32 MHz com truncamento; arredonde para o kHz.
+	uint64_t hz = (frf * 32000000ULL) >> 19;
+	return ((uint32_t)(((hz + 500) / 1000) * 1000));
+}
+
+uint8_t sx1276::sf()
+{
+	std::lock_guard<std::recursive_mutex> l(m);
+	return (regs[R_MC2] >> 4);
+}
+
+uint32_t sx1276::symbol()
+{
+	uint8_t bw = regs[R_MC1] >> 4;
+	return (sxSymbol(sf(), (bw == 9 ? 500 : (bw == 8 ? 250 : 125))));
+}
+
+std::vector<sxTx> sx1276::txLog()
+{
+	std::lock_guard<std::recursive_mutex> l(m);
+	return (txs);
+}
+
+std::vector<sxRx> sx1276::rxLog()
+{
+	std::lock_guard<std::recursive_mutex> l(m);
+	return (rxs);
+}
+
+uint8_t sx1276::readReg(uint8_t a, int64_t now)
+{
+	switch (a)
+	{
+	case R_FIFO:
+		return (fifo[regs[R_FIFO_ADDR_PTR]++]);
+	case R_FIFO_RX_BYTE_ADDR:
+		return (rxWrite);
+	case R_RSSI:
+	{
+		int rssi = NOISE;
+		uint32_t f = freq();
+		std::lock_guard<std::mutex> l(airM);
+		for (size_t i = 0; i < air.size(); i++)
+		{
+			if ((air[i].freq == f) && (air[i].radio != index) && (air[i].start <= now) && (now < air[i].end) && (air[i].rssi > rssi))
+				rssi = air[i].rssi;
+		}
+		return ((uint8_t)(rssi + 157));
+	}
+	default:
+		return (regs[a]);
+	}
+}
+
+void sx1276::writeReg(uint8_t a, uint8_t v, int64_t now, std::vector<uint8_t> &)
+{
+	switch (a)
+	{
+	case R_FIFO:
+		if ((regs[R_OPMODE] & 0x07) != M_SLEEP)
+			fifo[regs[R_FIFO_ADDR_PTR]++] = v;
+		break;
+	case R_OPMODE:
+		setMode(v, now);
+		break;
+	case R_IRQ_FLAGS:
+		regs[R_IRQ_FLAGS] &= ~v; // Escrever 1 limpa o flag.
+		break;
+	case R_FIFO_RX_CURRENT:
+	case R_RX_NB_BYTES:
+	case R_PKT_SNR:
+	case R_PKT_RSSI:
+	case R_RSSI:
+	case R_FIFO_RX_BYTE_ADDR:
+	case R_VERSION:
+		break; // Somente leitura.
+	default:
+		regs[a] = v;
+		break;
+	}
+}
+
+void sx1276::setMode(uint8_t v, int64_t now)
+{
+	uint8_t old = regs[R_OPMODE];
+	uint8_t oldMode = old & 0x07;
+	uint8_t newMode = v & 0x07;
+
+	// O bit LongRangeMode só muda no SLEEP.
+	if (((old ^ v) & 0x80) && (oldMode != M_SLEEP))
+	{
+		v = (v & ~0x80) | (old & 0x80);
+	}
+	regs[R_OPMODE] = v;
+	if (newMode == oldMode)
+	{
+		return;
+	}
+	modeStart = now;
+	rxActive = false;
+	switch (newMode)
+	{
+	case M_SLEEP:
+		memset(fifo, 0, sizeof(fifo)); // O FIFO é apagado no SLEEP.
+		break;
+	case M_TX:
+	{
+		uint8_t bw = regs[R_MC1] >> 4;
+		tx.start = now;
+		tx.freq = freq();
+		tx.sf = sf();
+		tx.len = regs[R_PAYLOAD_LENGTH];
+		tx.invertIq = (regs[R_INVERTIQ] & 0x40) != 0;
+		for (int i = 0; i < tx.len; i++)
+		{
+			tx.data[i] = fifo[(uint8_t)(regs[R_FIFO_TX_BASE] + i)];
+		}
+		modeEnd = now + sxAirTime(tx.sf, tx.len, (regs[R_MC2] & 0x04) != 0, (regs[R_MC1] & 0x01) != 0,
+								  (regs[R_MC3] & 0x08) != 0, (bw == 9 ? 500 : (bw == 8 ? 250 : 125)),
+								  ((regs[R_PREAMBLE_MSB] << 8) | regs[R_PREAMBLE_LSB]), (regs[R_MC1] >> 1) & 0x07);
+		tx.end = modeEnd;
+		txs.push_back(tx);
+		sxFrame f;
+		f.start = now;
+		f.freq = tx.freq;
+		f.sf = tx.sf;
+		f.len = tx.len;
+		f.crc = (regs[R_MC2] & 0x04) != 0;
+		f.radio = (int8_t)index;
+		f.rssi = 14;
+		memcpy(f.data, tx.data, tx.len);
+		sxAirSend(f);
+		break;
+	}
+	case M_RX:
+	case M_RX_SINGLE:
+		if ((oldMode != M_RX) && (oldMode != M_RX_SINGLE))
+			rxWrite = regs[R_FIFO_RX_BASE];
+		rxFrom = now;
+		modeEnd = now + (int64_t)((((regs[R_MC2] & 0x03) << 8) | regs[R_SYMB_TIMEOUT_LSB]) * (int64_t)symbol());
+		break;
+	case M_CAD:
+		modeEnd = now + symbol() * 15 / 8;
+		break;
+	default:
+		break;
+	}
+	sxWake();
+}
+
+void sx1276::setIrq(uint8_t bits)
+{
+	regs[R_IRQ_FLAGS] |= bits & ~regs[R_IRQ_FLAGS_MASK]; // Um IRQ mascarado não levanta o flag.
+}
+
+// Nível dos pinos DIO0..DIO2 segundo REG_DIO_MAPPING_1 (tabela 18 do datasheet).
+void sx1276::dio(std::vector<uint8_t> &edges)
+{
+	static const uint8_t map[3][4] = {
+		{I_RXDONE, I_TXDONE, I_CDDONE, 0},
+		{I_RXTOUT, I_FHSS, I_CDDETD, 0},
+		{I_FHSS, I_FHSS, I_FHSS, 0},
+	};
+	uint8_t m1 = regs[R_DIO_MAPPING_1];
+	for (int i = 0; i < 3; i++)
+	{
+		uint8_t sel = (m1 >> (6 - 2 * i)) & 0x03;
+		bool level = (regs[R_IRQ_FLAGS] & map[i][sel]) != 0;
+		if (level && !dioLevel[i])
+		{
+			edges.push_back(pinDio[i]);
+		}
+		dioLevel[i] = level;
+	}
+}
+
+void sx1276::tick(int64_t now, std::vector<uint8_t> &edges, int64_t &next)
+{
+	std::lock_guard<std::recursive_mutex> l(m);
+	advance(now, next);
+	dio(edges);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Avança o modo atual até now.
+// ---------------------------------------------------------------------------------------------------------
+void sx1276::advance(int64_t now, int64_t &next)
+{
+	uint8_t md = regs[R_OPMODE] & 0x07;
+	if ((regs[R_OPMODE] & 0x80) == 0)
+	{
+		return; // Modo FSK: o modelo só faz LoRa.
+	}
+	switch (md)
+	{
+	case M_TX:
+		if (now >= modeEnd)
+		{
+			setIrq(I_TXDONE);
+			regs[R_OPMODE] = (regs[R_OPMODE] & ~0x07) | M_STANDBY;
+			txDone++;
+		}
+		else if (modeEnd < next)
+		{
+			next = modeEnd;
+		}
+		break;
+
+	case M_CAD:
+		if (now >= modeEnd)
+		{
+			uint32_t f = freq();
+			uint8_t s = sf();
+			int64_t tsym = symbol();
+			int64_t mid = modeStart + tsym / 2;
+			bool detect = false;
+			{
+				std::lock_guard<std::mutex> l(airM);
+				for (size_t i = 0; i < air.size(); i++)
+				{
+					const sxFrame &a = air[i];
+					if ((a.freq == f) && (a.sf == s) && (a.radio != index) && (a.start <= mid) &&
+						(mid < a.start + (int64_t)(12.25 * sxSymbol(a.sf))))
+						detect = true;
+				}
+			}
+			setIrq(I_CDDONE | (detect ? I_CDDETD : 0));
+			regs[R_OPMODE] = (regs[R_OPMODE] & ~0x07) | M_STANDBY;
+			cadDone++;
+			if (detect)
+				cadDetect++;
+		}
+		else if (modeEnd < next)
+		{
+			next = modeEnd;
+		}
+		break;
+
+	case M_RX:
+	case M_RX_SINGLE:
+		if (!rxActive)
+		{
+			// Procure o primeiro quadro na frequência e SF do receptor que ainda dá para receber.
+			uint32_t f = freq();
+			uint8_t s = sf();
+			int64_t from = (rxFrom > modeStart ? rxFrom : modeStart);
+			int64_t lock = RX_LOCK * (int64_t)sxSymbol(s);
+			int64_t future = INT64_MAX;
+			std::lock_guard<std::mutex> l(airM);
+			for (size_t i = 0; i < air.size(); i++)
+			{
+				const sxFrame &a = air[i];
+				if ((a.freq != f) || (a.sf != s) || (a.radio == index) || (a.start + lock < from))
+					continue;
+				if ((md == M_RX_SINGLE) && (a.start > modeEnd))
+					continue;
+				if (a.start > now)
+				{
+					if (a.start < future)
+						future = a.start;
+					continue;
+				}
+				if (!rxActive || (a.start < rxFrame.start))
+				{
+					rxFrame = a;
+					rxActive = true;
+				}
+			}
+			if (!rxActive)
+			{
+				if ((md == M_RX_SINGLE) && (now >= modeEnd))
+				{
+					setIrq(I_RXTOUT);
+					regs[R_OPMODE] = (regs[R_OPMODE] & ~0x07) | M_STANDBY;
+					rxTimeout++;
+					break;
+				}
+				if (future < next)
+					next = future;
+				if ((md == M_RX_SINGLE) && (modeEnd < next))
+					next = modeEnd;
+				break;
+			}
+		}
+		if (now < rxFrame.end)
+		{
+			if (rxFrame.end < next)
+				next = rxFrame.end;
+			break;
+		}
+
+		// Fim do quadro: colisão com outro quadro na mesma frequência e SF estraga o CRC. O TX do
+		// próprio rádio não conta: ele terminou antes do RX começar (o rádio é half-duplex).
+		{
+			bool bad = rxFrame.crcErr;
+			{
+				std::lock_guard<std::mutex> l(airM);
+				for (size_t i = 0; i < air.size(); i++)
+				{
+					const sxFrame &a = air[i];
+					if ((a.id != rxFrame.id) && (a.radio != index) && (a.freq == rxFrame.freq) && (a.sf == rxFrame.sf) &&
+						(a.start < rxFrame.end) && (rxFrame.start < a.end))
+						bad = true;
+				}
+			}
+			regs[R_FIFO_RX_CURRENT] = rxWrite;
+			regs[R_RX_NB_BYTES] = rxFrame.len;
+			for (int i = 0; i < rxFrame.len; i++)
+			{
+				fifo[rxWrite++] = rxFrame.data[i];
+			}
+			regs[R_PKT_SNR] = (uint8_t)(int8_t)(rxFrame.snr * 4);
+			regs[R_PKT_RSSI] = (uint8_t)(rxFrame.rssi + 157);
+			setIrq(I_RXDONE | I_HEADER | ((bad && rxFrame.crc) ? I_CRCERR : 0));
+			sxRx r;
+			r.done = now;
+			r.end = rxFrame.end;
+			r.id = rxFrame.id;
+			r.crcErr = bad;
+			rxs.push_back(r);
+			rxDone++;
+			if (bad)
+				crcErr++;
+			rxActive = false;
+			rxFrom = rxFrame.end;
+			if (md == M_RX_SINGLE)
+				regs[R_OPMODE] = (regs[R_OPMODE] & ~0x07) | M_STANDBY;
+			else
+				next = now; // O RX contínuo continua: procure o próximo quadro.
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Gerador de uplinks.
+// ---------------------------------------------------------------------------------------------------------
+void sxUplink(sxFrame &f, uint32_t n, uint16_t fcnt, uint8_t len)
+{
+	uint32_t devAddr = 0x26000000 | (n & 0x00FFFFFF);
+	if (len < 13)
+		len = 13;
+	memset(f.data, 0, sizeof(f.data));
+	f.data[0] = 0x40; // Unconfirmed Data Up.
+	f.data[1] = devAddr & 0xFF;
+	f.data[2] = (devAddr >> 8) & 0xFF;
+	f.data[3] = (devAddr >> 16) & 0xFF;
+	f.data[4] = (devAddr >> 24) & 0xFF;
+	f.data[5] = 0x00; // FCtrl.
+	f.data[6] = fcnt & 0xFF;
+	f.data[7] = fcnt >> 8;
+	f.data[8] = 1; // FPort.
+	for (int i = 9; i < len - 4; i++)
+		f.data[i] = (uint8_t)(n + i);
+	for (int i = len - 4; i < len; i++)
+		f.data[i] = (uint8_t)(0xA5 ^ n ^ i); // MIC (não conferido com _CHECK_MIC 0).
+	f.len = len;
+}
+
+void sxInjector::start()
+{
+	running = true;
+	thread = std::thread(&sxInjector::run, this);
+}
+
+void sxInjector::stop()
+{
+	running = false;
+	if (thread.joinable())
+		thread.join();
+}
+
+std::vector<uint32_t> sxInjector::ids()
+{
+	std::lock_guard<std::mutex> l(m);
+	return (_ids);
+}
+
+void sxInjector::run()
+{
+	pthread_setname_np(pthread_self(), "injector");
+	hostRealtime(1);
+	std::mt19937 rnd(1);
+	std::exponential_distribution<double> expo(rate);
+	int64_t t = hostTime() + 1000;
+	int64_t lastEnd = 0;
+	uint32_t n = 0;
+	while (running)
+	{
+		int64_t guard = sxSymbol(sf);
+		if (t < lastEnd + guard)
+		{
+			t = lastEnd + guard; // O canal ainda está ocupado pelo quadro anterior.
+			deferred++;
+		}
+		hostSleepUntil(t - 500);
+		sxFrame f;
+		f.freq = freq;
+		f.sf = sf;
+		f.rssi = rssi;
+		f.snr = snr;
+		f.start = t;
+		if (payload)
+			payload(f, n);
+		else
+			sxUplink(f, n, (uint16_t)n, len);
+		uint32_t id = sxAirSend(f);
+		lastEnd = t + sxAirTime(f.sf, f.len, f.crc, false, (f.sf >= 11));
+		{
+			std::lock_guard<std::mutex> l(m);
+			_ids.push_back(id);
+		}
+		sent++;
+		n++;
+		t += (int64_t)((poisson ? expo(rnd) : 1.0 / rate) * 1000000.0);
+	}
+}
@@ -0,0 +1,177 @@
+// =========================================================================================================
+// sx1276.h: modelo do SX1276 no nível dos registradores, para o alvo host (tools/host).
+//
+// Cada sx1276 responde às transações SPI do gateway (o chip select é o pino ss) como o chip real, em
+// modo LoRa: banco de registradores com os valores de reset, FIFO de 256 bytes com o ponteiro
+// REG_FIFO_ADDR_PTR que dá a volta em 0xFF, burst com auto-incremento do endereço (exceto no FIFO),
+// flags de interrupção limpas escrevendo 1, máscara REG_IRQ_FLAGS_MASK e os pinos DIO0..DIO2 segundo
+// REG_DIO_MAPPING_1. Uma borda de subida num pino DIO chama o manipulador do attachInterrupt().
+//
+// Os modos seguem a seção 4.1 do datasheet:
+// - TX: transmite REG_PAYLOAD_LENGTH bytes a partir de REG_FIFO_TX_BASE_AD e, depois do tempo no ar,
+//   levanta TXDONE e volta a STANDBY. Cada TX fica em txLog(), com o instante da escrita do OPMODE.
+// - RX (contínuo) e RX_SINGLE: recebem um quadro do ar na mesma frequência e SF se estavam escutando
+//   antes do sexto símbolo do preâmbulo e continuam até o fim do quadro. O quadro vai para o FIFO a partir do
+//   ponteiro de escrita do RX, com REG_FIFO_RX_CURRENT_ADDR, REG_RX_NB_BYTES, REG_PKT_SNR_VALUE e
+//   REG_PKT_RSSI_VALUE, e levanta RXDONE (e CRCERR se o quadro tem erro ou colidiu). O RX_SINGLE volta
+//   a STANDBY depois do RXDONE, ou levanta RXTOUT depois de REG_SYMB_TIMEOUT símbolos sem preâmbulo.
+// - CAD: dura 15/8 símbolos; levanta CDDONE, e CDDETD se o primeiro símbolo do CAD caiu no preâmbulo
+//   de um quadro na mesma frequência e SF. Volta a STANDBY.
+// - REG_RSSI_VALUE é o RSSI do quadro no ar na mesma frequência (qualquer SF) ou o ruído, -125 dBm.
+//
+// O "ar" é uma lista de quadros (sxFrame) compartilhada por todos os rádios; sxAirSend() põe um
+// quadro no ar e o sxInjector gera quadros de nós numa taxa configurável. Uma thread de hardware
+// avança os rádios no tempo e gera as interrupções, com espera ativa nos últimos HOST_SPIN uSec para a
+// borda chegar no instante certo.
+// sxScale multiplica a duração dos símbolos (1.0 = tempo real), para taxas de quadros maiores no
+// benchmark; o gateway continua calculando o airTime() real, então a calibração do TX (_TX_CAL)
+// não vale com sxScale != 1.
+// =========================================================================================================
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Quadro LoRa no ar (BW 125 kHz, CR 4/5, preâmbulo de 8 símbolos, cabeçalho explícito).
+struct sxFrame
+{
+	int64_t start = 0; // hostTime() do início do preâmbulo.
+	int64_t end = 0; // Calculado por sxAirSend().
+	uint32_t freq = 0; // Hz.
+	uint8_t sf = 7;
+	uint8_t len = 0;
+	uint8_t data[256];
+	bool crc = true; // CRC do payload (uplinks); os downlinks não têm.
+	bool crcErr = false; // Chega com erro de CRC.
+	int16_t rssi = -80; // dBm.
+	int8_t snr = 8; // dB.
+	int8_t radio = -1; // Rádio que transmitiu, ou -1 para um nó.
+	uint32_t id = 0; // Número do quadro, dado por sxAirSend().
+};
+
+// Tempo no ar (uSec) de len bytes, já multiplicado por sxScale. bw em kHz.
+uint32_t sxAirTime(uint8_t sf, uint8_t len, bool crc = true, bool implicitHdr = false, bool ldro = false,
+				   uint16_t bw = 125, uint8_t preamble = 8, uint8_t cr = 1);
+uint32_t sxSymbol(uint8_t sf, uint16_t bw = 125); // Duração de um símbolo (uSec), com sxScale.
+uint32_t sxAirSend(sxFrame f); // Põe f no ar (f.start pode estar no futuro). Retorna f.id.
+extern double sxScale;
+
+// Eventos registrados por um rádio.
+struct sxTx
+{
+	int64_t start; // hostTime() da escrita de OPMODE_TX.
+	int64_t end; // TXDONE.
+	uint32_t freq;
+	uint8_t sf;
+	uint8_t len;
+	bool invertIq;
+	uint8_t data[256];
+};
+struct sxRx
+{
+	int64_t done; // hostTime() do RXDONE.
+	int64_t end; // Fim do quadro no ar. done - end é o atraso da thread de hardware (máquina virtual ocupada).
+	uint32_t id; // sxFrame.id.
+	bool crcErr;
+};
+
+class sx1276
+{
+public:
+	sx1276(uint8_t ss, uint8_t rst, uint8_t dio0, uint8_t dio1, uint8_t dio2);
+	~sx1276();
+
+	// Interface com o host.cpp (SPI e GPIO).
+	void select(bool sel);
+	uint8_t transfer(uint8_t out);
+	void resetPin(uint8_t level);
+
+	// Estado, para os testes.
+	uint8_t reg(uint8_t addr); // Lê um registrador sem efeitos (o FIFO não anda).
+	uint8_t mode(); // Os 3 bits de modo de REG_OPMODE.
+	uint32_t freq(); // Frequência programada em REG_FRF (Hz).
+	uint8_t sf(); // SF de REG_MODEM_CONFIG2.
+	std::vector<sxTx> txLog();
+	std::vector<sxRx> rxLog();
+
+	uint8_t pinSs, pinRst, pinDio[3];
+	int index; // Posição em sxRadios.
+	std::atomic<uint32_t> rxDone{0}, crcErr{0}, rxTimeout{0}, cadDone{0}, cadDetect{0}, txDone{0};
+	std::atomic<uint32_t> spiBytes{0}, resets{0};
+
+	// Avança o modelo até now e devolve em edges os pinos com borda de subida. Chamada pela thread
+	// de hardware; next recebe o próximo instante em que algo acontece (ou INT64_MAX).
+	void tick(int64_t now, std::vector<uint8_t> &edges, int64_t &next);
+
+private:
+	void reset();
+	void writeReg(uint8_t addr, uint8_t v, int64_t now, std::vector<uint8_t> &edges);
+	uint8_t readReg(uint8_t addr, int64_t now);
+	void setMode(uint8_t v, int64_t now);
+	void setIrq(uint8_t bits);
+	void dio(std::vector<uint8_t> &edges);
+	void advance(int64_t now, int64_t &next);
+	uint32_t symbol();
+
+	std::recursive_mutex m;
+	uint8_t regs[0x80];
+	uint8_t fifo[256];
+	bool selected = false;
+	int nbytes = 0; // Bytes da transação SPI atual.
+	uint8_t addr = 0;
+	bool write = false;
+	bool dioLevel[3] = {false, false, false};
+	int64_t modeStart = 0; // Instante da entrada no modo atual.
+	int64_t modeEnd = 0; // Fim do TX ou do CAD.
+	uint8_t rxWrite = 0; // Ponteiro de escrita do FIFO no RX.
+	bool rxActive = false; // Recebendo rxFrame.
+	sxFrame rxFrame;
+	int64_t rxFrom = 0; // Quadros com start antes disso já foram perdidos ou recebidos.
+	sxTx tx;
+	std::vector<sxTx> txs;
+	std::vector<sxRx> rxs;
+};
+
+extern std::vector<sx1276 *> sxRadios;
+
+// Ponte do host.cpp para os rádios: pino de saída escrito e byte transferido no SPI.
+void sxPinWrite(uint8_t pin, uint8_t level);
+uint8_t sxTransfer(uint8_t out);
+void sxWake(); // Acorda a thread de hardware (mudança de modo, quadro novo).
+
+// ---------------------------------------------------------------------------------------------------------
+// Gerador de uplinks: rate quadros/s (intervalo fixo, ou exponencial com poisson) na frequência e SF
+// dados. Um quadro que começaria antes do fim do anterior na mesma frequência é adiado (deferred).
+// O payload padrão é um uplink LoRaWAN não confirmado com DevAddr 0x26xxxxxx e FCnt diferentes,
+// para não ser descartado pelo filtro de repetidos (_DEDUP_WINDOW).
+// ---------------------------------------------------------------------------------------------------------
+class sxInjector
+{
+public:
+	uint32_t freq = 916800000;
+	uint8_t sf = 7;
+	uint8_t len = 20;
+	double rate = 10.0;
+	bool poisson = false;
+	int16_t rssi = -80;
+	int8_t snr = 8;
+	std::function<void(sxFrame &f, uint32_t n)> payload;
+
+	void start(); // Começa numa thread própria.
+	void stop(); // Espera a thread terminar.
+	std::atomic<uint32_t> sent{0}, deferred{0};
+	std::vector<uint32_t> ids(); // sxFrame.id dos quadros enviados.
+
+private:
+	void run();
+	std::atomic<bool> running{false};
+	std::thread thread;
+	std::mutex m;
+	std::vector<uint32_t> _ids;
+};
+
+// Uplink LoRaWAN de dados não confirmado de len bytes (len >= 13) do nó n, com FCnt fcnt.
+void sxUplink(sxFrame &f, uint32_t n, uint16_t fcnt, uint8_t len);
@@ -0,0 +1,26 @@
+// =========================================================================================================
+// test.h: verificações dos testes de tools/host. Cada teste é um programa que inclui o sketch, termina
+// com testEnd() e sai com 1 se alguma verificação falhou.
+// =========================================================================================================
+#pragma once
+#include <stdio.h>
+
+static int testFails = 0;
+
+#define CHECK(cond, ...)                                  \
+	do                                                    \
+	{                                                     \
+		if (!(cond))                                      \
+		{                                                 \
+			testFails++;                                  \
+			printf("FALHA %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+			printf(__VA_ARGS__);                          \
+			printf("\n");                                 \
+		}                                                 \
+	} while (0)
+
+static void testEnd(const char *name)
+{
+	printf("%s: %s\n", name, (testFails == 0 ? "OK" : "FALHOU"));
+	hostExit(testFails == 0 ? 0 : 1);
+}
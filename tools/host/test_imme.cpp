@@ -0,0 +1,70 @@
+// =========================================================================================================
+// test_imme.cpp: um txpk com "imme":true (sem tmst) entra na fila downQ, o TX_ACK volta sem erro e
+// o rádio transmite o payload pedido logo depois, em _TX_MIN_AHEAD + _TX_LEAD uSec.
+// =========================================================================================================
+#include "host.h"
+#include "sx1276.h"
+#include "test.h"
+
+#include "sketch.cpp"
+
+#define IMME_SLACK 20000 // Atraso aceito além da folga do sendPacket(): readUdp() e o despacho.
+
+int main()
+{
+	sx1276 radio0(pins.ss, pins.rst, pins.dio0, pins.dio1, pins.dio2);
+	hostBoot();
+	delay(100);
+
+	// O PULL_RESP vem do servidor 0, já resolvido no setup().
+	CHECK(upSrv[0].resolved, "servidor 0 não resolvido");
+	IPAddress ip = upSrv[0].ip;
+	uint16_t port = upSrv[0].port;
+	hostNetClear();
+
+	uint8_t payload[15] = {0x60, 0x01, 0x00, 0x00, 0x26, 0x00, 0x07, 0x00, 0x01, 0xA5, 0x5A, 0x00, 0xFF, 0x33, 0x77};
+	char b64[32];
+	base64_encode(b64, (char *)payload, sizeof(payload));
+	char txpk[300];
+	int len = snprintf(txpk + 4, sizeof(txpk) - 4,
+					   "{\"txpk\":{\"imme\":true,\"freq\":923.3,\"rfch\":0,\"powe\":14,\"modu\":\"LORA\","
+					   "\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"ipol\":true,\"size\":%u,\"data\":\"%s\"}}",
+					   (unsigned)sizeof(payload), b64);
+	txpk[0] = 2;
+	txpk[1] = 0x12;
+	txpk[2] = 0x34;
+	txpk[3] = PKT_PULL_RESP;
+	uint32_t queued = downQ.queued;
+	uint32_t sent = micros();
+	hostNetDown(ip, port, (uint8_t *)txpk, len + 4);
+	delay(200);
+
+	CHECK(downQ.queued == queued + 1, "downQ.queued %u, antes %u (tooLate %u)", downQ.queued, queued, downQ.tooLate);
+
+	// TX_ACK com o token do PULL_RESP e sem o objeto txpk_ack (nenhum erro).
+	std::vector<hostDatagram> up = hostNetUp();
+	int acks = 0;
+	for (size_t i = 0; i < up.size(); i++)
+	{
+		if ((up[i].data.size() >= 12) && (up[i].data[3] == PKT_TX_ACK))
+		{
+			acks++;
+			CHECK((up[i].data[1] == 0x12) && (up[i].data[2] == 0x34), "token do TX_ACK");
+			CHECK(up[i].data.size() == 12, "TX_ACK com erro: %.*s", (int)up[i].data.size() - 12,
+				  (const char *)up[i].data.data() + 12);
+		}
+	}
+	CHECK(acks == 1, "%d TX_ACK", acks);
+
+	std::vector<sxTx> tx = radio0.txLog();
+	CHECK(tx.size() == 1, "%u TX", (unsigned)tx.size());
+	if (tx.size() == 1)
+	{
+		int32_t after = (int32_t)((uint32_t)tx[0].start - sent);
+		CHECK((after >= _TX_MIN_AHEAD) && (after < _TX_MIN_AHEAD + _TX_LEAD + IMME_SLACK), "TX %d uSec depois do PULL_RESP", after);
+		CHECK((tx[0].len == sizeof(payload)) && (memcmp(tx[0].data, payload, sizeof(payload)) == 0), "payload do TX");
+		CHECK(tx[0].invertIq, "TX sem ipol");
+		printf("test_imme: TX %d uSec depois do PULL_RESP\n", after);
+	}
+	testEnd("test_imme");
+}
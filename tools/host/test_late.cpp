@@ -0,0 +1,69 @@
+// =========================================================================================================
+// test_late.cpp: um downlink cujo tmst já passou quando o downDispatch() o encontra é descartado
+// (downQ.lateDispatch) sem parar o receptor: o rádio continua em RX e o uplink seguinte é recebido.
+// Compilado sem CAD (build/nocad): o receptor fica em RX contínuo e só o reinício periódico do
+// radioService() (_MSG_INTERVAL) o tiraria de um STANDBY esquecido.
+// =========================================================================================================
+#include "host.h"
+#include "sx1276.h"
+#include "test.h"
+
+#include "sketch.cpp"
+
+#define LATE 5000 // uSec entre o tmst do downlink e a sua entrada na fila.
+#define UP_LEN 20
+
+int main()
+{
+	sx1276 radio0(pins.ss, pins.rst, pins.dio0, pins.dio1, pins.dio2);
+	hostBoot();
+	delay(100);
+	CHECK(!_cad && (_state == S_RX) && (radio0.mode() == OPMODE_RX), "receptor: _cad %d, _state %d, modo %u", _cad,
+		  _state, radio0.mode());
+	hostNetClear();
+
+	// Um downlink atrasado, posto direto na fila como se o loop() tivesse demorado.
+	struct LoraBuffer pkt;
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.payLength = 4;
+	pkt.sfTx = 7;
+	pkt.fff = freqs[ifreq];
+	pkt.airtime = 20000;
+	uint32_t late = downQ.lateDispatch, sent = downQ.sent;
+	DOWN_LOCK();
+	pkt.tmst = micros() - LATE;
+	downQ.pkt[0] = pkt;
+	downQ.count = 1;
+	DOWN_UNLOCK();
+	delay(50);
+
+	CHECK(downQ.count == 0, "downQ.count %u", downQ.count);
+	CHECK((downQ.lateDispatch == late + 1) && (downQ.sent == sent), "lateDispatch %u, sent %u", downQ.lateDispatch - late,
+		  downQ.sent - sent);
+	CHECK((_state == S_RX) && (radio0.mode() == OPMODE_RX), "depois do descarte: _state %d, modo %u", _state, radio0.mode());
+	CHECK(radio0.txLog().empty(), "%u TX", (unsigned)radio0.txLog().size());
+
+	// O uplink seguinte é recebido e encaminhado.
+	sxFrame f;
+	sxUplink(f, 1, 1, UP_LEN);
+	f.freq = freqs[ifreq];
+	f.sf = sf;
+	f.start = hostTime() + 10000;
+	uint32_t id = sxAirSend(f);
+	delay(10 + sxAirTime(f.sf, f.len) / 1000 + 200);
+
+	std::vector<sxRx> rx = radio0.rxLog();
+	CHECK((rx.size() == 1) && (rx[0].id == id) && !rx[0].crcErr, "%u RXDONE depois do descarte", (unsigned)rx.size());
+	char b64[64];
+	base64_encode(b64, (char *)f.data, f.len);
+	std::vector<hostDatagram> up = hostNetUp();
+	int rxpks = 0;
+	for (size_t i = 0; i < up.size(); i++)
+	{
+		if ((up[i].data.size() > 12) && (up[i].data[3] == PKT_PUSH_DATA) &&
+			(std::string(up[i].data.begin() + 12, up[i].data.end()).find(b64) != std::string::npos))
+			rxpks++;
+	}
+	CHECK(rxpks == 1, "%d rxpk do uplink", rxpks);
+	testEnd("test_late");
+}
@@ -0,0 +1,128 @@
+// =========================================================================================================
+// test_radios.cpp: dois SX1276 (_RADIOS=2, build/radios2) no mesmo SPI, cada um no seu canal, recebendo
+// ao mesmo tempo. Em cada rodada um quadro vai ao ar em cada canal no mesmo instante.
+//
+// Verifica que:
+// - o rádio 1 está no canal de radioPins[] e o rádio 0 em outro;
+// - cada rádio recebe só os quadros do seu canal, sem erro de CRC;
+// - todo quadro recebido vira exatamente um rxpk, com o payload e o "freq" do canal em que chegou;
+// - radios[].frames conta os quadros de cada rádio.
+// =========================================================================================================
+#include "host.h"
+#include "sx1276.h"
+#include "test.h"
+#include <map>
+
+#include "sketch.cpp"
+
+#define ROUNDS 20
+#define ROUND_MS 200
+#define UP_LEN 20
+
+static std::mutex upM;
+static std::multimap<std::string, std::string> rxpkFreq; // "data" -> "freq" de cada rxpk.
+
+static std::string field(const std::string &j, size_t from, const char *key, char end)
+{
+	size_t p = j.find(key, from);
+	if (p == std::string::npos)
+		return ("");
+	p += strlen(key);
+	return (j.substr(p, j.find(end, p) - p));
+}
+
+static void serverUp(const hostDatagram &d)
+{
+	if ((d.data.size() <= 12) || (d.data[3] != PKT_PUSH_DATA))
+		return;
+	std::string j(d.data.begin() + 12, d.data.end());
+	size_t pos = 0;
+	while ((pos = j.find("\"tmst\":", pos)) != std::string::npos)
+	{
+		std::lock_guard<std::mutex> l(upM);
+		rxpkFreq.insert(std::make_pair(field(j, pos, "\"data\":\"", '"'), field(j, pos, "\"freq\":", ',')));
+		pos++;
+	}
+}
+
+// "freq" do rxpk para f Hz, como jwFixed(w, f, 6).
+static std::string mhz(uint32_t f)
+{
+	char s[20];
+	snprintf(s, sizeof(s), "%u.%06u", f / 1000000, f % 1000000);
+	return (s);
+}
+
+int main()
+{
+	sx1276 radio0(pins.ss, pins.rst, pins.dio0, pins.dio1, pins.dio2);
+	sx1276 radio1(radioPins[0][0], radioPins[0][1], radioPins[0][2], radioPins[0][3], radioPins[0][4]);
+	hostOnUp = serverUp;
+	hostBoot();
+	delay(100);
+
+	uint32_t f0 = radio0.freq(), f1 = radio1.freq();
+	CHECK(f1 == (uint32_t)freqs[radioPins[0][5]], "rádio 1 em %u Hz, esperado %u", f1, freqs[radioPins[0][5]]);
+	CHECK(f0 != f1, "os dois rádios em %u Hz", f0);
+	uint32_t frames0 = radios[0].frames, frames1 = radios[1].frames;
+
+	// Em cada rodada, um quadro em cada canal com o mesmo início.
+	std::map<uint32_t, std::string> sent0, sent1; // sxFrame.id -> payload em base64.
+	for (int n = 0; n < ROUNDS; n++)
+	{
+		int64_t start = hostTime() + 10000;
+		sxFrame a, b;
+		char b64[64];
+		sxUplink(a, 2 * n, (uint16_t)n, UP_LEN);
+		a.freq = f0;
+		a.sf = radio0.sf();
+		a.start = start;
+		base64_encode(b64, (char *)a.data, a.len);
+		sent0[sxAirSend(a)] = b64;
+		sxUplink(b, 2 * n + 1, (uint16_t)n, UP_LEN);
+		b.freq = f1;
+		b.sf = radio1.sf();
+		b.start = start;
+		base64_encode(b64, (char *)b.data, b.len);
+		sent1[sxAirSend(b)] = b64;
+		delay(ROUND_MS);
+	}
+	delay(300);
+
+	// Cada rádio recebeu os quadros do seu canal, e só eles.
+	std::vector<sxRx> rx0 = radio0.rxLog(), rx1 = radio1.rxLog();
+	std::multimap<std::string, std::string> want; // payload -> "freq" esperado.
+	uint32_t good0 = 0, good1 = 0;
+	for (size_t i = 0; i < rx0.size(); i++)
+	{
+		CHECK(sent0.count(rx0[i].id) && !rx0[i].crcErr, "rádio 0: quadro %u%s", rx0[i].id, (rx0[i].crcErr ? " com CRC" : ""));
+		if (sent0.count(rx0[i].id) && !rx0[i].crcErr)
+		{
+			want.insert(std::make_pair(sent0[rx0[i].id], mhz(f0)));
+			good0++;
+		}
+	}
+	for (size_t i = 0; i < rx1.size(); i++)
+	{
+		CHECK(sent1.count(rx1[i].id) && !rx1[i].crcErr, "rádio 1: quadro %u%s", rx1[i].id, (rx1[i].crcErr ? " com CRC" : ""));
+		if (sent1.count(rx1[i].id) && !rx1[i].crcErr)
+		{
+			want.insert(std::make_pair(sent1[rx1[i].id], mhz(f1)));
+			good1++;
+		}
+	}
+	CHECK(good0 == ROUNDS, "rádio 0 recebeu %u de %u", good0, ROUNDS);
+	CHECK(good1 == ROUNDS, "rádio 1 recebeu %u de %u", good1, ROUNDS);
+
+	// Um rxpk por quadro recebido, com o payload e o canal certos.
+	{
+		std::lock_guard<std::mutex> l(upM);
+		CHECK(rxpkFreq == want, "%u rxpk para %u quadros (anel cheio %u)", (unsigned)rxpkFreq.size(), (unsigned)want.size(),
+			  upRing.overflow);
+	}
+	CHECK(radios[0].frames - frames0 == good0, "radios[0].frames %u", radios[0].frames - frames0);
+	CHECK(radios[1].frames - frames1 == good1, "radios[1].frames %u", radios[1].frames - frames1);
+
+	printf("test_radios: %u Hz e %u Hz, %u + %u quadros, %u rxpk\n", f0, f1, good0, good1, (unsigned)rxpkFreq.size());
+	testEnd("test_radios");
+}
@@ -0,0 +1,145 @@
+// =========================================================================================================
+// test_retry.cpp: reenvio dos PUSH_DATA sem PUSH_ACK (_PUSH_RETRY) com tráfego contínuo, que fecha um
+// lote a cada _RXPK_LATENCY mSec. O servidor de teste responde os acks ele mesmo e deixa sem resposta:
+// - A: a primeira transmissão de um PUSH_DATA JSON (o reenvio é confirmado);
+// - B: as duas transmissões de outro PUSH_DATA JSON;
+// - C: a primeira transmissão de um PUSH_DATA binário (upFormat UP_FMT_BIN).
+//
+// Verifica que A e C são reenviados uma vez, mais de _ACK_TIMEOUT depois, com o mesmo conteúdo, e não
+// contam como perdidos; que B é reenviado uma vez e conta como um token perdido; e que pushSent não
+// conta os reenvios (pushSent - pushAcked == lost).
+// =========================================================================================================
+#include "host.h"
+#include "sx1276.h"
+#include "test.h"
+#include <map>
+
+#include "sketch.cpp"
+
+#define UP_RATE 10.0
+#define UP_LEN 20
+
+static std::mutex srvM;
+static std::map<uint16_t, std::vector<hostDatagram> > seen; // token -> transmissões do PUSH_DATA.
+static std::map<uint16_t, int> drops; // token -> transmissões a deixar sem ack.
+static int dropNext = 0; // O próximo PUSH_DATA de rxpk novo fica sem ack dropNext vezes.
+static uint8_t dropIdent = PKT_PUSH_DATA;
+static uint16_t dropped = 0; // Token escolhido pelo último dropNext.
+
+static void serverUp(const hostDatagram &d)
+{
+	if (d.data.size() < 12)
+		return;
+	uint8_t ident = d.data[3];
+	uint16_t token = d.data[2] * 256 + d.data[1];
+	bool ack = true;
+	if ((ident == PKT_PUSH_DATA) || (ident == PKT_PUSH_BIN))
+	{
+		std::lock_guard<std::mutex> l(srvM);
+		bool rxpk = ((ident == PKT_PUSH_BIN) ||
+					 (std::string(d.data.begin() + 12, d.data.end()).find("\"rxpk\"") != std::string::npos));
+		if (rxpk && (seen.count(token) == 0) && (dropNext > 0) && (ident == dropIdent))
+		{
+			drops[token] = dropNext;
+			dropped = token;
+			dropNext = 0;
+		}
+		if (rxpk)
+			seen[token].push_back(d);
+		if (drops.count(token) && (drops[token] > 0))
+		{
+			drops[token]--;
+			ack = false;
+		}
+	}
+	if (ack && ((ident == PKT_PUSH_DATA) || (ident == PKT_PUSH_BIN) || (ident == PKT_PULL_DATA)))
+	{
+		uint8_t a[4] = {d.data[0], d.data[1], d.data[2], (uint8_t)(ident == PKT_PULL_DATA ? PKT_PULL_ACK : PKT_PUSH_ACK)};
+		hostNetDown(d.ip, d.port, a, sizeof(a));
+	}
+}
+
+// Espera o servidor escolher o token a deixar sem ack.
+static uint16_t drop(int times, uint8_t ident)
+{
+	{
+		std::lock_guard<std::mutex> l(srvM);
+		dropped = 0;
+		dropIdent = ident;
+		dropNext = times;
+	}
+	for (int i = 0; i < 100; i++)
+	{
+		delay(10);
+		std::lock_guard<std::mutex> l(srvM);
+		if (dropped != 0)
+			return (dropped);
+	}
+	return (0);
+}
+
+// As transmissões do token t: quantas, e se o reenvio é igual e veio depois de _ACK_TIMEOUT.
+static void checkRetry(const char *name, uint16_t t, size_t want)
+{
+	std::lock_guard<std::mutex> l(srvM);
+	std::vector<hostDatagram> &v = seen[t];
+	CHECK(v.size() == want, "%s: token %04x enviado %u vezes", name, t, (unsigned)v.size());
+	if (v.size() >= 2)
+	{
+		int64_t gap = v[1].time - v[0].time;
+		CHECK((gap >= (int64_t)_ACK_TIMEOUT * 1000) && (gap < (int64_t)_ACK_TIMEOUT * 1000 + 500000), "%s: reenvio %lld uSec depois",
+			  name, (long long)gap);
+		CHECK(v[1].data == v[0].data, "%s: reenvio diferente do original", name);
+	}
+}
+
+int main()
+{
+	sx1276 radio0(pins.ss, pins.rst, pins.dio0, pins.dio1, pins.dio2);
+	hostAutoAck = false;
+	hostOnUp = serverUp;
+	hostBoot();
+	delay(100);
+
+	sxInjector inj;
+	inj.freq = freqs[ifreq];
+	inj.sf = sf;
+	inj.len = UP_LEN;
+	inj.rate = UP_RATE;
+	inj.start();
+	delay(300);
+	struct upServer u0 = upSrv[0];
+
+	uint16_t a = drop(1, PKT_PUSH_DATA);
+	delay(500);
+	uint16_t b = drop(2, PKT_PUSH_DATA);
+	delay(500);
+	gwayConfig.upFormat[0] = UP_FMT_BIN;
+	delay(300);
+	uint16_t c = drop(1, PKT_PUSH_BIN);
+	delay(2 * _ACK_TIMEOUT + 500);
+	gwayConfig.upFormat[0] = UP_FMT_JSON;
+	inj.stop();
+	delay(2 * _ACK_TIMEOUT + 500); // Os últimos lotes e os reenvios pendentes.
+
+	CHECK((a != 0) && (b != 0) && (c != 0), "tokens A %04x, B %04x, C %04x", a, b, c);
+	checkRetry("A", a, 2);
+	checkRetry("B", b, 2);
+	checkRetry("C", c, 2);
+
+	struct upServer *u = &upSrv[0];
+	uint32_t sent = u->pushSent - u0.pushSent, acked = u->pushAcked - u0.pushAcked;
+	uint32_t lost = u->lost - u0.lost, retries = u->retries - u0.retries;
+	size_t tokens;
+	{
+		std::lock_guard<std::mutex> l(srvM);
+		tokens = seen.size();
+	}
+	CHECK(retries == 3, "%u reenvios", retries);
+	CHECK(lost == 1, "%u tokens perdidos", lost);
+	CHECK(sent - acked == lost, "pushSent %u, pushAcked %u", sent, acked);
+	CHECK(tokens > 30, "só %u PUSH_DATA de rxpk", (unsigned)tokens);
+
+	printf("test_retry: %u PUSH_DATA, %u confirmados, %u reenvios, %u perdido\n", sent, acked, retries, lost);
+	testEnd("test_retry");
+}
@@ -0,0 +1,231 @@
+// =========================================================================================================
+// test_rollover.cpp: o gateway atravessando o estouro do micros() (2^32 uSec, a cada 71 minutos).
+//
+// 1. Antes do setup(), com o micros() perto de 2^32:
+//    - loraWait() até um tmst depois do estouro espera o tempo certo;
+//    - downQueueAdd() aceita um tmst depois do estouro, recusa os do passado e os longe demais, e
+//      ordena a fila pelo tempo e não pelo valor (um tmst antes do estouro vem antes de um depois);
+//    - sendPacket() passa um pedido na RX2 (tmst + 2 s, depois do estouro) para a RX1 (_STRICT_1CH).
+// 2. O gateway começa WRAP_AHEAD uSec antes do estouro e recebe uplinks a UP_RATE quadros/s, com um
+//    downlink RX1 (tmst + 1 s) a cada DOWN_EVERY uplinks, dos dois lados do estouro:
+//    - o tmst de cada rxpk é o micros() do RXDONE, mesmo quando o estouro cai entre os dois;
+//    - nenhum downlink é recusado (a taxa cabe na fila);
+//    - todo downlink cujo tmst passou pelo estouro é transmitido, com o payload pedido, perto do
+//      tmst (um erro de estouro daria 71 minutos ou nenhum TX);
+//    - a mediana do erro do início do TX fica abaixo de TX_TOLERANCE uSec.
+// Compilado sem _TX_CAL (build/split), como o test_split.
+// =========================================================================================================
+#include "host.h"
+#include "sx1276.h"
+#include "test.h"
+#include <algorithm>
+#include <map>
+
+#include "sketch.cpp"
+
+#define WRAP_AHEAD 3000000
+#define UP_RATE 8.0
+#define UP_LEN 20
+#define DOWN_EVERY 3 // Um downlink a cada 375 mSec: no máximo 3 na fila (DOWN_QUEUE_SIZE 4).
+#define RUN_MS 6000
+#define TX_TOLERANCE 1000
+#define TX_FOUND 100000 // Um TX a mais que isto do tmst não é deste downlink.
+
+static std::mutex downM;
+static std::map<uint32_t, std::string> downPayload; // tmst pedido -> payload do downlink.
+static std::vector<std::pair<uint32_t, std::string> > rxpks; // tmst e "data" de cada rxpk.
+static std::atomic<uint32_t> rxpkN(0);
+
+static std::string field(const std::string &j, size_t from, const char *key, char end)
+{
+	size_t p = j.find(key, from);
+	if (p == std::string::npos)
+		return ("");
+	p += strlen(key);
+	return (j.substr(p, j.find(end, p) - p));
+}
+
+// Um txpk em buf (depois do cabeçalho de 4 bytes). Retorna o comprimento do JSON.
+static int txpk(char *buf, size_t size, uint32_t tmst, const uint8_t *payload, int len)
+{
+	char b64[64];
+	base64_encode(b64, (char *)payload, len);
+	return (snprintf(buf, size,
+					 "{\"txpk\":{\"imme\":false,\"tmst\":%u,\"freq\":923.3,\"rfch\":0,\"powe\":14,\"modu\":\"LORA\","
+					 "\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"ipol\":true,\"size\":%d,\"data\":\"%s\"}}",
+					 tmst, len, b64));
+}
+
+// Servidor de teste: guarda os rxpk e pede um downlink RX1 a cada DOWN_EVERY uplinks.
+static void serverUp(const hostDatagram &d)
+{
+	if ((d.data.size() <= 12) || (d.data[3] != PKT_PUSH_DATA))
+		return;
+	std::string j(d.data.begin() + 12, d.data.end());
+	size_t pos = 0;
+	while ((pos = j.find("\"tmst\":", pos)) != std::string::npos)
+	{
+		uint32_t tmst = (uint32_t)strtoul(j.c_str() + pos + 7, NULL, 10);
+		std::string data = field(j, pos, "\"data\":\"", '"');
+		pos++;
+		uint32_t n = ++rxpkN;
+		std::lock_guard<std::mutex> l(downM);
+		rxpks.push_back(std::make_pair(tmst, data));
+		if (n % DOWN_EVERY != 0)
+			continue;
+
+		uint8_t payload[15] = {0x60, 0x01, 0x00, 0x00, 0x26, 0x00, (uint8_t)n, (uint8_t)(n >> 8), 0x01, 0xA5, 0x5A, 0x00, 0xFF, (uint8_t)n, 0x77};
+		char msg[300];
+		int len = txpk(msg + 4, sizeof(msg) - 4, tmst + 1000000, payload, sizeof(payload));
+		msg[0] = 2;
+		msg[1] = (uint8_t)n;
+		msg[2] = (uint8_t)(n >> 8);
+		msg[3] = PKT_PULL_RESP;
+		downPayload[tmst + 1000000] = std::string((char *)payload, sizeof(payload));
+		hostNetDown(d.ip, d.port, (uint8_t *)msg, len + 4);
+	}
+}
+
+// Parte 1: as funções de tempo, sem as tarefas do gateway.
+static void units()
+{
+	// loraWait() até 40 mSec depois, passando pelo estouro.
+	hostMicrosSet(0xFFFFFFFFu - 20000);
+	txDelay = 0;
+	int64_t t0 = hostTime();
+	loraWait(micros() + 40000);
+	int64_t waited = hostTime() - t0;
+	CHECK((waited >= 40000) && (waited < 43000), "loraWait() esperou %d uSec", (int)waited);
+
+	// downQueueAdd() com o estouro 500 mSec à frente.
+	hostMicrosSet(0xFFFFFFFFu - 500000);
+	memset(&downQ, 0, sizeof(downQ));
+	struct LoraBuffer pkt;
+	memset(&pkt, 0, sizeof(pkt));
+	pkt.airtime = 50000;
+	uint32_t now = micros();
+	pkt.tmst = now + 800000; // Depois do estouro.
+	CHECK(downQueueAdd(&pkt) == TXACK_NONE, "tmst %u depois do estouro recusado", pkt.tmst);
+	pkt.tmst = now + 300000; // Antes do estouro, mas maior como uint32_t.
+	CHECK(downQueueAdd(&pkt) == TXACK_NONE, "tmst %u antes do estouro recusado", pkt.tmst);
+	CHECK((downQ.count == 2) && (downQ.pkt[0].tmst == now + 300000) && (downQ.pkt[1].tmst == now + 800000),
+		  "fila fora de ordem: %u, %u", downQ.pkt[0].tmst, downQ.pkt[1].tmst);
+	pkt.tmst = now + 800000 + 10000; // Sobrepõe o da fila, depois do estouro.
+	CHECK(downQueueAdd(&pkt) == TXACK_COLLISION_PACKET, "sobreposição depois do estouro aceita");
+	pkt.tmst = now + _TX_MIN_AHEAD / 2;
+	CHECK(downQueueAdd(&pkt) == TXACK_TOO_LATE, "tmst %u perto demais aceito", pkt.tmst);
+	pkt.tmst = now - 1000000; // Passado, antes do estouro.
+	CHECK(downQueueAdd(&pkt) == TXACK_TOO_LATE, "tmst %u do passado aceito", pkt.tmst);
+	pkt.tmst = now + _TX_MAX_AHEAD + 1000000;
+	CHECK(downQueueAdd(&pkt) == TXACK_TOO_EARLY, "tmst %u longe demais aceito", pkt.tmst);
+
+	// sendPacket(): a RX2 de um uplink 500 mSec antes do estouro vai para a RX1, depois do estouro.
+	memset(&downQ, 0, sizeof(downQ));
+	uint32_t up = micros() - 100000;
+	uint8_t payload[4] = {1, 2, 3, 4};
+	uint8_t msg[300];
+	int len = txpk((char *)msg, sizeof(msg), up + 2000000, payload, sizeof(payload));
+	CHECK(sendPacket(msg, len) == TXACK_NONE, "sendPacket() recusou a RX2");
+	CHECK((downQ.count == 1) && (downQ.pkt[0].tmst == up + 1000000), "tmst na fila %u, esperado %u", downQ.pkt[0].tmst,
+		  up + 1000000);
+	memset(&downQ, 0, sizeof(downQ));
+}
+
+int main()
+{
+	units();
+
+	// Parte 2: o gateway inteiro atravessando o estouro.
+	sx1276 radio0(pins.ss, pins.rst, pins.dio0, pins.dio1, pins.dio2);
+	hostOnUp = serverUp;
+	hostMicrosSet(0xFFFFFFFFu - WRAP_AHEAD);
+	hostBoot();
+	delay(100);
+
+	sxInjector inj;
+	inj.freq = freqs[ifreq];
+	inj.sf = sf;
+	inj.len = UP_LEN;
+	inj.rate = UP_RATE;
+	inj.start();
+	delay(RUN_MS);
+	inj.stop();
+	delay(1500); // Os últimos quadros e os downlinks pendentes.
+
+	// O tmst de cada rxpk é o micros() do RXDONE do seu quadro.
+	std::vector<uint32_t> ids = inj.ids();
+	std::map<std::string, uint32_t> doneOf; // payload em base64 -> micros() do RXDONE.
+	std::map<uint32_t, std::string> b64Of; // sxFrame.id -> payload em base64.
+	for (uint32_t n = 0; n < ids.size(); n++)
+	{
+		sxFrame f;
+		char b64[64];
+		sxUplink(f, n, (uint16_t)n, UP_LEN);
+		base64_encode(b64, (char *)f.data, f.len);
+		b64Of[ids[n]] = b64;
+	}
+	std::vector<sxRx> rx = radio0.rxLog();
+	for (size_t i = 0; i < rx.size(); i++)
+	{
+		if (!rx[i].crcErr && b64Of.count(rx[i].id))
+			doneOf[b64Of[rx[i].id]] = (uint32_t)rx[i].done;
+	}
+	std::lock_guard<std::mutex> l(downM);
+	uint32_t before = 0, after = 0;
+	for (size_t i = 0; i < rxpks.size(); i++)
+	{
+		CHECK(doneOf.count(rxpks[i].second), "rxpk %u sem quadro", (unsigned)i);
+		if (!doneOf.count(rxpks[i].second))
+			continue;
+		int32_t late = (int32_t)(rxpks[i].first - doneOf[rxpks[i].second]);
+		CHECK((late >= 0) && (late < 5000), "tmst %u, RXDONE %u", rxpks[i].first, doneOf[rxpks[i].second]);
+		if (rxpks[i].first >= 0x80000000u)
+			before++;
+		else
+			after++;
+	}
+	CHECK((before > 0) && (after > 0), "%u rxpk antes e %u depois do estouro", before, after);
+
+	// Downlinks: nenhum recusado pelo tempo, e os que passam pelo estouro são transmitidos.
+	std::vector<sxTx> tx = radio0.txLog();
+	CHECK((downQ.tooLate == 0) && (downQ.tooEarly == 0) && (downQ.collision == 0), "tooLate %u, tooEarly %u, collision %u",
+		  downQ.tooLate, downQ.tooEarly, downQ.collision);
+	uint32_t refused = downQ.tooLate + downQ.tooEarly + downQ.collision + downQ.lateDispatch;
+	CHECK(tx.size() + refused == downPayload.size(), "%u TX, %u recusados, %u pedidos", (unsigned)tx.size(), refused,
+		  (unsigned)downPayload.size());
+	std::vector<int32_t> errs;
+	int32_t worst = 0;
+	uint32_t wrapped = 0;
+	for (auto it = downPayload.begin(); it != downPayload.end(); ++it)
+	{
+		const sxTx *best = NULL;
+		for (size_t i = 0; i < tx.size(); i++)
+		{
+			if ((best == NULL) || (abs((int32_t)((uint32_t)tx[i].start - it->first)) < abs((int32_t)((uint32_t)best->start - it->first))))
+				best = &tx[i];
+		}
+		int32_t err = (best == NULL ? INT32_MAX : (int32_t)((uint32_t)best->start - it->first));
+		bool found = (best != NULL) && (abs(err) < TX_FOUND) && (best->len == it->second.size()) &&
+					 (memcmp(best->data, it->second.data(), best->len) == 0);
+		if (found)
+		{
+			errs.push_back(abs(err));
+			if (abs(err) > abs(worst))
+				worst = err;
+		}
+		// O uplink foi antes do estouro e o downlink depois.
+		if (it->first - 1000000 > it->first)
+		{
+			wrapped++;
+			CHECK(found, "downlink em %u (uplink antes do estouro) não transmitido, erro %d", it->first, err);
+		}
+	}
+	CHECK(wrapped > 0, "nenhum downlink passou pelo estouro");
+	std::sort(errs.begin(), errs.end());
+	int32_t median = (errs.empty() ? 0 : errs[errs.size() / 2]);
+	CHECK(!errs.empty() && (median < TX_TOLERANCE), "mediana do erro do TX %d uSec", median);
+
+	printf("test_rollover: %u rxpk (%u antes, %u depois do estouro), %u TX (%u pelo estouro, erro mediano %d, máx %d uSec)\n",
+		   (unsigned)rxpks.size(), before, after, (unsigned)tx.size(), wrapped, median, worst);
+	testEnd("test_rollover");
+}
@@ -0,0 +1,78 @@
+// =========================================================================================================
+// test_rx.cpp: um uplink no ar vira um rxpk com os metadados e o payload do quadro, e o tmst é o
+// micros() do RXDONE. Quadros na frequência ou SF errados não são recebidos.
+// =========================================================================================================
+#include "host.h"
+#include "sx1276.h"
+#include "test.h"
+
+#include "sketch.cpp"
+
+// rxpk enviados ao servidor desde o início do teste.
+static std::vector<std::string> rxpks()
+{
+	std::vector<std::string> r;
+	std::vector<hostDatagram> up = hostNetUp();
+	for (size_t i = 0; i < up.size(); i++)
+	{
+		if ((up[i].data.size() > 12) && (up[i].data[3] == 0x00))
+			r.push_back(std::string(up[i].data.begin() + 12, up[i].data.end()));
+	}
+	return (r);
+}
+
+int main()
+{
+	sx1276 radio0(pins.ss, pins.rst, pins.dio0, pins.dio1, pins.dio2);
+	hostBoot();
+	delay(50);
+
+	// Um uplink de 20 bytes no canal e SF do gateway.
+	sxFrame f;
+	sxUplink(f, 7, 42, 20);
+	f.freq = freqs[ifreq];
+	f.sf = sf;
+	f.rssi = -97;
+	f.snr = -3;
+	f.start = hostTime() + 10000;
+	uint32_t id = sxAirSend(f);
+	delay(50 + sxAirTime(f.sf, f.len) / 1000 + 200);
+
+	std::vector<std::string> r = rxpks();
+	CHECK(r.size() == 1, "%u rxpk", (unsigned)r.size());
+	std::vector<sxRx> rx = radio0.rxLog();
+	CHECK((rx.size() == 1) && (rx[0].id == id) && !rx[0].crcErr, "RXDONE do quadro");
+	if ((r.size() == 1) && (rx.size() == 1))
+	{
+		char data[64];
+		base64_encode(data, (char *)f.data, f.len);
+		const std::string &j = r[0];
+		CHECK(j.find("\"freq\":916.8") != std::string::npos, "%s", j.c_str());
+		CHECK(j.find("\"datr\":\"SF7BW125\"") != std::string::npos, "%s", j.c_str());
+		CHECK(j.find("\"size\":20") != std::string::npos, "%s", j.c_str());
+		CHECK(j.find("\"rssi\":-97") != std::string::npos, "%s", j.c_str());
+		CHECK(j.find("\"lsnr\":-3") != std::string::npos, "%s", j.c_str());
+		CHECK(j.find(std::string("\"data\":\"") + data + "\"") != std::string::npos, "%s", j.c_str());
+		CHECK(j.find("\"stat\":1") != std::string::npos, "%s", j.c_str());
+
+		// O tmst é o micros() da interrupção RXDONE; a tarefa do rádio a atende em poucos mSec.
+		uint32_t tmst = (uint32_t)strtoul(j.c_str() + j.find("\"tmst\":") + 7, NULL, 10);
+		int32_t late = (int32_t)(tmst - (uint32_t)rx[0].done);
+		CHECK((late >= 0) && (late < 5000), "tmst %u, RXDONE %u", tmst, (uint32_t)rx[0].done);
+	}
+
+	// Outro canal e outro SF não chegam ao gateway.
+	hostNetClear();
+	f.freq = freqs[ifreq] + 200000;
+	f.start = hostTime() + 10000;
+	sxAirSend(f);
+	sxUplink(f, 8, 43, 20);
+	f.freq = freqs[ifreq];
+	f.sf = (sf == SF12 ? SF11 : sf + 1);
+	f.start = hostTime() + 10000;
+	sxAirSend(f);
+	delay(50 + sxAirTime(f.sf, f.len) / 1000 + 200);
+	CHECK(rxpks().empty(), "%u rxpk", (unsigned)rxpks().size());
+
+	testEnd("test_rx");
+}
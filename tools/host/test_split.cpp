@@ -0,0 +1,206 @@
+// =========================================================================================================
+// test_split.cpp: a divisão do loop() em tarefas (_RADIO_TASK, _NET_TASK) com tudo rodando ao mesmo
+// tempo: uplinks a 20 quadros/s, downlinks RX1 para um a cada três uplinks e uma thread pedindo as
+// páginas web sem parar.
+//
+// Verifica que:
+// - todo RXDONE sem erro de CRC vira exatamente um rxpk, com o payload do quadro injetado (um acesso
+//   SPI intercalado entre tarefas estragaria o FIFO, os registradores ou o payload). Um RXDONE que o
+//   modelo levantou mais de STALL uSec depois do fim do quadro (a máquina virtual parou a thread de
+//   hardware) e os que vieram logo depois dele não são cobrados: o SX1276 real teria levantado cada
+//   um no seu tempo, e não dois juntos no mesmo FIFO;
+// - todo downlink aceito é transmitido com o payload pedido, com a mediana do erro do início do TX
+//   abaixo de TX_TOLERANCE uSec, mesmo com a página web ocupando o loop(). O máximo é só informado:
+//   numa máquina virtual com uma CPU a thread do esp_timer às vezes acorda mSec depois;
+// - com _TX_CAL, o atraso aprendido (txTime.lag) fica abaixo de TX_TOLERANCE uSec;
+// - as páginas respondem durante o tráfego.
+// Compilado com as tarefas (build/split) e sem elas (build/loop), para comparar, os dois sem _TX_CAL,
+// e com a configuração de fábrica (build/default), com _TX_CAL.
+// =========================================================================================================
+#include "host.h"
+#include "sx1276.h"
+#include "test.h"
+#include <algorithm>
+#include <map>
+#include <set>
+
+#include "sketch.cpp"
+
+#define UP_RATE 20.0
+#define UP_LEN 20
+#define DOWN_EVERY 3
+#define RUN_MS 5000
+#define TX_TOLERANCE 1000
+#define WEB_PERIOD 10 // mSec entre as páginas, bem mais que um navegador com REFR=1.
+#define STALL 5000
+
+static std::mutex downM;
+static std::map<uint32_t, std::string> downPayload; // tmst pedido -> payload do downlink.
+static std::vector<std::string> rxpkData; // Campo "data" de cada rxpk, em ordem.
+static std::atomic<uint32_t> rxpkN(0);
+
+static std::string field(const std::string &j, size_t from, const char *key, char end)
+{
+	size_t p = j.find(key, from);
+	if (p == std::string::npos)
+		return ("");
+	p += strlen(key);
+	return (j.substr(p, j.find(end, p) - p));
+}
+
+// Servidor de teste: guarda os rxpk e pede um downlink RX1 a cada DOWN_EVERY uplinks.
+static void serverUp(const hostDatagram &d)
+{
+	if ((d.data.size() <= 12) || (d.data[3] != 0x00))
+		return;
+	std::string j(d.data.begin() + 12, d.data.end());
+	size_t pos = 0;
+	while ((pos = j.find("\"tmst\":", pos)) != std::string::npos)
+	{
+		uint32_t tmst = (uint32_t)strtoul(j.c_str() + pos + 7, NULL, 10);
+		std::string data = field(j, pos, "\"data\":\"", '"');
+		pos++;
+		uint32_t n = ++rxpkN;
+		std::lock_guard<std::mutex> l(downM);
+		rxpkData.push_back(data);
+		if (n % DOWN_EVERY != 0)
+			continue;
+
+		uint8_t payload[15] = {0x60, 0x01, 0x00, 0x00, 0x26, 0x00, (uint8_t)n, (uint8_t)(n >> 8), 0x01, 0xA5, 0x5A, 0x00, 0xFF, (uint8_t)n, 0x77};
+		char b64[32];
+		base64_encode(b64, (char *)payload, sizeof(payload));
+		char txpk[300];
+		int len = snprintf(txpk + 4, sizeof(txpk) - 4,
+						   "{\"txpk\":{\"imme\":false,\"tmst\":%u,\"freq\":923.3,\"rfch\":0,\"powe\":14,\"modu\":\"LORA\","
+						   "\"datr\":\"SF7BW125\",\"codr\":\"4/5\",\"ipol\":true,\"size\":%u,\"data\":\"%s\"}}",
+						   tmst + 1000000, (unsigned)sizeof(payload), b64);
+		txpk[0] = 2;
+		txpk[1] = (uint8_t)n;
+		txpk[2] = (uint8_t)(n >> 8);
+		txpk[3] = 0x03; // PULL_RESP.
+		downPayload[tmst + 1000000] = std::string((char *)payload, sizeof(payload));
+		hostNetDown(d.ip, d.port, (uint8_t *)txpk, len + 4);
+	}
+}
+
+// Pede as páginas de leitura, uma a cada WEB_PERIOD mSec, enquanto running.
+static std::atomic<bool> running(true);
+static std::atomic<uint32_t> pages(0), badPages(0);
+static void webLoad()
+{
+	static const char *uris[] = {"/", "/api/status", "/metrics", "/trace", "/api/scan", "/api/nodes"};
+	for (uint32_t i = 0; running; i++)
+	{
+		if (hostWebGet(uris[i % (sizeof(uris) / sizeof(uris[0]))]).empty())
+			badPages++;
+		pages++;
+		delay(WEB_PERIOD);
+	}
+}
+
+int main()
+{
+	sx1276 radio0(pins.ss, pins.rst, pins.dio0, pins.dio1, pins.dio2);
+	hostOnUp = serverUp;
+	hostBoot(true);
+	delay(100);
+
+	std::thread web(webLoad);
+	sxInjector inj;
+	inj.freq = freqs[ifreq];
+	inj.sf = sf;
+	inj.len = UP_LEN;
+	inj.rate = UP_RATE;
+	inj.start();
+	delay(RUN_MS);
+	inj.stop();
+	delay(1500); // Os últimos quadros e os downlinks pendentes.
+	running = false;
+	web.join();
+
+	// Uplinks: cada RXDONE bom vira um rxpk com o payload do quadro.
+	std::vector<uint32_t> ids = inj.ids();
+	std::map<uint32_t, std::string> expected; // sxFrame.id -> payload em base64.
+	for (uint32_t n = 0; n < ids.size(); n++)
+	{
+		sxFrame f;
+		char b64[64];
+		sxUplink(f, n, (uint16_t)n, UP_LEN);
+		base64_encode(b64, (char *)f.data, f.len);
+		expected[ids[n]] = b64;
+	}
+	std::vector<sxRx> rx = radio0.rxLog();
+	std::multiset<std::string> want, got;
+	std::set<std::string> stalled; // RXDONE atrasados pelo host, e os que vieram junto.
+	int64_t stallEnd = INT64_MIN;
+	for (size_t i = 0; i < rx.size(); i++)
+	{
+		if (rx[i].done - rx[i].end > STALL)
+			stallEnd = rx[i].done + STALL;
+		bool stall = (rx[i].done <= stallEnd);
+		if (!rx[i].crcErr && expected.count(rx[i].id))
+		{
+			if (stall)
+				stalled.insert(expected[rx[i].id]);
+			else
+				want.insert(expected[rx[i].id]);
+		}
+	}
+	{
+		std::lock_guard<std::mutex> l(downM);
+		for (size_t i = 0; i < rxpkData.size(); i++)
+		{
+			if (!stalled.count(rxpkData[i]))
+				got.insert(rxpkData[i]);
+		}
+	}
+	CHECK(want.size() + stalled.size() > (size_t)(UP_RATE * RUN_MS / 1000 / 2), "só %u quadros recebidos de %u",
+		  (unsigned)(want.size() + stalled.size()), (unsigned)ids.size());
+	CHECK(got == want, "%u rxpk para %u RXDONE (anel cheio %u, repetidos %u, recusados %u)", (unsigned)got.size(),
+		  (unsigned)want.size(), upRing.overflow, upDrop.dup, upDrop.deny);
+
+	// Downlinks: todos os aceitos foram transmitidos com o payload pedido e no instante.
+	std::vector<sxTx> tx = radio0.txLog();
+	std::lock_guard<std::mutex> l(downM);
+	uint32_t refused = downQ.tooLate + downQ.tooEarly + downQ.collision + downQ.lateDispatch;
+	CHECK(tx.size() + refused == downPayload.size(), "%u TX, %u recusados, %u pedidos", (unsigned)tx.size(), refused,
+		  (unsigned)downPayload.size());
+	CHECK(tx.size() > 0, "nenhum TX");
+	int32_t worst = 0;
+	std::vector<int32_t> errs;
+	for (size_t i = 0; i < tx.size(); i++)
+	{
+		uint32_t start = (uint32_t)tx[i].start;
+		auto best = downPayload.end();
+		for (auto it = downPayload.begin(); it != downPayload.end(); ++it)
+		{
+			if ((best == downPayload.end()) || (abs((int32_t)(start - it->first)) < abs((int32_t)(start - best->first))))
+				best = it;
+		}
+		if (best == downPayload.end())
+			break;
+		int32_t err = (int32_t)(start - best->first);
+		if (abs(err) > abs(worst))
+			worst = err;
+		errs.push_back(abs(err));
+		CHECK((tx[i].len == best->second.size()) && (memcmp(tx[i].data, best->second.data(), tx[i].len) == 0),
+			  "payload do TX %u", (unsigned)i);
+		CHECK(tx[i].invertIq, "TX %u sem ipol", (unsigned)i);
+	}
+	std::sort(errs.begin(), errs.end());
+	int32_t median = (errs.empty() ? 0 : errs[errs.size() / 2]);
+	CHECK(median < TX_TOLERANCE, "mediana do erro do TX %d uSec", median);
+#if _TX_CAL >= 1
+	CHECK(abs(txTime.lag) < TX_TOLERANCE, "txTime.lag %d uSec com %u medidas", txTime.lag, txTime.calCount);
+#endif
+
+	// Páginas web atendidas durante o tráfego.
+	CHECK(pages > 20, "%u páginas", (uint32_t)pages);
+	CHECK(badPages == 0, "%u páginas vazias", (uint32_t)badPages);
+
+	printf("test_split (_RADIO_TASK=%d _NET_TASK=%d _TX_CAL=%d): %u quadros, %u rxpk, %u TX (erro mediano %d, máx %d uSec, "
+		   "lag %d uSec), %u páginas, %u RXDONE atrasados pelo host\n",
+		   _RADIO_TASK, _NET_TASK, _TX_CAL, (unsigned)ids.size(), (unsigned)got.size(), (unsigned)tx.size(), median, worst,
+		   (int32_t)txTime.lag, (uint32_t)pages, (unsigned)stalled.size());
+	testEnd("test_split");
+}
@@ -0,0 +1,72 @@
+// =========================================================================================================
+// test_txcal.cpp: a calibração do TX (_TX_CAL, txCalibrate()) com medidas sintéticas no TXDONE.
+//
+// Verifica que:
+// - txTime.lag fica em zero até _TX_CAL_N medidas, mesmo com a primeira vinda de uma interrupção atrasada;
+// - com _TX_CAL_N medidas, txTime.lag é a mediana e algumas interrupções atrasadas não o mudam;
+// - medidas fora de _TX_CAL_MAX são descartadas;
+// - quando o atraso do rádio muda de fato (mais da metade das medidas), txTime.lag o acompanha;
+// - txArm() desconta txTime.lag do instante do TX.
+// A calibração com o gateway inteiro é medida pelo test_split compilado com _TX_CAL (build/default).
+// =========================================================================================================
+#include "host.h"
+#include "test.h"
+
+#include "sketch.cpp"
+
+#define AIRTIME 51456 // SF7, 20 bytes.
+#define LAG 120
+#define LATE_IRQ 1800 // Interrupção atendida 1,8 mSec depois do TXDONE, ainda dentro de _TX_CAL_MAX.
+
+// Um TXDONE com o atraso do rádio lag uSec.
+static void txDone(int32_t lag)
+{
+	txTime.start = 1000000;
+	irqTime = txTime.start + AIRTIME + lag;
+	txCalibrate();
+}
+
+int main()
+{
+	memset(&txTime, 0, sizeof(txTime));
+	LoraDown.airtime = AIRTIME;
+
+	// A primeira medida é de uma interrupção atrasada: nada muda até _TX_CAL_N medidas.
+	txDone(LATE_IRQ);
+	for (int i = 1; i < _TX_CAL_N - 1; i++)
+		txDone(LAG + (i % 3) - 1);
+	CHECK((txTime.lag == 0) && (txTime.calCount == _TX_CAL_N - 1), "lag %d com %u medidas", txTime.lag, txTime.calCount);
+	txDone(LAG);
+	CHECK(txTime.lag == LAG, "lag %d, esperado %d", txTime.lag, LAG);
+
+	// Interrupções atrasadas em menos da metade das medidas não movem a mediana.
+	for (int i = 0; i < _TX_CAL_N / 2 - 1; i++)
+	{
+		txDone(LATE_IRQ);
+		CHECK((txTime.lag >= LAG - 1) && (txTime.lag <= LAG + 1), "lag %d depois de %d interrupções atrasadas", txTime.lag,
+			  i + 1);
+	}
+
+	// Fora de _TX_CAL_MAX: descartada.
+	uint32_t n = txTime.calCount;
+	txDone(_TX_CAL_MAX + 1);
+	txDone(-_TX_CAL_MAX - 1);
+	CHECK(txTime.calCount == n, "medida fora de _TX_CAL_MAX aceita");
+
+	// Um atraso novo e estável é adotado depois de metade do anel.
+	for (int i = 0; i < _TX_CAL_N; i++)
+		txDone(2 * LAG);
+	CHECK(txTime.lag == 2 * LAG, "lag %d, esperado %d", txTime.lag, 2 * LAG);
+
+	// txArm() agenda o TX lag uSec antes do tmst.
+	txDelay = 0;
+	hostMicrosSet(5000000);
+	uint32_t tmst = micros() + 30000;
+	txArm(tmst);
+	delay(50);
+	CHECK(txTime.target == tmst - 2 * LAG, "target %u, tmst %u", txTime.target, tmst);
+	CHECK((int32_t)(txTime.start - txTime.target) >= 0, "TX %d uSec antes do target", (int32_t)(txTime.target - txTime.start));
+
+	printf("test_txcal: lag %d uSec com %u medidas\n", txTime.lag, txTime.calCount);
+	testEnd("test_txcal");
+}
@@ -0,0 +1,265 @@
+// =========================================================================================================
+// upAggregator: receptor de referência (Linux) para o PUSH_DATA binário do gateway (PKT_PUSH_BIN).
+//
+// Recebe os datagramas do gateway em UDP, responde PUSH_ACK e PULL_ACK como um servidor Semtech,
+// e converte cada PUSH_DATA binário de volta para o JSON {"rxpk":[...]} que o gateway enviaria
+// no formato UP_FMT_JSON, com os campos na mesma ordem e com os mesmos valores. O JSON é impresso
+// e, se um servidor for informado, reenviado a ele como PUSH_DATA comum. Os PUSH_DATA em JSON
+// (stat, sensor interno, journal) são impressos e reenviados sem alteração.
+// Só o caminho de uplink é tratado: os PULL_DATA são respondidos aqui mesmo e os downlinks
+// (PULL_RESP) do servidor não são repassados ao gateway.
+//
+// Compilação: g++ -O2 -Wall -o upAggregator upAggregator.cpp
+//
+// Uso:
+//   upAggregator [porta [servidor portaServidor]]
+//     Escuta na porta (padrão 1700) e, opcionalmente, reenvia o JSON ao servidor.
+//   upAggregator -s host porta
+//     Simula o gateway: envia ao agregador um PUSH_DATA binário com dois quadros de exemplo e
+//     espera o PUSH_ACK, para testar o caminho completo sem o rádio.
+//
+// Para cada PUSH_DATA binário é impresso também o tamanho do datagrama binário e o do JSON
+// equivalente, que é o que o gateway teria enviado.
+// =========================================================================================================
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Os mesmos valores de loraModem.h.
+#define PROTOCOL_VERSION 0x01
+#define PKT_PUSH_DATA 0x00
+#define PKT_PUSH_ACK 0x01
+#define PKT_PULL_DATA 0x02
+#define PKT_PULL_ACK 0x04
+#define PKT_PUSH_BIN 0x20
+#define RXBIN_HDR 13
+
+#define BUF_SIZE 4096
+
+static const char b64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// ---------------------------------------------------------------------------------------------------------
+// Acrescenta a base64 de in[0..len) em out. Retorna o número de caracteres escritos.
+// ---------------------------------------------------------------------------------------------------------
+static int base64(char *out, const uint8_t *in, int len)
+{
+	int n = 0;
+	for (int i = 0; i < len; i += 3)
+	{
+		uint32_t v = in[i] << 16;
+		if (i + 1 < len)
+			v |= in[i + 1] << 8;
+		if (i + 2 < len)
+			v |= in[i + 2];
+		out[n++] = b64[(v >> 18) & 0x3F];
+		out[n++] = b64[(v >> 12) & 0x3F];
+		out[n++] = (i + 1 < len) ? b64[(v >> 6) & 0x3F] : '=';
+		out[n++] = (i + 2 < len) ? b64[v & 0x3F] : '=';
+	}
+	out[n] = 0;
+	return (n);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Converte o PUSH_DATA binário in (com o cabeçalho de 12 bytes) para o PUSH_DATA JSON em out, com o
+// mesmo token e o mesmo EUI. Retorna o comprimento de out, ou -1 se o datagrama está malformado.
+// ---------------------------------------------------------------------------------------------------------
+static int binToJson(uint8_t *out, int size, const uint8_t *in, int len)
+{
+	char data[400];
+	int n = 12;
+	int frames = 0;
+
+	memcpy(out, in, 12);
+	out[3] = PKT_PUSH_DATA;
+	n += snprintf((char *)out + n, size - n, "{\"rxpk\":[");
+
+	for (int i = 12; i < len;)
+	{
+		if (i + RXBIN_HDR > len)
+			return (-1);
+		const uint8_t *p = in + i;
+		uint32_t tmst = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+		uint32_t freq = p[4] | (p[5] << 8) | (p[6] << 16) | ((uint32_t)p[7] << 24);
+		int sf = p[8];
+		int lsnr = (int8_t)p[9];
+		int rssi = (int16_t)(p[10] | (p[11] << 8));
+		int plen = p[12];
+		if (i + RXBIN_HDR + plen > len)
+			return (-1);
+		base64(data, p + RXBIN_HDR, plen);
+
+		n += snprintf((char *)out + n, size - n,
+					  "%s{\"tmst\":%u,\"chan\":0,\"rfch\":0,\"freq\":%u.%06u,\"stat\":1,\"modu\":\"LORA\","
+					  "\"datr\":\"SF%dBW125\",\"codr\":\"4/5\",\"lsnr\":%d,\"rssi\":%d,\"size\":%d,\"data\":\"%s\"}",
+					  (frames > 0 ? "," : ""), tmst, freq / 1000000, freq % 1000000, sf, lsnr, rssi, plen, data);
+		if (n >= size - 2)
+			return (-1);
+		i += RXBIN_HDR + plen;
+		frames++;
+	}
+	n += snprintf((char *)out + n, size - n, "]}");
+	return (n);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Resolve host:port em addr. Retorna 0 ou -1.
+// ---------------------------------------------------------------------------------------------------------
+static int resolve(const char *host, const char *port, struct sockaddr_in *addr)
+{
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	if (getaddrinfo(host, port, &hints, &res) != 0)
+		return (-1);
+	memcpy(addr, res->ai_addr, sizeof(*addr));
+	freeaddrinfo(res);
+	return (0);
+}
+
+// ---------------------------------------------------------------------------------------------------------
+// Modo -s: envia um PUSH_DATA binário de exemplo ao agregador e espera o PUSH_ACK.
+// ---------------------------------------------------------------------------------------------------------
+static int simulate(const char *host, const char *port)
+{
+	struct sockaddr_in addr;
+	uint8_t buf[256];
+	int n = 12;
+
+	if (resolve(host, port, &addr) < 0)
+	{
+		fprintf(stderr, "Erro: host %s desconhecido.\n", host);
+		return (1);
+	}
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct timeval tv = {2, 0};
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+	const uint8_t eui[8] = {0x24, 0x0A, 0xC4, 0xFF, 0xFF, 0x01, 0x02, 0x03};
+	buf[0] = PROTOCOL_VERSION;
+	buf[1] = 0x34;
+	buf[2] = 0x12;
+	buf[3] = PKT_PUSH_BIN;
+	memcpy(buf + 4, eui, 8);
+
+	// Dois quadros de exemplo: Unconfirmed Data Up com 13 e 24 bytes de PHYPayload.
+	const int sizes[2] = {13, 24};
+	for (int f = 0; f < 2; f++)
+	{
+		uint8_t *p = buf + n;
+		uint32_t tmst = 123456789 + f * 1000000;
+		uint32_t freq = 916800000 + f * 200000;
+		int16_t rssi = -97 - f;
+		memcpy(p, &tmst, 4); // x86 e ESP32 são little-endian.
+		memcpy(p + 4, &freq, 4);
+		p[8] = 7 + f;
+		p[9] = (uint8_t)(int8_t)(f == 0 ? 9 : -3);
+		memcpy(p + 10, &rssi, 2);
+		p[12] = sizes[f];
+		p[RXBIN_HDR] = 0x40;
+		for (int k = 1; k < sizes[f]; k++)
+			p[RXBIN_HDR + k] = (uint8_t)(k * 7 + f);
+		n += RXBIN_HDR + sizes[f];
+	}
+
+	sendto(fd, buf, n, 0, (struct sockaddr *)&addr, sizeof(addr));
+	uint8_t ack[16];
+	int r = recv(fd, ack, sizeof(ack), 0);
+	close(fd);
+	if ((r >= 4) && (ack[3] == PKT_PUSH_ACK) && (ack[1] == buf[1]) && (ack[2] == buf[2]))
+	{
+		printf("PUSH_ACK recebido, %d bytes enviados.\n", n);
+		return (0);
+	}
+	fprintf(stderr, "Erro: sem PUSH_ACK.\n");
+	return (1);
+}
+
+int main(int argc, char **argv)
+{
+	if ((argc == 4) && (strcmp(argv[1], "-s") == 0))
+	{
+		return (simulate(argv[2], argv[3]));
+	}
+
+	int port = (argc > 1 ? atoi(argv[1]) : 1700);
+	bool forward = (argc > 3);
+	struct sockaddr_in up;
+	if (forward && (resolve(argv[2], argv[3], &up) < 0))
+	{
+		fprintf(stderr, "Erro: servidor %s desconhecido.\n", argv[2]);
+		return (1);
+	}
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons(port);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+	{
+		perror("bind");
+		return (1);
+	}
+	printf("upAggregator:: escutando na porta %d.\n", port);
+
+	static uint8_t in[BUF_SIZE];
+	static uint8_t out[BUF_SIZE];
+	for (;;)
+	{
+		struct sockaddr_in from;
+		socklen_t fromLen = sizeof(from);
+		int len = recvfrom(fd, in, sizeof(in) - 1, 0, (struct sockaddr *)&from, &fromLen);
+		if ((len < 12) || (in[0] != PROTOCOL_VERSION))
+			continue;
+
+		// Resposta: versão, o mesmo token e o identificador do ack.
+		uint8_t ack[4] = {in[0], in[1], in[2], 0};
+		uint8_t ident = in[3];
+		if (ident == PKT_PULL_DATA)
+		{
+			ack[3] = PKT_PULL_ACK;
+			sendto(fd, ack, 4, 0, (struct sockaddr *)&from, fromLen);
+			continue;
+		}
+		if ((ident != PKT_PUSH_DATA) && (ident != PKT_PUSH_BIN))
+			continue;
+		ack[3] = PKT_PUSH_ACK;
+		sendto(fd, ack, 4, 0, (struct sockaddr *)&from, fromLen);
+
+		int n;
+		if (ident == PKT_PUSH_BIN)
+		{
+			n = binToJson(out, sizeof(out), in, len);
+			if (n < 0)
+			{
+				fprintf(stderr, "Datagrama binário malformado de %s.\n", inet_ntoa(from.sin_addr));
+				continue;
+			}
+			printf("%s binário %d bytes, JSON %d bytes: %s\n", inet_ntoa(from.sin_addr), len, n,
+				   (char *)out + 12);
+		}
+		else
+		{
+			memcpy(out, in, len);
+			out[len] = 0;
+			n = len;
+			printf("%s JSON %d bytes: %s\n", inet_ntoa(from.sin_addr), len, (char *)out + 12);
+		}
+		fflush(stdout);
+		if (forward)
+		{
+			sendto(fd, out, n, 0, (struct sockaddr *)&up, sizeof(up));
+		}
+	}
+}